@@ -114,6 +114,10 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 	rewind(fp);
 
 	fi = ftp_parse_ls_fp(fp, ST_MACOS);
+	freefileinfo(fi);
+	rewind(fp);
+
+	fi = ftp_parse_mlsd_fp(fp);
 
 done:
 	freefileinfo(fi);
@@ -0,0 +1,808 @@
+/* Binary index of a CDX file, for WARC deduplication.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With -DSTANDALONE, this file can be compiled outside Wget, for the
+   index builder in util/cdx-index.c.  */
+
+#ifndef STANDALONE
+# include "wget.h"
+#else
+# include "config.h"
+# include <stdbool.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+#include <base32.h>
+
+#ifndef STANDALONE
+# include "utils.h"
+#else
+static void *
+xmalloc (size_t size)
+{
+  void *p = malloc (size);
+  if (!p && size)
+    {
+      perror ("malloc");
+      exit (EXIT_FAILURE);
+    }
+  return p;
+}
+
+static void *
+xcalloc (size_t n, size_t size)
+{
+  void *p = calloc (n, size);
+  if (!p && n && size)
+    {
+      perror ("calloc");
+      exit (EXIT_FAILURE);
+    }
+  return p;
+}
+
+static void *
+xrealloc (void *ptr, size_t size)
+{
+  void *p = realloc (ptr, size);
+  if (!p && size)
+    {
+      perror ("realloc");
+      exit (EXIT_FAILURE);
+    }
+  return p;
+}
+# define xnew0(type) (xcalloc (1, sizeof (type)))
+# define xnew_array(type, len) (xmalloc ((len) * sizeof (type)))
+# define xfree(p) do { free ((void *) (p)); p = NULL; } while (0)
+#endif
+
+#include "cdx-index.h"
+
+#ifdef TESTING
+# include <tmpdir.h>
+# include "../tests/unit-tests.h"
+#endif
+
+/* A CDX index holds, for every record of a CDX file, the payload
+   digest, the original URL and the WARC record id -- the three fields
+   that --warc-dedup needs -- in a form that can be searched without
+   loading it:
+
+     header    struct cdx_index_header
+     fan-out   CDX_FANOUT entries of 8 bytes: the number of entries
+               whose digest starts with a 16-bit prefix up to and
+               including the one at that position
+     filter    a Bloom filter of 2^bloom_bits_log2 bits over the
+               digests
+     entries   struct cdx_index_entry, sorted by digest
+     strings   "URL\0RECORD-ID\0" for every entry
+
+   The file is mapped into memory, so opening it is immediate and only
+   the pages that lookups touch are read.  Most payloads of a crawl
+   are new; the filter answers for those without touching the entries
+   at all.  Nothing is written after the file is opened, so lookups
+   can run in several threads at once.
+
+   Integers are stored in host byte order; the file is meant to be
+   built and used on the same kind of machine.  */
+
+struct cdx_index_header {
+  char magic[CDX_INDEX_MAGIC_SIZE];
+  uint64_t count;               /* number of entries */
+  uint32_t bloom_bits_log2;
+  uint32_t bloom_probes;
+  uint64_t strings_size;
+};
+
+struct cdx_index_entry {
+  unsigned char digest[CDX_DIGEST_SIZE];
+  uint32_t reserved;            /* zero */
+  uint64_t strings_offset;      /* of the URL */
+};
+
+#define CDX_FANOUT 65536
+
+/* About 10 bits and 7 probes per digest keep false positives of the
+   filter under 1%.  */
+#define CDX_BLOOM_BITS_PER_ENTRY 10
+#define CDX_BLOOM_PROBES 7
+#define CDX_BLOOM_MIN_LOG2 16
+
+struct cdx_index {
+  const struct cdx_index_header *header;
+  const uint64_t *fanout;
+  const unsigned char *bloom;
+  uint64_t bloom_mask;
+  const struct cdx_index_entry *entries;
+  const char *strings;
+  void *map;
+  size_t map_size;
+  bool mapped;                  /* MAP came from mmap */
+};
+
+#define CDX_FIELDSEP " \t\r\n"
+
+/* Parses the header line of a CDX file, " CDX x x x ...", and finds
+   the columns of the original URL ('a'), the checksum ('k') and the
+   WARC record id ('u').  LINE is modified.  Returns true if all three
+   are present; the missing ones are set to -1.  */
+bool
+cdx_parse_header (char *line, int *field_num_original_url,
+                  int *field_num_checksum, int *field_num_record_id)
+{
+  char *token;
+  char *save_ptr;
+
+  *field_num_original_url = -1;
+  *field_num_checksum = -1;
+  *field_num_record_id = -1;
+
+  token = strtok_r (line, CDX_FIELDSEP, &save_ptr);
+
+  if (token != NULL && strcmp (token, "CDX") == 0)
+    {
+      int field_num = 0;
+      while (token != NULL)
+        {
+          token = strtok_r (NULL, CDX_FIELDSEP, &save_ptr);
+          if (token != NULL)
+            {
+              switch (token[0])
+                {
+                case 'a':
+                  *field_num_original_url = field_num;
+                  break;
+                case 'k':
+                  *field_num_checksum = field_num;
+                  break;
+                case 'u':
+                  *field_num_record_id = field_num;
+                  break;
+                }
+            }
+          field_num++;
+        }
+    }
+
+  return *field_num_original_url != -1
+         && *field_num_checksum != -1
+         && *field_num_record_id != -1;
+}
+
+/* Parses a record line of a CDX file with the columns found by
+   cdx_parse_header.  Stores the original URL in *URL, the decoded
+   checksum in DIGEST and the record id in *RECORD_ID; the strings
+   point into LINE, which is modified.  Returns false if a field is
+   missing or the checksum is not a base32 SHA-1 digest.  */
+bool
+cdx_parse_line (char *line, int field_num_original_url,
+                int field_num_checksum, int field_num_record_id,
+                const char **url, char *digest, const char **record_id)
+{
+  const char *checksum = NULL;
+  char *token;
+  char *save_ptr;
+  int field_num = 0;
+  idx_t digest_size = CDX_DIGEST_SIZE;
+
+  *url = *record_id = NULL;
+  for (token = strtok_r (line, CDX_FIELDSEP, &save_ptr); token != NULL;
+       token = strtok_r (NULL, CDX_FIELDSEP, &save_ptr), field_num++)
+    {
+      if (field_num == field_num_original_url)
+        *url = token;
+      else if (field_num == field_num_checksum)
+        checksum = token;
+      else if (field_num == field_num_record_id)
+        *record_id = token;
+    }
+
+  return *url != NULL && checksum != NULL && *record_id != NULL
+    && base32_decode (checksum, strlen (checksum), digest, &digest_size)
+    && digest_size == CDX_DIGEST_SIZE;
+}
+
+/* The filter probes are derived from the digest itself, which is
+   already uniformly distributed.  The first bytes select the fan-out
+   slot, so the probes use the others.  */
+
+static inline void
+cdx_bloom_hashes (const unsigned char *digest, uint64_t *h1, uint64_t *h2)
+{
+  memcpy (h1, digest + 4, 8);
+  memcpy (h2, digest + 12, 8);
+  *h2 |= 1;
+}
+
+static void
+cdx_bloom_add (unsigned char *bloom, uint64_t mask, const unsigned char *digest)
+{
+  uint64_t h1, h2;
+  int k;
+
+  cdx_bloom_hashes (digest, &h1, &h2);
+  for (k = 0; k < CDX_BLOOM_PROBES; k++)
+    {
+      uint64_t bit = (h1 + k * h2) & mask;
+      bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static bool
+cdx_bloom_maybe_contains (const unsigned char *bloom, uint64_t mask,
+                          const unsigned char *digest)
+{
+  uint64_t h1, h2;
+  int k;
+
+  cdx_bloom_hashes (digest, &h1, &h2);
+  for (k = 0; k < CDX_BLOOM_PROBES; k++)
+    {
+      uint64_t bit = (h1 + k * h2) & mask;
+      if (!(bloom[bit >> 3] & (1 << (bit & 7))))
+        return false;
+    }
+  return true;
+}
+
+static inline unsigned
+cdx_prefix (const unsigned char *digest)
+{
+  return (digest[0] << 8) | digest[1];
+}
+
+/* The size of the filter for COUNT entries, as a power of two.  */
+static uint32_t
+cdx_bloom_bits_log2 (uint64_t count)
+{
+  uint32_t log2 = CDX_BLOOM_MIN_LOG2;
+  while (log2 < 40 && ((uint64_t) 1 << log2) < count * CDX_BLOOM_BITS_PER_ENTRY)
+    log2++;
+  return log2;
+}
+
+/* Opens the CDX index FILE.  Returns NULL and sets errno if it cannot
+   be read or is not a valid index.  */
+struct cdx_index *
+cdx_index_open (const char *file)
+{
+  struct cdx_index *idx;
+  struct stat st;
+  const struct cdx_index_header *hdr;
+  uint64_t bloom_size, size;
+  int fd;
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &st) < 0)
+    {
+      close (fd);
+      return NULL;
+    }
+  if ((uint64_t) st.st_size < sizeof (struct cdx_index_header)
+      + CDX_FANOUT * sizeof (uint64_t) || (uint64_t) st.st_size > SIZE_MAX)
+    {
+      close (fd);
+      errno = EINVAL;
+      return NULL;
+    }
+
+  idx = xnew0 (struct cdx_index);
+  idx->map_size = st.st_size;
+#ifdef HAVE_MMAP
+  idx->map = mmap (NULL, idx->map_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (idx->map != MAP_FAILED)
+    idx->mapped = true;
+  else
+#endif
+    {
+      /* Read it into memory.  */
+      size_t done = 0;
+
+      idx->map = xmalloc (idx->map_size);
+      while (done < idx->map_size)
+        {
+          ssize_t n = read (fd, (char *) idx->map + done,
+                            idx->map_size - done);
+          if (n <= 0)
+            {
+              if (n == 0)
+                errno = EINVAL;
+              close (fd);
+              cdx_index_close (idx);
+              return NULL;
+            }
+          done += n;
+        }
+    }
+  close (fd);
+
+  hdr = idx->map;
+  if (memcmp (hdr->magic, CDX_INDEX_MAGIC, CDX_INDEX_MAGIC_SIZE) != 0
+      || hdr->bloom_bits_log2 < CDX_BLOOM_MIN_LOG2
+      || hdr->bloom_bits_log2 > 40
+      || hdr->count > idx->map_size / sizeof (struct cdx_index_entry)
+      || hdr->strings_size > idx->map_size)
+    goto invalid;
+
+  bloom_size = (uint64_t) 1 << (hdr->bloom_bits_log2 - 3);
+  size = sizeof (struct cdx_index_header) + CDX_FANOUT * sizeof (uint64_t)
+    + bloom_size + hdr->count * sizeof (struct cdx_index_entry)
+    + hdr->strings_size;
+  if (size != idx->map_size)
+    goto invalid;
+
+  idx->header = hdr;
+  idx->fanout = (const uint64_t *) (hdr + 1);
+  idx->bloom = (const unsigned char *) (idx->fanout + CDX_FANOUT);
+  idx->bloom_mask = ((uint64_t) 1 << hdr->bloom_bits_log2) - 1;
+  idx->entries = (const struct cdx_index_entry *) (idx->bloom + bloom_size);
+  idx->strings = (const char *) (idx->entries + hdr->count);
+
+  /* Lookups rely on these to stay within the file.  */
+  if (idx->fanout[CDX_FANOUT - 1] != hdr->count
+      || (hdr->strings_size && idx->strings[hdr->strings_size - 1] != '\0'))
+    goto invalid;
+
+  return idx;
+
+ invalid:
+  cdx_index_close (idx);
+  errno = EINVAL;
+  return NULL;
+}
+
+/* Returns the record id of an entry of IDX with the payload DIGEST and
+   the original URL URL, or NULL if there is none.  */
+const char *
+cdx_index_find (const struct cdx_index *idx, const char *url,
+                const char *digest)
+{
+  const unsigned char *d = (const unsigned char *) digest;
+  unsigned prefix = cdx_prefix (d);
+  uint64_t lo, hi, end;
+
+  if (!cdx_bloom_maybe_contains (idx->bloom, idx->bloom_mask, d))
+    return NULL;
+
+  /* Find the first entry with DIGEST in the slice of its prefix.  */
+  lo = prefix ? idx->fanout[prefix - 1] : 0;
+  end = hi = idx->fanout[prefix];
+  if (lo > hi || hi > idx->header->count)
+    return NULL;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (memcmp (idx->entries[mid].digest, d, CDX_DIGEST_SIZE) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Several URLs may have the same payload.  */
+  for (; lo < end && !memcmp (idx->entries[lo].digest, d, CDX_DIGEST_SIZE);
+       lo++)
+    {
+      uint64_t offset = idx->entries[lo].strings_offset;
+      const char *entry_url, *record_id;
+
+      if (offset >= idx->header->strings_size)
+        continue;
+      entry_url = idx->strings + offset;
+      record_id = entry_url + strlen (entry_url) + 1;
+      if (record_id < idx->strings + idx->header->strings_size
+          && !strcmp (entry_url, url))
+        return record_id;
+    }
+  return NULL;
+}
+
+/* Returns the number of entries in IDX.  */
+unsigned long long
+cdx_index_count (const struct cdx_index *idx)
+{
+  return idx->header->count;
+}
+
+void
+cdx_index_close (struct cdx_index *idx)
+{
+  if (!idx)
+    return;
+#ifdef HAVE_MMAP
+  if (idx->mapped)
+    munmap (idx->map, idx->map_size);
+  else
+#endif
+    xfree (idx->map);
+  xfree (idx);
+}
+
+/* Building an index.
+
+   The entries are sorted in runs of CDX_BUILD_RUN entries, which are
+   written to temporary files and merged at the end, so that CDX files
+   of any size can be indexed in bounded memory.  The strings are
+   appended to another temporary file as the lines are read.  */
+
+#define CDX_BUILD_RUN (1 << 22)
+
+struct cdx_run {
+  FILE *fp;
+  struct cdx_index_entry head;  /* the next entry of the run */
+};
+
+static int
+cdx_entry_cmp (const void *a, const void *b)
+{
+  return memcmp (((const struct cdx_index_entry *) a)->digest,
+                 ((const struct cdx_index_entry *) b)->digest,
+                 CDX_DIGEST_SIZE);
+}
+
+/* Sorts the COUNT entries in BUF and writes them to a new temporary
+   file.  */
+static FILE *
+cdx_write_run (struct cdx_index_entry *buf, size_t count)
+{
+  FILE *fp = tmpfile ();
+
+  if (!fp)
+    return NULL;
+  qsort (buf, count, sizeof (*buf), cdx_entry_cmp);
+  if (fwrite (buf, sizeof (*buf), count, fp) != count
+      || fflush (fp) != 0 || fseeko (fp, 0, SEEK_SET) != 0)
+    {
+      fclose (fp);
+      return NULL;
+    }
+  return fp;
+}
+
+/* Restores the heap order of the runs in HEAP below position I.  */
+static void
+cdx_run_sift_down (struct cdx_run **heap, size_t n, size_t i)
+{
+  for (;;)
+    {
+      size_t l = 2 * i + 1, smallest = i;
+      struct cdx_run *tmp;
+
+      if (l < n && cdx_entry_cmp (&heap[l]->head, &heap[smallest]->head) < 0)
+        smallest = l;
+      if (l + 1 < n
+          && cdx_entry_cmp (&heap[l + 1]->head, &heap[smallest]->head) < 0)
+        smallest = l + 1;
+      if (smallest == i)
+        return;
+      tmp = heap[i];
+      heap[i] = heap[smallest];
+      heap[smallest] = tmp;
+      i = smallest;
+    }
+}
+
+static bool
+cdx_copy_file (FILE *from, FILE *to)
+{
+  char buf[64 * 1024];
+  size_t n;
+
+  if (fseeko (from, 0, SEEK_SET) != 0)
+    return false;
+  while ((n = fread (buf, 1, sizeof (buf), from)) > 0)
+    if (fwrite (buf, 1, n, to) != n)
+      return false;
+  return !ferror (from);
+}
+
+/* Builds the index FILE from the CDX file read from CDX.  The index is
+   written to FILE.tmp and renamed when it is complete.  Returns NULL
+   on success, or a message describing the error; errno is then set
+   if it is meaningful.  */
+const char *
+cdx_index_build (FILE *cdx, const char *file)
+{
+  int field_num_original_url, field_num_checksum, field_num_record_id;
+  char *line = NULL;
+  size_t line_size = 0;
+  struct cdx_index_entry *buf;
+  size_t buf_count = 0;
+  struct cdx_run *runs = NULL, **heap = NULL;
+  size_t nruns = 0, runs_alloc = 0, nheap = 0, i;
+  FILE *strings, *out = NULL;
+  struct cdx_index_header hdr;
+  uint64_t *fanout = NULL;
+  unsigned char *bloom = NULL;
+  uint64_t bloom_size, n;
+  char *tmp_file = NULL;
+  const char *error = NULL;
+
+  if (getline (&line, &line_size, cdx) < 0
+      || !cdx_parse_header (line, &field_num_original_url,
+                            &field_num_checksum, &field_num_record_id))
+    {
+      xfree (line);
+      errno = 0;
+      return "the CDX header does not list columns 'a', 'k' and 'u'";
+    }
+
+  strings = tmpfile ();
+  if (!strings)
+    {
+      xfree (line);
+      return "cannot create a temporary file";
+    }
+
+  memset (&hdr, 0, sizeof (hdr));
+  buf = xnew_array (struct cdx_index_entry, CDX_BUILD_RUN);
+  while (getline (&line, &line_size, cdx) >= 0)
+    {
+      struct cdx_index_entry *e = &buf[buf_count];
+      const char *url, *record_id;
+      size_t url_len, record_id_len;
+
+      if (!cdx_parse_line (line, field_num_original_url, field_num_checksum,
+                           field_num_record_id, &url, (char *) e->digest,
+                           &record_id))
+        continue;
+
+      url_len = strlen (url) + 1;
+      record_id_len = strlen (record_id) + 1;
+      e->reserved = 0;
+      e->strings_offset = hdr.strings_size;
+      if (fwrite (url, 1, url_len, strings) != url_len
+          || fwrite (record_id, 1, record_id_len, strings) != record_id_len)
+        {
+          error = "cannot write a temporary file";
+          goto done;
+        }
+      hdr.strings_size += url_len + record_id_len;
+      hdr.count++;
+
+      if (++buf_count == CDX_BUILD_RUN)
+        {
+          if (nruns == runs_alloc)
+            {
+              runs_alloc = runs_alloc ? 2 * runs_alloc : 16;
+              runs = xrealloc (runs, runs_alloc * sizeof (*runs));
+            }
+          runs[nruns].fp = cdx_write_run (buf, buf_count);
+          if (!runs[nruns].fp)
+            {
+              error = "cannot write a temporary file";
+              goto done;
+            }
+          nruns++;
+          buf_count = 0;
+        }
+    }
+  if (ferror (cdx))
+    {
+      error = "cannot read the CDX file";
+      goto done;
+    }
+
+  tmp_file = xmalloc (strlen (file) + sizeof (".tmp"));
+  strcpy (tmp_file, file);
+  strcat (tmp_file, ".tmp");
+  out = fopen (tmp_file, "wb");
+  if (!out)
+    {
+      error = "cannot create the index";
+      goto done;
+    }
+
+  hdr.bloom_bits_log2 = cdx_bloom_bits_log2 (hdr.count);
+  hdr.bloom_probes = CDX_BLOOM_PROBES;
+  bloom_size = (uint64_t) 1 << (hdr.bloom_bits_log2 - 3);
+  bloom = xcalloc (1, bloom_size);
+  fanout = xcalloc (CDX_FANOUT, sizeof (uint64_t));
+
+  /* The entries go after the header, fan-out and filter, which are
+     written last, once they are known.  */
+  if (fseeko (out, sizeof (hdr) + CDX_FANOUT * sizeof (uint64_t)
+              + bloom_size, SEEK_SET) != 0)
+    {
+      error = "cannot write the index";
+      goto done;
+    }
+
+  if (nruns == 0)
+    {
+      /* Everything fit in memory.  */
+      qsort (buf, buf_count, sizeof (*buf), cdx_entry_cmp);
+      for (i = 0; i < buf_count; i++)
+        {
+          fanout[cdx_prefix (buf[i].digest)]++;
+          cdx_bloom_add (bloom, bloom_size * 8 - 1, buf[i].digest);
+        }
+      if (fwrite (buf, sizeof (*buf), buf_count, out) != buf_count)
+        {
+          error = "cannot write the index";
+          goto done;
+        }
+    }
+  else
+    {
+      /* Merge the runs, including what is left in BUF.  */
+      if (buf_count)
+        {
+          if (nruns == runs_alloc)
+            runs = xrealloc (runs, ++runs_alloc * sizeof (*runs));
+          runs[nruns].fp = cdx_write_run (buf, buf_count);
+          if (!runs[nruns].fp)
+            {
+              error = "cannot write a temporary file";
+              goto done;
+            }
+          nruns++;
+        }
+      xfree (buf);
+
+      heap = xnew_array (struct cdx_run *, nruns);
+      for (i = 0; i < nruns; i++)
+        if (fread (&runs[i].head, sizeof (runs[i].head), 1, runs[i].fp) == 1)
+          heap[nheap++] = &runs[i];
+      for (i = nheap / 2; i-- > 0;)
+        cdx_run_sift_down (heap, nheap, i);
+
+      while (nheap > 0)
+        {
+          struct cdx_run *run = heap[0];
+
+          fanout[cdx_prefix (run->head.digest)]++;
+          cdx_bloom_add (bloom, bloom_size * 8 - 1, run->head.digest);
+          if (fwrite (&run->head, sizeof (run->head), 1, out) != 1)
+            {
+              error = "cannot write the index";
+              goto done;
+            }
+          if (fread (&run->head, sizeof (run->head), 1, run->fp) != 1)
+            heap[0] = heap[--nheap];
+          cdx_run_sift_down (heap, nheap, 0);
+        }
+    }
+
+  if (!cdx_copy_file (strings, out))
+    {
+      error = "cannot write the index";
+      goto done;
+    }
+
+  /* Turn the counts into cumulative counts.  */
+  for (n = 0, i = 0; i < CDX_FANOUT; i++)
+    {
+      n += fanout[i];
+      fanout[i] = n;
+    }
+
+  memcpy (hdr.magic, CDX_INDEX_MAGIC, CDX_INDEX_MAGIC_SIZE);
+  if (fseeko (out, 0, SEEK_SET) != 0
+      || fwrite (&hdr, sizeof (hdr), 1, out) != 1
+      || fwrite (fanout, sizeof (uint64_t), CDX_FANOUT, out) != CDX_FANOUT
+      || fwrite (bloom, 1, bloom_size, out) != bloom_size)
+    {
+      error = "cannot write the index";
+      goto done;
+    }
+
+  if (fclose (out) != 0)
+    error = "cannot write the index";
+  else if (rename (tmp_file, file) != 0)
+    error = "cannot rename the index";
+  out = NULL;
+
+ done:
+  if (out)
+    fclose (out);
+  if (error && tmp_file)
+    unlink (tmp_file);
+  for (i = 0; i < nruns; i++)
+    fclose (runs[i].fp);
+  xfree (runs);
+  xfree (heap);
+  fclose (strings);
+  xfree (buf);
+  xfree (fanout);
+  xfree (bloom);
+  xfree (tmp_file);
+  xfree (line);
+  return error;
+}
+
+#ifdef TESTING
+
+const char *
+test_cdx_index (void)
+{
+  static const char cdx[] =
+    " CDX a b a m s k r M V g u\n"
+    "http://a.example/ 20260101000000 http://a.example/ text/html 200 "
+    "LIBD7YPU34Z6446LKLCMJBMVYV2BHCWC - - 0 x.warc <urn:uuid:1>\n"
+    "http://b.example/ 20260101000000 http://b.example/ text/html 200 "
+    "LIBD7YPU34Z6446LKLCMJBMVYV2BHCWC - - 0 x.warc <urn:uuid:2>\n"
+    "http://c.example/ 20260101000000 http://c.example/ text/html 200 "
+    "EYLOBZUVJB7A6T6F3XAYYV647FOOLBI2 - - 0 x.warc <urn:uuid:3>\n"
+    "broken line\n";
+  char digest[CDX_DIGEST_SIZE], other[CDX_DIGEST_SIZE];
+  idx_t size = CDX_DIGEST_SIZE;
+  char file[100];
+  struct cdx_index *idx;
+  const char *error;
+  FILE *fp;
+  int fd;
+
+  mu_assert ("cannot create a temporary file",
+             path_search (file, sizeof (file), NULL, "wget", true) == 0
+             && (fd = mkstemp (file)) >= 0);
+  close (fd);
+
+  fp = fmemopen ((void *) cdx, sizeof (cdx) - 1, "r");
+  error = cdx_index_build (fp, file);
+  fclose (fp);
+  mu_assert ("cannot build the index", error == NULL);
+
+  idx = cdx_index_open (file);
+  unlink (file);
+  mu_assert ("cannot open the index", idx != NULL);
+  mu_assert ("wrong entry count", cdx_index_count (idx) == 3);
+
+  base32_decode ("LIBD7YPU34Z6446LKLCMJBMVYV2BHCWC", 32, digest, &size);
+  mu_assert ("first URL not found",
+             !strcmp (cdx_index_find (idx, "http://a.example/", digest),
+                      "<urn:uuid:1>"));
+  mu_assert ("second URL not found",
+             !strcmp (cdx_index_find (idx, "http://b.example/", digest),
+                      "<urn:uuid:2>"));
+  mu_assert ("wrong URL found",
+             cdx_index_find (idx, "http://c.example/", digest) == NULL);
+
+  memcpy (other, digest, sizeof (other));
+  other[CDX_DIGEST_SIZE - 1] ^= 1;
+  mu_assert ("unknown digest found",
+             cdx_index_find (idx, "http://a.example/", other) == NULL);
+
+  cdx_index_close (idx);
+  return NULL;
+}
+
+#endif /* TESTING */
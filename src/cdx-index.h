@@ -0,0 +1,55 @@
+/* Declarations for cdx-index.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef CDX_INDEX_H
+#define CDX_INDEX_H
+
+/* The first bytes of a CDX index file. */
+#define CDX_INDEX_MAGIC "WGCDXI01"
+#define CDX_INDEX_MAGIC_SIZE 8
+
+/* The size of the digests in a CDX file (SHA-1). */
+#define CDX_DIGEST_SIZE 20
+
+struct cdx_index;
+
+bool cdx_parse_header (char *, int *, int *, int *);
+bool cdx_parse_line (char *, int, int, int, const char **, char *,
+                     const char **);
+
+struct cdx_index *cdx_index_open (const char *);
+const char *cdx_index_find (const struct cdx_index *, const char *,
+                            const char *);
+unsigned long long cdx_index_count (const struct cdx_index *);
+void cdx_index_close (struct cdx_index *);
+
+const char *cdx_index_build (FILE *, const char *);
+
+#endif /* CDX_INDEX_H */
@@ -46,6 +46,7 @@ as that of the covered work.  */
 #  include <netdb.h>
 # endif /* def __VMS [else] */
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # ifndef __BEOS__
 #  include <arpa/inet.h>
 # endif
@@ -53,12 +54,15 @@ as that of the covered work.  */
 
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/time.h>
 
 #include "utils.h"
 #include "host.h"
 #include "connect.h"
 #include "hash.h"
+#include "stats.h"
+#include "ptimer.h"
 
 #include <stdint.h>
 
@@ -252,48 +256,47 @@ connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
   return ctx.result;
 }
 
-/* Connect via TCP to the specified address and port.
-
-   If PRINT is non-NULL, it is the host name to print that we're
-   connecting to.  */
+/* Print the "Connecting to..." line for connecting to IP and PORT,
+   with PRINT being the host name we're connecting to.  */
 
-int
-connect_to_ip (const ip_address *ip, int port, const char *print)
+static void
+print_connecting (const ip_address *ip, int port, const char *print)
 {
-  struct sockaddr_storage ss;
-  struct sockaddr *sa = (struct sockaddr *)&ss;
-  int sock;
-
-  /* If PRINT is non-NULL, print the "Connecting to..." line, with
-     PRINT being the host name we're connecting to.  */
-  if (print)
+  const char *txt_addr = print_address (ip);
+  if (0 != strcmp (print, txt_addr))
     {
-      const char *txt_addr = print_address (ip);
-      if (0 != strcmp (print, txt_addr))
-        {
-          char *str = NULL, *name;
+      char *str = NULL, *name;
 
-          if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
-            {
-              str = aprintf ("%s (%s)", name, print);
-              xfree (name);
-            }
+      if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
+        {
+          str = aprintf ("%s (%s)", name, print);
+          xfree (name);
+        }
 
-          logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
-                     str ? str : escnonprint_uri (print), txt_addr, port);
+      logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
+                 str ? str : escnonprint_uri (print), txt_addr, port);
 
-          xfree (str);
-        }
-      else
-        {
-           if (ip->family == AF_INET)
-               logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
+      xfree (str);
+    }
+  else
+    {
+       if (ip->family == AF_INET)
+           logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
 #ifdef ENABLE_IPV6
-           else if (ip->family == AF_INET6)
-               logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
+       else if (ip->family == AF_INET6)
+           logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
 #endif
-        }
     }
+}
+
+/* Create a socket for connecting to IP and PORT, store the address to
+   connect to in SA, and set the socket up as the options require.
+   Return the socket, or -1 with errno set on failure.  */
+
+static int
+make_socket (const ip_address *ip, int port, struct sockaddr *sa)
+{
+  int sock;
 
   /* Store the sockaddr info to SA.  */
   sockaddr_set_data (sa, ip, port);
@@ -301,7 +304,7 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   /* Create the socket of the family appropriate for the address.  */
   sock = socket (sa->sa_family, SOCK_STREAM, 0);
   if (sock < 0)
-    goto err;
+    return -1;
 
 #if defined(ENABLE_IPV6) && defined(IPV6_V6ONLY)
   if (opt.ipv6_only) {
@@ -342,17 +345,51 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
       if (resolve_bind_address (bind_sa))
         {
           if (bind (sock, bind_sa, sockaddr_size (bind_sa)) < 0)
-            goto err;
+            {
+              int save_errno = errno;
+              fd_close (sock);
+              errno = save_errno;
+              return -1;
+            }
         }
     }
 
+  return sock;
+}
+
+/* Connect via TCP to the specified address and port.
+
+   If PRINT is non-NULL, it is the host name to print that we're
+   connecting to.  */
+
+int
+connect_to_ip (const ip_address *ip, int port, const char *print)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int sock, res;
+  double since;
+
+  /* If PRINT is non-NULL, print the "Connecting to..." line, with
+     PRINT being the host name we're connecting to.  */
+  if (print)
+    print_connecting (ip, port, print);
+
+  sock = make_socket (ip, port, sa);
+  if (sock < 0)
+    goto err;
+
   /* Connect the socket to the remote endpoint.  */
-  if (connect_with_timeout (sock, sa, sockaddr_size (sa),
-                            opt.connect_timeout) < 0)
+  since = stats_time ();
+  res = connect_with_timeout (sock, sa, sockaddr_size (sa),
+                              opt.connect_timeout);
+  stats_phase (STATS_CONNECT, since);
+  if (res < 0)
     goto err;
 
   /* Success. */
   assert (sock >= 0);
+  stats_connection (false);
   if (print)
     logprintf (LOG_VERBOSE, _("connected.\n"));
   DEBUGP (("Created socket %d.\n", sock));
@@ -379,6 +416,253 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 }
 
+#ifndef WINDOWS
+/* The delay before starting the connection attempt to the next
+   address of a host, as recommended by RFC 8305 ("Happy
+   Eyeballs").  */
+#define CONNECTION_ATTEMPT_DELAY 0.25
+
+struct connection_attempt {
+  int index;                    /* the position of the address in AL */
+  int sock;                     /* -1 when not in progress */
+  double started;               /* when the attempt was started */
+  bool failed;                  /* whether the attempt has failed */
+};
+
+/* Start a non-blocking connection to IP and PORT.  Return the socket,
+   or -1 with errno set on failure.  *CONNECTED is set if the
+   connection was established right away.  */
+
+static int
+start_connection (const ip_address *ip, int port, bool *connected)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int sock, flags, res = -1;
+
+  sock = make_socket (ip, port, sa);
+  if (sock < 0)
+    return -1;
+  if (sock >= FD_SETSIZE)
+    errno = EMFILE;
+  else if ((flags = fcntl (sock, F_GETFL, 0)) >= 0
+           && fcntl (sock, F_SETFL, flags | O_NONBLOCK) >= 0)
+    res = connect (sock, sa, sockaddr_size (sa));
+  if (res < 0 && errno != EINPROGRESS)
+    {
+      int save_errno = errno;
+      fd_close (sock);
+      errno = save_errno;
+      return -1;
+    }
+  *connected = (res == 0);
+  return sock;
+}
+
+/* Report the failure of attempt A as connect_to_ip does.  errno holds
+   the reason.  */
+
+static void
+attempt_failed (const struct address_list *al, struct connection_attempt *a,
+                int port, const char *print)
+{
+  int save_errno = errno;
+
+  a->failed = true;
+  if (print)
+    {
+      print_connecting (address_list_address_at (al, a->index), port, print);
+      logprintf (LOG_NOTQUIET, _("failed: %s.\n"), strerror (save_errno));
+    }
+}
+
+/* Connect to one of the addresses of AL between START and END, which
+   are at least two, and return the socket, or -1 on failure.
+
+   Rather than wait for each address to fail in turn, start a
+   connection attempt to the next address every
+   CONNECTION_ATTEMPT_DELAY seconds, or as soon as an attempt fails,
+   alternating between address families.  The first connection to be
+   established is used and the others are abandoned.  Each attempt
+   fails after --connect-timeout seconds.  */
+
+static int
+connect_to_addresses (struct address_list *al, int start, int end, int port,
+                      const char *print)
+{
+  int count = end - start;
+  struct connection_attempt *att = xnew0_array (struct connection_attempt,
+                                                count);
+  struct connection_attempt *a, *won = NULL;
+  struct ptimer *timer = ptimer_new ();
+  double since = stats_time ();
+  double next_start = 0;
+  int next = 0, active = 0;
+  int i, p, q, family;
+
+  /* Order the attempts so that the families alternate, starting with
+     that of the first address, which --prefer-family has chosen.  */
+  family = address_list_address_at (al, start)->family;
+  for (i = 0, p = q = start; i < count; )
+    {
+      while (p < end && address_list_address_at (al, p)->family != family)
+        ++p;
+      if (p < end)
+        att[i++].index = p++;
+      while (q < end && address_list_address_at (al, q)->family == family)
+        ++q;
+      if (q < end)
+        att[i++].index = q++;
+    }
+  for (i = 0; i < count; i++)
+    att[i].sock = -1;
+
+  DEBUGP (("Racing connections to %d addresses of %s.\n", count, print));
+
+  while (!won)
+    {
+      double now = ptimer_measure (timer);
+      double wait = 0;
+      bool have_deadline = false;
+      struct timeval tmout;
+      fd_set wset;
+      int maxfd = -1, res;
+      bool connected;
+
+      if (next < count && now >= next_start)
+        {
+          a = att + next++;
+          a->started = now;
+          a->sock = start_connection (address_list_address_at (al, a->index),
+                                      port, &connected);
+          if (a->sock < 0)
+            attempt_failed (al, a, port, print);
+          else if (connected)
+            won = a;
+          else
+            {
+              ++active;
+              next_start = now + CONNECTION_ATTEMPT_DELAY;
+            }
+          continue;
+        }
+
+      if (!active)
+        break;
+
+      /* Wait for an attempt to finish, the next one to be due, or the
+         oldest one to time out.  */
+      FD_ZERO (&wset);
+      if (next < count)
+        {
+          wait = next_start - now;
+          have_deadline = true;
+        }
+      for (i = 0; i < next; i++)
+        {
+          a = att + i;
+          if (a->sock < 0)
+            continue;
+          FD_SET (a->sock, &wset);
+          if (a->sock > maxfd)
+            maxfd = a->sock;
+          if (opt.connect_timeout
+              && (!have_deadline
+                  || a->started + opt.connect_timeout - now < wait))
+            {
+              wait = a->started + opt.connect_timeout - now;
+              have_deadline = true;
+            }
+        }
+      if (have_deadline)
+        {
+          /* An attempt that is overdue times out right away.  */
+          if (wait < 0)
+            wait = 0;
+          tmout.tv_sec = (long) wait;
+          tmout.tv_usec = 1000000 * (wait - (long) wait);
+        }
+      res = select (maxfd + 1, NULL, &wset, NULL,
+                    have_deadline ? &tmout : NULL);
+      if (res < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      now = ptimer_measure (timer);
+      for (i = 0; i < next && !won; i++)
+        {
+          int err = 0;
+          socklen_t errlen = sizeof (err);
+
+          a = att + i;
+          if (a->sock < 0)
+            continue;
+          if (FD_ISSET (a->sock, &wset))
+            {
+              if (getsockopt (a->sock, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0)
+                err = errno;
+              if (!err)
+                {
+                  won = a;
+                  break;
+                }
+            }
+          else if (opt.connect_timeout
+                   && now - a->started >= opt.connect_timeout)
+            err = ETIMEDOUT;
+          else
+            continue;
+
+          fd_close (a->sock);
+          a->sock = -1;
+          --active;
+          errno = err;
+          attempt_failed (al, a, port, print);
+          next_start = now;
+        }
+    }
+
+  /* Abandon the attempts still in progress.  */
+  for (i = 0; i < next; i++)
+    if (att[i].sock >= 0 && att + i != won)
+      fd_close (att[i].sock);
+
+  /* Mark the addresses that failed as faulty, as far as the address
+     list can record it: up to the first one that didn't.  */
+  for (p = start; p < end; p++)
+    {
+      for (i = 0; att[i].index != p; i++)
+        ;
+      if (!att[i].failed)
+        break;
+      address_list_set_faulty (al, p);
+    }
+
+  stats_phase (STATS_CONNECT, since);
+  if (won)
+    {
+      int flags = fcntl (won->sock, F_GETFL, 0);
+      fcntl (won->sock, F_SETFL, flags & ~O_NONBLOCK);
+      stats_connection (false);
+      if (print)
+        {
+          print_connecting (address_list_address_at (al, won->index), port,
+                            print);
+          logprintf (LOG_VERBOSE, _("connected.\n"));
+        }
+      DEBUGP (("Created socket %d.\n", won->sock));
+    }
+
+  i = won ? won->sock : -1;
+  ptimer_destroy (timer);
+  xfree (att);
+  return i;
+}
+#endif /* not WINDOWS */
+
 /* Connect via TCP to a remote host on the specified port.
 
    HOST is resolved as an Internet host name.  If HOST resolves to
@@ -403,6 +687,19 @@ connect_to_host (const char *host, int port)
     }
 
   address_list_get_bounds (al, &start, &end);
+#ifndef WINDOWS
+  if (end - start > 1)
+    {
+      sock = connect_to_addresses (al, start, end, port, host);
+      if (sock >= 0)
+        {
+          address_list_set_connected (al);
+          address_list_release (al);
+          return sock;
+        }
+    }
+  else
+#endif
   for (i = start; i < end; i++)
     {
       const ip_address *ip = address_list_address_at (al, i);
@@ -783,6 +1080,76 @@ wget uses blocking sockets so we must convert them back to blocking
     return false;
 }
 
+#if defined SO_RCVBUF && defined TCP_INFO
+/* Whether the kernel grows the receive buffers of TCP sockets by
+   itself.  Setting SO_RCVBUF turns that off for the socket, and the
+   value is capped well below what the kernel would grow to, so the
+   buffer is then better left alone.  */
+
+static bool
+rcvbuf_autotuned (void)
+{
+  static int autotuned = -1;
+
+  if (autotuned < 0)
+    {
+      FILE *fp = fopen ("/proc/sys/net/ipv4/tcp_moderate_rcvbuf", "r");
+      int value = 0;
+
+      autotuned = fp && fscanf (fp, "%d", &value) == 1 && value;
+      if (fp)
+        fclose (fp);
+    }
+  return autotuned;
+}
+#endif
+
+/* Size the receive buffer of the TCP socket SOCK for data arriving at
+   RATE bytes per second: it should hold what arrives in two round
+   trips, as measured by the kernel.  The buffer is only ever raised,
+   up to RCVBUF_MAX, and only where the kernel does not size it
+   itself.  */
+
+#define RCVBUF_MAX (16 * 1024 * 1024)
+
+void
+socket_tune_rcvbuf (int sock, double rate)
+{
+#if defined SO_RCVBUF && defined TCP_INFO
+  struct tcp_info info;
+  socklen_t len = sizeof info;
+  int size, want;
+  double bytes;
+
+  if (rcvbuf_autotuned ())
+    return;
+  if (getsockopt (sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0
+      || !info.tcpi_rtt)
+    return;
+  /* tcpi_rtt is in microseconds.  */
+  bytes = 2 * rate * info.tcpi_rtt / 1e6;
+  want = bytes < RCVBUF_MAX ? (int) bytes : RCVBUF_MAX;
+
+  len = sizeof size;
+  if (getsockopt (sock, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0)
+    return;
+#ifdef __linux__
+  /* Linux reports twice the size that was set, the rest being kept
+     for its own bookkeeping.  */
+  size /= 2;
+#endif
+  if (size >= want)
+    return;
+  if (setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &want, sizeof want) == 0)
+    DEBUGP (("Raised the receive buffer of socket %d from %d to %d bytes"
+             " (rtt %.1f ms).\n", sock, size, want,
+             info.tcpi_rtt / 1000.0));
+#else
+  (void) sock;
+  (void) rate;
+#endif
+}
+
 /* Basic socket operations, mostly EINTR wrappers.  */
 
 static int
@@ -977,6 +1344,18 @@ fd_peek (int fd, char *buf, int bufsize, double timeout)
   return sock_peek (fd, buf, bufsize);
 }
 
+/* Return the most data one call to fd_read on FD can return, or 0 if
+   it is only limited by the size of the buffer.  */
+
+int
+fd_read_size (int fd)
+{
+  struct transport_info *info;
+  LAZY_RETRIEVE_INFO (info);
+
+  return info ? info->imp->read_size : 0;
+}
+
 /* Write the entire contents of BUF to FD.  If TIMEOUT is non-zero,
    the operation aborts if no data is received after that many
    seconds.  If TIMEOUT is -1, the value of opt.timeout is used for
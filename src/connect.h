@@ -61,6 +61,7 @@ enum {
 };
 int select_fd (int, double, int);
 bool test_socket_open (int);
+void socket_tune_rcvbuf (int, double);
 
 struct transport_implementation {
   int (*reader) (int, char *, int, void *, double);
@@ -69,6 +70,9 @@ struct transport_implementation {
   int (*peeker) (int, char *, int, void *, double);
   const char *(*errstr) (int, void *);
   void (*closer) (int, void *);
+  /* Most data one call to READER returns, or 0 if it fills BUF
+     whenever enough data is waiting.  */
+  int read_size;
 };
 
 void fd_register_transport (int, struct transport_implementation *, void *);
@@ -76,6 +80,7 @@ void *fd_transport_context (int);
 int fd_read (int, char *, int, double);
 int fd_write (int, char *, int, double);
 int fd_peek (int, char *, int, double);
+int fd_read_size (int);
 const char *fd_errstr (int);
 void fd_close (int);
 void connect_cleanup (void);
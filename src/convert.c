@@ -36,6 +36,9 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #include "convert.h"
 #include "url.h"
 #include "recur.h"
@@ -47,6 +50,7 @@ as that of the covered work.  */
 #include "css-url.h"
 #include "iri.h"
 #include "xstrndup.h"
+#include "strpool.h"
 
 static struct hash_table *dl_file_url_map;
 struct hash_table *dl_url_file_map;
@@ -807,7 +811,11 @@ local_quote_string (const char *file, bool no_html_quote)
 
 /* Book-keeping code for dl_file_url_map, dl_url_file_map,
    downloaded_html_list, and downloaded_html_set.  Other code calls
-   these functions to let us know that a file has been downloaded.  */
+   these functions to let us know that a file has been downloaded.
+
+   The keys and values of dl_file_url_map and dl_url_file_map are
+   interned strings (see strpool.c), shared between the two maps and
+   with the recursive retrieval queue.  They are never freed here.  */
 
 #define ENSURE_TABLES_EXIST do {                        \
   if (!dl_file_url_map)                                 \
@@ -878,11 +886,7 @@ dissociate_urls_from_file_mapper (void *key, void *value, void *arg)
   char *file = (char *)arg;
 
   if (0 == strcmp (mapping_file, file))
-    {
-      hash_table_remove (dl_url_file_map, mapping_url);
-      xfree (mapping_url);
-      xfree (mapping_file);
-    }
+    hash_table_remove (dl_url_file_map, mapping_url);
 
   /* Continue mapping. */
   return 0;
@@ -906,7 +910,7 @@ dissociate_urls_from_file (const char *file)
 void
 register_download (const char *url, const char *file)
 {
-  char *old_file, *old_url;
+  char *old_url;
 
   ENSURE_TABLES_EXIST;
 
@@ -915,7 +919,8 @@ register_download (const char *url, const char *file)
      download will override the first one.  When that happens,
      dissociate the old file name from the URL.  */
 
-  if (hash_table_get_pair (dl_file_url_map, file, &old_file, &old_url))
+  old_url = hash_table_get (dl_file_url_map, file);
+  if (old_url)
     {
       if (0 == strcmp (url, old_url))
         /* We have somehow managed to download the same URL twice.
@@ -931,8 +936,6 @@ register_download (const char *url, const char *file)
         goto url_only;
 
       hash_table_remove (dl_file_url_map, file);
-      xfree (old_file);
-      xfree (old_url);
 
       /* Remove all the URLs that point to this file.  Yes, there can
          be more than one such URL, because we store redirections as
@@ -950,7 +953,9 @@ register_download (const char *url, const char *file)
       dissociate_urls_from_file (file);
     }
 
-  hash_table_put (dl_file_url_map, xstrdup (file), xstrdup (url));
+  url = intern_string (url);
+  file = intern_string (file);
+  hash_table_put (dl_file_url_map, file, url);
 
  url_only:
   /* A URL->FILE mapping is not possible without a FILE->URL mapping.
@@ -968,15 +973,11 @@ register_download (const char *url, const char *file)
      then the first URL will resolve to "FILE", and the other to
      "FILE.1".  In that case, FILE.1 will not be found in
      dl_file_url_map, but URL will still point to FILE in
-     dl_url_file_map.  */
-  if (hash_table_get_pair (dl_url_file_map, url, &old_url, &old_file))
-    {
-      hash_table_remove (dl_url_file_map, url);
-      xfree (old_url);
-      xfree (old_file);
-    }
+     dl_url_file_map.
 
-  hash_table_put (dl_url_file_map, xstrdup (url), xstrdup (file));
+     Since the keys are interned, putting the mapping simply replaces
+     the old one.  */
+  hash_table_put (dl_url_file_map, intern_string (url), intern_string (file));
 }
 
 /* Register that FROM has been redirected to "TO".  This assumes that TO
@@ -993,7 +994,7 @@ register_redirection (const char *from, const char *to)
   file = hash_table_get (dl_url_file_map, to);
   assert (file != NULL);
   if (!hash_table_contains (dl_url_file_map, from))
-    hash_table_put (dl_url_file_map, xstrdup (from), xstrdup (file));
+    hash_table_put (dl_url_file_map, intern_string (from), file);
 }
 
 /* Register that the file has been deleted. */
@@ -1001,16 +1002,11 @@ register_redirection (const char *from, const char *to)
 void
 register_delete_file (const char *file)
 {
-  char *old_url, *old_file;
-
   ENSURE_TABLES_EXIST;
 
-  if (!hash_table_get_pair (dl_file_url_map, file, &old_file, &old_url))
+  if (!hash_table_remove (dl_file_url_map, file))
     return;
 
-  hash_table_remove (dl_file_url_map, file);
-  xfree (old_file);
-  xfree (old_url);
   dissociate_urls_from_file (file);
 }
 
@@ -1044,13 +1040,11 @@ convert_cleanup (void)
 {
   if (dl_file_url_map)
     {
-      free_keys_and_values (dl_file_url_map);
       hash_table_destroy (dl_file_url_map);
       dl_file_url_map = NULL;
     }
   if (dl_url_file_map)
     {
-      free_keys_and_values (dl_url_file_map);
       hash_table_destroy (dl_url_file_map);
       dl_url_file_map = NULL;
     }
@@ -1121,28 +1115,37 @@ downloaded_file_t
 downloaded_file (downloaded_file_t mode, const char *file)
 {
   downloaded_file_t *ptr;
+  downloaded_file_t res = FILE_NOT_ALREADY_DOWNLOADED;
+
+#ifdef HAVE_PTHREAD_H
+  /* Parallel downloads finish files from several threads.  */
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_lock (&lock);
+#endif
 
   if (mode == CHECK_FOR_FILE)
+    {
+      if (downloaded_files_hash
+          && (ptr = hash_table_get (downloaded_files_hash, file)))
+        res = *ptr;
+    }
+  else
     {
       if (!downloaded_files_hash)
-        return FILE_NOT_ALREADY_DOWNLOADED;
+        downloaded_files_hash = make_string_hash_table (0);
+
       ptr = hash_table_get (downloaded_files_hash, file);
-      if (!ptr)
-        return FILE_NOT_ALREADY_DOWNLOADED;
-      return *ptr;
+      if (ptr)
+        res = *ptr;
+      else
+        hash_table_put (downloaded_files_hash, xstrdup (file),
+                        downloaded_mode_to_ptr (mode));
     }
 
-  if (!downloaded_files_hash)
-    downloaded_files_hash = make_string_hash_table (0);
-
-  ptr = hash_table_get (downloaded_files_hash, file);
-  if (ptr)
-    return *ptr;
-
-  ptr = downloaded_mode_to_ptr (mode);
-  hash_table_put (downloaded_files_hash, xstrdup (file), ptr);
-
-  return FILE_NOT_ALREADY_DOWNLOADED;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock (&lock);
+#endif
+  return res;
 }
 
 #if defined DEBUG_MALLOC || defined TESTING
@@ -55,12 +55,19 @@ as that of the covered work.  */
 #ifdef HAVE_LIBPSL
 # include <libpsl.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #include "utils.h"
 #include "hash.h"
 #include "cookies.h"
 #include "http.h"               /* for http_atotm */
 #include "c-strcase.h"
 
+#ifdef TESTING
+# include "../tests/unit-tests.h"
+#endif
+
 
 /* Declarations of `struct cookie' and the most basic functions. */
 
@@ -74,15 +81,41 @@ as that of the covered work.  */
    course, when sending a cookie to `www.google.com', one must search
    for cookies that belong to either `www.google.com' or `google.com'
    -- but the point is that the code doesn't need to go through *all*
-   the cookies.  */
+   the cookies.
+
+   Each chain is kept ordered by decreasing path length, and chains
+   are visited from the most to the least specific domain, so the
+   matching cookies come out in the order in which they are sent.
+
+   The Cookie headers built from the jar are cached by host, port,
+   security and directory, and the cache is invalidated whenever the
+   jar changes, so that a crawl of a site with many cookies builds
+   the header only once per directory.  */
 
 struct cookie_jar {
   /* Cookie chains indexed by domain.  */
   struct hash_table *chains;
 
   int cookie_count;             /* number of cookies in the jar. */
+
+  /* Rendered Cookie headers, see cookie_header.  */
+  struct hash_table *header_cache;
+  unsigned int generation;      /* incremented on every change */
+  unsigned int cache_generation;/* generation of HEADER_CACHE */
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;         /* downloads may run in parallel */
+#endif
 };
 
+#ifdef HAVE_PTHREAD_H
+# define LOCK_JAR(jar) pthread_mutex_lock (&(jar)->lock)
+# define UNLOCK_JAR(jar) pthread_mutex_unlock (&(jar)->lock)
+#else
+# define LOCK_JAR(jar)
+# define UNLOCK_JAR(jar)
+#endif
+
 /* Value set by entry point functions, so that the low-level
    routines don't need to call time() all the time.  */
 static time_t cookies_now;
@@ -90,9 +123,12 @@ static time_t cookies_now;
 struct cookie_jar *
 cookie_jar_new (void)
 {
-  struct cookie_jar *jar = xnew (struct cookie_jar);
+  struct cookie_jar *jar = xnew0 (struct cookie_jar);
   jar->chains = make_nocase_string_hash_table (0);
-  jar->cookie_count = 0;
+  jar->header_cache = make_string_hash_table (0);
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init (&jar->lock, NULL);
+#endif
   return jar;
 }
 
@@ -120,7 +156,7 @@ struct cookie {
   char *value;                  /* cookie attribute value */
 
   struct cookie *next;          /* used for chaining of cookies in the
-                                   same domain. */
+                                   same domain, longest path first. */
 };
 
 #define PORT_ANY (-1)
@@ -165,8 +201,9 @@ delete_cookie (struct cookie *cookie)
 
    All cookies can be reached beginning with jar->chains.  The key in
    that table is the domain name, and the value is a linked list of
-   all cookies from that domain.  Every new cookie is placed on the
-   head of the list.  */
+   all cookies from that domain, ordered by decreasing path length.
+   A new cookie is placed before the cookies whose path is no longer
+   than its own.  */
 
 /* Find and return a cookie in JAR whose domain, path, and attribute
    name correspond to COOKIE.  If found, PREVPTR will point to the
@@ -200,10 +237,26 @@ find_matching_cookie (struct cookie_jar *jar, struct cookie *cookie,
   return NULL;
 }
 
+/* Insert COOKIE into the chain beginning with HEAD, keeping the chain
+   ordered by decreasing path length.  Return the new head.  */
+
+static struct cookie *
+chain_insert (struct cookie *head, struct cookie *cookie)
+{
+  size_t len = strlen (cookie->path);
+  struct cookie **loc = &head;
+
+  while (*loc && strlen ((*loc)->path) > len)
+    loc = &(*loc)->next;
+  cookie->next = *loc;
+  *loc = cookie;
+  return head;
+}
+
 /* Store COOKIE to the jar.
 
-   This is done by placing COOKIE at the head of its chain.  However,
-   if COOKIE matches a cookie already in memory, as determined by
+   This is done by inserting COOKIE into its chain.  However, if
+   COOKIE matches a cookie already in memory, as determined by
    find_matching_cookie, the old cookie is unlinked and destroyed.
 
    The key of each chain's hash table entry is allocated only the
@@ -226,26 +279,15 @@ store_cookie (struct cookie_jar *jar, struct cookie *cookie)
 
       if (victim)
         {
-          /* Remove VICTIM from the chain.  COOKIE will be placed at
-             the head. */
+          /* Remove VICTIM from the chain. */
           if (prev)
-            {
-              prev->next = victim->next;
-              cookie->next = chain_head;
-            }
+            prev->next = victim->next;
           else
-            {
-              /* prev is NULL; apparently VICTIM was at the head of
-                 the chain.  This place will be taken by COOKIE, so
-                 all we need to do is:  */
-              cookie->next = victim->next;
-            }
+            chain_head = victim->next;
           delete_cookie (victim);
           --jar->cookie_count;
           DEBUGP (("Deleted old cookie (to be replaced.)\n"));
         }
-      else
-        cookie->next = chain_head;
     }
   else
     {
@@ -254,12 +296,14 @@ store_cookie (struct cookie_jar *jar, struct cookie *cookie)
          cookie->domain would be unsafe because the life-time of the
          chain may exceed the life-time of the cookie.  (Cookies may
          be deleted from the chain by this very function.)  */
-      cookie->next = NULL;
+      chain_head = NULL;
       chain_key = xstrdup (cookie->domain);
     }
 
-  hash_table_put (jar->chains, chain_key, cookie);
+  chain_head = chain_insert (chain_head, cookie);
+  hash_table_put (jar->chains, chain_key, chain_head);
   ++jar->cookie_count;
+  ++jar->generation;
 
   IF_DEBUG
     {
@@ -322,6 +366,8 @@ discard_matching_cookie (struct cookie_jar *jar, struct cookie *cookie)
             hash_table_put (jar->chains, chain_key, victim->next);
         }
       delete_cookie (victim);
+      --jar->cookie_count;
+      ++jar->generation;
       DEBUGP (("Discarded old cookie.\n"));
     }
 }
@@ -808,13 +854,16 @@ cookie_handle_set_cookie (struct cookie_jar *jar,
   /* Now store the cookie, or discard an existing cookie, if
      discarding was requested.  */
 
+  LOCK_JAR (jar);
   if (cookie->discard_requested)
     {
       discard_matching_cookie (jar, cookie);
+      UNLOCK_JAR (jar);
       goto out;
     }
 
   store_cookie (jar, cookie);
+  UNLOCK_JAR (jar);
   if (tmp != buf)
     xfree (tmp);
   return;
@@ -957,113 +1006,56 @@ cookie_matches_url (const struct cookie *cookie,
   return true;
 }
 
-/* A structure that points to a cookie, along with the additional
-   information about the cookie's "goodness".  This allows us to sort
-   the cookies when returning them to the server, as required by the
-   spec.  */
-
-struct weighed_cookie {
-  struct cookie *cookie;
-  int domain_goodness;
-  int path_goodness;
-};
-
-/* Comparator used for uniquifying the list. */
+/* Hash and compare cookies by name and value, for eliminating
+   duplicates.  */
 
-static int
-equality_comparator (const void *p1, const void *p2)
+static unsigned long
+cookie_pair_hash (const void *key)
 {
-  struct weighed_cookie *wc1 = (struct weighed_cookie *)p1;
-  struct weighed_cookie *wc2 = (struct weighed_cookie *)p2;
-
-  int namecmp  = strcmp (wc1->cookie->attr, wc2->cookie->attr);
-  int valuecmp = strcmp (wc1->cookie->value, wc2->cookie->value);
+  const struct cookie *c = key;
+  const char *p;
+  unsigned long h = 0;
 
-  /* We only really care whether both name and value are equal.  We
-     return them in this order only for consistency...  */
-  return namecmp ? namecmp : valuecmp;
+  for (p = c->attr; *p; p++)
+    h = (h << 5) - h + (unsigned char) *p;
+  for (p = c->value; *p; p++)
+    h = (h << 5) - h + (unsigned char) *p;
+  return h;
 }
 
-/* Eliminate duplicate cookies.  "Duplicate cookies" are any two
-   cookies with the same attr name and value.  Whenever a duplicate
-   pair is found, one of the cookies is removed.  */
-
 static int
-eliminate_dups (struct weighed_cookie *outgoing, int count)
+cookie_pair_cmp (const void *key1, const void *key2)
 {
-  struct weighed_cookie *h;     /* hare */
-  struct weighed_cookie *t;     /* tortoise */
-  struct weighed_cookie *end = outgoing + count;
-
-  /* We deploy a simple uniquify algorithm: first sort the array
-     according to our sort criteria, then copy it to itself, comparing
-     each cookie to its neighbor and ignoring the duplicates.  */
-
-  qsort (outgoing, count, sizeof (struct weighed_cookie), equality_comparator);
-
-  /* "Hare" runs through all the entries in the array, followed by
-     "tortoise".  If a duplicate is found, the hare skips it.
-     Non-duplicate entries are copied to the tortoise ptr.  */
-
-  for (h = t = outgoing; h < end; h++)
-    {
-      if (h != end - 1)
-        {
-          struct cookie *c0 = h[0].cookie;
-          struct cookie *c1 = h[1].cookie;
-          if (!strcmp (c0->attr, c1->attr) && !strcmp (c0->value, c1->value))
-            continue;           /* ignore the duplicate */
-        }
-
-      /* If the hare has advanced past the tortoise (because of
-         previous dups), make sure the values get copied.  Otherwise,
-         no copying is necessary.  */
-      if (h != t)
-        *t++ = *h;
-      else
-        t++;
-    }
-  return t - outgoing;
+  const struct cookie *c1 = key1, *c2 = key2;
+  return !strcmp (c1->attr, c2->attr) && !strcmp (c1->value, c2->value);
 }
 
-/* Comparator used for sorting by quality. */
+/* Build the Cookie header for HOST, PORT, PATH and SECFLAG from the
+   cookies in JAR, as described at cookie_header.
 
-static int
-goodness_comparator (const void *p1, const void *p2)
-{
-  struct weighed_cookie *wc1 = (struct weighed_cookie *)p1;
-  struct weighed_cookie *wc2 = (struct weighed_cookie *)p2;
-
-  /* Subtractions take `wc2' as the first argument becauase we want a
-     sort in *decreasing* order of goodness.  */
-  int dgdiff = wc2->domain_goodness - wc1->domain_goodness;
-  int pgdiff = wc2->path_goodness - wc1->path_goodness;
-
-  /* Sort by domain goodness; if these are the same, sort by path
-     goodness.  (The sorting order isn't really specified; maybe it
-     should be the other way around.)  */
-  return dgdiff ? dgdiff : pgdiff;
-}
+   The header is also valid for any other path in the directory DIR
+   (the first DIRLEN characters of PATH), unless a candidate cookie
+   has a path that extends past DIR, in which case *CACHEABLE is set
+   to false.  *EXPIRY is set to the earliest expiry time of the
+   cookies in the header, or to 0 if none expires.  */
 
-/* Generate a `Cookie' header for a request that goes to HOST:PORT and
-   requests PATH from the server.  The resulting string is allocated
-   with `malloc', and the caller is responsible for freeing it.  If no
-   cookies pertain to this request, i.e. no cookie header should be
-   generated, NULL is returned.  */
-
-char *
-cookie_header (struct cookie_jar *jar, const char *host,
-               int port, const char *path, bool secflag)
+static char *
+build_cookie_header (struct cookie_jar *jar, const char *host, int port,
+                     const char *path, size_t dirlen, bool secflag,
+                     bool *cacheable, time_t *expiry)
 {
   struct cookie *chains[32];
   int chain_count;
 
   struct cookie *cookie;
-  struct weighed_cookie *outgoing;
-  size_t count, i, ocnt;
-  char *result = NULL;
+  struct cookie **outgoing;
+  struct hash_table *seen = NULL;
+  size_t count, i;
+  char *result;
   int result_size, pos;
-  char pathbuf[1024];
+
+  *cacheable = true;
+  *expiry = 0;
 
   /* First, find the cookie chains whose domains match HOST. */
 
@@ -1079,25 +1071,6 @@ cookie_header (struct cookie_jar *jar, const char *host,
   if (chain_count <= 0)
     return NULL;
 
-  /* Wget's paths don't begin with '/' (blame rfc1808), but cookie
-     usage assumes /-prefixed paths.  Until the rest of Wget is fixed,
-     simply prepend slash to PATH.  */
-  {
-    char *tmp;
-    size_t pathlen = strlen(path);
-
-    if (pathlen < sizeof (pathbuf) - 1)
-      tmp = pathbuf;
-    else
-      tmp = xmalloc (pathlen + 2);
-
-    *tmp = '/';
-    memcpy (tmp + 1, path, pathlen + 1);
-    path = tmp;
-  }
-
-  cookies_now = time (NULL);
-
   /* Now extract from the chains those cookies that match our host
      (for domain_exact cookies), port (for cookies with port other
      than PORT_ANY), etc.  See matching_cookie for details.  */
@@ -1106,51 +1079,53 @@ cookie_header (struct cookie_jar *jar, const char *host,
   count = 0;
   for (i = 0; i < (unsigned) chain_count; i++)
     for (cookie = chains[i]; cookie; cookie = cookie->next)
-      if (cookie_matches_url (cookie, host, port, path, secflag, NULL))
-        ++count;
+      {
+        if (cookie_matches_url (cookie, host, port, path, secflag, NULL))
+          ++count;
+        if (strlen (cookie->path) > dirlen
+            && !strncmp (cookie->path, path, dirlen))
+          *cacheable = false;
+      }
   if (!count)
-    goto out;                /* no cookies matched */
+    return NULL;                /* no cookies matched */
 
   /* Allocate the array. */
-  if (count > SIZE_MAX / sizeof (struct weighed_cookie))
-    goto out;                /* unable to process so many cookies */
-  outgoing = xmalloc (count * sizeof (struct weighed_cookie));
-
-  /* Fill the array with all the matching cookies from the chains that
-     match HOST. */
-  ocnt = 0;
+  if (count > SIZE_MAX / sizeof (struct cookie *))
+    return NULL;                /* unable to process so many cookies */
+  outgoing = xmalloc (count * sizeof (struct cookie *));
+  if (count > 1)
+    seen = hash_table_new (count, cookie_pair_hash, cookie_pair_cmp);
+
+  /* Fill the array with the matching cookies.  The chains are ordered
+     from the most to the least specific domain, and each chain by
+     decreasing path length, so the best-matching cookies come first,
+     as required by the spec.  Of cookies with the same name and
+     value, only the first is sent.  */
+  count = 0;
   for (i = 0; i < (unsigned) chain_count; i++)
     for (cookie = chains[i]; cookie; cookie = cookie->next)
       {
-        int pg;
-        if (!cookie_matches_url (cookie, host, port, path, secflag, &pg))
+        if (!cookie_matches_url (cookie, host, port, path, secflag, NULL))
           continue;
-        outgoing[ocnt].cookie = cookie;
-        outgoing[ocnt].domain_goodness = strlen (cookie->domain);
-        outgoing[ocnt].path_goodness   = pg;
-        ++ocnt;
+        if (seen)
+          {
+            if (hash_table_contains (seen, cookie))
+              continue;
+            hash_table_put (seen, cookie, cookie);
+          }
+        outgoing[count++] = cookie;
+        if (cookie->expiry_time
+            && (!*expiry || cookie->expiry_time < *expiry))
+          *expiry = cookie->expiry_time;
       }
-  assert (ocnt == count);
-
-  /* Eliminate duplicate cookies; that is, those whose name and value
-     are the same.  */
-  count = eliminate_dups (outgoing, count);
-
-  if (count == 0)
-    {
-      xfree (outgoing);
-      goto out;
-    }
-
-  /* Sort the array so that best-matching domains come first, and
-     that, within one domain, best-matching paths come first. */
-  qsort (outgoing, count, sizeof (struct weighed_cookie), goodness_comparator);
+  if (seen)
+    hash_table_destroy (seen);
 
   /* Count the space the name=value pairs will take. */
   result_size = 0;
   for (i = 0; i < count; i++)
     {
-      struct cookie *c = outgoing[i].cookie;
+      struct cookie *c = outgoing[i];
       /* name=value */
       result_size += strlen (c->attr) + 1 + strlen (c->value);
     }
@@ -1164,7 +1139,7 @@ cookie_header (struct cookie_jar *jar, const char *host,
   pos = 0;
   for (i = 0; i < count; i++)
     {
-      struct cookie *c = outgoing[i].cookie;
+      struct cookie *c = outgoing[i];
       int namlen = strlen (c->attr);
       int vallen = strlen (c->value);
 
@@ -1183,11 +1158,107 @@ cookie_header (struct cookie_jar *jar, const char *host,
   xfree (outgoing);
   assert (pos == result_size);
 
-out:
-  if (path != pathbuf)
-    xfree (path);
+  return result;
+}
+
+/* The header cache maps "HOST:PORT:SECFLAG/DIR/" to a cached_header.
+   It is emptied when the jar changes, and when it grows past
+   HEADER_CACHE_MAX entries.  */
+
+#define HEADER_CACHE_MAX 1024
+
+struct cached_header {
+  char *header;                 /* the header, or NULL for none */
+  time_t expiry;                /* when a cookie in the header expires,
+                                   0 for never. */
+};
 
-return result;
+static void
+header_cache_flush (struct cookie_jar *jar)
+{
+  hash_table_iterator iter;
+  for (hash_table_iterate (jar->header_cache, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      struct cached_header *ch = iter.value;
+      xfree (ch->header);
+      xfree (ch);
+      xfree (iter.key);
+    }
+  hash_table_clear (jar->header_cache);
+  jar->cache_generation = jar->generation;
+}
+
+/* Generate a `Cookie' header for a request that goes to HOST:PORT and
+   requests PATH from the server.  The resulting string is allocated
+   with `malloc', and the caller is responsible for freeing it.  If no
+   cookies pertain to this request, i.e. no cookie header should be
+   generated, NULL is returned.  */
+
+char *
+cookie_header (struct cookie_jar *jar, const char *host,
+               int port, const char *path, bool secflag)
+{
+  char *result = NULL;
+  char *key, *cache_key, *slash, saved;
+  struct cached_header *ch;
+  bool cacheable;
+  time_t expiry;
+
+  /* Bail out quickly if there are no cookies in the jar.  */
+  if (!hash_table_count (jar->chains))
+    return NULL;
+
+  /* Wget's paths don't begin with '/' (blame rfc1808), but cookie
+     usage assumes /-prefixed paths.  Until the rest of Wget is fixed,
+     simply prepend slash to PATH.  The cache key is built in the same
+     buffer, in front of the path, and is looked up with the path
+     truncated after its last slash.  */
+  key = aprintf ("%s:%d:%d/%s", host, port, secflag, path);
+  path = strchr (key + strlen (host) + 1, '/');
+  slash = strrchr (path, '/');
+
+  LOCK_JAR (jar);
+  cookies_now = time (NULL);
+
+  if (jar->cache_generation != jar->generation)
+    header_cache_flush (jar);
+
+  /* Look up the directory part of the key. */
+  saved = slash[1];
+  slash[1] = '\0';
+  if (hash_table_get_pair (jar->header_cache, key, &cache_key, &ch))
+    {
+      if (!ch->expiry || ch->expiry >= cookies_now)
+        {
+          result = ch->header ? xstrdup (ch->header) : NULL;
+          goto out;
+        }
+      /* A cookie in the cached header has expired. */
+      hash_table_remove (jar->header_cache, key);
+      xfree (cache_key);
+      xfree (ch->header);
+      xfree (ch);
+    }
+  slash[1] = saved;
+
+  result = build_cookie_header (jar, host, port, path, slash + 1 - path,
+                                secflag, &cacheable, &expiry);
+
+  if (cacheable)
+    {
+      if (hash_table_count (jar->header_cache) >= HEADER_CACHE_MAX)
+        header_cache_flush (jar);
+      ch = xnew (struct cached_header);
+      ch->header = result ? xstrdup (result) : NULL;
+      ch->expiry = expiry;
+      hash_table_put (jar->header_cache, strdupdelim (key, slash + 1), ch);
+    }
+
+ out:
+  UNLOCK_JAR (jar);
+  xfree (key);
+  return result;
 }
 
 /* Support for loading and saving cookies.  The format used for
@@ -1449,6 +1520,11 @@ cookie_jar_delete (struct cookie_jar *jar)
         }
     }
   hash_table_destroy (jar->chains);
+  header_cache_flush (jar);
+  hash_table_destroy (jar->header_cache);
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_destroy (&jar->lock);
+#endif
   xfree (jar);
 
 #ifdef HAVE_LIBPSL
@@ -1543,3 +1619,70 @@ test_cookies (void)
     }
 }
 #endif /* TEST_COOKIES */
+
+#ifdef TESTING
+
+const char *
+test_cookie_header (void)
+{
+  struct cookie_jar *jar = cookie_jar_new ();
+  char *h;
+  int i;
+  static const struct {
+    const char *path;
+    const char *expected;
+  } tests[] = {
+    { "dir/page.html", "a=1; b=2; c=3" },
+    { "dir/other.html", "a=1; b=2; c=3" },
+    { "index.html", "b=2; c=3" },
+  };
+
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "index.html",
+                            "b=2");
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "dir/page.html",
+                            "a=1");
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "index.html",
+                            "c=3; domain=example.com");
+  /* Duplicate of b=2 in a less specific domain. */
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "index.html",
+                            "b=2; domain=example.com");
+
+  /* The second lookup of each path is served from the cache. */
+  for (i = 0; i < (int) (2 * countof (tests)); i++)
+    {
+      h = cookie_header (jar, "www.example.com", 80,
+                         tests[i % countof (tests)].path, false);
+      mu_assert ("test_cookie_header: wrong header",
+                 h && !strcmp (h, tests[i % countof (tests)].expected));
+      xfree (h);
+    }
+
+  /* Changing the jar invalidates the cache. */
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "dir/page.html",
+                            "a=9");
+  h = cookie_header (jar, "www.example.com", 80, "dir/page.html", false);
+  mu_assert ("test_cookie_header: stale header after change",
+             h && !strcmp (h, "a=9; b=2; c=3"));
+  xfree (h);
+
+  /* A cookie whose path extends into the file name applies to some
+     files in the directory only.  */
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "dir/page.html",
+                            "d=4; path=/dir/p");
+  h = cookie_header (jar, "www.example.com", 80, "dir/page.html", false);
+  mu_assert ("test_cookie_header: file-specific cookie missing",
+             h && !strcmp (h, "d=4; a=9; b=2; c=3"));
+  xfree (h);
+  h = cookie_header (jar, "www.example.com", 80, "dir/other.html", false);
+  mu_assert ("test_cookie_header: file-specific cookie sent",
+             h && !strcmp (h, "a=9; b=2; c=3"));
+  xfree (h);
+
+  h = cookie_header (jar, "www.example.org", 80, "dir/page.html", false);
+  mu_assert ("test_cookie_header: header for another host", h == NULL);
+
+  cookie_jar_delete (jar);
+  return NULL;
+}
+
+#endif /* TESTING */
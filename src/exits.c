@@ -33,7 +33,7 @@ static int final_exit_status = WGET_EXIT_SUCCESS;
    returned to retrieve_url's caller, but since it's very difficult to
    determine which do and which don't, I grab virtually all of them to
    be safe. */
-static int
+int
 get_status_for_err (uerr_t err)
 {
   switch (err)
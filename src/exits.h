@@ -41,6 +41,7 @@ enum
   };
 
 void inform_exit_status (uerr_t err);
+int get_status_for_err (uerr_t err);
 
 int get_exit_status (void);
 
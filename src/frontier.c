@@ -0,0 +1,1470 @@
+/* URL frontier and seen-set for recursive retrieval.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "frontier.h"
+#include "hash.h"
+#include "strpool.h"
+#include "utils.h"
+#include "init.h"               /* for ajoin_dir_file */
+#include "iri.h"
+
+#ifdef TESTING
+# include <tmpdir.h>
+# include "../tests/unit-tests.h"
+#endif
+
+/* The frontier is the queue of URLs that recursive retrieval has
+   discovered but not yet downloaded, and the seen-set (blacklist) is
+   the set of URLs that have ever been enqueued.
+
+   By default both live in memory.  When --frontier-dir is given,
+   they are kept in files in that directory instead, so that memory
+   use stays flat regardless of the size of the crawl, and a crawl
+   that was interrupted can be continued by running the same command
+   again:
+
+   - frontier.log is a sequential log of enqueued elements, one per
+     line.  Up to frontier_window elements at the head of the queue
+     and as many at its tail are held in memory, so a short queue
+     never touches the disk; only the elements between them are in
+     the log.  When the tail fills up, it is appended to the log in
+     one go, and when the head runs out, it is read back from there.
+     Once more than half of a large log has been consumed, the
+     pending part is copied to a fresh log (see spill_compact), so
+     the file does not grow with the whole crawl.
+
+   - frontier.pos holds the offset in frontier.log of the element
+     being processed as of the last checkpoint.  A checkpoint, taken
+     every FRONTIER_CHECKPOINT dequeues, every
+     FRONTIER_CHECKPOINT_SECS seconds, and when the crawl stops,
+     writes the elements held in memory to the log and then the
+     position.  A crawl that is killed resumes from the last
+     checkpoint: the URLs dequeued since are retrieved again, and
+     those enqueued since are lost, as seen.db already has them.
+
+   - seen.db is an on-disk hash table of seen URLs, pre-screened by
+     an in-memory Bloom filter that is rebuilt from the file when a
+     crawl is resumed.
+
+   The files are removed when the crawl runs to completion.
+
+   The in-memory queue is FIFO by default, which makes the crawl
+   breadth-first.  --frontier-order selects a priority order instead,
+   in which case the queue is a binary heap; see queue_rankers.  */
+
+#define FRONTIER_LOG  "frontier.log"
+#define FRONTIER_POS  "frontier.pos"
+#define SEEN_DB       "seen.db"
+
+/* The log is compacted when more than half of it, and at least this
+   many bytes, has been consumed.  */
+#define FRONTIER_COMPACT_MIN (64 * 1024 * 1024)
+
+/* Number of elements held in memory at each end of the on-disk
+   queue.  */
+#define FRONTIER_WINDOW 4096
+
+/* A checkpoint is taken after this many dequeues, or this many
+   seconds after the last one.  */
+#define FRONTIER_CHECKPOINT 1024
+#define FRONTIER_CHECKPOINT_SECS 10
+
+/* Variables so that the tests can exercise compaction, spilling and
+   checkpoints on a small log.  */
+static wgint frontier_compact_min = FRONTIER_COMPACT_MIN;
+static int frontier_window = FRONTIER_WINDOW;
+static int frontier_checkpoint = FRONTIER_CHECKPOINT;
+
+/* Functions for maintaining the URL queue.  */
+
+/* In memory, the URL and referer strings are interned (see strpool.c)
+   and therefore shared with the blacklist and with the download maps
+   in convert.c; they are never freed by the queue.  */
+
+struct queue_element {
+  const char *url;              /* the URL to download */
+  const char *referer;          /* the referring document */
+  int depth;                    /* the depth */
+  bool html_allowed;            /* whether the document is allowed to
+                                   be treated as HTML. */
+  struct iri *iri;                /* sXXXav */
+  bool css_allowed;             /* whether the document is allowed to
+                                   be treated as CSS. */
+  unsigned int rank[2];         /* priority, lowest first; unused in
+                                   FIFO order. */
+  unsigned long seq;            /* enqueue sequence number, breaking
+                                   ties between equal ranks. */
+  struct queue_element *next;   /* next element in queue */
+};
+
+/* Queue elements are allocated in slabs of this many elements, and
+   recycled through a free list when dequeued.  */
+#define QUEUE_SLAB_SIZE 256
+
+struct queue_slab {
+  struct queue_slab *next;
+  struct queue_element elements[QUEUE_SLAB_SIZE];
+};
+
+/* With --frontier-dir, the elements held in memory are kept as the
+   lines that stand for them in the log.  */
+
+struct spill_line {
+  char *text;                   /* the line, with its newline */
+  wgint offset;                 /* its offset in the log, or -1 if it
+                                   has not been written yet */
+  struct spill_line *next;
+};
+
+struct spill_list {
+  struct spill_line *first, *last;
+  int count;
+};
+
+struct url_queue {
+  struct queue_element *head;
+  struct queue_element *tail;
+  int count, maxcount;
+
+  struct queue_slab *slabs;         /* all slabs, for freeing. */
+  struct queue_element *free_list;  /* unused elements, linked through
+                                       their NEXT pointers. */
+
+  /* Used with a priority order only. */
+  void (*rank) (struct url_queue *, struct queue_element *);
+  struct queue_element **heap;  /* COUNT elements, HEAP_SIZE allocated */
+  int heap_size;
+  unsigned long seq;
+  struct hash_table *host_counts;   /* host -> URLs enqueued from it */
+
+  /* Used with --frontier-dir only. */
+  char *log_name, *pos_name;
+  FILE *log_out;                /* appends to the log */
+  FILE *log_in;                 /* reads the log */
+  FILE *pos_fp;
+  struct spill_list mem_head;   /* the first elements of the queue */
+  struct spill_list mem_tail;   /* the last elements, not written yet */
+  struct spill_line *current;   /* the element being processed */
+  char *line;                   /* a copy of CURRENT, which the strings
+                                   returned by url_dequeue point into */
+  size_t line_size;
+  wgint read_pos;               /* where the next element to read from
+                                   the log starts */
+  wgint log_end;                /* the size of the log */
+  wgint saved_pos;              /* the position of the last checkpoint */
+  int dequeues;                 /* dequeues since the last checkpoint */
+  time_t saved_time;            /* the time of the last checkpoint */
+};
+
+/* Return an unused element from QUEUE's free list, allocating a new
+   slab if the list is empty.  */
+
+static struct queue_element *
+queue_element_alloc (struct url_queue *queue)
+{
+  struct queue_element *qel;
+
+  if (!queue->free_list)
+    {
+      struct queue_slab *slab = xnew (struct queue_slab);
+      int i;
+
+      slab->next = queue->slabs;
+      queue->slabs = slab;
+      for (i = 0; i < QUEUE_SLAB_SIZE - 1; i++)
+        slab->elements[i].next = &slab->elements[i + 1];
+      slab->elements[QUEUE_SLAB_SIZE - 1].next = NULL;
+      queue->free_list = slab->elements;
+    }
+
+  qel = queue->free_list;
+  queue->free_list = qel->next;
+  return qel;
+}
+
+/* Return QEL to QUEUE's free list. */
+
+static void
+queue_element_release (struct url_queue *queue, struct queue_element *qel)
+{
+  qel->next = queue->free_list;
+  queue->free_list = qel;
+}
+
+/* Priority orders.  A ranker fills in the RANK of an element being
+   enqueued; elements with equal ranks are dequeued in the order they
+   were enqueued.  */
+
+/* --frontier-order=links: documents that are likely to contain links
+   come before those that may not, and leaf assets such as images
+   come last, so that the crawl discovers new URLs as early as
+   possible.  Within each class, shallower documents come first.  */
+
+static void
+rank_links (struct url_queue *queue _GL_UNUSED, struct queue_element *qel)
+{
+  const char *suf;
+
+  if (qel->css_allowed)
+    qel->rank[0] = 0;
+  else if (!qel->html_allowed)
+    qel->rank[0] = 2;
+  else
+    {
+      /* Links to HTML pages and to directories look the same as links
+         to tarballs, so also go by the name.  */
+      suf = suffix (qel->url);
+      qel->rank[0] = !suf || has_html_suffix_p (qel->url) ? 0 : 1;
+    }
+  qel->rank[1] = qel->depth;
+}
+
+/* --frontier-order=hosts: take URLs from each host in turn, so that
+   a host with many pending URLs does not starve the others.  The
+   rank is the number of URLs enqueued from the same host before.  */
+
+static void
+rank_hosts (struct url_queue *queue, struct queue_element *qel)
+{
+  const char *beg, *end;
+  char *host, *key;
+  void *count;
+
+  beg = strstr (qel->url, "://");
+  beg = beg ? beg + 3 : qel->url;
+  end = beg + strcspn (beg, "/?#");
+  host = strdupdelim (beg, end);
+
+  if (!queue->host_counts)
+    queue->host_counts = make_nocase_string_hash_table (0);
+  if (hash_table_get_pair (queue->host_counts, host, &key, &count))
+    xfree (host);
+  else
+    {
+      key = host;
+      count = NULL;
+    }
+  hash_table_put (queue->host_counts, key, (void *) ((uintptr_t) count + 1));
+
+  qel->rank[0] = (unsigned int) (uintptr_t) count;
+  qel->rank[1] = qel->depth;
+}
+
+/* Indexed by enum frontier_order; NULL means FIFO.  */
+static void (*const queue_rankers[]) (struct url_queue *,
+                                      struct queue_element *) = {
+  NULL,                         /* frontier_fifo */
+  rank_links,                   /* frontier_links */
+  rank_hosts,                   /* frontier_hosts */
+};
+
+static inline bool
+queue_element_before (const struct queue_element *a,
+                      const struct queue_element *b)
+{
+  if (a->rank[0] != b->rank[0])
+    return a->rank[0] < b->rank[0];
+  if (a->rank[1] != b->rank[1])
+    return a->rank[1] < b->rank[1];
+  return a->seq < b->seq;
+}
+
+/* Add QEL to the heap of QUEUE, which holds QUEUE->count - 1
+   elements before the call.  */
+
+static void
+heap_push (struct url_queue *queue, struct queue_element *qel)
+{
+  int pos = queue->count - 1;
+
+  if (pos >= queue->heap_size)
+    {
+      queue->heap_size = MAX (64, queue->heap_size * 2);
+      queue->heap = xrealloc (queue->heap,
+                              queue->heap_size * sizeof (*queue->heap));
+    }
+
+  while (pos > 0)
+    {
+      int parent = (pos - 1) / 2;
+      if (!queue_element_before (qel, queue->heap[parent]))
+        break;
+      queue->heap[pos] = queue->heap[parent];
+      pos = parent;
+    }
+  queue->heap[pos] = qel;
+}
+
+/* Remove and return the first element of the heap of QUEUE, which
+   holds QUEUE->count elements before the call.  */
+
+static struct queue_element *
+heap_pop (struct url_queue *queue)
+{
+  struct queue_element *top = queue->heap[0];
+  struct queue_element *last = queue->heap[queue->count - 1];
+  int n = queue->count - 1, pos = 0;
+
+  while (2 * pos + 1 < n)
+    {
+      int child = 2 * pos + 1;
+      if (child + 1 < n
+          && queue_element_before (queue->heap[child + 1],
+                                   queue->heap[child]))
+        child++;
+      if (!queue_element_before (queue->heap[child], last))
+        break;
+      queue->heap[pos] = queue->heap[child];
+      pos = child;
+    }
+  queue->heap[pos] = last;
+  return top;
+}
+
+/* Write POS, the offset of the element being processed, to the
+   position file, so that a restarted crawl begins with it.  */
+
+static void
+spill_save_position (struct url_queue *queue, wgint pos)
+{
+  /* Pad to a fixed width so that a shorter number does not leave
+     digits of a longer one behind.  */
+  rewind (queue->pos_fp);
+  fprintf (queue->pos_fp, "%20s\n", number_to_static_string (pos));
+  fflush (queue->pos_fp);
+}
+
+/* Open the spill files of QUEUE in DIR, resuming from an existing log
+   if there is one.  Returns false on error.  */
+
+static void url_queue_close_spill (struct url_queue *, bool);
+
+static bool
+spill_open (struct url_queue *queue, const char *dir)
+{
+  wgint pos = 0;
+
+  queue->log_name = ajoin_dir_file (dir, FRONTIER_LOG);
+  queue->pos_name = ajoin_dir_file (dir, FRONTIER_POS);
+
+  queue->log_out = fopen (queue->log_name, "ab");
+  queue->log_in = queue->log_out ? fopen (queue->log_name, "rb") : NULL;
+  if (!queue->log_in)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", queue->log_name, strerror (errno));
+      return false;
+    }
+
+  queue->pos_fp = fopen (queue->pos_name, "r+");
+  if (queue->pos_fp)
+    {
+      char buf[32];
+      if (fgets (buf, sizeof (buf), queue->pos_fp))
+        pos = MAX (0, str_to_wgint (buf, NULL, 10));
+    }
+  else
+    queue->pos_fp = fopen (queue->pos_name, "w+");
+  if (!queue->pos_fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", queue->pos_name, strerror (errno));
+      return false;
+    }
+
+  /* Count the elements still pending, so that the queue statistics
+     make sense for a resumed crawl.  */
+  if (fseeko (queue->log_in, pos, SEEK_SET) == 0)
+    {
+      int c;
+      while ((c = getc (queue->log_in)) != EOF)
+        if (c == '\n')
+          ++queue->count;
+      queue->log_end = ftello (queue->log_in);
+    }
+  if (queue->log_end < pos)
+    pos = queue->log_end = 0;
+  queue->maxcount = queue->count;
+  queue->read_pos = queue->saved_pos = pos;
+  queue->saved_time = time (NULL);
+
+  if (queue->count)
+    logprintf (LOG_VERBOSE,
+               _("Resuming crawl frontier in %s: %d URLs pending.\n"),
+               quote (dir), queue->count);
+  return true;
+}
+
+/* Create a URL queue.  With --frontier-dir the queue is kept on disk,
+   and picks up where a previous, interrupted crawl stopped.  */
+
+struct url_queue *
+url_queue_new (void)
+{
+  struct url_queue *queue = xnew0 (struct url_queue);
+
+  if (opt.frontier_dir)
+    {
+      bool ok;
+
+      /* make_directory fails with EEXIST on an existing directory,
+         which is the normal case when resuming.  */
+      if (make_directory (opt.frontier_dir) < 0 && errno != EEXIST)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", opt.frontier_dir,
+                     strerror (errno));
+          ok = false;
+        }
+      else
+        ok = spill_open (queue, opt.frontier_dir);
+
+      if (!ok)
+        {
+          logputs (LOG_NOTQUIET,
+                   _("Keeping the crawl frontier in memory instead.\n"));
+          url_queue_close_spill (queue, false);
+        }
+    }
+
+  if (opt.frontier_order != frontier_fifo)
+    {
+      if (queue->log_out)
+        logputs (LOG_VERBOSE, _("\
+The on-disk crawl frontier is always processed in FIFO order.\n"));
+      else
+        queue->rank = queue_rankers[opt.frontier_order];
+    }
+  return queue;
+}
+
+static void
+spill_line_free (struct spill_line *sl)
+{
+  xfree (sl->text);
+  xfree (sl);
+}
+
+static void
+spill_list_free (struct spill_list *list)
+{
+  while (list->first)
+    {
+      struct spill_line *sl = list->first;
+      list->first = sl->next;
+      spill_line_free (sl);
+    }
+  list->last = NULL;
+  list->count = 0;
+}
+
+static void spill_checkpoint (struct url_queue *);
+
+/* Close QUEUE's spill files.  When REMOVE is true, the crawl has
+   finished and the files are deleted; otherwise the elements held in
+   memory are written out first.  */
+
+static void
+url_queue_close_spill (struct url_queue *queue, bool remove)
+{
+  if (queue->pos_fp && !remove)
+    spill_checkpoint (queue);
+  spill_list_free (&queue->mem_head);
+  spill_list_free (&queue->mem_tail);
+  if (queue->current)
+    spill_line_free (queue->current);
+  queue->current = NULL;
+
+  if (queue->log_out)
+    fclose (queue->log_out);
+  if (queue->log_in)
+    fclose (queue->log_in);
+  if (queue->pos_fp)
+    fclose (queue->pos_fp);
+  queue->log_out = queue->log_in = queue->pos_fp = NULL;
+
+  if (remove && queue->log_name)
+    {
+      unlink (queue->log_name);
+      unlink (queue->pos_name);
+    }
+  xfree (queue->log_name);
+  xfree (queue->pos_name);
+  xfree (queue->line);
+  queue->line_size = 0;
+}
+
+/* Delete a URL queue.  Elements still in memory are freed.  With
+   --frontier-dir, the spill files are removed if FINISHED is true,
+   and otherwise kept so that the crawl can be resumed.  */
+
+void
+url_queue_delete (struct url_queue *queue, bool finished)
+{
+  struct queue_slab *slab;
+  struct queue_element *qel;
+
+  for (qel = queue->head; qel; qel = qel->next)
+    iri_free (qel->iri);
+  if (queue->heap)
+    {
+      int i;
+      for (i = 0; i < queue->count; i++)
+        iri_free (queue->heap[i]->iri);
+      xfree (queue->heap);
+    }
+  if (queue->host_counts)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (queue->host_counts, &iter);
+           hash_table_iter_next (&iter); )
+        xfree (iter.key);
+      hash_table_destroy (queue->host_counts);
+    }
+
+  url_queue_close_spill (queue, finished);
+
+  slab = queue->slabs;
+  while (slab)
+    {
+      struct queue_slab *next = slab->next;
+      xfree (slab);
+      slab = next;
+    }
+  xfree (queue);
+}
+
+#define STR_OR_DASH(s) ((s) && *(s) ? (s) : "-")
+
+/* Add SL at the end of LIST.  */
+
+static void
+spill_list_append (struct spill_list *list, struct spill_line *sl)
+{
+  sl->next = NULL;
+  if (list->last)
+    list->last->next = sl;
+  else
+    list->first = sl;
+  list->last = sl;
+  list->count++;
+}
+
+/* Write SL at the end of the log.  */
+
+static void
+spill_write_line (struct url_queue *queue, struct spill_line *sl)
+{
+  size_t len = strlen (sl->text);
+
+  sl->offset = queue->log_end;
+  fwrite (sl->text, 1, len, queue->log_out);
+  queue->log_end += len;
+}
+
+/* Write the elements of QUEUE held in memory to the log, in queue
+   order: the element being processed and the head, if they are not
+   in the log yet, and the tail.  The head and the element being
+   processed only ever are when the log has nothing pending, so they
+   still come before what it has.  */
+
+static void
+spill_write (struct url_queue *queue)
+{
+  struct spill_line *sl;
+  bool written = false;
+
+  if (queue->current && queue->current->offset < 0)
+    {
+      spill_write_line (queue, queue->current);
+      written = true;
+    }
+  if (queue->mem_head.first && queue->mem_head.first->offset < 0)
+    {
+      for (sl = queue->mem_head.first; sl; sl = sl->next)
+        spill_write_line (queue, sl);
+      written = true;
+    }
+  /* Those are in memory, so the log is read after them.  */
+  if (written)
+    queue->read_pos = queue->log_end;
+
+  while ((sl = queue->mem_tail.first))
+    {
+      queue->mem_tail.first = sl->next;
+      spill_write_line (queue, sl);
+      spill_line_free (sl);
+      written = true;
+    }
+  queue->mem_tail.last = NULL;
+  queue->mem_tail.count = 0;
+
+  if (written && fflush (queue->log_out) != 0)
+    logprintf (LOG_NOTQUIET, "%s: %s\n", queue->log_name, strerror (errno));
+}
+
+/* Write the elements held in memory to the log, and the position of
+   the element being processed to the position file.  */
+
+static void
+spill_checkpoint (struct url_queue *queue)
+{
+  wgint pos;
+
+  spill_write (queue);
+  if (queue->current)
+    pos = queue->current->offset;
+  else if (queue->mem_head.first)
+    pos = queue->mem_head.first->offset;
+  else
+    pos = queue->read_pos;
+
+  spill_save_position (queue, pos);
+  queue->saved_pos = pos;
+  queue->dequeues = 0;
+  queue->saved_time = time (NULL);
+}
+
+/* Add an element to the on-disk queue: to the head in memory while
+   the queue is short, and otherwise to the tail, which is written to
+   the log when it is full.  The URLs are in canonical form, in which
+   whitespace and control characters are escaped, so they cannot
+   contain the tab and newline separators.  */
+
+static void
+spill_enqueue (struct url_queue *queue, struct iri *i,
+               const char *url, const char *referer, int depth,
+               bool html_allowed, bool css_allowed)
+{
+  struct spill_line *sl = xnew (struct spill_line);
+  struct spill_list *head = &queue->mem_head;
+
+  sl->text = aprintf ("%d\t%d%d%d\t%s\t%s\t%s\t%s\n",
+                      depth, html_allowed, css_allowed,
+                      i ? i->utf8_encode : 0,
+                      STR_OR_DASH (i ? i->uri_encoding : NULL),
+                      STR_OR_DASH (i ? i->content_encoding : NULL),
+                      url, STR_OR_DASH (referer));
+  sl->offset = -1;
+  iri_free (i);
+
+  if (queue->read_pos == queue->log_end && !queue->mem_tail.count
+      && head->count < frontier_window
+      && (!head->first || head->first->offset < 0))
+    spill_list_append (head, sl);
+  else
+    {
+      spill_list_append (&queue->mem_tail, sl);
+      if (queue->mem_tail.count >= frontier_window)
+        spill_write (queue);
+    }
+}
+
+/* Copy the elements of QUEUE's log from the position of the last
+   checkpoint onwards to a new log, and replace the old one with it.
+   The head in memory must be empty.  On failure, the old log is
+   kept.  */
+
+static void
+spill_compact (struct url_queue *queue)
+{
+  char *tmp_name = aprintf ("%s.tmp", queue->log_name);
+  wgint pos = queue->saved_pos;
+  FILE *tmp = fopen (tmp_name, "wb");
+  FILE *log_out, *log_in;
+  char buf[8192];
+  size_t n;
+
+  if (!tmp || fseeko (queue->log_in, pos, SEEK_SET) != 0)
+    goto error;
+  while ((n = fread (buf, 1, sizeof (buf), queue->log_in)) > 0)
+    if (fwrite (buf, 1, n, tmp) != n)
+      break;
+  if (ferror (queue->log_in) | ferror (tmp) | (fclose (tmp) != 0))
+    {
+      tmp = NULL;
+      goto error;
+    }
+  tmp = NULL;
+
+  /* Reset the position before renaming: a crash in between leaves
+     the old log with position 0, which repeats elements that were
+     already processed instead of losing pending ones.  */
+  spill_save_position (queue, 0);
+  if (rename (tmp_name, queue->log_name) != 0)
+    {
+      spill_save_position (queue, pos);
+      goto error;
+    }
+  DEBUGP (("Compacted %s, dropping %s bytes.\n", queue->log_name,
+           number_to_static_string (pos)));
+
+  queue->saved_pos = 0;
+  queue->read_pos -= pos;
+  queue->log_end -= pos;
+  if (queue->current && queue->current->offset >= 0)
+    queue->current->offset -= pos;
+
+  log_out = fopen (queue->log_name, "ab");
+  log_in = log_out ? fopen (queue->log_name, "rb") : NULL;
+  if (!log_in)
+    {
+      /* The old streams still read and write the unlinked file, which
+         is better than nothing.  */
+      logprintf (LOG_NOTQUIET, "%s: %s\n", queue->log_name, strerror (errno));
+      if (log_out)
+        fclose (log_out);
+      xfree (tmp_name);
+      return;
+    }
+  fclose (queue->log_out);
+  fclose (queue->log_in);
+  queue->log_out = log_out;
+  queue->log_in = log_in;
+  xfree (tmp_name);
+  return;
+
+ error:
+  logprintf (LOG_NOTQUIET, "%s: %s\n", tmp_name, strerror (errno));
+  if (tmp)
+    fclose (tmp);
+  unlink (tmp_name);
+  xfree (tmp_name);
+  clearerr (queue->log_in);
+}
+
+/* Refill the empty head of QUEUE in memory: from the log if it has
+   elements pending, and otherwise from the tail.  */
+
+static void
+spill_refill (struct url_queue *queue)
+{
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+
+  if (queue->saved_pos >= frontier_compact_min
+      && queue->saved_pos > queue->log_end - queue->saved_pos)
+    {
+      spill_checkpoint (queue);
+      spill_compact (queue);
+    }
+
+  if (queue->read_pos == queue->log_end)
+    {
+      queue->mem_head = queue->mem_tail;
+      queue->mem_tail.first = queue->mem_tail.last = NULL;
+      queue->mem_tail.count = 0;
+      return;
+    }
+
+  /* spill_write has flushed everything written so far, but the
+     reading stream may have hit EOF before.  */
+  clearerr (queue->log_in);
+  if (fseeko (queue->log_in, queue->read_pos, SEEK_SET) != 0)
+    return;
+  while (queue->mem_head.count < frontier_window
+         && (len = getline (&line, &size, queue->log_in)) > 0)
+    {
+      struct spill_line *sl = xnew (struct spill_line);
+
+      sl->text = xstrdup (line);
+      sl->offset = queue->read_pos;
+      queue->read_pos += len;
+      spill_list_append (&queue->mem_head, sl);
+    }
+  xfree (line);
+}
+
+/* Take the next element of the on-disk queue.  The strings returned
+   point into QUEUE->line and remain valid until the next call.  */
+
+static bool
+spill_dequeue (struct url_queue *queue, struct iri **i,
+               const char **url, const char **referer, int *depth,
+               bool *html_allowed, bool *css_allowed)
+{
+  struct spill_line *sl;
+  char *fields[6], *p;
+  size_t len;
+  int n;
+
+  if (queue->current)
+    spill_line_free (queue->current);
+  queue->current = NULL;
+
+  if (!queue->mem_head.first)
+    spill_refill (queue);
+  sl = queue->mem_head.first;
+  if (!sl)
+    return false;
+  queue->mem_head.first = sl->next;
+  if (!sl->next)
+    queue->mem_head.last = NULL;
+  queue->mem_head.count--;
+  queue->current = sl;
+
+  len = strlen (sl->text);
+  if (queue->line_size < len + 1)
+    {
+      queue->line_size = len + 1;
+      queue->line = xrealloc (queue->line, queue->line_size);
+    }
+  memcpy (queue->line, sl->text, len + 1);
+  if (len && queue->line[len - 1] == '\n')
+    queue->line[len - 1] = '\0';
+
+  for (n = 0, p = queue->line; n < (int) countof (fields); n++)
+    {
+      fields[n] = p;
+      p = strchr (p, '\t');
+      if (!p)
+        break;
+      *p++ = '\0';
+    }
+  if (n != (int) countof (fields) - 1 || strlen (fields[1]) != 3)
+    {
+      logprintf (LOG_NOTQUIET, _("%s: corrupt entry at offset %s.\n"),
+                 queue->log_name, number_to_static_string (sl->offset));
+      return false;
+    }
+
+  if (++queue->dequeues >= frontier_checkpoint
+      || time (NULL) - queue->saved_time >= FRONTIER_CHECKPOINT_SECS)
+    spill_checkpoint (queue);
+
+  *depth = atoi (fields[0]);
+  *html_allowed = fields[1][0] == '1';
+  *css_allowed = fields[1][1] == '1';
+  *i = iri_new ();
+#ifdef ENABLE_IRI
+  (*i)->utf8_encode = fields[1][2] == '1';
+  xfree ((*i)->uri_encoding);
+  if (strcmp (fields[2], "-"))
+    (*i)->uri_encoding = xstrdup (fields[2]);
+  if (strcmp (fields[3], "-"))
+    (*i)->content_encoding = xstrdup (fields[3]);
+#endif
+  *url = fields[4];
+  *referer = strcmp (fields[5], "-") ? fields[5] : NULL;
+  return true;
+}
+
+/* Enqueue a URL in the queue.  Unless --frontier-order says otherwise,
+   the queue is FIFO: the items will be retrieved ("dequeued") from the
+   queue in the order they were placed into it.  The queue takes
+   ownership of I.  */
+
+void
+url_enqueue (struct url_queue *queue, struct iri *i,
+             const char *url, const char *referer, int depth,
+             bool html_allowed, bool css_allowed)
+{
+  struct queue_element *qel;
+
+  ++queue->count;
+  if (queue->count > queue->maxcount)
+    queue->maxcount = queue->count;
+
+  DEBUGP (("Enqueuing %s at depth %d\n",
+           quotearg_n_style (0, escape_quoting_style, url), depth));
+  DEBUGP (("Queue count %d, maxcount %d.\n", queue->count, queue->maxcount));
+
+  if (i)
+    DEBUGP (("[IRI Enqueuing %s with %s\n", quote_n (0, url),
+             i->uri_encoding ? quote_n (1, i->uri_encoding) : "None"));
+
+  if (queue->log_out)
+    {
+      spill_enqueue (queue, i, url, referer, depth, html_allowed,
+                     css_allowed);
+      return;
+    }
+
+  qel = queue_element_alloc (queue);
+  qel->iri = i;
+  qel->url = intern_string (url);
+  qel->referer = referer ? intern_string (referer) : NULL;
+  qel->depth = depth;
+  qel->html_allowed = html_allowed;
+  qel->css_allowed = css_allowed;
+  qel->next = NULL;
+
+  if (queue->rank)
+    {
+      qel->seq = queue->seq++;
+      queue->rank (queue, qel);
+      heap_push (queue, qel);
+      return;
+    }
+
+  if (queue->tail)
+    queue->tail->next = qel;
+  queue->tail = qel;
+
+  if (!queue->head)
+    queue->head = queue->tail;
+}
+
+/* Take a URL out of the queue.  Return true if this operation
+   succeeded, or false if the queue is empty.  The caller owns the
+   returned iri; the strings belong to the queue and remain valid
+   at least until the next call.  */
+
+bool
+url_dequeue (struct url_queue *queue, struct iri **i,
+             const char **url, const char **referer, int *depth,
+             bool *html_allowed, bool *css_allowed)
+{
+  struct queue_element *qel;
+
+  if (queue->log_in)
+    {
+      if (!spill_dequeue (queue, i, url, referer, depth,
+                          html_allowed, css_allowed))
+        {
+          queue->count = 0;
+          return false;
+        }
+      --queue->count;
+      DEBUGP (("Dequeuing %s at depth %d\n",
+               quotearg_n_style (0, escape_quoting_style, *url), *depth));
+      DEBUGP (("Queue count %d, maxcount %d.\n", queue->count,
+               queue->maxcount));
+      return true;
+    }
+
+  if (queue->rank)
+    qel = queue->count ? heap_pop (queue) : NULL;
+  else
+    {
+      qel = queue->head;
+      if (qel)
+        {
+          queue->head = qel->next;
+          if (!queue->head)
+            queue->tail = NULL;
+        }
+    }
+  if (!qel)
+    return false;
+
+  *i = qel->iri;
+  *url = qel->url;
+  *referer = qel->referer;
+  *depth = qel->depth;
+  *html_allowed = qel->html_allowed;
+  *css_allowed = qel->css_allowed;
+
+  --queue->count;
+
+  DEBUGP (("Dequeuing %s at depth %d\n",
+           quotearg_n_style (0, escape_quoting_style, qel->url), qel->depth));
+  DEBUGP (("Queue count %d, maxcount %d.\n", queue->count, queue->maxcount));
+
+  queue_element_release (queue, qel);
+  return true;
+}
+
+/* Functions for maintaining the seen-set.  */
+
+/* Bloom filter parameters: 2^27 bits (16 MiB) and 6 probes keep the
+   false positive rate around 1% for 10 million URLs.  A false
+   positive only costs a lookup in the on-disk set.  */
+#define BLOOM_BITS_LOG2 27
+#define BLOOM_PROBES 6
+
+/* Number of buckets of the on-disk hash table, and the size of its
+   header.  Records are chained from the buckets; with 2^22 buckets,
+   chains stay short for crawls of tens of millions of URLs.  */
+#define SEEN_BUCKETS_LOG2 22
+#define SEEN_MAGIC "WGSEEN01"
+#define SEEN_HEADER_SIZE (8 + ((wgint) 8 << SEEN_BUCKETS_LOG2))
+
+/* An on-disk record: the offset of the next record in the bucket
+   chain (0 for none), the hash of the string, its length, and the
+   string itself.  Integers are stored in host byte order; the file
+   is only meant to be read back on the same machine.  */
+struct seen_record {
+  uint64_t next;
+  uint64_t hash;
+  uint32_t len;
+};
+#define SEEN_RECORD_SIZE (8 + 8 + 4)
+
+struct seen_set {
+  struct hash_table *table;     /* in-memory set of interned strings */
+
+  FILE *fp;                     /* seen.db */
+  char *file_name;
+  unsigned char *bloom;
+  char *buf;                    /* for comparing stored strings */
+  size_t buf_size;
+  char *miss;                   /* the last string not found, which
+                                   callers usually add next */
+  size_t miss_size;
+  bool miss_valid;
+};
+
+/* 64-bit FNV-1a. */
+
+static uint64_t
+seen_hash (const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *s; s++)
+    {
+      h ^= (unsigned char) *s;
+      h *= 0x100000001b3ULL;
+    }
+  return h;
+}
+
+static void
+bloom_add (unsigned char *bloom, uint64_t hash)
+{
+  uint32_t h1 = (uint32_t) hash, h2 = (uint32_t) (hash >> 32) | 1;
+  int k;
+  for (k = 0; k < BLOOM_PROBES; k++)
+    {
+      uint32_t bit = (h1 + k * h2) & ((1u << BLOOM_BITS_LOG2) - 1);
+      bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static bool
+bloom_maybe_contains (const unsigned char *bloom, uint64_t hash)
+{
+  uint32_t h1 = (uint32_t) hash, h2 = (uint32_t) (hash >> 32) | 1;
+  int k;
+  for (k = 0; k < BLOOM_PROBES; k++)
+    {
+      uint32_t bit = (h1 + k * h2) & ((1u << BLOOM_BITS_LOG2) - 1);
+      if (!(bloom[bit >> 3] & (1 << (bit & 7))))
+        return false;
+    }
+  return true;
+}
+
+static bool
+seen_read_record (FILE *fp, wgint offset, struct seen_record *rec)
+{
+  return fseeko (fp, offset, SEEK_SET) == 0
+    && fread (&rec->next, 8, 1, fp) == 1
+    && fread (&rec->hash, 8, 1, fp) == 1
+    && fread (&rec->len, 4, 1, fp) == 1;
+}
+
+/* Create seen.db in DIR, or open the existing one and rebuild the
+   Bloom filter from its records.  */
+
+static bool
+seen_open (struct seen_set *set, const char *dir)
+{
+  char magic[8];
+  wgint offset;
+  struct seen_record rec;
+
+  set->file_name = ajoin_dir_file (dir, SEEN_DB);
+  set->bloom = xcalloc (1, (size_t) 1 << (BLOOM_BITS_LOG2 - 3));
+
+  set->fp = fopen (set->file_name, "r+b");
+  if (!set->fp)
+    {
+      static char zeros[64 * 1024];
+      wgint left = SEEN_HEADER_SIZE - 8;
+
+      set->fp = fopen (set->file_name, "w+b");
+      if (!set->fp)
+        goto error;
+      fwrite (SEEN_MAGIC, 8, 1, set->fp);
+      while (left > 0)
+        {
+          size_t chunk = MIN (left, (wgint) sizeof (zeros));
+          if (fwrite (zeros, 1, chunk, set->fp) != chunk)
+            goto error;
+          left -= chunk;
+        }
+      if (fflush (set->fp) != 0)
+        goto error;
+      return true;
+    }
+
+  if (fread (magic, 8, 1, set->fp) != 1 || memcmp (magic, SEEN_MAGIC, 8))
+    {
+      logprintf (LOG_NOTQUIET, _("%s: not a seen-URL database.\n"),
+                 set->file_name);
+      return false;
+    }
+
+  /* Records are stored back to back after the header. */
+  for (offset = SEEN_HEADER_SIZE; seen_read_record (set->fp, offset, &rec);
+       offset += SEEN_RECORD_SIZE + rec.len)
+    bloom_add (set->bloom, rec.hash);
+  return true;
+
+ error:
+  logprintf (LOG_NOTQUIET, "%s: %s\n", set->file_name, strerror (errno));
+  return false;
+}
+
+static void
+seen_close (struct seen_set *set, bool remove)
+{
+  if (set->fp)
+    fclose (set->fp);
+  set->fp = NULL;
+  if (remove && set->file_name)
+    unlink (set->file_name);
+  xfree (set->file_name);
+  xfree (set->bloom);
+  xfree (set->buf);
+  xfree (set->miss);
+}
+
+/* Return the offset of the bucket for HASH in the on-disk table. */
+
+static inline wgint
+seen_bucket (uint64_t hash)
+{
+  return 8 + 8 * (wgint) (hash & ((1u << SEEN_BUCKETS_LOG2) - 1));
+}
+
+/* Remember S as not being in SET, so that adding it right after the
+   lookup does not search its bucket chain again.  */
+
+static bool
+seen_disk_miss (struct seen_set *set, const char *s, size_t len)
+{
+  if (set->miss_size < len + 1)
+    {
+      set->miss_size = len + 1;
+      set->miss = xrealloc (set->miss, set->miss_size);
+    }
+  memcpy (set->miss, s, len + 1);
+  set->miss_valid = true;
+  return false;
+}
+
+static bool
+seen_disk_contains (struct seen_set *set, const char *s, uint64_t hash)
+{
+  uint64_t offset;
+  size_t len = strlen (s);
+  struct seen_record rec;
+
+  if (!bloom_maybe_contains (set->bloom, hash))
+    return seen_disk_miss (set, s, len);
+
+  if (fseeko (set->fp, seen_bucket (hash), SEEK_SET) != 0
+      || fread (&offset, 8, 1, set->fp) != 1)
+    return false;
+
+  for (; offset; offset = rec.next)
+    {
+      if (!seen_read_record (set->fp, offset, &rec))
+        return false;
+      if (rec.hash != hash || rec.len != len)
+        continue;
+      if (set->buf_size < len)
+        {
+          set->buf_size = len;
+          set->buf = xrealloc (set->buf, len);
+        }
+      if (fread (set->buf, 1, len, set->fp) == len
+          && !memcmp (set->buf, s, len))
+        return true;
+    }
+  return seen_disk_miss (set, s, len);
+}
+
+static void
+seen_disk_add (struct seen_set *set, const char *s, uint64_t hash)
+{
+  struct seen_record rec;
+  uint64_t offset;
+
+  /* The caller has normally just looked S up. */
+  if (!(set->miss_valid && !strcmp (set->miss, s))
+      && seen_disk_contains (set, s, hash))
+    return;
+  set->miss_valid = false;
+
+  if (fseeko (set->fp, seen_bucket (hash), SEEK_SET) != 0
+      || fread (&rec.next, 8, 1, set->fp) != 1
+      || fseeko (set->fp, 0, SEEK_END) != 0)
+    return;
+
+  offset = ftello (set->fp);
+  rec.hash = hash;
+  rec.len = strlen (s);
+  fwrite (&rec.next, 8, 1, set->fp);
+  fwrite (&rec.hash, 8, 1, set->fp);
+  fwrite (&rec.len, 4, 1, set->fp);
+  fwrite (s, 1, rec.len, set->fp);
+
+  /* Link the record only after it is complete, so that a crash in
+     between leaves at worst an unreachable record.  */
+  fseeko (set->fp, seen_bucket (hash), SEEK_SET);
+  fwrite (&offset, 8, 1, set->fp);
+  bloom_add (set->bloom, hash);
+}
+
+/* Create a seen-set, on disk if --frontier-dir is in effect. */
+
+struct seen_set *
+seen_set_new (void)
+{
+  struct seen_set *set = xnew0 (struct seen_set);
+
+  if (opt.frontier_dir && !seen_open (set, opt.frontier_dir))
+    {
+      logputs (LOG_NOTQUIET, _("Keeping the seen-URL set in memory instead.\n"));
+      seen_close (set, false);
+    }
+  if (!set->fp)
+    set->table = hash_table_new (0, NULL, NULL);
+  return set;
+}
+
+/* Add S to SET. */
+
+void
+seen_set_add (struct seen_set *set, const char *s)
+{
+  if (set->fp)
+    seen_disk_add (set, s, seen_hash (s));
+  else
+    hash_table_put (set->table, intern_string (s), "1");
+}
+
+/* Return true if S has been added to SET. */
+
+bool
+seen_set_contains (struct seen_set *set, const char *s)
+{
+  if (set->fp)
+    return seen_disk_contains (set, s, seen_hash (s));
+  else
+    {
+      const char *interned = find_interned_string (s);
+      return interned && hash_table_contains (set->table, interned);
+    }
+}
+
+/* Free SET.  If REMOVE is true, the crawl has finished and the
+   on-disk set is deleted.  */
+
+void
+seen_set_free (struct seen_set *set, bool remove)
+{
+  if (set->table)
+    hash_table_destroy (set->table);
+  seen_close (set, remove);
+  xfree (set);
+}
+
+#ifdef TESTING
+
+const char *
+test_url_queue_order (void)
+{
+  static const struct {
+    const char *url;
+    bool html_allowed, css_allowed;
+    int depth;
+  } input[] = {
+    { "http://a.example/logo.png", false, false, 1 },
+    { "http://a.example/big.tar.gz", true, false, 1 },
+    { "http://a.example/sub/", true, false, 2 },
+    { "http://a.example/style.css", false, true, 1 },
+    { "http://b.example/index.html", true, false, 1 },
+    { "http://a.example/page.html", true, false, 1 },
+  };
+  static const int links_order[] = { 3, 4, 5, 2, 1, 0 };
+  static const int hosts_order[] = { 0, 4, 1, 2, 3, 5 };
+  struct url_queue *queue;
+  const char *url, *referer;
+  struct iri *i;
+  int depth;
+  bool html_allowed, css_allowed;
+  unsigned j;
+
+  opt.frontier_order = frontier_links;
+  queue = url_queue_new ();
+  for (j = 0; j < countof (input); j++)
+    url_enqueue (queue, NULL, input[j].url, NULL, input[j].depth,
+                 input[j].html_allowed, input[j].css_allowed);
+  for (j = 0; j < countof (links_order); j++)
+    {
+      mu_assert ("test_url_queue_order: links queue drained early",
+                 url_dequeue (queue, &i, &url, &referer, &depth,
+                              &html_allowed, &css_allowed));
+      mu_assert ("test_url_queue_order: wrong links order",
+                 !strcmp (url, input[links_order[j]].url));
+    }
+  mu_assert ("test_url_queue_order: links queue not drained",
+             !url_dequeue (queue, &i, &url, &referer, &depth,
+                           &html_allowed, &css_allowed));
+  url_queue_delete (queue, true);
+
+  opt.frontier_order = frontier_hosts;
+  queue = url_queue_new ();
+  for (j = 0; j < countof (input); j++)
+    url_enqueue (queue, NULL, input[j].url, NULL, input[j].depth,
+                 input[j].html_allowed, input[j].css_allowed);
+  for (j = 0; j < 3; j++)
+    {
+      url_dequeue (queue, &i, &url, &referer, &depth,
+                   &html_allowed, &css_allowed);
+      mu_assert ("test_url_queue_order: wrong hosts order",
+                 !strcmp (url, input[hosts_order[j]].url));
+    }
+  /* Elements still queued are freed by url_queue_delete. */
+  url_queue_delete (queue, true);
+
+  opt.frontier_order = frontier_fifo;
+  return NULL;
+}
+
+const char *
+test_url_queue_disk (void)
+{
+  static const char *const urls[] = {
+    "http://a.example/", "http://a.example/one.html",
+    "http://a.example/two.html", "http://a.example/three.html",
+  };
+  static const char *const more[] = {
+    "http://a.example/four.html", "http://a.example/five.html",
+    "http://a.example/six.html",
+  };
+  char dir[100];
+  char *log_name;
+  struct url_queue *queue;
+  struct seen_set *seen;
+  const char *url, *referer;
+  struct iri *i;
+  int depth;
+  bool html_allowed, css_allowed;
+  struct stat st;
+  unsigned j;
+
+  mu_assert ("test_url_queue_disk: no temporary directory",
+             path_search (dir, sizeof (dir), NULL, "wget", true) == 0
+             && mkdtemp (dir));
+  opt.frontier_dir = dir;
+  log_name = ajoin_dir_file (dir, FRONTIER_LOG);
+
+  queue = url_queue_new ();
+  seen = seen_set_new ();
+  for (j = 0; j < countof (urls); j++)
+    {
+      mu_assert ("test_url_queue_disk: seen before enqueuing",
+                 !seen_set_contains (seen, urls[j]));
+      url_enqueue (queue, NULL, urls[j], j ? urls[0] : NULL, j != 0,
+                   true, false);
+      seen_set_add (seen, urls[j]);
+    }
+  mu_assert ("test_url_queue_disk: not seen after enqueuing",
+             seen_set_contains (seen, urls[2]));
+  mu_assert ("test_url_queue_disk: short queue written to the log",
+             stat (log_name, &st) == 0 && st.st_size == 0);
+
+  mu_assert ("test_url_queue_disk: queue empty",
+             url_dequeue (queue, &i, &url, &referer, &depth,
+                          &html_allowed, &css_allowed));
+  mu_assert ("test_url_queue_disk: wrong first element",
+             !strcmp (url, urls[0]) && !referer && depth == 0
+             && html_allowed && !css_allowed);
+  iri_free (i);
+  url_dequeue (queue, &i, &url, &referer, &depth,
+               &html_allowed, &css_allowed);
+  iri_free (i);
+
+  /* Interrupt the crawl while the second element is processed. */
+  url_queue_delete (queue, false);
+  seen_set_free (seen, false);
+
+  queue = url_queue_new ();
+  seen = seen_set_new ();
+  for (j = 0; j < countof (urls); j++)
+    mu_assert ("test_url_queue_disk: seen-set not resumed",
+               seen_set_contains (seen, urls[j]));
+  mu_assert ("test_url_queue_disk: unknown URL seen",
+             !seen_set_contains (seen, "http://a.example/four.html"));
+
+  /* Hold one element at each end of the queue, take a checkpoint on
+     every dequeue, and compact the log whenever the head runs out.
+     The new elements go through the tail and the log.  */
+  frontier_window = 1;
+  frontier_checkpoint = 1;
+  frontier_compact_min = 1;
+  for (j = 0; j < countof (more); j++)
+    url_enqueue (queue, NULL, more[j], urls[0], 2, true, false);
+  for (j = 1; j < countof (urls) + countof (more); j++)
+    {
+      const char *expected = j < countof (urls) ? urls[j]
+                             : more[j - countof (urls)];
+
+      mu_assert ("test_url_queue_disk: resumed queue empty",
+                 url_dequeue (queue, &i, &url, &referer, &depth,
+                              &html_allowed, &css_allowed));
+      mu_assert ("test_url_queue_disk: wrong resumed element",
+                 !strcmp (url, expected) && !strcmp (referer, urls[0])
+                 && depth == (j < countof (urls) ? 1 : 2));
+      iri_free (i);
+    }
+  mu_assert ("test_url_queue_disk: resumed queue not drained",
+             !url_dequeue (queue, &i, &url, &referer, &depth,
+                           &html_allowed, &css_allowed));
+  frontier_window = FRONTIER_WINDOW;
+  frontier_checkpoint = FRONTIER_CHECKPOINT;
+  frontier_compact_min = FRONTIER_COMPACT_MIN;
+  mu_assert ("test_url_queue_disk: log not compacted",
+             stat (log_name, &st) == 0
+             && st.st_size < (wgint) (strlen (more[2]) * 2 + 20));
+
+  url_queue_delete (queue, true);
+  seen_set_free (seen, true);
+  mu_assert ("test_url_queue_disk: files not removed",
+             stat (log_name, &st) != 0 && rmdir (dir) == 0);
+  xfree (log_name);
+  opt.frontier_dir = NULL;
+  return NULL;
+}
+
+#endif /* TESTING */
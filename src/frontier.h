@@ -0,0 +1,50 @@
+/* Declarations for frontier.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef FRONTIER_H
+#define FRONTIER_H
+
+struct iri;
+struct url_queue;
+struct seen_set;
+
+struct url_queue *url_queue_new (void);
+void url_queue_delete (struct url_queue *, bool);
+void url_enqueue (struct url_queue *, struct iri *, const char *,
+                  const char *, int, bool, bool);
+bool url_dequeue (struct url_queue *, struct iri **, const char **,
+                  const char **, int *, bool *, bool *);
+
+struct seen_set *seen_set_new (void);
+void seen_set_add (struct seen_set *, const char *);
+bool seen_set_contains (struct seen_set *, const char *);
+void seen_set_free (struct seen_set *, bool);
+
+#endif /* FRONTIER_H */
@@ -45,6 +45,36 @@ as that of the covered work.  */
 #include "c-strcase.h"
 
 
+/* Read a line of a response from FD, without the trailing CRLF.  */
+static char *
+ftp_response_line (int fd)
+{
+  char *p;
+  char *line = fd_read_line (fd);
+  if (!line)
+    return NULL;
+
+  /* Strip trailing CRLF before printing the line, so that
+     quoting doesn't include bogus \012 and \015. */
+  if ((p = strpbrk(line , "\r\n")))
+    *p = 0;
+
+  if (opt.server_response)
+    logprintf (LOG_NOTQUIET, "%s\n",
+               quotearg_style (escape_quoting_style, line));
+  else
+    DEBUGP (("%s\n", quotearg_style (escape_quoting_style, line)));
+  return line;
+}
+
+/* Whether LINE is the last one of a response.  */
+static bool
+ftp_last_line_p (const char *line)
+{
+  return (c_isdigit (line[0]) && c_isdigit (line[1]) && c_isdigit (line[2])
+          && line[3] == ' ');
+}
+
 /* Get the response of FTP server and allocate enough room to handle
    it.  <CR> and <LF> characters are stripped from the line, and the
    line is 0-terminated.  All the response lines but the last one are
@@ -59,25 +89,12 @@ ftp_response (int fd, char **ret_line)
 {
   for (;;)
     {
-      char *p;
-      char *line = fd_read_line (fd);
+      char *line = ftp_response_line (fd);
       if (!line)
         return FTPRERR;
 
-      /* Strip trailing CRLF before printing the line, so that
-         quoting doesn't include bogus \012 and \015. */
-      if ((p = strpbrk(line , "\r\n")))
-        *p = 0;
-
-      if (opt.server_response)
-        logprintf (LOG_NOTQUIET, "%s\n",
-                   quotearg_style (escape_quoting_style, line));
-      else
-        DEBUGP (("%s\n", quotearg_style (escape_quoting_style, line)));
-
       /* The last line of output is the one that begins with "ddd ". */
-      if (c_isdigit (line[0]) && c_isdigit (line[1]) && c_isdigit (line[2])
-          && line[3] == ' ')
+      if (ftp_last_line_p (line))
         {
           *ret_line = line;
           return FTPOK;
@@ -1153,6 +1170,76 @@ ftp_list (int csock, const char *file, bool avoid_list_a, bool avoid_list,
   return err;
 }
 
+/* Sends the MLSD command (RFC 3659) to the server.  */
+uerr_t
+ftp_mlsd (int csock)
+{
+  char *request, *respline;
+  int nwritten;
+  uerr_t err;
+
+  /* Send MLSD request.  */
+  request = ftp_request ("MLSD", NULL);
+  nwritten = fd_write (csock, request, strlen (request), -1);
+  if (nwritten < 0)
+    {
+      xfree (request);
+      return WRITEFAILED;
+    }
+  xfree (request);
+  /* Get appropriate response.  */
+  err = ftp_response (csock, &respline);
+  if (err != FTPOK)
+    return err;
+  if (*respline == '5')
+    err = FTPNSFOD;
+  else if (*respline != '1')
+    err = FTPRERR;
+  xfree (respline);
+  return err;
+}
+
+/* Sends the FEAT command (RFC 2389) to the server, and sets *MLSD if
+   the server supports MLSD, which RFC 3659 has it advertise as the
+   MLST feature.  Servers that do not know FEAT are not an error.  */
+uerr_t
+ftp_feat (int csock, bool *mlsd)
+{
+  char *request;
+  int nwritten;
+
+  *mlsd = false;
+
+  /* Send FEAT request.  */
+  request = ftp_request ("FEAT", NULL);
+  nwritten = fd_write (csock, request, strlen (request), -1);
+  if (nwritten < 0)
+    {
+      xfree (request);
+      return WRITEFAILED;
+    }
+  xfree (request);
+
+  /* The features are listed one per line, each after a space, between
+     the first and the last line of the response.  */
+  for (;;)
+    {
+      char *line = ftp_response_line (csock);
+      if (!line)
+        return FTPRERR;
+
+      if (line[0] == ' ' && !c_strncasecmp (line + 1, "MLST", 4)
+          && (line[5] == ' ' || line[5] == '\0'))
+        *mlsd = true;
+      if (ftp_last_line_p (line))
+        {
+          xfree (line);
+          return FTPOK;
+        }
+      xfree (line);
+    }
+}
+
 /* Sends the SYST command to the server. */
 uerr_t
 ftp_syst (int csock, enum stype *server_type, enum ustype *unix_type)
@@ -43,6 +43,10 @@ as that of the covered work.  */
 #include "retr.h"               /* for output_stream */
 #include "c-strcase.h"
 
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
+
 /* Converts symbolic permissions to number-style ones, e.g. string
    rwxr-xr-x to 755.  For now, it knows nothing of
    setuid/setgid/sticky.  ACLs are ignored.  */
@@ -1048,6 +1052,180 @@ Unsupported listing type, trying Unix listing parser.\n"));
     }
 }
 
+/* Return the number in the N digits at S.  */
+static int
+mlsd_number (const char *s, int n)
+{
+  int res = 0;
+  while (n--)
+    res = res * 10 + (*s++ - '0');
+  return res;
+}
+
+/* Return the time of a "modify" fact, YYYYMMDDHHMMSS[.sss] in UTC, or
+   -1 if VALUE is not such a time.  */
+static long
+mlsd_time (const char *value)
+{
+  struct tm t;
+  int i;
+
+  for (i = 0; i < 14; i++)
+    if (!c_isdigit (value[i]))
+      return -1;
+  if (value[14] != '\0' && value[14] != '.')
+    return -1;
+
+  xzero (t);
+  t.tm_year = mlsd_number (value, 4) - 1900;
+  t.tm_mon  = mlsd_number (value + 4, 2) - 1;
+  t.tm_mday = mlsd_number (value + 6, 2);
+  t.tm_hour = mlsd_number (value + 8, 2);
+  t.tm_min  = mlsd_number (value + 10, 2);
+  t.tm_sec  = mlsd_number (value + 12, 2);
+  return timegm (&t);
+}
+
+/* Convert the machine listing (the output of MLSD, RFC 3659) in FP to
+   a linked list of fileinfo entries.  Each line is a list of facts,
+   each "name=value;", then a space and the file name, which is taken
+   as is.  Sizes are exact and times are in UTC, so unlike the LIST
+   parsers this one needs neither the system type nor the current
+   date.  The entries of the listed directory and of its parent are
+   skipped.  */
+struct fileinfo *
+ftp_parse_mlsd_fp (FILE *fp)
+{
+  size_t bufsize = 0;
+  ssize_t len;
+  char *line = NULL;
+  struct fileinfo *dir, *l, cur;
+
+  dir = l = NULL;
+
+  while ((len = getline (&line, &bufsize, fp)) > 0)
+    {
+      char *fact, *name;
+      bool skip = false;
+
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+
+      name = strchr (line, ' ');
+      if (!name || !name[1])
+        continue;
+      *name++ = '\0';
+
+      xzero (cur);
+      cur.type = FT_UNKNOWN;
+      cur.tstamp = -1;
+      cur.ptype = TT_HOUR_MIN;
+      cur.perms = -1;
+
+      for (fact = line; *fact; )
+        {
+          char *value, *end = strchr (fact, ';');
+
+          if (!end)
+            break;
+          *end = '\0';
+          value = strchr (fact, '=');
+          if (value)
+            {
+              *value++ = '\0';
+              if (!c_strcasecmp (fact, "type"))
+                {
+                  if (!c_strcasecmp (value, "file"))
+                    cur.type = FT_PLAINFILE;
+                  else if (!c_strcasecmp (value, "dir"))
+                    cur.type = FT_DIRECTORY;
+                  else if (!c_strcasecmp (value, "cdir")
+                           || !c_strcasecmp (value, "pdir"))
+                    skip = true;
+                  else if (!c_strncasecmp (value, "OS.unix=slink:", 14)
+                           && value[14])
+                    {
+                      cur.type = FT_SYMLINK;
+                      xfree (cur.linkto);
+                      cur.linkto = xstrdup (value + 14);
+                    }
+                }
+              else if (!c_strcasecmp (fact, "size"))
+                {
+                  char *p;
+                  wgint size;
+
+                  errno = 0;
+                  size = str_to_wgint (value, &p, 10);
+                  if (!errno && p != value && !*p && size >= 0)
+                    cur.size = size;
+                }
+              else if (!c_strcasecmp (fact, "modify"))
+                cur.tstamp = mlsd_time (value);
+              else if (!c_strcasecmp (fact, "UNIX.mode"))
+                {
+                  char *p;
+                  long mode = strtol (value, &p, 8);
+                  if (p != value && !*p)
+                    cur.perms = mode & 07777;
+                }
+            }
+          fact = end + 1;
+        }
+
+      DEBUGP (("%s\n", name));
+      if (skip)
+        {
+          DEBUGP (("Skipping.\n"));
+          xfree (cur.linkto);
+          continue;
+        }
+      if (cur.type == FT_SYMLINK && cur.linkto)
+        DEBUGP (("link to: %s\n", cur.linkto));
+      if (cur.perms == -1)
+        cur.perms = cur.type == FT_DIRECTORY ? 0755 : 0644;
+      cur.name = xstrdup (name);
+
+      if (!dir)
+        {
+          l = dir = xnew (struct fileinfo);
+          memcpy (l, &cur, sizeof (cur));
+          l->prev = l->next = NULL;
+        }
+      else
+        {
+          cur.prev = l;
+          l->next = xnew (struct fileinfo);
+          l = l->next;
+          memcpy (l, &cur, sizeof (cur));
+          l->next = NULL;
+        }
+    }
+
+  xfree (line);
+  return dir;
+}
+
+/* Like ftp_parse_ls, for the output of MLSD.  */
+struct fileinfo *
+ftp_parse_mlsd (const char *file)
+{
+  FILE *fp;
+  struct fileinfo *fi;
+
+  fp = fopen (file, "rb");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return NULL;
+    }
+
+  fi = ftp_parse_mlsd_fp (fp);
+  fclose (fp);
+
+  return fi;
+}
+
 /* Stuff for creating FTP index. */
 
 /* The function creates an HTML index containing references to given
@@ -1173,3 +1351,46 @@ ftp_index (const char *file, struct url *u, struct fileinfo *f)
     fflush (fp);
   return FTPOK;
 }
+
+#ifdef TESTING
+const char *
+test_ftp_parse_mlsd (void)
+{
+  static const char listing[] =
+    "type=cdir;modify=20200101000000; .\r\n"
+    "type=pdir;modify=20200101000000; ..\r\n"
+    "type=file;size=1234;modify=20200102030405.250;UNIX.mode=0600; a file\r\n"
+    "Type=dir;Modify=20200101000000; sub\r\n"
+    "type=OS.unix=slink:target;modify=bogus; link\r\n"
+    "no-facts-no-name\r\n";
+  struct fileinfo *start, *f;
+  FILE *fp;
+
+  fp = fmemopen ((void *) listing, sizeof (listing) - 1, "r");
+  mu_assert ("cannot open the listing", fp != NULL);
+  start = ftp_parse_mlsd_fp (fp);
+  fclose (fp);
+
+  f = start;
+  mu_assert ("file missing", f && !strcmp (f->name, "a file"));
+  mu_assert ("wrong file type", f->type == FT_PLAINFILE);
+  mu_assert ("wrong file size", f->size == 1234);
+  mu_assert ("wrong file time", f->tstamp == 1577934245);
+  mu_assert ("wrong file mode", f->perms == 0600);
+
+  f = f->next;
+  mu_assert ("directory missing", f && !strcmp (f->name, "sub"));
+  mu_assert ("wrong directory type", f->type == FT_DIRECTORY);
+  mu_assert ("wrong directory mode", f->perms == 0755);
+
+  f = f->next;
+  mu_assert ("symlink missing", f && !strcmp (f->name, "link"));
+  mu_assert ("wrong symlink", f->type == FT_SYMLINK
+             && !strcmp (f->linkto, "target"));
+  mu_assert ("wrong symlink time", f->tstamp == -1);
+  mu_assert ("extra entries", f->next == NULL);
+
+  freefileinfo (start);
+  return NULL;
+}
+#endif /* TESTING */
@@ -42,6 +42,7 @@ as that of the covered work.  */
 #include "utils.h"
 #include "url.h"
 #include "retr.h"
+#include "stats.h"
 #include "ftp.h"
 #include "ssl.h"
 #include "connect.h"
@@ -54,6 +55,9 @@ as that of the covered work.  */
 #ifdef ENABLE_XATTR
 #include "xattr.h"
 #endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #ifdef __VMS
 # include "vms.h"
@@ -272,7 +276,11 @@ init_control_ssl_connection (int csock, struct url *u, bool *using_control_secur
     logputs (LOG_VERBOSE, "==> AUTH TLS ... ");
   if (opt.ftps_implicit || ftp_auth (csock, SCHEME_FTPS) == FTPOK)
     {
-      if (!ssl_connect_wget (csock, u->host, NULL))
+      double since = stats_time ();
+      bool connected = ssl_connect_wget (csock, u->host, NULL);
+
+      stats_phase (STATS_TLS, since);
+      if (!connected)
         {
           fd_close (csock);
           return CONSSLERR;
@@ -315,12 +323,12 @@ init_control_ssl_connection (int csock, struct url *u, bool *using_control_secur
 /* Retrieves a file with denoted parameters through opening an FTP
    connection to the server.  It always closes the data connection,
    and closes the control connection in case of error.  If warc_tmp
-   is non-NULL, the downloaded data will be written there as well.  */
+   is non-NULL, the downloaded data will be added to it as well.  */
 static uerr_t
 getftp (struct url *u, struct url *original_url,
         wgint passed_expected_bytes, wgint *qtyread,
         wgint restval, ccon *con, int count, wgint *last_expected_bytes,
-        FILE *warc_tmp)
+        struct warc_body *warc_tmp)
 {
   int csock, dtsock, local_sock, res;
   uerr_t err = RETROK;          /* appease the compiler */
@@ -336,6 +344,7 @@ getftp (struct url *u, struct url *original_url,
   char type_char;
   bool try_again;
   bool list_a_used = false;
+  bool mlsd = false;
 #ifdef HAVE_SSL
   enum prot_level prot = (opt.ftps_clear_data_connection ? PROT_CLEAR : PROT_PRIVATE);
   /* these variables tell whether the target server
@@ -644,6 +653,39 @@ Error in server response, closing control connection.\n"));
           break;
         }
 
+      /* Ask for the features of the server, to list directories with
+         MLSD if it can.  Machine listings do not depend on the system
+         type and give exact sizes and times.  */
+      con->st &= ~USE_MLSD;
+      if (!opt.server_response)
+        logprintf (LOG_VERBOSE, "==> FEAT ... ");
+      err = ftp_feat (csock, &mlsd);
+      switch (err)
+        {
+        case FTPRERR:
+          logputs (LOG_VERBOSE, "\n");
+          logputs (LOG_NOTQUIET, _("\
+Error in server response, closing control connection.\n"));
+          fd_close (csock);
+          con->csock = -1;
+          return err;
+        case WRITEFAILED:
+          logputs (LOG_VERBOSE, "\n");
+          logputs (LOG_NOTQUIET,
+                   _("Write failed, closing control connection.\n"));
+          fd_close (csock);
+          con->csock = -1;
+          return err;
+        case FTPOK:
+          if (mlsd)
+            con->st |= USE_MLSD;
+          break;
+        default:
+          abort ();
+        }
+      if (!opt.server_response)
+        logputs (LOG_VERBOSE, _("done.    "));
+
       /* Fourth: Find the initial ftp directory */
 
       if (!opt.server_response)
@@ -1320,12 +1362,29 @@ Error in server response, closing control connection.\n"));
 
   if (cmd & DO_LIST)
     {
-      if (!opt.server_response)
-        logputs (LOG_VERBOSE, "==> LIST ... ");
-      /* As Maciej W. Rozycki (macro@ds2.pg.gda.pl) says, `LIST'
-         without arguments is better than `LIST .'; confirmed by
-         RFC959.  */
-      err = ftp_list (csock, NULL, con->st&AVOID_LIST_A, con->st&AVOID_LIST, &list_a_used);
+      if (con->st & USE_MLSD)
+        {
+          if (!opt.server_response)
+            logputs (LOG_VERBOSE, "==> MLSD ... ");
+          err = ftp_mlsd (csock);
+          if (err == FTPNSFOD)
+            {
+              /* Use LIST for the rest of the session.  */
+              logputs (LOG_VERBOSE, "\n");
+              DEBUGP (("MLSD failed: falling back to LIST\n"));
+              con->st &= ~USE_MLSD;
+            }
+        }
+      if (!(con->st & USE_MLSD))
+        {
+          if (!opt.server_response)
+            logputs (LOG_VERBOSE, "==> LIST ... ");
+          /* As Maciej W. Rozycki (macro@ds2.pg.gda.pl) says, `LIST'
+             without arguments is better than `LIST .'; confirmed by
+             RFC959.  */
+          err = ftp_list (csock, NULL, con->st&AVOID_LIST_A,
+                          con->st&AVOID_LIST, &list_a_used);
+        }
 
       /* FTPRERR, WRITEFAILED */
       switch (err)
@@ -1543,6 +1602,8 @@ Error in server response, closing control connection.\n"));
 #ifdef HAVE_SSL
   if (u->scheme == SCHEME_FTPS && using_data_security)
     {
+      double since = stats_time ();
+
       /* We should try to restore the existing SSL session in the data connection
        * and fall back to establishing a new session if the server doesn't want to restore it.
        */
@@ -1561,6 +1622,7 @@ Error in server response, closing control connection.\n"));
         }
       else
         logputs (LOG_NOTQUIET, "Resuming SSL session in data connection.\n");
+      stats_phase (STATS_TLS, since);
 
       if (!ssl_check_certificate (dtsock, u->host))
         {
@@ -1583,7 +1645,7 @@ Error in server response, closing control connection.\n"));
 
   tms = datetime_str (time (NULL));
   tmrate = retr_rate (rd_size, con->dltime);
-  total_download_time += con->dltime;
+  add_download_totals (0, 0, con->dltime);
 
 #ifdef ENABLE_XATTR
   if (opt.enable_xattr)
@@ -1731,7 +1793,7 @@ Error in server response, closing control connection.\n"));
           ("LIST -a" is used to get also the hidden files)
 
           */
-      if (!(con->st & LIST_AFTER_LIST_A_CHECK_DONE))
+      if (!(con->st & (LIST_AFTER_LIST_A_CHECK_DONE | USE_MLSD)))
         {
           /* We still have to check "LIST" after the first "LIST -a" to see
              if with "LIST" we get more data than "LIST -a", that means
@@ -1836,7 +1898,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
 
   /* Declare WARC variables. */
   bool warc_enabled = (opt.warc_filename != NULL);
-  FILE *warc_tmp = NULL;
+  struct warc_body *warc_tmp = NULL;
   ip_address warc_ip_buf, *warc_ip = NULL;
   wgint last_expected_bytes = 0;
 
@@ -1887,6 +1949,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
     {
       /* Increment the pass counter.  */
       ++count;
+      stats_try ();
       sleep_between_retrievals (count);
       if (con->st & ON_YOUR_OWN)
         {
@@ -1910,12 +1973,10 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
         }
 
       /* For file RETR requests, we can write a WARC record.
-         We record the file contents to a temporary file. */
+         We collect the file contents in a record block. */
       if (warc_enabled && (con->cmd & DO_RETR) && warc_tmp == NULL)
         {
-          warc_tmp = warc_tempfile ();
-          if (warc_tmp == NULL)
-            return WARC_TMP_FOPENERR;
+          warc_tmp = warc_body_new ();
 
           if (!con->proxy && con->csock != -1)
             {
@@ -1967,7 +2028,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
         len = 0;
 
       /* If we are working on a WARC record, getftp should also write
-         to the warc_tmp file. */
+         to the warc_tmp record block. */
       err = getftp (u, original_url, len, &qtyread, restval, con, count,
                     &last_expected_bytes, warc_tmp);
 
@@ -1991,7 +2052,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
           /* Fatal errors, give up.  */
           if (warc_tmp != NULL)
             {
-              fclose (warc_tmp);
+              warc_body_free (warc_tmp);
               warc_tmp = NULL;
             }
           return err;
@@ -2067,12 +2128,12 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
           bool warc_res;
 
           warc_res = warc_write_resource_record (NULL, u->url, NULL, NULL,
-                                                  warc_ip, NULL, warc_tmp, -1);
+                                                  warc_ip, NULL, warc_tmp);
 
           if (! warc_res)
             return WARC_ERR;
 
-          /* warc_write_resource_record has also closed warc_tmp. */
+          /* warc_write_resource_record has also freed warc_tmp. */
           warc_tmp = NULL;
         }
 
@@ -2082,10 +2143,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
           if (!opt.remove_listing)
             /* --dont-remove-listing was specified, so do count this towards the
                number of bytes and files downloaded. */
-            {
-              total_downloaded_bytes += (qtyread - restval);
-              numurls++;
-            }
+            add_download_totals (1, qtyread - restval, 0);
 
           /* Deletion of listing files is not controlled by --delete-after, but
              by the more specific option --dont-remove-listing, and the code
@@ -2098,8 +2156,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
              downloaded if they're going to be deleted.  People seeding proxies,
              for instance, may want to know how many bytes and files they've
              downloaded through it. */
-          total_downloaded_bytes += (qtyread - restval);
-          numurls++;
+          add_download_totals (1, qtyread - restval, 0);
 
           if (opt.delete_after && !input_file_url (opt.input_filename))
             {
@@ -2122,7 +2179,7 @@ Removing file due to --delete-after in ftp_loop_internal():\n"));
 
       if (warc_tmp != NULL)
         {
-          fclose (warc_tmp);
+          warc_body_free (warc_tmp);
           warc_tmp = NULL;
         }
 
@@ -2136,7 +2193,7 @@ Removing file due to --delete-after in ftp_loop_internal():\n"));
     }
 
   if (warc_tmp != NULL)
-    fclose (warc_tmp);
+    warc_body_free (warc_tmp);
 
   return TRYLIMEXC;
 }
@@ -2173,7 +2230,10 @@ ftp_get_listing (struct url *u, struct url *original_url, ccon *con,
 
   if (err == RETROK)
     {
-      *f = ftp_parse_ls (lf, con->rs);
+      if (con->st & USE_MLSD)
+        *f = ftp_parse_mlsd (lf);
+      else
+        *f = ftp_parse_ls (lf, con->rs);
       if (opt.remove_listing)
         {
           if (unlink (lf))
@@ -2189,15 +2249,240 @@ ftp_get_listing (struct url *u, struct url *original_url, ccon *con,
   return err;
 }
 
+/* Return true if ERR ends the retrieval of a list of files.  */
+static bool
+ftp_fatal_error (uerr_t err)
+{
+  return (err == QUOTEXC || err == HOSTERR || err == FWRITEERR
+          || err == WARC_ERR || err == WARC_TMP_FOPENERR
+          || err == WARC_TMP_FWRITEERR);
+}
+
+/* Retrieve F, an entry of the listing of the directory of U.  If F is
+   a symbolic link, do not retrieve it, but rather try to set up a
+   similar link on the local disk, if the symlinks are supported.  The
+   caller sets up the commands of CON.  */
+static uerr_t
+ftp_retrieve_file (struct url *u, struct url *original_url,
+                   struct fileinfo *f, ccon *con)
+{
+  uerr_t err = RETROK;
+  char *old_target, *ofile;
+  wgint local_size;
+  time_t tml;
+  bool dlthis; /* Download this (file). */
+  const char *actual_target = NULL;
+  bool force_full_retrieve = false;
+
+  old_target = con->target;
+  ofile = xstrdup (u->file);
+  url_set_file (u, f->name);
+
+  con->target = url_file_name (u, NULL);
+
+  dlthis = true;
+  if (opt.timestamping && f->type == FT_PLAINFILE)
+    {
+      struct stat st;
+      /* If conversion of HTML files retrieved via FTP is ever implemented,
+         we'll need to stat() <file>.orig here when -K has been specified.
+         I'm not implementing it now since files on an FTP server are much
+         more likely than files on an HTTP server to legitimately have a
+         .orig suffix. */
+      if (!stat (con->target, &st))
+        {
+          bool eq_size;
+          bool cor_val;
+          /* Else, get it from the file.  */
+          local_size = st.st_size;
+          tml = st.st_mtime;
+#ifdef WINDOWS
+          /* Modification time granularity is 2 seconds for Windows, so
+             increase local time by 1 second for later comparison. */
+          tml++;
+#endif
+          /* Compare file sizes only for servers that tell us correct
+             values. Assume sizes being equal for servers that lie
+             about file size.  */
+          cor_val = ((con->st & USE_MLSD)
+                     || con->rs == ST_UNIX || con->rs == ST_WINNT);
+          eq_size = cor_val ? (local_size == f->size) : true;
+          if (f->tstamp <= tml && eq_size)
+            {
+              /* Remote file is older, file sizes can be compared and
+                 are both equal. */
+              logprintf (LOG_VERBOSE, _("\
+Remote file no newer than local file %s -- not retrieving.\n"), quote (con->target));
+              dlthis = false;
+            }
+          else if (f->tstamp > tml)
+            {
+              /* Remote file is newer */
+              force_full_retrieve = true;
+              logprintf (LOG_VERBOSE, _("\
+Remote file is newer than local file %s -- retrieving.\n\n"),
+                         quote (con->target));
+            }
+          else
+            {
+              /* Sizes do not match */
+              logprintf (LOG_VERBOSE, _("\
+The sizes do not match (local %s) -- retrieving.\n\n"),
+                         number_to_static_string (local_size));
+            }
+        }
+    }       /* opt.timestamping && f->type == FT_PLAINFILE */
+  switch (f->type)
+    {
+    case FT_SYMLINK:
+      /* If opt.retr_symlinks is defined, we treat symlinks as
+         if they were normal files.  There is currently no way
+         to distinguish whether they might be directories, and
+         follow them.  */
+      if (!opt.retr_symlinks)
+        {
+#ifdef HAVE_SYMLINK
+          if (!f->linkto)
+            logputs (LOG_NOTQUIET,
+                     _("Invalid name of the symlink, skipping.\n"));
+          else
+            {
+              struct stat st;
+              /* Check whether we already have the correct
+                 symbolic link.  */
+              int rc = lstat (con->target, &st);
+              if (rc == 0)
+                {
+                  size_t len = strlen (f->linkto) + 1;
+                  if (S_ISLNK (st.st_mode))
+                    {
+                      char buf[1024], *link_target;
+                      size_t n;
+                      bool res;
+
+                      if (len < sizeof (buf))
+                        link_target = buf;
+                      else
+                        link_target = xmalloc (len);
+
+                      n = readlink (con->target, link_target, len);
+                      res = (n == len - 1) && (memcmp (link_target, f->linkto, n) == 0);
+
+                      if (link_target != buf)
+                        xfree (link_target);
+
+                      if (res)
+                        {
+                          logprintf (LOG_VERBOSE, _("\
+Already have correct symlink %s -> %s\n\n"),
+                                     quote_n (0, con->target),
+                                     quote_n (1, f->linkto));
+                          dlthis = false;
+                          break;
+                        }
+                    }
+                }
+              logprintf (LOG_VERBOSE, _("Creating symlink %s -> %s\n"),
+                         quote_n (0, con->target), quote_n (1, f->linkto));
+              /* Unlink before creating symlink!  */
+              unlink (con->target);
+              if (symlink (f->linkto, con->target) == -1)
+                logprintf (LOG_NOTQUIET, "symlink: %s\n", strerror (errno));
+              logputs (LOG_VERBOSE, "\n");
+            } /* have f->linkto */
+#else  /* not HAVE_SYMLINK */
+          logprintf (LOG_NOTQUIET,
+                     _("Symlinks not supported, skipping symlink %s.\n"),
+                     quote (con->target));
+#endif /* not HAVE_SYMLINK */
+        }
+      else                /* opt.retr_symlinks */
+        {
+          if (dlthis)
+            {
+              err = ftp_loop_internal (u, original_url, f, con, NULL,
+                                       force_full_retrieve);
+            }
+        } /* opt.retr_symlinks */
+      break;
+    case FT_DIRECTORY:
+      if (!opt.recursive)
+        logprintf (LOG_NOTQUIET, _("Skipping directory %s.\n"),
+                   quote (f->name));
+      break;
+    case FT_PLAINFILE:
+      /* Call the retrieve loop.  */
+      if (dlthis)
+        {
+          err = ftp_loop_internal (u, original_url, f, con, NULL,
+                                   force_full_retrieve);
+        }
+      break;
+    case FT_UNKNOWN:
+    default:
+      logprintf (LOG_NOTQUIET, _("%s: unknown/unsupported file type.\n"),
+                 quote (f->name));
+      break;
+    }       /* switch */
+
+  /* 2004-12-15 SMS.
+   * Set permissions _before_ setting the times, as setting the
+   * permissions changes the modified-time, at least on VMS.
+   * Also, use the opt.output_document name here, too, as
+   * appropriate.  (Do the test once, and save the result.)
+   */
+
+  set_local_file (&actual_target, con->target);
+
+  /* If downloading a plain file, and the user requested it, then
+     set valid (non-zero) permissions. */
+  if (dlthis && (actual_target != NULL) &&
+   (f->type == FT_PLAINFILE) && opt.preserve_perm)
+    {
+      if (f->perms)
+        {
+          if (chmod (actual_target, f->perms))
+            logprintf (LOG_NOTQUIET,
+                       _("Failed to set permissions for %s.\n"),
+                       actual_target);
+        }
+      else
+        DEBUGP (("Unrecognized permissions for %s.\n", actual_target));
+    }
+
+  /* Set the time-stamp information to the local file.  Symlinks
+     are not to be stamped because it sets the stamp on the
+     original.  :( */
+  if (actual_target != NULL)
+    {
+      if (opt.useservertimestamps
+          && !(f->type == FT_SYMLINK && !opt.retr_symlinks)
+          && f->tstamp != -1
+          && dlthis
+          && file_exists_p (con->target, NULL))
+        {
+          touch (actual_target, f->tstamp);
+        }
+      else if (f->tstamp == -1)
+        logprintf (LOG_NOTQUIET, _("%s: corrupt time-stamp.\n"),
+                   actual_target);
+    }
+
+  xfree (con->target);
+  con->target = old_target;
+
+  url_set_file (u, ofile);
+  xfree (ofile);
+  return err;
+}
+
 static uerr_t ftp_retrieve_dirs (struct url *, struct url *,
                                  struct fileinfo *, ccon *);
 static uerr_t ftp_retrieve_glob (struct url *, struct url *, ccon *, int);
 static struct fileinfo *delelement (struct fileinfo **, struct fileinfo **);
 
-/* Retrieve a list of files given in struct fileinfo linked list.  If
-   a file is a symbolic link, do not retrieve it, but rather try to
-   set up a similar link on the local disk, if the symlinks are
-   supported.
+/* Retrieve a list of files given in struct fileinfo linked list,
+   calling ftp_retrieve_file on each.
 
    If opt.recursive is set, after all files have been retrieved,
    ftp_retrieve_dirs will be called to retrieve the directories.  */
@@ -2208,11 +2493,6 @@ ftp_retrieve_list (struct url *u, struct url *original_url,
   static int depth = 0;
   uerr_t err;
   struct fileinfo *orig;
-  wgint local_size;
-  time_t tml;
-  bool dlthis; /* Download this (file). */
-  const char *actual_target = NULL;
-  bool force_full_retrieve = false;
 
   /* Increase the depth.  */
   ++depth;
@@ -2243,219 +2523,15 @@ ftp_retrieve_list (struct url *u, struct url *original_url,
 
   while (f)
     {
-      char *old_target, *ofile;
-
       if (opt.quota && total_downloaded_bytes > opt.quota)
         {
           --depth;
           return QUOTEXC;
         }
-      old_target = con->target;
-
-      ofile = xstrdup (u->file);
-      url_set_file (u, f->name);
-
-      con->target = url_file_name (u, NULL);
-      err = RETROK;
-
-      dlthis = true;
-      if (opt.timestamping && f->type == FT_PLAINFILE)
-        {
-          struct stat st;
-          /* If conversion of HTML files retrieved via FTP is ever implemented,
-             we'll need to stat() <file>.orig here when -K has been specified.
-             I'm not implementing it now since files on an FTP server are much
-             more likely than files on an HTTP server to legitimately have a
-             .orig suffix. */
-          if (!stat (con->target, &st))
-            {
-              bool eq_size;
-              bool cor_val;
-              /* Else, get it from the file.  */
-              local_size = st.st_size;
-              tml = st.st_mtime;
-#ifdef WINDOWS
-              /* Modification time granularity is 2 seconds for Windows, so
-                 increase local time by 1 second for later comparison. */
-              tml++;
-#endif
-              /* Compare file sizes only for servers that tell us correct
-                 values. Assume sizes being equal for servers that lie
-                 about file size.  */
-              cor_val = (con->rs == ST_UNIX || con->rs == ST_WINNT);
-              eq_size = cor_val ? (local_size == f->size) : true;
-              if (f->tstamp <= tml && eq_size)
-                {
-                  /* Remote file is older, file sizes can be compared and
-                     are both equal. */
-                  logprintf (LOG_VERBOSE, _("\
-Remote file no newer than local file %s -- not retrieving.\n"), quote (con->target));
-                  dlthis = false;
-                }
-              else if (f->tstamp > tml)
-                {
-                  /* Remote file is newer */
-                  force_full_retrieve = true;
-                  logprintf (LOG_VERBOSE, _("\
-Remote file is newer than local file %s -- retrieving.\n\n"),
-                             quote (con->target));
-                }
-              else
-                {
-                  /* Sizes do not match */
-                  logprintf (LOG_VERBOSE, _("\
-The sizes do not match (local %s) -- retrieving.\n\n"),
-                             number_to_static_string (local_size));
-                }
-            }
-        }       /* opt.timestamping && f->type == FT_PLAINFILE */
-      switch (f->type)
-        {
-        case FT_SYMLINK:
-          /* If opt.retr_symlinks is defined, we treat symlinks as
-             if they were normal files.  There is currently no way
-             to distinguish whether they might be directories, and
-             follow them.  */
-          if (!opt.retr_symlinks)
-            {
-#ifdef HAVE_SYMLINK
-              if (!f->linkto)
-                logputs (LOG_NOTQUIET,
-                         _("Invalid name of the symlink, skipping.\n"));
-              else
-                {
-                  struct stat st;
-                  /* Check whether we already have the correct
-                     symbolic link.  */
-                  int rc = lstat (con->target, &st);
-                  if (rc == 0)
-                    {
-                      size_t len = strlen (f->linkto) + 1;
-                      if (S_ISLNK (st.st_mode))
-                        {
-                          char buf[1024], *link_target;
-                          size_t n;
-                          bool res;
-
-                          if (len < sizeof (buf))
-                            link_target = buf;
-                          else
-                            link_target = xmalloc (len);
-
-                          n = readlink (con->target, link_target, len);
-                          res = (n == len - 1) && (memcmp (link_target, f->linkto, n) == 0);
-
-                          if (link_target != buf)
-                            xfree (link_target);
-
-                          if (res)
-                            {
-                              logprintf (LOG_VERBOSE, _("\
-Already have correct symlink %s -> %s\n\n"),
-                                         quote_n (0, con->target),
-                                         quote_n (1, f->linkto));
-                              dlthis = false;
-                              break;
-                            }
-                        }
-                    }
-                  logprintf (LOG_VERBOSE, _("Creating symlink %s -> %s\n"),
-                             quote_n (0, con->target), quote_n (1, f->linkto));
-                  /* Unlink before creating symlink!  */
-                  unlink (con->target);
-                  if (symlink (f->linkto, con->target) == -1)
-                    logprintf (LOG_NOTQUIET, "symlink: %s\n", strerror (errno));
-                  logputs (LOG_VERBOSE, "\n");
-                } /* have f->linkto */
-#else  /* not HAVE_SYMLINK */
-              logprintf (LOG_NOTQUIET,
-                         _("Symlinks not supported, skipping symlink %s.\n"),
-                         quote (con->target));
-#endif /* not HAVE_SYMLINK */
-            }
-          else                /* opt.retr_symlinks */
-            {
-              if (dlthis)
-                {
-                  err = ftp_loop_internal (u, original_url, f, con, NULL,
-                                           force_full_retrieve);
-                }
-            } /* opt.retr_symlinks */
-          break;
-        case FT_DIRECTORY:
-          if (!opt.recursive)
-            logprintf (LOG_NOTQUIET, _("Skipping directory %s.\n"),
-                       quote (f->name));
-          break;
-        case FT_PLAINFILE:
-          /* Call the retrieve loop.  */
-          if (dlthis)
-            {
-              err = ftp_loop_internal (u, original_url, f, con, NULL,
-                                       force_full_retrieve);
-            }
-          break;
-        case FT_UNKNOWN:
-        default:
-          logprintf (LOG_NOTQUIET, _("%s: unknown/unsupported file type.\n"),
-                     quote (f->name));
-          break;
-        }       /* switch */
-
-
-      /* 2004-12-15 SMS.
-       * Set permissions _before_ setting the times, as setting the
-       * permissions changes the modified-time, at least on VMS.
-       * Also, use the opt.output_document name here, too, as
-       * appropriate.  (Do the test once, and save the result.)
-       */
-
-      set_local_file (&actual_target, con->target);
-
-      /* If downloading a plain file, and the user requested it, then
-         set valid (non-zero) permissions. */
-      if (dlthis && (actual_target != NULL) &&
-       (f->type == FT_PLAINFILE) && opt.preserve_perm)
-        {
-          if (f->perms)
-            {
-              if (chmod (actual_target, f->perms))
-                logprintf (LOG_NOTQUIET,
-                           _("Failed to set permissions for %s.\n"),
-                           actual_target);
-            }
-          else
-            DEBUGP (("Unrecognized permissions for %s.\n", actual_target));
-        }
-
-      /* Set the time-stamp information to the local file.  Symlinks
-         are not to be stamped because it sets the stamp on the
-         original.  :( */
-      if (actual_target != NULL)
-        {
-          if (opt.useservertimestamps
-              && !(f->type == FT_SYMLINK && !opt.retr_symlinks)
-              && f->tstamp != -1
-              && dlthis
-              && file_exists_p (con->target, NULL))
-            {
-              touch (actual_target, f->tstamp);
-            }
-          else if (f->tstamp == -1)
-            logprintf (LOG_NOTQUIET, _("%s: corrupt time-stamp.\n"),
-                       actual_target);
-        }
-
-      xfree (con->target);
-      con->target = old_target;
-
-      url_set_file (u, ofile);
-      xfree (ofile);
+      err = ftp_retrieve_file (u, original_url, f, con);
 
       /* Break on fatals.  */
-      if (err == QUOTEXC || err == HOSTERR || err == FWRITEERR
-          || err == WARC_ERR || err == WARC_TMP_FOPENERR
-          || err == WARC_TMP_FWRITEERR)
+      if (ftp_fatal_error (err))
         break;
       con->cmd &= ~ (DO_CWD | DO_LOGIN);
       f = f->next;
@@ -2472,6 +2548,29 @@ Already have correct symlink %s -> %s\n\n"),
   return err;
 }
 
+/* Return the directory NAME in DIR, relative to the initial directory
+   if DIR is.  */
+static char *
+ftp_compose_dir (const char *dir, const char *name)
+{
+  char *newdir;
+
+  if (*dir == '\0'
+      || (*dir == '/' && *(dir + 1) == '\0'))
+    /* If DIR is empty or just "/", simply append NAME to DIR.  (In
+       the former case, to preserve the directory being relative; in
+       the latter case, to avoid double slash.)  */
+    newdir = concat_strings (dir, name, (char *) 0);
+  else
+    /* Else, use a separator. */
+    newdir = concat_strings (dir, "/", name, (char *) 0);
+
+  DEBUGP (("Composing new CWD relative to the initial directory.\n"));
+  DEBUGP (("  odir = '%s'\n  f->name = '%s'\n  newdir = '%s'\n\n",
+           dir, name, newdir));
+  return newdir;
+}
+
 /* Retrieve the directories given in a file list.  This function works
    by simply going through the linked list and calling
    ftp_retrieve_glob on each directory entry.  The function knows
@@ -2480,13 +2579,8 @@ static uerr_t
 ftp_retrieve_dirs (struct url *u, struct url *original_url,
                    struct fileinfo *f, ccon *con)
 {
-  char buf[1024];
-  char *container = buf;
-  int container_size = sizeof (buf);
-
   for (; f; f = f->next)
     {
-      int size;
       char *odir, *newdir;
 
       if (opt.quota && total_downloaded_bytes > opt.quota)
@@ -2494,40 +2588,13 @@ ftp_retrieve_dirs (struct url *u, struct url *original_url,
       if (f->type != FT_DIRECTORY)
         continue;
 
-      /* Allocate u->dir off stack, but reallocate only if a larger
-         string is needed.  It's a pity there's no "realloca" for an
-         item on the bottom of the stack.  */
-      size = strlen (u->dir) + 1 + strlen (f->name) + 1;
-      if (size > container_size)
-        {
-          if (container == buf)
-            container = xmalloc (size);
-          else
-            container = xrealloc (container, size);
-
-          container_size = size;
-        }
-      newdir = container;
-
-      odir = u->dir;
-      if (*odir == '\0'
-          || (*odir == '/' && *(odir + 1) == '\0'))
-        /* If ODIR is empty or just "/", simply append f->name to
-           ODIR.  (In the former case, to preserve u->dir being
-           relative; in the latter case, to avoid double slash.)  */
-        sprintf (newdir, "%s%s", odir, f->name);
-      else
-        /* Else, use a separator. */
-        sprintf (newdir, "%s/%s", odir, f->name);
-
-      DEBUGP (("Composing new CWD relative to the initial directory.\n"));
-      DEBUGP (("  odir = '%s'\n  f->name = '%s'\n  newdir = '%s'\n\n",
-               odir, f->name, newdir));
+      newdir = ftp_compose_dir (u->dir, f->name);
       if (!accdir (newdir))
         {
           logprintf (LOG_VERBOSE, _("\
 Not descending to %s as it is excluded/not-included.\n"),
                      quote (newdir));
+          xfree (newdir);
           continue;
         }
 
@@ -2536,6 +2603,7 @@ Not descending to %s as it is excluded/not-included.\n"),
       odir = xstrdup (u->dir);  /* because url_set_dir will free
                                    u->dir. */
       url_set_dir (u, newdir);
+      xfree (newdir);
       ftp_retrieve_glob (u, original_url, con, GLOB_GETALL);
       url_set_dir (u, odir);
       xfree (odir);
@@ -2543,9 +2611,6 @@ Not descending to %s as it is excluded/not-included.\n"),
       /* Set the time-stamp?  */
     }
 
-  if (container != buf)
-    xfree (container);
-
   if (opt.quota && total_downloaded_bytes > opt.quota)
     return QUOTEXC;
   else
@@ -2588,27 +2653,15 @@ is_invalid_entry (struct fileinfo *f)
   return false;
 }
 
-/* A near-top-level function to retrieve the files in a directory.
-   The function calls ftp_get_listing, to get a linked list of files.
-   Then it weeds out the file names that do not match the pattern.
-   ftp_retrieve_list is called with this updated list as an argument.
-
-   If the argument ACTION is GLOB_GETONE, just download the file (but
-   first get the listing, so that the time-stamp is heeded); if it's
-   GLOB_GLOBALL, use globbing; if it's GLOB_GETALL, download the whole
-   directory.  */
+/* Weed out the entries of the listing START of the directory of U
+   that are not to be retrieved: those rejected by the accept/reject
+   rules, those with harmful names and, if U has a file name, those
+   that do not match it as ACTION tells.  On error, the whole listing
+   is freed.  */
 static uerr_t
-ftp_retrieve_glob (struct url *u, struct url *original_url,
-                   ccon *con, int action)
+ftp_filter_listing (struct url *u, struct fileinfo **start, int action)
 {
-  struct fileinfo *f, *start;
-  uerr_t res;
-
-  con->cmd |= LEAVE_PENDING;
-
-  res = ftp_get_listing (u, original_url, con, &start);
-  if (res != RETROK)
-    return res;
+  struct fileinfo *f;
 
   // Set the function used for glob matching.
   int (*matcher) (const char *, const char *, int)
@@ -2632,7 +2685,7 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
     = opt.ignore_case ? strcasecmp : strcmp;
 #endif /* def __VMS [else] */
 
-  f = start;
+  f = *start;
   while (f)
     {
 
@@ -2643,7 +2696,7 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
         {
           logprintf (LOG_VERBOSE, _("Rejecting %s.\n"),
                      quote (f->name));
-          f = delelement (&f, &start);
+          f = delelement (&f, start);
           continue;
         }
 
@@ -2653,7 +2706,7 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
         {
           logprintf (LOG_VERBOSE, _("Rejecting %s (Invalid Entry).\n"),
                      quote (f->name));
-          f = delelement (&f, &start);
+          f = delelement (&f, start);
           continue;
         }
 
@@ -2673,7 +2726,7 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
           if (!accept_url (url))
             {
               logprintf (LOG_VERBOSE, _ ("%s is excluded/not-included through regex.\n"), url);
-              f = delelement (&f, &start);
+              f = delelement (&f, start);
               if (url != buf)
                 xfree(url);
               continue;
@@ -2695,12 +2748,13 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
                   logprintf (LOG_NOTQUIET, _("Error matching %s against %s: %s\n"),
                              u->file, quotearg_style (escape_quoting_style, f->name),
                              strerror (errno));
-                  freefileinfo (start);
+                  freefileinfo (*start);
+                  *start = NULL;
                   return RETRBADPATTERN;
                 }
               if (matchres == FNM_NOMATCH)
                 {
-                  f = delelement (&f, &start); /* delete the element from the list */
+                  f = delelement (&f, start); /* delete the element from the list */
                   continue;
                 }
             }
@@ -2708,13 +2762,41 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
             {
               if (0 != cmp(u->file, f->name))
                 {
-                  f = delelement (&f, &start);
+                  f = delelement (&f, start);
                   continue;
                 }
             }
         }
       f = f->next;
     }
+  return RETROK;
+}
+
+/* A near-top-level function to retrieve the files in a directory.
+   The function calls ftp_get_listing, to get a linked list of files.
+   Then it weeds out the file names that do not match the pattern.
+   ftp_retrieve_list is called with this updated list as an argument.
+
+   If the argument ACTION is GLOB_GETONE, just download the file (but
+   first get the listing, so that the time-stamp is heeded); if it's
+   GLOB_GLOBALL, use globbing; if it's GLOB_GETALL, download the whole
+   directory.  */
+static uerr_t
+ftp_retrieve_glob (struct url *u, struct url *original_url,
+                   ccon *con, int action)
+{
+  struct fileinfo *start;
+  uerr_t res;
+
+  con->cmd |= LEAVE_PENDING;
+
+  res = ftp_get_listing (u, original_url, con, &start);
+  if (res != RETROK)
+    return res;
+
+  res = ftp_filter_listing (u, &start, action);
+  if (res != RETROK)
+    return res;
 
   /*
    * Now that preprocessing of the file listing is over, let's try to download
@@ -2755,6 +2837,389 @@ ftp_retrieve_glob (struct url *u, struct url *original_url,
     return res;
 }
 
+#ifdef HAVE_PTHREAD_H
+
+/* Recursive and globbing retrieval over several connections.
+
+   When --connections is greater than one, the listings and files of a
+   recursive or globbing retrieval are spread over that many control
+   connections to the server.  Each connection logs in once, is driven
+   by a worker thread of its own and stays open for the whole
+   retrieval.  The workers share a queue of jobs, each either listing a
+   directory or retrieving one file.  A listing job queues the files of
+   the directory and then, if recursing, its subdirectories, so that
+   the files of a directory are taken before anything below it, as
+   ftp_retrieve_list does.
+
+   Listings go through ftp_filter_listing and files through
+   ftp_retrieve_file, so that the accept/reject rules, time-stamping,
+   symbolic links and permissions are handled exactly as over a single
+   connection.  A worker only sends CWD when its next job is in another
+   directory than its last one.  */
+
+enum ftp_job_type {
+  FTP_JOB_LIST,                 /* list DIR and queue what is found */
+  FTP_JOB_FILE                  /* retrieve F from DIR */
+};
+
+struct ftp_job {
+  enum ftp_job_type type;
+  char *dir;                    /* directory of the job, unquoted */
+  int depth;                    /* recursion depth of DIR, 1 at the top */
+  int action;                   /* GLOB_* for a listing */
+  struct fileinfo *f;           /* the file to retrieve */
+  struct ftp_job *next;
+};
+
+struct ftp_pool {
+  struct ftp_job *head, *tail;  /* jobs waiting for a worker */
+  int busy;                     /* workers running a job */
+  bool stop;                    /* a fatal error ends the retrieval */
+  uerr_t err;                   /* result of the retrieval */
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* signaled when the queue changes */
+};
+
+struct ftp_worker {
+  struct ftp_pool *pool;
+  struct url *u;                /* the URL, moved to the job's directory */
+  struct url *original_url;     /* U if the original URL is the URL */
+  ccon con;
+  char *cwd;                    /* directory of the last job */
+  pthread_t thread;
+};
+
+static char *
+xstrdup_null (const char *s)
+{
+  return s ? xstrdup (s) : NULL;
+}
+
+static struct url *
+ftp_url_dup (const struct url *u)
+{
+  struct url *copy = xnew0 (struct url);
+
+  copy->url = xstrdup (u->url);
+  copy->scheme = u->scheme;
+  copy->host = xstrdup (u->host);
+  copy->port = u->port;
+  copy->path = xstrdup (u->path);
+  copy->params = xstrdup_null (u->params);
+  copy->query = xstrdup_null (u->query);
+  copy->fragment = xstrdup_null (u->fragment);
+  copy->dir = xstrdup (u->dir);
+  copy->file = xstrdup (u->file);
+  copy->user = xstrdup_null (u->user);
+  copy->passwd = xstrdup_null (u->passwd);
+  return copy;
+}
+
+static struct fileinfo *
+ftp_fileinfo_dup (const struct fileinfo *f)
+{
+  struct fileinfo *copy = xmemdup (f, sizeof *f);
+
+  copy->name = xstrdup (f->name);
+  copy->linkto = xstrdup_null (f->linkto);
+  copy->prev = copy->next = NULL;
+  return copy;
+}
+
+/* Queue a job of TYPE in directory DIR.  */
+
+static void
+ftp_pool_add (struct ftp_pool *pool, enum ftp_job_type type,
+              const char *dir, int depth, int action, struct fileinfo *f)
+{
+  struct ftp_job *job = xnew0 (struct ftp_job);
+
+  job->type = type;
+  job->dir = xstrdup (dir);
+  job->depth = depth;
+  job->action = action;
+  job->f = f;
+
+  pthread_mutex_lock (&pool->lock);
+  if (pool->tail)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  pthread_cond_signal (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Make ERR the result of the retrieval, unless an earlier error is.
+   A fatal error also makes the workers stop.  */
+
+static void
+ftp_pool_fail (struct ftp_pool *pool, uerr_t err, bool fatal)
+{
+  pthread_mutex_lock (&pool->lock);
+  if (!pool->stop && (fatal || pool->err == RETROK))
+    pool->err = err;
+  if (fatal)
+    {
+      pool->stop = true;
+      pthread_cond_broadcast (&pool->cond);
+    }
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Set up the connection of W for a job in directory DIR.  */
+
+static void
+ftp_worker_enter (struct ftp_worker *w, const char *dir)
+{
+  ccon *con = &w->con;
+
+  if (!w->cwd || strcmp (w->cwd, dir))
+    {
+      /* An empty directory is the initial one, which getftp does not
+         CWD to.  Log in again to get back there.  */
+      if (!*dir && w->cwd && con->csock != -1)
+        {
+          fd_close (con->csock);
+          con->csock = -1;
+        }
+      con->st &= ~DONE_CWD;
+      xfree (w->cwd);
+      w->cwd = xstrdup (dir);
+      url_set_dir (w->u, dir);
+    }
+
+  con->st &= ~ON_YOUR_OWN;
+  if (!(con->st & DONE_CWD))
+    con->cmd |= DO_CWD;
+  else
+    con->cmd &= ~DO_CWD;
+  if (con->csock < 0)
+    con->cmd |= DO_LOGIN;
+  else
+    con->cmd &= ~DO_LOGIN;
+  con->cmd |= LEAVE_PENDING;
+}
+
+/* List the directory of JOB and queue its entries.  */
+
+static void
+ftp_worker_list (struct ftp_worker *w, struct ftp_job *job)
+{
+  struct ftp_pool *pool = w->pool;
+  struct fileinfo *start, *f;
+  uerr_t err;
+
+  ftp_worker_enter (w, job->dir);
+  err = ftp_get_listing (w->u, w->original_url, &w->con, &start);
+  if (err == RETROK)
+    err = ftp_filter_listing (w->u, &start, job->action);
+  if (err != RETROK)
+    {
+      /* As with ftp_retrieve_dirs, only the top directory counts.  */
+      if (job->depth == 1)
+        ftp_pool_fail (pool, err, false);
+      return;
+    }
+
+  if (!start)
+    {
+      if (job->action == GLOB_GLOBALL)
+        logprintf (LOG_VERBOSE, _("No matches on pattern %s.\n"),
+                   quote (w->u->file));
+      else if (job->action == GLOB_GETONE)
+        {
+          /* Let's try retrieving it anyway.  */
+          w->con.st |= ON_YOUR_OWN;
+          err = ftp_loop_internal (w->u, w->original_url, NULL, &w->con,
+                                   NULL, false);
+          if (err != RETROK)
+            ftp_pool_fail (pool, err, ftp_fatal_error (err));
+        }
+      return;
+    }
+
+  for (f = start; f; f = f->next)
+    if (!(f->type == FT_DIRECTORY && opt.recursive))
+      ftp_pool_add (pool, FTP_JOB_FILE, job->dir, job->depth, 0,
+                    ftp_fileinfo_dup (f));
+
+  if (opt.recursive
+      && !(opt.reclevel != INFINITE_RECURSION && job->depth >= opt.reclevel))
+    {
+      for (f = start; f; f = f->next)
+        {
+          char *newdir;
+
+          if (f->type != FT_DIRECTORY)
+            continue;
+          newdir = ftp_compose_dir (job->dir, f->name);
+          if (accdir (newdir))
+            ftp_pool_add (pool, FTP_JOB_LIST, newdir, job->depth + 1,
+                          GLOB_GETALL, NULL);
+          else
+            logprintf (LOG_VERBOSE, _("\
+Not descending to %s as it is excluded/not-included.\n"),
+                       quote (newdir));
+          xfree (newdir);
+        }
+    }
+  else if (opt.recursive)
+    DEBUGP ((_("Will not retrieve dirs since depth is %d (max %d).\n"),
+             job->depth, opt.reclevel));
+  freefileinfo (start);
+}
+
+/* Retrieve the file of JOB.  */
+
+static void
+ftp_worker_file (struct ftp_worker *w, struct ftp_job *job)
+{
+  uerr_t err;
+
+  ftp_worker_enter (w, job->dir);
+  w->con.cmd |= DO_RETR;
+  err = ftp_retrieve_file (w->u, w->original_url, job->f, &w->con);
+  w->con.cmd &= ~DO_RETR;
+
+  /* A file that fails does not fail a recursive retrieval, as in
+     ftp_retrieve_list.  */
+  if (ftp_fatal_error (err))
+    ftp_pool_fail (w->pool, err, true);
+  else if (err != RETROK && !opt.recursive)
+    ftp_pool_fail (w->pool, err, false);
+}
+
+static void *
+ftp_worker_run (void *arg)
+{
+  struct ftp_worker *w = arg;
+  struct ftp_pool *pool = w->pool;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      struct ftp_job *job = pool->stop ? NULL : pool->head;
+
+      if (!job)
+        {
+          /* Done when nobody is left to queue more jobs.  */
+          if (pool->stop || !pool->busy)
+            break;
+          pthread_cond_wait (&pool->cond, &pool->lock);
+          continue;
+        }
+      pool->head = job->next;
+      if (!pool->head)
+        pool->tail = NULL;
+      pool->busy++;
+      pthread_mutex_unlock (&pool->lock);
+
+      if (opt.quota && total_downloaded_bytes > opt.quota)
+        ftp_pool_fail (pool, QUOTEXC, true);
+      else if (job->type == FTP_JOB_LIST)
+        ftp_worker_list (w, job);
+      else
+        ftp_worker_file (w, job);
+      xfree (job->dir);
+      freefileinfo (job->f);
+      xfree (job);
+
+      pthread_mutex_lock (&pool->lock);
+      pool->busy--;
+    }
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* Retrieve U as ftp_retrieve_glob does, over opt.connections control
+   connections.  */
+
+static uerr_t
+ftp_retrieve_pool (struct url *u, struct url *original_url,
+                   struct url *proxy, int action)
+{
+  struct ftp_pool pool;
+  struct ftp_worker *workers;
+  int i, worker_count = 0;
+  bool threaded = true;
+
+  xzero (pool);
+  pool.err = RETROK;
+  pthread_mutex_init (&pool.lock, NULL);
+  pthread_cond_init (&pool.cond, NULL);
+  ftp_pool_add (&pool, FTP_JOB_LIST, u->dir, 1, action, NULL);
+
+  logprintf (LOG_VERBOSE, _("Retrieving over %d connections.\n"),
+             opt.connections);
+
+  workers = xnew0_array (struct ftp_worker, opt.connections);
+  for (i = 0; i < opt.connections; i++)
+    {
+      struct ftp_worker *w = &workers[worker_count];
+
+      w->pool = &pool;
+      w->u = ftp_url_dup (u);
+      w->original_url = original_url == u ? w->u : original_url;
+      w->con.csock = -1;
+      w->con.rs = ST_UNIX;
+      w->con.proxy = proxy;
+      if (pthread_create (&w->thread, NULL, ftp_worker_run, w) != 0)
+        {
+          url_free (w->u);
+          break;
+        }
+      worker_count++;
+    }
+  if (!worker_count)
+    {
+      /* Do the work in this thread over a single connection.  */
+      struct ftp_worker *w = &workers[0];
+
+      w->u = ftp_url_dup (u);
+      w->original_url = original_url == u ? w->u : original_url;
+      ftp_worker_run (w);
+      worker_count = 1;
+      threaded = false;
+    }
+
+  for (i = 0; i < worker_count; i++)
+    {
+      struct ftp_worker *w = &workers[i];
+
+      if (threaded)
+        pthread_join (w->thread, NULL);
+      if (w->con.csock != -1)
+        fd_close (w->con.csock);
+      xfree (w->con.id);
+      xfree (w->con.target);
+      xfree (w->cwd);
+      url_free (w->u);
+    }
+  xfree (workers);
+
+  /* Jobs left behind by a fatal error.  */
+  while (pool.head)
+    {
+      struct ftp_job *job = pool.head;
+
+      pool.head = job->next;
+      xfree (job->dir);
+      freefileinfo (job->f);
+      xfree (job);
+    }
+  pthread_cond_destroy (&pool.cond);
+  pthread_mutex_destroy (&pool.lock);
+
+  if (opt.quota && total_downloaded_bytes > opt.quota)
+    return QUOTEXC;
+  return pool.err;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
 /* The wrapper that calls an appropriate routine according to contents
    of URL.  Inherently, its capabilities are limited on what can be
    encoded into a URL.  */
@@ -2836,6 +3301,15 @@ ftp_loop (struct url *u, struct url *original_url, char **local_file, int *dt,
           /* ftp_retrieve_glob is a catch-all function that gets called
              if we need globbing, time-stamping, recursion or preserve
              permissions.  Its third argument is just what we really need.  */
+#ifdef HAVE_PTHREAD_H
+          /* WARC records and -O go to a single stream, so those keep
+             to one connection.  */
+          if (opt.connections > 1 && (ispattern || recursive)
+              && !opt.warc_filename && !opt.output_document)
+            res = ftp_retrieve_pool (u, original_url, proxy,
+                                     ispattern ? GLOB_GLOBALL : GLOB_GETONE);
+          else
+#endif
           res = ftp_retrieve_glob (u, original_url, &con,
                                    ispattern ? GLOB_GLOBALL : GLOB_GETONE);
         }
@@ -88,6 +88,8 @@ uerr_t ftp_cwd (int, const char *);
 uerr_t ftp_retr (int, const char *);
 uerr_t ftp_rest (int, wgint);
 uerr_t ftp_list (int, const char *, bool, bool, bool *);
+uerr_t ftp_mlsd (int);
+uerr_t ftp_feat (int, bool *);
 uerr_t ftp_syst (int, enum stype *, enum ustype *);
 uerr_t ftp_pwd (int, char **);
 uerr_t ftp_size (int, const char *, wgint *);
@@ -167,11 +169,15 @@ enum wget_ftp_fstatus
                                checked "LIST" after the first
                                "LIST -a" to handle the case of
                                file/folders named "-a". */
-  DATA_CHANNEL_SECURITY = 0x0020 /* Establish a secure data channel */
+  DATA_CHANNEL_SECURITY = 0x0020, /* Establish a secure data channel */
+  USE_MLSD      = 0x0040    /* The server supports MLSD, so listings
+                               are machine listings (RFC 3659).  */
 };
 
 struct fileinfo *ftp_parse_ls (const char *, const enum stype);
 struct fileinfo *ftp_parse_ls_fp (FILE *, const enum stype);
+struct fileinfo *ftp_parse_mlsd (const char *);
+struct fileinfo *ftp_parse_mlsd_fp (FILE *);
 void freefileinfo(struct fileinfo *);
 uerr_t ftp_loop (struct url *, struct url *, char **, int *, struct url *,
                  bool, bool);
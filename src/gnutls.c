@@ -42,6 +42,9 @@ as that of the covered work.  */
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
 #include <sys/ioctl.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include "utils.h"
 #include "connect.h"
@@ -96,8 +99,9 @@ key_type_to_gnutls_type (enum keyfile_type type)
 static bool ssl_initialized = false;
 
 static gnutls_certificate_credentials_t credentials;
-bool
-ssl_init (void)
+
+static bool
+ssl_init_1 (void)
 {
   /* Becomes true if GnuTLS is initialized. */
   const char *ca_directory;
@@ -233,6 +237,29 @@ cert to be of the same type.\n"));
   return true;
 }
 
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t ssl_init_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Initialize GnuTLS and load the certificates.  Called the first time
+   an HTTPS or FTPS connection is made, possibly by several download
+   threads at once; only one of them does the work.  */
+
+bool
+ssl_init (void)
+{
+  bool ok;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock (&ssl_init_lock);
+#endif
+  ok = ssl_init_1 ();
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock (&ssl_init_lock);
+#endif
+  return ok;
+}
+
 void
 ssl_cleanup (void)
 {
@@ -522,7 +549,10 @@ wgnutls_close (int fd, void *arg)
 static struct transport_implementation wgnutls_transport =
 {
   wgnutls_read, wgnutls_write, wgnutls_poll,
-  wgnutls_peek, wgnutls_errstr, wgnutls_close
+  wgnutls_peek, wgnutls_errstr, wgnutls_close,
+  /* gnutls_record_recv returns the data of one record at a time, and
+     a TLS record carries at most 16 KiB.  */
+  16384
 };
 
 static int
@@ -63,6 +63,10 @@ as that of the covered work.  */
 
 #include "hash.h"
 
+#ifdef TESTING
+# include "../tests/unit-tests.h"
+#endif
+
 /* INTERFACE:
 
    Hash tables are a technique used to implement mapping between
@@ -109,44 +113,70 @@ as that of the covered work.  */
 
 /* IMPLEMENTATION:
 
-   The hash table is implemented as an open-addressed table with
-   linear probing collision resolution.
-
-   The above means that all the cells (each cell containing a key and
-   a value pointer) are stored in a contiguous array.  Array position
-   of each cell is determined by the hash value of its key and the
-   size of the table: location := hash(key) % size.  If two different
-   keys end up on the same position (collide), the one that came
-   second is stored in the first unoccupied cell that follows it.
-   This collision resolution technique is called "linear probing".
-
-   There are more advanced collision resolution methods (quadratic
-   probing, double hashing), but we don't use them because they incur
-   more non-sequential access to the array, which results in worse CPU
-   cache behavior.  Linear probing works well as long as the
-   count/size ratio (fullness) is kept below 75%.  We make sure to
-   grow and rehash the table whenever this threshold is exceeded.
-
-   Collisions complicate deletion because simply clearing a cell
-   followed by previously collided entries would cause those neighbors
-   to not be picked up by find_cell later.  One solution is to leave a
-   "tombstone" marker instead of clearing the cell, and another is to
-   recalculate the positions of adjacent cells.  We take the latter
-   approach because it results in less bookkeeping garbage and faster
-   retrieval at the (slight) expense of deletion.  */
+   The hash table is implemented as an open-addressed table in the
+   style of Google's SwissTable.  Besides the contiguous array of
+   cells (each cell containing a key, a value pointer and the cached
+   hash of the key), the table keeps a parallel array of one-byte
+   "control" entries.  A control byte is either one of the EMPTY or
+   DELETED markers, or the low 7 bits of the hash of the key stored
+   in the corresponding cell (its "fingerprint").
+
+   Cells are organized in groups of GROUP_WIDTH consecutive
+   positions.  The group where the search for a key starts is
+   determined by the high bits of its hash; if the key is not found
+   in that group and the group has no empty positions, the search
+   continues in other groups using triangular (quadratic) probing,
+   which is guaranteed to visit every group because the number of
+   groups is a power of two.
+
+   Searching a group compares the fingerprint against all of its
+   control bytes at once -- using SSE2 instructions where available
+   -- which yields a bitmask of candidate positions.  Only for those
+   candidates is the cached hash compared, and only if the full hash
+   matches is the (comparatively expensive) test function called.
+   In the common case a lookup touches a single 16-byte control
+   group and calls the test function exactly once for a hit and not
+   at all for a miss.
+
+   Because the full hash of each key is cached in its cell, growing
+   the table does not call the hash function again; entries are
+   simply redistributed using the cached values.
+
+   Removal leaves a DELETED marker ("tombstone") in the control byte,
+   unless the group still contains an empty position, in which case
+   no probe sequence can run past it and the position can be marked
+   EMPTY right away.  Tombstones count towards the fullness of the
+   table, so that a table with many removals is eventually rebuilt
+   without them.
+
+   Cells that are empty or deleted additionally have their key set to
+   INVALID_PTR, so that iteration can walk the cells array alone.  */
 
 /* Maximum allowed fullness: when hash table's fullness exceeds this
-   value, the table is resized.  */
-#define HASH_MAX_FULLNESS 0.75
+   value, the table is resized.  Group probing keeps probe sequences
+   short even at high load, so we can afford more than the 75% that
+   linear probing would require.  */
+#define HASH_MAX_FULLNESS 0.875
 
-/* The hash table size is multiplied by this factor (and then rounded
-   to the next prime) with each resize.  This guarantees infrequent
-   resizes.  */
+/* The hash table size is multiplied by this factor with each resize.
+   This guarantees infrequent resizes.  */
 #define HASH_RESIZE_FACTOR 2
 
+/* Number of positions examined in one step of probing.  This is the
+   width of an SSE2 register in bytes.  */
+#define GROUP_WIDTH 16
+
+/* Control byte values.  A full position has a control byte with the
+   high bit cleared (the 7-bit fingerprint of its key); both markers
+   have the high bit set, which allows finding free positions with a
+   single movemask.  */
+#define CTRL_EMPTY   ((signed char) -128)     /* 0x80 */
+#define CTRL_DELETED ((signed char) -2)       /* 0xfe */
+
 struct cell {
   void *key;
   void *value;
+  unsigned int hash;            /* cached (mixed) hash of KEY. */
 };
 
 typedef unsigned long (*hashfun_t) (const void *);
@@ -156,14 +186,16 @@ struct hash_table {
   hashfun_t hash_function;
   testfun_t test_function;
 
+  signed char *ctrl;            /* control bytes, one per cell. */
   struct cell *cells;           /* contiguous array of cells. */
-  int size;                     /* size of the array. */
+  int size;                     /* size of the arrays, a power of two
+                                   and a multiple of GROUP_WIDTH. */
 
   int count;                    /* number of occupied entries. */
-  int resize_threshold;         /* after size exceeds this number of
-                                   entries, resize the table.  */
-  int prime_offset;             /* the offset of the current prime in
-                                   the prime table. */
+  int deleted;                  /* number of tombstones. */
+  int resize_threshold;         /* after count + deleted exceeds this
+                                   number of entries, resize the
+                                   table.  */
 };
 
 /* We use the all-bits-set constant (INVALID_PTR) marker to mean that
@@ -189,57 +221,149 @@ struct hash_table {
 /* Clear the cell C, i.e. mark it as empty (unoccupied). */
 #define CLEAR_CELL(c) ((c)->key = INVALID_PTR)
 
-/* "Next" cell is the cell following C, but wrapping back to CELLS
-   when C would reach CELLS+SIZE.  */
-#define NEXT_CELL(c, cells, size) (c != cells + (size - 1) ? c + 1 : cells)
+/* The part of the hash that selects the first group to probe, and the
+   7-bit fingerprint stored in the control byte.  */
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((signed char) ((hash) & 0x7f))
+
+/* A bitmask with bit I set when position I of a group matched. */
+typedef unsigned int group_mask_t;
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+
+static inline group_mask_t
+group_match (const signed char *group, signed char h2)
+{
+  __m128i ctrl = _mm_loadu_si128 ((const __m128i *) group);
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (ctrl, _mm_set1_epi8 (h2)));
+}
+
+static inline group_mask_t
+group_match_empty (const signed char *group)
+{
+  return group_match (group, CTRL_EMPTY);
+}
+
+/* Positions that are either EMPTY or DELETED, i.e. available for
+   insertion.  Both markers have their high bit set.  */
+static inline group_mask_t
+group_match_free (const signed char *group)
+{
+  __m128i ctrl = _mm_loadu_si128 ((const __m128i *) group);
+  return _mm_movemask_epi8 (ctrl);
+}
+
+#else /* not __SSE2__ */
+
+static inline group_mask_t
+group_match (const signed char *group, signed char h2)
+{
+  group_mask_t mask = 0;
+  int i;
+  for (i = 0; i < GROUP_WIDTH; i++)
+    if (group[i] == h2)
+      mask |= 1u << i;
+  return mask;
+}
+
+static inline group_mask_t
+group_match_empty (const signed char *group)
+{
+  return group_match (group, CTRL_EMPTY);
+}
+
+static inline group_mask_t
+group_match_free (const signed char *group)
+{
+  group_mask_t mask = 0;
+  int i;
+  for (i = 0; i < GROUP_WIDTH; i++)
+    if (group[i] < 0)
+      mask |= 1u << i;
+  return mask;
+}
+
+#endif /* not __SSE2__ */
+
+/* Return the index of the lowest set bit in MASK, which must be
+   non-zero.  */
+
+static inline int
+lowest_bit (group_mask_t mask)
+{
+#if defined __GNUC__ || defined __clang__
+  return __builtin_ctz (mask);
+#else
+  int i = 0;
+  while (!(mask & 1))
+    {
+      mask >>= 1;
+      ++i;
+    }
+  return i;
+#endif
+}
 
-/* Loop over occupied cells starting at C, terminating the loop when
-   an empty cell is encountered.  */
-#define FOREACH_OCCUPIED_ADJACENT(c, cells, size)                               \
-  for (; CELL_OCCUPIED (c); c = NEXT_CELL (c, cells, size))
+/* Loop over the positions of the set bits in MASK, storing each in
+   BIT.  MASK is consumed.  */
+#define FOREACH_BIT(bit, mask) \
+  for (; (mask) && ((bit) = lowest_bit (mask), 1); (mask) &= (mask) - 1)
 
-/* Return the position of KEY in hash table SIZE large, hash function
-   being HASHFUN.  */
-#define HASH_POSITION(key, hashfun, size) ((hashfun) (key) % size)
+/* Scramble the value returned by the user-supplied hash function.
+   Group selection uses the high bits and the fingerprint the low
+   bits of the result, so every input bit must affect both.  This is
+   the finalizer of MurmurHash3.  */
 
-/* Find a prime near, but greater than or equal to SIZE.  The primes
-   are looked up from a table with a selection of primes convenient
-   for this purpose.
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static inline unsigned int
+mix_hash (unsigned long h)
+{
+  unsigned int k = (unsigned int) h;
+#if SIZEOF_LONG > 4
+  k ^= (unsigned int) (h >> 31 >> 1);
+#endif
+  k ^= k >> 16;
+  k *= 0x85ebca6bu;
+  k ^= k >> 13;
+  k *= 0xc2b2ae35u;
+  k ^= k >> 16;
+  return k;
+}
 
-   PRIME_OFFSET is a minor optimization: it specifies start position
-   for the search for the large enough prime.  The final offset is
-   stored in the same variable.  That way the list of primes does not
-   have to be scanned from the beginning each time around.  */
+/* Return the smallest permissible table size able to hold ITEMS
+   entries without growing.  */
 
 static int
-prime_size (int size, int *prime_offset)
-{
-  static const int primes[] = {
-    13, 19, 29, 41, 59, 79, 107, 149, 197, 263, 347, 457, 599, 787, 1031,
-    1361, 1777, 2333, 3037, 3967, 5167, 6719, 8737, 11369, 14783,
-    19219, 24989, 32491, 42257, 54941, 71429, 92861, 120721, 156941,
-    204047, 265271, 344857, 448321, 582821, 757693, 985003, 1280519,
-    1664681, 2164111, 2813353, 3657361, 4754591, 6180989, 8035301,
-    10445899, 13579681, 17653589, 22949669, 29834603, 38784989,
-    50420551, 65546729, 85210757, 110774011, 144006217, 187208107,
-    243370577, 316381771, 411296309, 534685237, 695090819, 903618083,
-    1174703521, 1527114613, 1837299131, 2147483647
-  };
-  size_t i;
-
-  for (i = *prime_offset; i < countof (primes); i++)
-    if (primes[i] >= size)
-      {
-        /* Set the offset to the next prime.  That is safe because,
-           next time we are called, it will be with a larger SIZE,
-           which means we could never return the same prime anyway.
-           (If that is not the case, the caller can simply reset
-           *prime_offset.)  */
-        *prime_offset = i + 1;
-        return primes[i];
-      }
+table_size_for (int items)
+{
+  int size = GROUP_WIDTH;
+  while (size * HASH_MAX_FULLNESS < items + 1)
+    {
+      if (size > INT_MAX / 2)
+        abort ();
+      size <<= 1;
+    }
+  return size;
+}
 
-  abort ();
+/* Allocate empty arrays for HT to hold SIZE cells. */
+
+static void
+alloc_arrays (struct hash_table *ht, int size)
+{
+  ht->size = size;
+  ht->resize_threshold = (int) (size * HASH_MAX_FULLNESS);
+  ht->ctrl = xnew_array (signed char, size);
+  memset (ht->ctrl, CTRL_EMPTY, size);
+  ht->cells = xnew_array (struct cell, size);
+  /* Mark cells as empty.  We use 0xff rather than 0 to mark empty
+     keys because it allows us to use NULL/0 as keys.  */
+  memset (ht->cells, INVALID_PTR_CHAR, size * sizeof (struct cell));
+  ht->count = 0;
+  ht->deleted = 0;
 }
 
 static int cmp_pointer (const void *, const void *);
@@ -256,8 +380,7 @@ static int cmp_pointer (const void *, const void *);
 
    Note that hash tables grow dynamically regardless of ITEMS.  The
    only use of ITEMS is to preallocate the table and avoid unnecessary
-   dynamic regrows.  Don't bother making ITEMS prime because it's not
-   used as size unchanged.  To start with a small table that grows as
+   dynamic regrows.  To start with a small table that grows as
    needed, simply specify zero ITEMS.
 
    If hash and test callbacks are not specified, identity mapping is
@@ -273,31 +396,12 @@ hash_table_new (int items,
                 unsigned long (*hash_function) (const void *),
                 int (*test_function) (const void *, const void *))
 {
-  int size;
   struct hash_table *ht = xnew (struct hash_table);
 
   ht->hash_function = hash_function ? hash_function : hash_pointer;
   ht->test_function = test_function ? test_function : cmp_pointer;
 
-  /* If the size of struct hash_table ever becomes a concern, this
-     field can go.  (Wget doesn't create many hashes.)  */
-  ht->prime_offset = 0;
-
-  /* Calculate the size that ensures that the table will store at
-     least ITEMS keys without the need to resize.  */
-  size = (int) (1 + items / HASH_MAX_FULLNESS);
-  size = prime_size (size, &ht->prime_offset);
-  ht->size = size;
-  ht->resize_threshold = (int) (size * HASH_MAX_FULLNESS);
-  /*assert (ht->resize_threshold >= items);*/
-
-  ht->cells = xnew_array (struct cell, ht->size);
-
-  /* Mark cells as empty.  We use 0xff rather than 0 to mark empty
-     keys because it allows us to use NULL/0 as keys.  */
-  memset (ht->cells, INVALID_PTR_CHAR, size * sizeof (struct cell));
-
-  ht->count = 0;
+  alloc_arrays (ht, table_size_for (items));
 
   return ht;
 }
@@ -307,26 +411,69 @@ hash_table_new (int items,
 void
 hash_table_destroy (struct hash_table *ht)
 {
+  xfree (ht->ctrl);
   xfree (ht->cells);
   xfree (ht);
 }
 
 /* The heart of most functions in this file -- find the cell whose
-   KEY is equal to key, using linear probing.  Returns the cell
-   that matches KEY, or the first empty cell if none matches.  */
+   key is equal to KEY, whose mixed hash is HASH.  Returns the cell
+   that matches KEY, or NULL if none matches.  */
 
 static inline struct cell *
-find_cell (const struct hash_table *ht, const void *key)
+find_cell_hashed (const struct hash_table *ht, const void *key,
+                  unsigned int hash)
 {
+  const signed char *ctrl = ht->ctrl;
   struct cell *cells = ht->cells;
-  int size = ht->size;
-  struct cell *c = cells + HASH_POSITION (key, ht->hash_function, size);
+  int group_mask = ht->size / GROUP_WIDTH - 1;
+  int group = H1 (hash) & group_mask;
+  signed char h2 = H2 (hash);
   testfun_t equals = ht->test_function;
+  int step = 0;
 
-  FOREACH_OCCUPIED_ADJACENT (c, cells, size)
-    if (equals (key, c->key))
-      break;
-  return c;
+  for (;;)
+    {
+      const signed char *g = ctrl + group * GROUP_WIDTH;
+      group_mask_t match = group_match (g, h2);
+      int bit;
+
+      FOREACH_BIT (bit, match)
+        {
+          struct cell *c = cells + group * GROUP_WIDTH + bit;
+          if (c->hash == hash && equals (key, c->key))
+            return c;
+        }
+      if (group_match_empty (g))
+        return NULL;
+      group = (group + ++step) & group_mask;
+    }
+}
+
+static inline struct cell *
+find_cell (const struct hash_table *ht, const void *key)
+{
+  return find_cell_hashed (ht, key, mix_hash (ht->hash_function (key)));
+}
+
+/* Return the index of the first position available for inserting an
+   entry whose mixed hash is HASH.  The table must have at least one
+   free position.  */
+
+static inline int
+find_free_position (const struct hash_table *ht, unsigned int hash)
+{
+  int group_mask = ht->size / GROUP_WIDTH - 1;
+  int group = H1 (hash) & group_mask;
+  int step = 0;
+
+  for (;;)
+    {
+      group_mask_t avail = group_match_free (ht->ctrl + group * GROUP_WIDTH);
+      if (avail)
+        return group * GROUP_WIDTH + lowest_bit (avail);
+      group = (group + ++step) & group_mask;
+    }
 }
 
 /* Get the value that corresponds to the key KEY in the hash table HT.
@@ -340,7 +487,7 @@ void *
 hash_table_get (const struct hash_table *ht, const void *key)
 {
   struct cell *c = find_cell (ht, key);
-  if (CELL_OCCUPIED (c))
+  if (c)
     return c->value;
   else
     return NULL;
@@ -354,7 +501,7 @@ hash_table_get_pair (const struct hash_table *ht, const void *lookup_key,
                      void *orig_key, void *value)
 {
   struct cell *c = find_cell (ht, lookup_key);
-  if (CELL_OCCUPIED (c))
+  if (c)
     {
       if (orig_key)
         *(void **)orig_key = c->key;
@@ -371,50 +518,54 @@ hash_table_get_pair (const struct hash_table *ht, const void *lookup_key,
 int
 hash_table_contains (const struct hash_table *ht, const void *key)
 {
-  struct cell *c = find_cell (ht, key);
-  return CELL_OCCUPIED (c);
+  return find_cell (ht, key) != NULL;
 }
 
-/* Grow hash table HT as necessary, and rehash all the key-value
-   mappings.  */
+/* Grow hash table HT as necessary, and redistribute all the key-value
+   mappings.  If most of the fullness is due to tombstones, the table
+   is merely rebuilt at its current size.  */
 
 static void
 grow_hash_table (struct hash_table *ht)
 {
-  hashfun_t hasher = ht->hash_function;
+  signed char *old_ctrl = ht->ctrl;
   struct cell *old_cells = ht->cells;
-  struct cell *old_end   = ht->cells + ht->size;
-  struct cell *c, *cells;
-  int newsize;
+  int old_size = ht->size;
+  int count = ht->count;
+  int newsize, i;
 
-  newsize = prime_size (ht->size * HASH_RESIZE_FACTOR, &ht->prime_offset);
+  if (ht->deleted > count)
+    newsize = old_size;
+  else
+    {
+      if (old_size > INT_MAX / HASH_RESIZE_FACTOR)
+        abort ();
+      newsize = old_size * HASH_RESIZE_FACTOR;
+    }
 #if 0
   printf ("growing from %d to %d; fullness %.2f%% to %.2f%%\n",
-          ht->size, newsize,
-          100.0 * ht->count / ht->size,
-          100.0 * ht->count / newsize);
+          old_size, newsize,
+          100.0 * (count + ht->deleted) / old_size,
+          100.0 * count / newsize);
 #endif
 
-  ht->size = newsize;
-  ht->resize_threshold = (int) (newsize * HASH_MAX_FULLNESS);
+  alloc_arrays (ht, newsize);
 
-  cells = xnew_array (struct cell, newsize);
-  memset (cells, INVALID_PTR_CHAR, newsize * sizeof (struct cell));
-  ht->cells = cells;
-
-  for (c = old_cells; c < old_end; c++)
-    if (CELL_OCCUPIED (c))
+  for (i = 0; i < old_size; i++)
+    if (old_ctrl[i] >= 0)
       {
-        struct cell *new_c;
         /* We don't need to test for uniqueness of keys because they
            come from the hash table and are therefore known to be
-           unique.  */
-        new_c = cells + HASH_POSITION (c->key, hasher, newsize);
-        FOREACH_OCCUPIED_ADJACENT (new_c, cells, newsize)
-          ;
-        *new_c = *c;
+           unique.  Nor do we need to call the hash function, as the
+           hash is cached in the cell.  */
+        struct cell *c = old_cells + i;
+        int pos = find_free_position (ht, c->hash);
+        ht->ctrl[pos] = H2 (c->hash);
+        ht->cells[pos] = *c;
       }
+  ht->count = count;
 
+  xfree (old_ctrl);
   xfree (old_cells);
 }
 
@@ -424,8 +575,11 @@ grow_hash_table (struct hash_table *ht)
 void
 hash_table_put (struct hash_table *ht, const void *key, const void *value)
 {
-  struct cell *c = find_cell (ht, key);
-  if (CELL_OCCUPIED (c))
+  unsigned int hash = mix_hash (ht->hash_function (key));
+  struct cell *c = find_cell_hashed (ht, key, hash);
+  int pos;
+
+  if (c)
     {
       /* update existing item */
       c->key   = (void *)key; /* const? */
@@ -435,16 +589,19 @@ hash_table_put (struct hash_table *ht, const void *key, const void *value)
 
   /* If adding the item would make the table exceed max. fullness,
      grow the table first.  */
-  if (ht->count >= ht->resize_threshold)
-    {
-      grow_hash_table (ht);
-      c = find_cell (ht, key);
-    }
+  if (ht->count + ht->deleted >= ht->resize_threshold)
+    grow_hash_table (ht);
 
   /* add new item */
+  pos = find_free_position (ht, hash);
+  if (ht->ctrl[pos] == CTRL_DELETED)
+    --ht->deleted;
   ++ht->count;
+  ht->ctrl[pos] = H2 (hash);
+  c = ht->cells + pos;
   c->key   = (void *)key;       /* const? */
   c->value = (void *)value;
+  c->hash  = hash;
 }
 
 /* Remove KEY->value mapping from HT.  Return 0 if there was no such
@@ -454,42 +611,26 @@ int
 hash_table_remove (struct hash_table *ht, const void *key)
 {
   struct cell *c = find_cell (ht, key);
-  if (!CELL_OCCUPIED (c))
+  if (!c)
     return 0;
   else
     {
-      int size = ht->size;
-      struct cell *cells = ht->cells;
-      hashfun_t hasher = ht->hash_function;
-
-      CLEAR_CELL (c);
-      --ht->count;
-
-      /* Rehash all the entries following C.  The alternative
-         approach is to mark the entry as deleted, i.e. create a
-         "tombstone".  That speeds up removal, but leaves a lot of
-         garbage and slows down hash_table_get and hash_table_put.  */
-
-      c = NEXT_CELL (c, cells, size);
-      FOREACH_OCCUPIED_ADJACENT (c, cells, size)
+      int pos = c - ht->cells;
+      const signed char *group = ht->ctrl + pos / GROUP_WIDTH * GROUP_WIDTH;
+
+      /* If the group has an empty position, no search ever proceeded
+         past it, and the position can be reused as if it had never
+         been occupied.  Otherwise leave a tombstone so that searches
+         for keys stored further along keep going.  */
+      if (group_match_empty (group))
+        ht->ctrl[pos] = CTRL_EMPTY;
+      else
         {
-          const void *key2 = c->key;
-          struct cell *c_new;
-
-          /* Find the new location for the key. */
-          c_new = cells + HASH_POSITION (key2, hasher, size);
-          FOREACH_OCCUPIED_ADJACENT (c_new, cells, size)
-            if (key2 == c_new->key)
-              /* The cell C (key2) is already where we want it (in
-                 C_NEW's "chain" of keys.)  */
-              goto next_rehash;
-
-          *c_new = *c;
-          CLEAR_CELL (c);
-
-        next_rehash:
-          ;
+          ht->ctrl[pos] = CTRL_DELETED;
+          ++ht->deleted;
         }
+      CLEAR_CELL (c);
+      --ht->count;
       return 1;
     }
 }
@@ -501,8 +642,10 @@ hash_table_remove (struct hash_table *ht, const void *key)
 void
 hash_table_clear (struct hash_table *ht)
 {
+  memset (ht->ctrl, CTRL_EMPTY, ht->size);
   memset (ht->cells, INVALID_PTR_CHAR, ht->size * sizeof (struct cell));
   ht->count = 0;
+  ht->deleted = 0;
 }
 
 /* Call FN for each entry in HT.  FN is called with three arguments:
@@ -512,9 +655,9 @@ hash_table_clear (struct hash_table *ht)
    It is undefined what happens if you add or remove entries in the
    hash table while hash_table_for_each is running.  The exception is
    the entry you're currently mapping over; you may call
-   hash_table_put or hash_table_remove on that entry's key.  That is
-   also the reason why this function cannot be implemented in terms of
-   hash_table_iterate.  */
+   hash_table_put or hash_table_remove on that entry's key.  Since
+   entries never move except when the table grows, doing so doesn't
+   disturb the iteration.  */
 
 void
 hash_table_for_each (struct hash_table *ht,
@@ -525,16 +668,8 @@ hash_table_for_each (struct hash_table *ht,
 
   for (; c < end; c++)
     if (CELL_OCCUPIED (c))
-      {
-        void *key;
-      repeat:
-        key = c->key;
-        if (fn (key, c->value, arg))
-          return;
-        /* hash_table_remove might have moved the adjacent cells. */
-        if (c->key != key && CELL_OCCUPIED (c))
-          goto repeat;
-      }
+      if (fn (c->key, c->value, arg))
+        return;
 }
 
 /* Initiate iteration over HT.  Entries are obtained with
@@ -753,6 +888,66 @@ cmp_pointer (const void *ptr1, const void *ptr2)
   return ptr1 == ptr2;
 }
 
+#ifdef TESTING
+
+const char *
+test_hash_table (void)
+{
+  struct hash_table *ht = make_string_hash_table (0);
+  static char keys[3000][8];
+  hash_table_iterator iter;
+  int i, seen;
+
+  for (i = 0; i < countof (keys); i++)
+    {
+      snprintf (keys[i], sizeof (keys[i]), "k%d", i);
+      hash_table_put (ht, keys[i], keys[i]);
+    }
+  mu_assert ("test_hash_table: wrong count after put",
+             hash_table_count (ht) == countof (keys));
+
+  /* Remove every other key, leaving tombstones behind, then make sure
+     that the remaining keys are still found and the removed ones are
+     not.  */
+  for (i = 0; i < countof (keys); i += 2)
+    mu_assert ("test_hash_table: remove failed",
+               hash_table_remove (ht, keys[i]) == 1);
+  for (i = 0; i < countof (keys); i++)
+    {
+      char lookup[8];
+      snprintf (lookup, sizeof (lookup), "k%d", i);
+      if (i % 2)
+        mu_assert ("test_hash_table: lost key",
+                   hash_table_get (ht, lookup) == keys[i]);
+      else
+        mu_assert ("test_hash_table: removed key found",
+                   !hash_table_contains (ht, lookup));
+    }
+
+  /* Reinserting must reuse the freed positions. */
+  for (i = 0; i < countof (keys); i += 2)
+    hash_table_put (ht, keys[i], NULL);
+  mu_assert ("test_hash_table: wrong count after reinsertion",
+             hash_table_count (ht) == countof (keys));
+  mu_assert ("test_hash_table: NULL value not found",
+             hash_table_contains (ht, "k0") && !hash_table_get (ht, "k0"));
+
+  seen = 0;
+  for (hash_table_iterate (ht, &iter); hash_table_iter_next (&iter); )
+    ++seen;
+  mu_assert ("test_hash_table: iteration missed entries",
+             seen == countof (keys));
+
+  hash_table_clear (ht);
+  mu_assert ("test_hash_table: clear failed",
+             hash_table_count (ht) == 0 && !hash_table_contains (ht, "k1"));
+
+  hash_table_destroy (ht);
+  return NULL;
+}
+
+#endif /* TESTING */
+
 #ifdef TEST
 
 #include <stdio.h>
@@ -56,11 +56,16 @@ as that of the covered work.  */
 
 #include <errno.h>
 
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #include "utils.h"
 #include "host.h"
 #include "url.h"
 #include "hash.h"
 #include "ptimer.h"
+#include "stats.h"
 
 #ifndef NO_ADDRESS
 # define NO_ADDRESS NO_DATA
@@ -87,12 +92,26 @@ struct address_list {
                                    0, the entry is freed. */
 };
 
+/* Cached address lists are shared by the threads of parallel
+   downloads.  This lock protects the cache and the reference counts
+   and fault marks of the lists in it.  */
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_HOSTS() pthread_mutex_lock (&host_lock)
+# define UNLOCK_HOSTS() pthread_mutex_unlock (&host_lock)
+#else
+# define LOCK_HOSTS()
+# define UNLOCK_HOSTS()
+#endif
+
 /* Get the bounds of the address list.  */
 
 void
 address_list_get_bounds (const struct address_list *al, int *start, int *end)
 {
+  LOCK_HOSTS ();
   *start = al->faulty;
+  UNLOCK_HOSTS ();
   *end   = al->count;
 }
 
@@ -101,7 +120,9 @@ address_list_get_bounds (const struct address_list *al, int *start, int *end)
 const ip_address *
 address_list_address_at (const struct address_list *al, int pos)
 {
-  assert (pos >= al->faulty && pos < al->count);
+  /* Another thread may have marked POS faulty since the caller got
+     the bounds, so only check against the list itself.  */
+  assert (pos >= 0 && pos < al->count);
   return al->addresses + pos;
 }
 
@@ -149,23 +170,21 @@ address_list_set_faulty (struct address_list *al, int index)
 {
   /* We assume that the address list is traversed in order, so that a
      "faulty" attempt is always preceded with all-faulty addresses,
-     and this is how Wget uses it.  */
-  assert (index == al->faulty);
-  if (index != al->faulty)
+     and this is how Wget uses it.  When several threads use a cached
+     list, another one may already have moved past INDEX; its mark
+     then stands.  */
+  LOCK_HOSTS ();
+  if (index == al->faulty)
     {
-      logprintf (LOG_ALWAYS, "index: %d\nal->faulty: %d\n", index, al->faulty);
-      logprintf (LOG_ALWAYS, _("Error in handling the address list.\n"));
-      logprintf (LOG_ALWAYS, _("Please report this issue to bug-wget@gnu.org\n"));
-      abort();
+      ++al->faulty;
+      if (al->faulty >= al->count)
+        /* All addresses have been proven faulty.  Since there's not much
+           sense in returning the user an empty address list the next
+           time, we'll rather make them all clean, so that they can be
+           retried anew.  */
+        al->faulty = 0;
     }
-
-  ++al->faulty;
-  if (al->faulty >= al->count)
-    /* All addresses have been proven faulty.  Since there's not much
-       sense in returning the user an empty address list the next
-       time, we'll rather make them all clean, so that they can be
-       retried anew.  */
-    al->faulty = 0;
+  UNLOCK_HOSTS ();
 }
 
 /* Set the "connected" flag to true.  This flag used by connect.c to
@@ -307,10 +326,14 @@ address_list_delete (struct address_list *al)
 void
 address_list_release (struct address_list *al)
 {
-  --al->refcount;
+  int refcount;
+
+  LOCK_HOSTS ();
+  refcount = --al->refcount;
+  UNLOCK_HOSTS ();
   DEBUGP (("Releasing 0x%0*lx (new refcount %d).\n", PTR_FORMAT (al),
-           al->refcount));
-  if (al->refcount <= 0)
+           refcount));
+  if (refcount <= 0)
     {
       DEBUGP (("Deleting unused 0x%0*lx.\n", PTR_FORMAT (al)));
       address_list_delete (al);
@@ -591,17 +614,18 @@ static struct hash_table *host_name_addresses_map;
 static struct address_list *
 cache_query (const char *host)
 {
-  struct address_list *al;
-  if (!host_name_addresses_map)
-    return NULL;
-  al = hash_table_get (host_name_addresses_map, host);
+  struct address_list *al = NULL;
+
+  LOCK_HOSTS ();
+  if (host_name_addresses_map)
+    al = hash_table_get (host_name_addresses_map, host);
   if (al)
-    {
-      DEBUGP (("Found %s in host_name_addresses_map (%p)\n", host, (void *) al));
-      ++al->refcount;
-      return al;
-    }
-  return NULL;
+    ++al->refcount;
+  UNLOCK_HOSTS ();
+
+  if (al)
+    DEBUGP (("Found %s in host_name_addresses_map (%p)\n", host, (void *) al));
+  return al;
 }
 
 /* Cache the DNS lookup of HOST.  Subsequent invocations of
@@ -610,11 +634,20 @@ cache_query (const char *host)
 static void
 cache_store (const char *host, struct address_list *al)
 {
+  LOCK_HOSTS ();
   if (!host_name_addresses_map)
     host_name_addresses_map = make_nocase_string_hash_table (0);
 
+  /* Another thread may have resolved HOST at the same time; keep the
+     list that is already cached.  */
+  if (hash_table_contains (host_name_addresses_map, host))
+    {
+      UNLOCK_HOSTS ();
+      return;
+    }
   ++al->refcount;
   hash_table_put (host_name_addresses_map, xstrdup_lower (host), al);
+  UNLOCK_HOSTS ();
 
   IF_DEBUG
     {
@@ -632,15 +665,20 @@ cache_store (const char *host, struct address_list *al)
 static void
 cache_remove (const char *host)
 {
-  struct address_list *al;
-  if (!host_name_addresses_map)
-    return;
-  al = hash_table_get (host_name_addresses_map, host);
-  if (al)
+  struct address_list *al = NULL;
+  char *key;
+
+  LOCK_HOSTS ();
+  if (host_name_addresses_map
+      && hash_table_get_pair (host_name_addresses_map, host, &key, &al))
     {
-      address_list_release (al);
       hash_table_remove (host_name_addresses_map, host);
+      xfree (key);
     }
+  UNLOCK_HOSTS ();
+
+  if (al)
+    address_list_release (al);
 }
 
 #ifdef HAVE_LIBCARES
@@ -781,6 +819,7 @@ lookup_host (const char *host, int flags)
   bool use_cache;
   bool numeric_address = false;
   double timeout = opt.dns_timeout;
+  double since;
 
 #ifndef ENABLE_IPV6
   /* If we're not using getaddrinfo, first check if HOST specifies a
@@ -836,6 +875,7 @@ lookup_host (const char *host, int flags)
     }
 
   /* No luck with the cache; resolve HOST. */
+  since = stats_time ();
 
   if (!silent && !numeric_address)
     {
@@ -962,6 +1002,8 @@ lookup_host (const char *host, int flags)
     }
 #endif /* not ENABLE_IPV6 */
 
+  stats_phase (STATS_DNS, since);
+
   /* Print the addresses determined by DNS lookup, but no more than
      three if show_all_dns_entries is not specified.  */
   if (!silent && !numeric_address)
@@ -48,13 +48,30 @@ as that of the covered work.  */
 #include <string.h>
 #include <stdio.h>
 #include <sys/file.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 struct hsts_store {
   struct hash_table *table;
+  struct hash_table *tlds;      /* top-level domain -> number of hosts */
   time_t last_mtime;
   bool changed;
+#ifdef HAVE_PTHREAD_H
+  pthread_rwlock_t lock;        /* lets concurrent requests match */
+#endif
 };
 
+#ifdef HAVE_PTHREAD_H
+# define READ_LOCK(store) pthread_rwlock_rdlock (&(store)->lock)
+# define WRITE_LOCK(store) pthread_rwlock_wrlock (&(store)->lock)
+# define UNLOCK(store) pthread_rwlock_unlock (&(store)->lock)
+#else
+# define READ_LOCK(store)
+# define WRITE_LOCK(store)
+# define UNLOCK(store)
+#endif
+
 struct hsts_kh {
   char *host;
   int explicit_port;
@@ -111,35 +128,58 @@ hsts_cmp_func (const void *h1, const void *h2)
 
 /* Private functions. Feel free to make some of these public when needed. */
 
+/* Return the top-level domain of HOST, i.e. its last label.  */
+
+static const char *
+hsts_tld (const char *host)
+{
+  const char *p = strrchr (host, '.');
+  return p ? p + 1 : host;
+}
+
+/* Look HOST up in STORE, congruently or as a subdomain of a known host
+   that includes its subdomains.  If KH is not NULL, the key of the
+   entry found is stored there.
+
+   This runs for every URL, so it doesn't allocate: HOST is lowercased
+   into a buffer on the stack, and a host whose top-level domain no
+   known host shares, which is the common case, costs a single
+   lookup.  */
+
 static struct hsts_kh_info *
 hsts_find_entry (hsts_store_t store,
                  const char *host, int explicit_port,
                  enum hsts_kh_match *match_type,
-                 struct hsts_kh *kh)
+                 struct hsts_kh **kh)
 {
-  struct hsts_kh *k = NULL;
+  struct hsts_kh k, *found = NULL;
   struct hsts_kh_info *khi = NULL;
   enum hsts_kh_match match = NO_MATCH;
-  char *org_ptr = NULL;
+  char buf[256], *lower = buf;
+  size_t len = strlen (host), i;
 
-  k = (struct hsts_kh *) xnew (struct hsts_kh);
-  k->host = xstrdup_lower (host);
-  k->explicit_port = explicit_port;
+  /* Host names are at most 253 characters, but be safe.  */
+  if (len >= sizeof buf)
+    lower = xmalloc (len + 1);
+  for (i = 0; i <= len; i++)
+    lower[i] = c_tolower (host[i]);
 
-  /* save pointer so that we don't get into trouble later when freeing */
-  org_ptr = k->host;
+  if (!hash_table_contains (store->tlds, hsts_tld (lower)))
+    goto end;
 
-  khi = (struct hsts_kh_info *) hash_table_get (store->table, k);
-  if (khi)
+  k.host = lower;
+  k.explicit_port = explicit_port;
+  if (hash_table_get_pair (store->table, &k, &found, &khi))
     {
       match = CONGRUENT_MATCH;
       goto end;
     }
 
-  for (char *p = k->host; (p = strchr(p, '.')); )
+  for (char *p = lower; (p = strchr (p, '.')); )
     {
-      k->host = ++p;
-      khi = (struct hsts_kh_info *) hash_table_get (store->table, k);
+      k.host = ++p;
+      khi = NULL;
+      hash_table_get_pair (store->table, &k, &found, &khi);
       if (khi && khi->include_subdomains)
         {
           match = SUPERDOMAIN_MATCH;
@@ -148,21 +188,89 @@ hsts_find_entry (hsts_store_t store,
     }
 
 end:
-  /* restore pointer or we'll get a SEGV */
-  k->host = org_ptr;
+  if (lower != buf)
+    xfree (lower);
 
   /* copy parameters to previous frame */
   if (match_type)
     *match_type = match;
   if (kh)
-    memcpy (kh, k, sizeof (struct hsts_kh));
-  else
-    xfree (k->host);
+    *kh = khi ? found : NULL;
 
-  xfree (k);
   return khi;
 }
 
+/* Add the entry KH, KHI to STORE, which takes them over.  */
+
+static void
+hsts_put_entry (hsts_store_t store,
+                struct hsts_kh *kh, struct hsts_kh_info *khi)
+{
+  const char *tld = hsts_tld (kh->host);
+  char *tld_key;
+  void *count;
+
+  hash_table_put (store->table, kh, khi);
+  if (hash_table_get_pair (store->tlds, tld, &tld_key, &count))
+    hash_table_put (store->tlds, tld_key, (void *) ((intptr_t) count + 1));
+  else
+    hash_table_put (store->tlds, xstrdup (tld), (void *) (intptr_t) 1);
+}
+
+/* Remove the entry whose key is KH from STORE, and free it.  */
+
+static void
+hsts_remove_entry (hsts_store_t store, struct hsts_kh *kh)
+{
+  struct hsts_kh *key;
+  struct hsts_kh_info *khi;
+  char *tld_key;
+  void *count;
+
+  if (!hash_table_get_pair (store->table, kh, &key, &khi))
+    return;
+  hash_table_remove (store->table, key);
+
+  if (hash_table_get_pair (store->tlds, hsts_tld (key->host), &tld_key, &count))
+    {
+      if ((intptr_t) count > 1)
+        hash_table_put (store->tlds, tld_key, (void *) ((intptr_t) count - 1));
+      else
+        {
+          hash_table_remove (store->tlds, tld_key);
+          xfree (tld_key);
+        }
+    }
+
+  xfree (key->host);
+  xfree (key);
+  xfree (khi);
+}
+
+/* Remove the entries of STORE that have expired.  */
+
+static void
+hsts_remove_expired (hsts_store_t store)
+{
+  hash_table_iterator it;
+  struct hsts_kh **expired;
+  int count = 0, i;
+  int64_t now = (int64_t) time (NULL);
+
+  expired = xnew_array (struct hsts_kh *, hash_table_count (store->table) + 1);
+  for (hash_table_iterate (store->table, &it); hash_table_iter_next (&it);)
+    {
+      struct hsts_kh_info *khi = it.value;
+      if (khi->created + khi->max_age < now)
+        expired[count++] = it.key;
+    }
+  for (i = 0; i < count; i++)
+    hsts_remove_entry (store, expired[i]);
+  if (count)
+    store->changed = true;
+  xfree (expired);
+}
+
 static bool
 hsts_new_entry_internal (hsts_store_t store,
                          const char *host, int port,
@@ -194,7 +302,7 @@ hsts_new_entry_internal (hsts_store_t store,
     goto bail;
 
   /* Now store the new entry */
-  hash_table_put (store->table, kh, khi);
+  hsts_put_entry (store, kh, khi);
   success = true;
 
 bail:
@@ -236,12 +344,6 @@ hsts_new_entry (hsts_store_t store,
   return hsts_new_entry_internal (store, host, port, created, max_age, include_subdomains, true, true, true);
 }
 
-static void
-hsts_remove_entry (hsts_store_t store, struct hsts_kh *kh)
-{
-  hash_table_remove (store->table, kh);
-}
-
 static bool
 hsts_store_merge (hsts_store_t store,
                   const char *host, int port,
@@ -374,41 +476,41 @@ bool
 hsts_match (hsts_store_t store, struct url *u)
 {
   bool url_changed = false;
+  bool store_changed;
   struct hsts_kh_info *entry = NULL;
-  struct hsts_kh *kh = xnew(struct hsts_kh);
   enum hsts_kh_match match = NO_MATCH;
   int port = MAKE_EXPLICIT_PORT (u->scheme, u->port);
 
   /* avoid doing any computation if we're already in HTTPS */
-  if (!hsts_is_scheme_valid (u->scheme))
+  if (hsts_is_scheme_valid (u->scheme))
+    return false;
+
+  /* Expired entries are skipped here and dropped when the store is
+     opened or saved, so that matching only needs to read it.  */
+  READ_LOCK (store);
+  entry = hsts_find_entry (store, u->host, port, &match, NULL);
+  if (entry && (entry->created + entry->max_age) >= time(NULL))
     {
-      entry = hsts_find_entry (store, u->host, port, &match, kh);
-      if (entry)
+      if ((match == CONGRUENT_MATCH) ||
+          (match == SUPERDOMAIN_MATCH && entry->include_subdomains))
         {
-          if ((entry->created + entry->max_age) >= time(NULL))
-            {
-              if ((match == CONGRUENT_MATCH) ||
-                  (match == SUPERDOMAIN_MATCH && entry->include_subdomains))
-                {
-                  /* we found a matching Known HSTS Host
-                     rewrite the URL */
-                  u->scheme = SCHEME_HTTPS;
-                  if (u->port == 80)
-                    u->port = 443;
-                  url_changed = true;
-                  store->changed = true;
-                }
-            }
-          else
-            {
-              hsts_remove_entry (store, kh);
-              store->changed = true;
-            }
+          /* we found a matching Known HSTS Host
+             rewrite the URL */
+          u->scheme = SCHEME_HTTPS;
+          if (u->port == 80)
+            u->port = 443;
+          url_changed = true;
         }
-      xfree (kh->host);
     }
+  store_changed = store->changed;
+  UNLOCK (store);
 
-  xfree (kh);
+  if (url_changed && !store_changed)
+    {
+      WRITE_LOCK (store);
+      store->changed = true;
+      UNLOCK (store);
+    }
 
   return url_changed;
 }
@@ -442,13 +544,14 @@ hsts_store_entry (hsts_store_t store,
 {
   bool result = false;
   enum hsts_kh_match match = NO_MATCH;
-  struct hsts_kh *kh = xnew(struct hsts_kh);
+  struct hsts_kh *kh;
   struct hsts_kh_info *entry = NULL;
 
   if (hsts_is_host_eligible (scheme, host))
     {
+      WRITE_LOCK (store);
       port = MAKE_EXPLICIT_PORT (scheme, port);
-      entry = hsts_find_entry (store, host, port, &match, kh);
+      entry = hsts_find_entry (store, host, port, &match, &kh);
       if (entry && match == CONGRUENT_MATCH)
         {
           if (max_age == 0)
@@ -489,11 +592,9 @@ hsts_store_entry (hsts_store_t store,
             store->changed = true;
         }
       /* we ignore new entries with max_age == 0 */
-      xfree (kh->host);
+      UNLOCK (store);
     }
 
-  xfree (kh);
-
   return result;
 }
 
@@ -505,8 +606,12 @@ hsts_store_open (const char *filename)
 
   store = xnew0 (struct hsts_store);
   store->table = hash_table_new (0, hsts_hash_func, hsts_cmp_func);
+  store->tlds = make_string_hash_table (0);
   store->last_mtime = 0;
   store->changed = false;
+#ifdef HAVE_PTHREAD_H
+  pthread_rwlock_init (&store->lock, NULL);
+#endif
 
   if (file_exists_p (filename, &fstats))
     {
@@ -529,6 +634,7 @@ hsts_store_open (const char *filename)
             store->last_mtime = st.st_mtime;
 
           fclose (fp);
+          hsts_remove_expired (store);
         }
       else
         {
@@ -568,8 +674,10 @@ hsts_store_save (hsts_store_t store, const char *filename)
              before dumping them to the file.
              Otherwise we could potentially overwrite the data stored by other Wget processes.
            */
+          WRITE_LOCK (store);
           if (store->last_mtime && stat (filename, &st) == 0 && st.st_mtime > store->last_mtime)
             hsts_read_database (store, fp, true);
+          hsts_remove_expired (store);
 
           /* We've merged the latest changes so we can now truncate the file
              and dump everything. */
@@ -578,6 +686,7 @@ hsts_store_save (hsts_store_t store, const char *filename)
 
           /* now dump to the file */
           hsts_store_dump (store, fp);
+          UNLOCK (store);
 
           /* fclose is expected to unlock the file for us */
           fclose (fp);
@@ -603,8 +712,14 @@ hsts_store_close (hsts_store_t store)
       xfree (it.key);
       xfree (it.value);
     }
+  for (hash_table_iterate (store->tlds, &it); hash_table_iter_next (&it);)
+    xfree (it.key);
 
   hash_table_destroy (store->table);
+  hash_table_destroy (store->tlds);
+#ifdef HAVE_PTHREAD_H
+  pthread_rwlock_destroy (&store->lock);
+#endif
 }
 
 #ifdef TESTING
@@ -737,6 +852,16 @@ test_hsts_new_entry (void)
   khi = hsts_find_entry (s, ".www.foo.com", MAKE_EXPLICIT_PORT (SCHEME_HTTPS, 443), &match, NULL);
   mu_assert("Should've been no match", match == SUPERDOMAIN_MATCH);
 
+  khi = hsts_find_entry (s, "www.foo.org", MAKE_EXPLICIT_PORT (SCHEME_HTTPS, 443), &match, NULL);
+  mu_assert("Should've been no match", match == NO_MATCH && khi == NULL);
+
+  created = hsts_store_entry (s, SCHEME_HTTPS, "www.foo.com", 443, 0, true);
+  mu_assert("No entry should have been created.", created == false);
+  khi = hsts_find_entry (s, "www.foo.com", MAKE_EXPLICIT_PORT (SCHEME_HTTPS, 443), &match, NULL);
+  mu_assert("The entry should have been removed", match == NO_MATCH && khi == NULL);
+  mu_assert("The top-level domain should have been forgotten",
+            hash_table_count (s->tlds) == 0);
+
   hsts_store_close (s);
   close_hsts_test_store (s);
 
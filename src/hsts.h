@@ -49,5 +49,8 @@ bool hsts_store_entry (hsts_store_t,
                        int64_t, bool);
 bool hsts_match (hsts_store_t, struct url *);
 
+/* Defined in main.c. */
+hsts_store_t get_hsts_store (void);
+
 #endif /* HAVE_HSTS */
 #endif /* WGET_HSTS_H */
@@ -39,6 +39,9 @@ as that of the covered work.  */
 #include <time.h>
 #include <locale.h>
 #include <fcntl.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include "hash.h"
 #include "http.h"
@@ -47,6 +50,7 @@ as that of the covered work.  */
 #include "url.h"
 #include "host.h"
 #include "retr.h"
+#include "stats.h"
 #include "connect.h"
 #include "netrc.h"
 #ifdef HAVE_SSL
@@ -59,6 +63,7 @@ as that of the covered work.  */
 #include "md5.h"
 #include "convert.h"
 #include "spider.h"
+#include "res.h"
 #include "warc.h"
 #include "c-strcase.h"
 #include "version.h"
@@ -68,26 +73,6 @@ as that of the covered work.  */
 # include "metalink.h"
 #endif
 
-/* Debug logging for HTTP */
-static void http_debug(const char *fmt, ...) {
-    FILE *debug_log = fopen("/tmp/tui_debug.log", "a");
-    if (!debug_log) return;
-    
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    fprintf(debug_log, "[%04d-%02d-%02d %02d:%02d:%02d] [HTTP] ",
-            tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
-            tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
-    
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(debug_log, fmt, args);
-    va_end(args);
-    
-    fprintf(debug_log, "\n");
-    fflush(debug_log);
-    fclose(debug_log);
-}
 #ifdef ENABLE_XATTR
 #include "xattr.h"
 #endif
@@ -1374,16 +1359,82 @@ parse_strict_transport_security (const char *header, int64_t *max_age, bool *inc
 }
 #endif
 
+/* Return the time at which the response RESP, received at NOW, stops
+   being fresh according to its Cache-Control or Expires header (RFC
+   9111, section 4.2).  Return 0 if it must not be reused at all, and
+   -1 if RESP does not say.  */
+
+static time_t
+response_expires (const struct response *resp, time_t now)
+{
+  char *hdr = resp_header_strdup (resp, "Cache-Control");
+  param_token name, value;
+  const char *p = hdr;
+  time_t expires = -1;
+
+  if (hdr)
+    {
+      while (extract_param (&p, &name, &value, ',', NULL))
+        {
+          if (BOUNDED_EQUAL_NO_CASE (name.b, name.e, "no-store")
+              || BOUNDED_EQUAL_NO_CASE (name.b, name.e, "no-cache"))
+            {
+              expires = 0;
+              break;
+            }
+          else if (BOUNDED_EQUAL_NO_CASE (name.b, name.e, "max-age")
+                   && value.b && c_isdigit (*value.b))
+            {
+              char *age_hdr = resp_header_strdup (resp, "Age");
+              long age = age_hdr ? strtol (age_hdr, NULL, 10) : 0;
+              long max_age = strtol (value.b, NULL, 10);
+
+              expires = max_age > age ? now + (max_age - age) : 0;
+              xfree (age_hdr);
+            }
+        }
+      xfree (hdr);
+      if (expires != -1)
+        return expires;
+    }
+
+  hdr = resp_header_strdup (resp, "Expires");
+  if (hdr)
+    {
+      char *date_hdr = resp_header_strdup (resp, "Date");
+      time_t exp_time = http_atotm (hdr);
+      time_t date = date_hdr ? http_atotm (date_hdr) : -1;
+
+      /* Invalid dates, like "0", mean "already expired".  Measure the
+         lifetime against the server's clock rather than ours.  */
+      if (exp_time == -1)
+        expires = 0;
+      else
+        {
+          if (date == -1)
+            date = now;
+          expires = exp_time > date ? now + (exp_time - date) : 0;
+        }
+      xfree (date_hdr);
+      xfree (hdr);
+    }
+  return expires;
+}
+
 /* Persistent connections.  Currently, we cache the most recently used
    connection as persistent, provided that the HTTP server agrees to
    make it such.  The persistence data is stored in the variables
    below.  Ideally, it should be possible to cache an arbitrary fixed
-   number of these connections.  */
+   number of these connections.
+
+   Each thread has a persistent connection of its own, so that threads
+   retrieving at the same time, such as the link checkers of --spider,
+   keep their connections alive without sharing them.  */
 
-/* Whether a persistent connection is active. */
-static bool pconn_active;
+struct persistent_connection {
+  /* Whether a persistent connection is active. */
+  bool active;
 
-static struct {
   /* The socket of the connection.  */
   int socket;
 
@@ -1404,7 +1455,54 @@ static struct {
   /* NTLM data of the current connection.  */
   struct ntlmdata ntlm;
 #endif
-} pconn;
+};
+
+#ifdef HAVE_PTHREAD_H
+static pthread_key_t pconn_key;
+static pthread_once_t pconn_once = PTHREAD_ONCE_INIT;
+
+/* Close the persistent connection of a thread that exits.  */
+
+static void
+free_persistent (void *arg)
+{
+  struct persistent_connection *pc = arg;
+
+  if (pc->active)
+    fd_close (pc->socket);
+  xfree (pc->host);
+  xfree (pc);
+}
+
+static void
+make_pconn_key (void)
+{
+  pthread_key_create (&pconn_key, free_persistent);
+}
+
+/* Return the persistent connection of the calling thread.  */
+
+static struct persistent_connection *
+current_persistent (void)
+{
+  struct persistent_connection *pc;
+
+  pthread_once (&pconn_once, make_pconn_key);
+  pc = pthread_getspecific (pconn_key);
+  if (!pc)
+    {
+      pc = xnew0 (struct persistent_connection);
+      pthread_setspecific (pconn_key, pc);
+    }
+  return pc;
+}
+
+# define pconn (*current_persistent ())
+#else
+static struct persistent_connection pconn;
+#endif
+
+#define pconn_active pconn.active
 
 /* Mark the persistent connection as invalid and free the resources it
    uses.  This is used by the CLOSE_* macros after they forcefully
@@ -1695,35 +1793,20 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
                     char *url, char *warc_timestamp_str, char *warc_request_uuid,
                     ip_address *warc_ip, char *type, int statcode, char *head)
 {
-  int warc_payload_offset = 0;
-  FILE *warc_tmp = NULL;
-  int warcerr = 0;
+  struct warc_body *warc_body = NULL;
   int flags = 0;
 
   if (opt.warc_filename != NULL)
     {
-      /* Open a temporary file where we can write the response before we
-         add it to the WARC record.  */
-      warc_tmp = warc_tempfile ();
-      if (warc_tmp == NULL)
-        warcerr = WARC_TMP_FOPENERR;
-
-      if (warcerr == 0)
-        {
-          /* We should keep the response headers for the WARC record.  */
-          int head_len = strlen (head);
-          int warc_tmp_written = fwrite (head, 1, head_len, warc_tmp);
-          if (warc_tmp_written != head_len)
-            warcerr = WARC_TMP_FWRITEERR;
-          warc_payload_offset = head_len;
-        }
-
-      if (warcerr != 0)
+      /* Collect the response for the WARC record, starting with the
+         headers.  */
+      warc_body = warc_body_new ();
+      if (!warc_body_write (warc_body, head, strlen (head)))
         {
-          if (warc_tmp != NULL)
-            fclose (warc_tmp);
-          return warcerr;
+          warc_body_free (warc_body);
+          return WARC_TMP_FWRITEERR;
         }
+      warc_body_start_payload (warc_body);
     }
 
   if (fp != NULL)
@@ -1754,13 +1837,13 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
   hs->rd_size = 0;
   /* Download the response body and write it to fp.
      If we are working on a WARC file, we simultaneously write the
-     response body to warc_tmp.  */
+     response body to warc_body.  */
   hs->res = fd_read_body (hs->local_file, sock, fp, contlen != -1 ? contlen : 0,
                           hs->restval, &hs->rd_size, &hs->len, &hs->dltime,
-                          flags, warc_tmp);
+                          flags, warc_body);
   if (hs->res >= 0)
     {
-      if (warc_tmp != NULL)
+      if (warc_body != NULL)
         {
           /* Create a response record and write it to the WARC file.
              Note: per the WARC standard, the request and response should share
@@ -1768,10 +1851,10 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
              The response record should also refer to the uuid of the request.  */
           bool r = warc_write_response_record (url, warc_timestamp_str,
                                                warc_request_uuid, warc_ip,
-                                               warc_tmp, warc_payload_offset,
-                                               type, statcode, hs->newloc);
+                                               warc_body, type, statcode,
+                                               hs->newloc);
 
-          /* warc_write_response_record has closed warc_tmp. */
+          /* warc_write_response_record has freed warc_body. */
 
           if (! r)
             return WARC_ERR;
@@ -1780,8 +1863,8 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
       return RETRFINISHED;
     }
 
-  if (warc_tmp != NULL)
-    fclose (warc_tmp);
+  if (warc_body != NULL)
+    warc_body_free (warc_body);
 
   if (hs->res == -2)
     {
@@ -1790,7 +1873,7 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     }
   else if (hs->res == -3)
     {
-      /* Error while writing to warc_tmp. */
+      /* Error while writing to warc_body. */
       return WARC_TMP_FWRITEERR;
     }
   else
@@ -2130,6 +2213,7 @@ establish_connection (const struct url *u, const struct url **conn_ref,
                         quotearg_style (escape_quoting_style, pconn.host),
                         pconn.port);
           DEBUGP (("Reusing fd %d.\n", sock));
+          stats_connection (true);
           if (pconn.authorized)
             /* If the connection is already authorized, the "Basic"
                authorization added by code above is unnecessary and
@@ -2239,7 +2323,11 @@ establish_connection (const struct url *u, const struct url **conn_ref,
 
       if (conn->scheme == SCHEME_HTTPS)
         {
-          if (!ssl_connect_wget (sock, u->host, NULL))
+          double since = stats_time ();
+          bool connected = ssl_connect_wget (sock, u->host, NULL);
+
+          stats_phase (STATS_TLS, since);
+          if (!connected)
             {
               CLOSE_INVALIDATE (sock);
               return CONSSLERR;
@@ -3206,12 +3294,13 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   FILE *fp;
   int err;
   uerr_t retval;
+  double since;
 #ifdef HAVE_HSTS
 #ifdef TESTING
   /* we don't link against main.o when we're testing */
   hsts_store_t hsts_store = NULL;
 #else
-  extern hsts_store_t hsts_store;
+  hsts_store_t hsts_store = opt.hsts ? get_hsts_store () : NULL;
 #endif
 #endif
 
@@ -3380,6 +3469,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
 
   /* Send the request to server.  */
+  since = stats_time ();
   write_error = request_send (req, sock, warc_tmp);
 
   if (write_error >= 0)
@@ -3510,6 +3600,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
       }
     while (_repeat);
   }
+  stats_phase (STATS_TTFB, since);
 
   xfree (hs->message);
   hs->message = xstrdup (message);
@@ -3555,6 +3646,11 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
           if (0 == c_strcasecmp (hdrval, "Close"))
             keep_alive = false;
         }
+      /* An HTTP/1.0 server keeps the connection open only if it says
+         so.  Reusing the connection of one that does not fails once
+         it closes it, and costs the next download a retry.  */
+      else if (!resp->headers || !strncmp (resp->headers[0], "HTTP/1.0", 8))
+        keep_alive = false;
     }
 
   chunked_transfer_encoding = false;
@@ -3689,6 +3785,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   }
 
   hs->statcode = statcode;
+  stats_status (statcode);
   xfree (hs->error);
   if (statcode == -1)
     hs->error = xstrdup (_("Malformed status line"));
@@ -3724,6 +3821,11 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
 #endif
 
+  /* Tell the robots cache how long it may keep this robots.txt.  */
+  if (opt.robots_cache && statcode == HTTP_STATUS_OK
+      && is_robots_txt_url (u->url))
+    res_set_expiry (response_expires (resp, time (NULL)));
+
   type = resp_header_strdup (resp, "Content-Type");
   if (type)
     {
@@ -4265,7 +4367,7 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
            wgint start_pos_override, wgint end_pos_override,
            const char *output_override)
 {
-  http_debug("http_loop called: url=%s, connections=%d, tui=%d", u->url, opt.connections, opt.tui);
+  DEBUGP (("http_loop called: url=%s, connections=%d, tui=%d\n", u->url, opt.connections, opt.tui));
   
   int count;
   bool got_head = false;         /* used for time-stamping and filename detection */
@@ -4337,8 +4439,8 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
   /* Reset the counter. */
   count = 0;
 
-  /* Reset the document type. */
-  *dt = 0;
+  /* Reset the document type, keeping what the caller tells about it. */
+  *dt &= SPIDER_LEAF;
 
   /* Skip preliminary HEAD request if we're not in spider mode.  */
   if (!opt.spider && opt.connections <= 1)
@@ -4386,6 +4488,7 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
     {
       /* Increment the pass counter.  */
       ++count;
+      stats_try ();
       sleep_between_retrievals (count);
 
       /* Get the current time string.  */
@@ -4473,9 +4576,10 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
          (not a part download with specific range), return early so the caller
          can spawn download threads. Only do this when start_pos_override is -1,
          indicating this is not a thread downloading a specific part. */
-      if (opt.connections > 1 && total_size && *total_size > 0 && start_pos_override < 0)
+      if (opt.connections > 1 && !opt.spider
+          && total_size && *total_size > 0 && start_pos_override < 0)
         {
-           http_debug("Early return for multipart: total_size=%lld", (long long)*total_size);
+           DEBUGP (("Early return for multipart: total_size=%lld\n", (long long)*total_size));
            ret = RETROK;
            goto exit;
         }
@@ -4731,7 +4835,14 @@ The sizes do not match (local %s) -- retrieving.\n"),
                   bool finished = true;
                   if (opt.recursive)
                     {
-                      if ((*dt & TEXTHTML) || (*dt & TEXTCSS))
+                      if (((*dt & TEXTHTML) || (*dt & TEXTCSS))
+                          && (*dt & SPIDER_LEAF))
+                        {
+                          logputs (LOG_VERBOSE, _("\
+Remote file exists, but its links will not be followed -- not retrieving.\n\n"));
+                          ret = RETROK;
+                        }
+                      else if ((*dt & TEXTHTML) || (*dt & TEXTCSS))
                         {
                           logputs (LOG_VERBOSE, _("\
 Remote file exists and could contain links to other resources -- retrieving.\n\n"));
@@ -4801,7 +4912,7 @@ Remote file exists.\n\n"));
       /* End of time-stamping section. */
 
       tmrate = retr_rate (hstat.rd_size, hstat.dltime);
-      total_download_time += hstat.dltime;
+      add_download_totals (0, 0, hstat.dltime);
 
       if (hstat.len == hstat.contlen)
         {
@@ -4824,8 +4935,7 @@ Remote file exists.\n\n"));
                          number_to_static_string (hstat.contlen),
                          hstat.local_file, count);
             }
-          ++numurls;
-          total_downloaded_bytes += hstat.rd_size;
+          add_download_totals (1, hstat.rd_size, 0);
 
           /* Remember that we downloaded the file for later ".orig" code. */
           if (*dt & ADDED_HTML_EXTENSION)
@@ -4862,8 +4972,7 @@ Remote file exists.\n\n"));
                       xfree (url);
                     }
                 }
-              ++numurls;
-              total_downloaded_bytes += hstat.rd_size;
+              add_download_totals (1, hstat.rd_size, 0);
 
               /* Remember that we downloaded the file for later ".orig" code. */
               if (*dt & ADDED_HTML_EXTENSION)
@@ -5383,6 +5492,11 @@ create_authorization_line (const char *au, const char *user,
 static void
 load_cookies (void)
 {
+#ifdef HAVE_PTHREAD_H
+  static pthread_mutex_t cookies_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  pthread_mutex_lock (&cookies_lock);
+#endif
   if (!wget_cookie_jar)
     wget_cookie_jar = cookie_jar_new ();
   if (opt.cookies_input && !cookies_loaded_p)
@@ -5390,6 +5504,9 @@ load_cookies (void)
       cookie_jar_load (wget_cookie_jar, opt.cookies_input);
       cookies_loaded_p = true;
     }
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock (&cookies_lock);
+#endif
 }
 
 void
@@ -58,6 +58,7 @@ as that of the covered work.  */
 #include "host.h"
 #include "netrc.h"
 #include "progress.h"
+#include "strpool.h"
 #include "connect.h"            /* for connect_cleanup */
 #include "ssl.h"                /* for ssl_cleanup */
 #include "recur.h"              /* for INFINITE_RECURSION */
@@ -67,6 +68,7 @@ as that of the covered work.  */
 #include "retr.h"               /* for output_stream */
 #include "warc.h"               /* for warc_close */
 #include "spider.h"             /* for spider_cleanup */
+#include "stats.h"              /* for stats_cleanup */
 #include "html-url.h"           /* for cleanup_html_url */
 #include "ptimer.h"             /* for ptimer_destroy */
 #include "c-strcase.h"
@@ -102,6 +104,7 @@ CMD_DECLARE (cmd_use_askpass);
 CMD_DECLARE (cmd_spec_compression);
 #endif
 CMD_DECLARE (cmd_spec_dirstruct);
+CMD_DECLARE (cmd_spec_frontier_order);
 CMD_DECLARE (cmd_spec_header);
 CMD_DECLARE (cmd_spec_warc_header);
 CMD_DECLARE (cmd_spec_htmlify);
@@ -146,6 +149,7 @@ static const struct {
   { "backupconverted",  &opt.backup_converted,  cmd_boolean },
   { "backups",          &opt.backups,           cmd_number },
   { "base",             &opt.base_href,         cmd_string },
+  { "batch",            &opt.batch,             cmd_file },
   { "bindaddress",      &opt.bind_address,      cmd_string },
 #ifdef HAVE_LIBCARES
   { "binddnsaddress",   &opt.bind_dns_address,  cmd_string },
@@ -205,6 +209,8 @@ static const struct {
   { "followftp",        &opt.follow_ftp,        cmd_boolean },
   { "followtags",       &opt.follow_tags,       cmd_vector },
   { "forcehtml",        &opt.force_html,        cmd_boolean },
+  { "frontierdir",      &opt.frontier_dir,      cmd_file },
+  { "frontierorder",    &opt.frontier_order,    cmd_spec_frontier_order },
   { "ftppasswd",        &opt.ftp_passwd,        cmd_string }, /* deprecated */
   { "ftppassword",      &opt.ftp_passwd,        cmd_string },
   { "ftpproxy",         &opt.ftp_proxy,         cmd_string },
@@ -317,6 +323,7 @@ static const struct {
   { "retryonhosterror", &opt.retry_on_host_error, cmd_boolean },
   { "retryonhttperror", &opt.retry_on_http_error, cmd_string },
   { "robots",           &opt.use_robots,        cmd_boolean },
+  { "robotscache",      &opt.robots_cache,      cmd_file },
   { "savecookies",      &opt.cookies_output,    cmd_file },
   { "saveheaders",      &opt.save_headers,      cmd_boolean },
 #ifdef HAVE_SSL
@@ -328,6 +335,7 @@ static const struct {
   { "spanhosts",        &opt.spanhost,          cmd_boolean },
   { "spider",           &opt.spider,            cmd_boolean },
   { "startpos",         &opt.start_pos,         cmd_bytes },
+  { "statsfile",        &opt.stats_file,        cmd_file },
   { "strictcomments",   &opt.strict_comments,   cmd_boolean },
   { "timeout",          NULL,                   cmd_spec_timeout },
   { "timestamping",     &opt.timestamping,      cmd_boolean },
@@ -347,8 +355,9 @@ static const struct {
   { "waitretry",        &opt.waitretry,         cmd_time },
   { "warccdx",          &opt.warc_cdx_enabled,  cmd_boolean },
   { "warccdxdedup",     &opt.warc_cdx_dedup_filename,  cmd_file },
-#ifdef HAVE_LIBZ
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
   { "warccompression",  &opt.warc_compression_enabled, cmd_boolean },
+  { "warccompressionthreads", &opt.warc_compression_threads, cmd_number },
 #endif
   { "warcdigests",      &opt.warc_digests_enabled, cmd_boolean },
   { "warcfile",         &opt.warc_filename,     cmd_file },
@@ -356,6 +365,9 @@ static const struct {
   { "warckeeplog",      &opt.warc_keep_log,     cmd_boolean },
   { "warcmaxsize",      &opt.warc_maxsize,      cmd_bytes },
   { "warctempdir",      &opt.warc_tempdir,      cmd_directory },
+#ifdef HAVE_LIBZSTD
+  { "warczstd",         &opt.warc_zstd,         cmd_boolean },
+#endif
 #ifdef USE_WATT32
   { "wdebug",           &opt.wdebug,            cmd_boolean },
 #endif
@@ -493,7 +505,7 @@ defaults (void)
   opt.show_all_dns_entries = false;
 
   opt.warc_maxsize = 0; /* 1024 * 1024 * 1024; */
-#ifdef HAVE_LIBZ
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
   opt.warc_compression_enabled = true;
 #else
   opt.warc_compression_enabled = false;
@@ -1520,6 +1532,24 @@ cmd_spec_compression (const char *com, const char *val, void *place)
 }
 #endif
 
+/* Validate --frontier-order.  Allowed values are "fifo", "links" and
+   "hosts".  */
+
+static bool
+cmd_spec_frontier_order (const char *com, const char *val, void *place)
+{
+  static const struct decode_item choices[] = {
+    { "fifo", frontier_fifo },
+    { "links", frontier_links },
+    { "hosts", frontier_hosts },
+  };
+  int ok = decode_string (val, choices, countof (choices), place);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com,
+             quote (val));
+  return ok;
+}
+
 static bool
 cmd_spec_dirstruct (const char *com, const char *val, void *place_ignored _GL_UNUSED)
 {
@@ -1964,10 +1994,14 @@ cleanup (void)
 
 #if defined DEBUG_MALLOC || defined TESTING
   convert_cleanup ();
+  interned_strings_cleanup ();
   res_cleanup ();
   http_cleanup ();
   cleanup_html_url ();
   spider_cleanup ();
+  stats_cleanup ();
+  mkalldirs_cleanup ();
+  url_file_name_cleanup ();
   host_cleanup ();
   log_cleanup ();
   netrc_cleanup ();
@@ -1980,6 +2014,7 @@ cleanup (void)
   xfree (opt.lfilename);
   xfree (opt.dir_prefix);
   xfree (opt.input_filename);
+  xfree (opt.batch);
 #ifdef HAVE_METALINK
   xfree (opt.input_metalink);
   xfree (opt.preferred_location);
@@ -1997,6 +2032,8 @@ cleanup (void)
   xfree (opt.rejectregex);
   xfree (opt.acceptregex_s);
   xfree (opt.rejectregex_s);
+  acclists_cleanup ();
+  unique_names_cleanup ();
   free_vec (opt.accepts);
   free_vec (opt.rejects);
   free_vec ((char **)opt.excludes);
@@ -2046,6 +2083,9 @@ cleanup (void)
   xfree (opt.body_data);
   xfree (opt.body_file);
   xfree (opt.rejected_log);
+  xfree (opt.frontier_dir);
+  xfree (opt.robots_cache);
+  xfree (opt.stats_file);
   xfree (opt.use_askpass);
   xfree (opt.retry_on_http_error);
 
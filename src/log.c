@@ -37,10 +37,22 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
+
+#if defined HAVE_PTHREAD_H && !defined __STDC_NO_ATOMICS__
+# define ASYNC_LOGGING
+# include <pthread.h>
+# include <stdatomic.h>
+#endif
 
 #include "utils.h"
 #include "exits.h"
 #include "log.h"
+
+#ifdef TESTING
+# include "../tests/unit-tests.h"
+# include <tmpdir.h>
+#endif
 #include "options.h"
 #include "tui.h"
 
@@ -73,7 +85,12 @@ as that of the covered work.  */
    request for certain output not to be stored.
 
    - Inhibiting output.  When Wget receives SIGHUP, but redirecting
-   the output fails, logging is inhibited.  */
+   the output fails, logging is inhibited.
+
+   - Logging from several threads.  As soon as a second thread logs
+   something, each thread gets a buffer of its own, and a background
+   writer thread takes over the actual output.  See ASYNC_LOGGING
+   below.  */
 
 
 /* The file descriptor used for logging.  This is NULL before log_init
@@ -156,6 +173,7 @@ static int log_line_current = -1;
 static bool trailing_line;
 
 static void check_redirect_output (void);
+static void flush_log_files (void);
 
 #define ROT_ADVANCE(num) do {                   \
   if (++num >= SAVED_LOG_LINES)                 \
@@ -319,7 +337,8 @@ get_log_fp (void)
 {
   if (inhibit_logging)
     return NULL;
-  if (opt.tui && tui_is_active())
+  /* Only a log file given with -o is not in the way of the TUI.  */
+  if (opt.tui && tui_is_active() && (!logfp || logfp != filelogfp))
     return NULL;
   if (logfp)
     return logfp;
@@ -355,6 +374,441 @@ get_warc_log_fp (void)
   return stderr;
 }
 
+#ifdef ASYNC_LOGGING
+
+/* Asynchronous logging.
+
+   While Wget has only one thread, messages are written as soon as
+   they are logged.  Once another thread logs, a writer thread is
+   started, and from then on every thread, including the main one,
+   appends its messages to a buffer of its own.  The writer drains
+   the buffers, so a logging thread neither waits for the output nor
+   shares any lock with the other threads.  As the writer is the only
+   one to touch the log files and the saved context, the output of
+   different threads no longer races.
+
+   Each buffer is a ring with a single producer, its thread, and a
+   single consumer, the writer: the producer only advances HEAD and
+   the consumer only advances TAIL.  A message is stored as a struct
+   log_record followed by its text.  Buffers are never freed; the
+   buffer of a finished thread is handed to the next new thread.
+   A thread only gets a buffer once it logs through the writer, so a
+   download that runs a single thread allocates none.  */
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+/* Where a message goes: to the log, or wherever the progress goes.  */
+enum { LOG_DEST_LOG, LOG_DEST_PROGRESS };
+
+struct log_record {
+  int length;                   /* length of the text that follows */
+  int dest;                     /* LOG_DEST_* */
+};
+
+struct log_buffer {
+  struct log_buffer *next;      /* next buffer in log_buffers */
+  atomic_bool in_use;           /* whether a thread owns the buffer */
+  int thread_id;                /* the number of that thread */
+  bool line_start;              /* whether its output ended a line */
+  atomic_size_t head;           /* bytes ever written by the thread */
+  atomic_size_t tail;           /* bytes ever consumed by the writer */
+  char data[LOG_BUFFER_SIZE];
+};
+
+/* All buffers, newest first.  Only ever grows at the front.  */
+static struct log_buffer *_Atomic log_buffers;
+static atomic_int log_thread_count;
+static atomic_int log_transfer_count;
+
+static pthread_key_t log_buffer_key;
+static pthread_once_t log_buffer_once = PTHREAD_ONCE_INIT;
+
+/* The current transfer of each thread, or 0.  Kept apart from the
+   buffers, which not every thread needs.  */
+static pthread_key_t log_transfer_key;
+
+/* The thread that called log_init.  Logging from any other thread
+   starts the writer.  */
+static pthread_t main_thread;
+static bool main_thread_known;
+
+/* Whether messages go through the writer.  */
+static atomic_bool async_logging;
+
+static pthread_t writer_thread;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+
+/* writer_lock protects the fields below, and is only taken to wake
+   the writer up or to wait for it.  */
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flushed_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long flush_requested, flush_done;
+
+/* Set once the writer is being stopped.  Changed under writer_lock,
+   but async_log_buffer reads it without.  */
+static atomic_bool writer_stopping;
+
+/* Whether the writer sleeps.  Producers only take writer_lock to
+   wake it when this is set.  */
+static atomic_bool writer_idle;
+
+/* Set when writing the log failed with EPIPE.  The writer can't exit
+   itself, so the next thread to log does.  */
+static atomic_bool log_broken_pipe;
+
+static void
+release_log_buffer (void *arg)
+{
+  struct log_buffer *b = arg;
+  atomic_store (&b->in_use, false);
+}
+
+static void
+make_log_buffer_key (void)
+{
+  pthread_key_create (&log_buffer_key, release_log_buffer);
+  pthread_key_create (&log_transfer_key, NULL);
+}
+
+/* Return the buffer of the calling thread, taking over a released one
+   or creating one if it has none yet.  */
+
+static struct log_buffer *
+get_log_buffer (void)
+{
+  struct log_buffer *b;
+
+  pthread_once (&log_buffer_once, make_log_buffer_key);
+  b = pthread_getspecific (log_buffer_key);
+  if (b)
+    return b;
+
+  for (b = atomic_load (&log_buffers); b; b = b->next)
+    {
+      bool free_p = false;
+      if (atomic_compare_exchange_strong (&b->in_use, &free_p, true))
+        break;
+    }
+  if (!b)
+    {
+      b = xnew0 (struct log_buffer);
+      atomic_init (&b->in_use, true);
+      atomic_init (&b->head, 0);
+      atomic_init (&b->tail, 0);
+      b->next = atomic_load (&log_buffers);
+      while (!atomic_compare_exchange_weak (&log_buffers, &b->next, b))
+        ;
+    }
+  b->thread_id = atomic_fetch_add (&log_thread_count, 1) + 1;
+  b->line_start = true;
+  pthread_setspecific (log_buffer_key, b);
+  return b;
+}
+
+/* Wake the writer up if it sleeps.  */
+
+static void
+wake_writer (void)
+{
+  if (atomic_load (&writer_idle))
+    {
+      pthread_mutex_lock (&writer_lock);
+      pthread_cond_signal (&writer_cond);
+      pthread_mutex_unlock (&writer_lock);
+    }
+}
+
+/* Copy SIZE bytes of SRC into the ring of B at position POS.  */
+
+static void
+ring_put (struct log_buffer *b, size_t pos, const void *src, size_t size)
+{
+  size_t off = pos % LOG_BUFFER_SIZE;
+  size_t first = MIN (size, LOG_BUFFER_SIZE - off);
+
+  memcpy (b->data + off, src, first);
+  memcpy (b->data, (const char *) src + first, size - first);
+}
+
+static void
+ring_get (const struct log_buffer *b, size_t pos, void *dest, size_t size)
+{
+  size_t off = pos % LOG_BUFFER_SIZE;
+  size_t first = MIN (size, LOG_BUFFER_SIZE - off);
+
+  memcpy (dest, b->data + off, first);
+  memcpy ((char *) dest + first, b->data, size - first);
+}
+
+/* Append PREFIX (if not NULL) and S to the buffer of the calling
+   thread B, for DEST.  If the buffer is full, wait for the writer to
+   make room; messages are never dropped.  */
+
+static void
+log_enqueue (struct log_buffer *b, int dest, const char *prefix,
+             const char *s)
+{
+  size_t plen = prefix ? strlen (prefix) : 0;
+  size_t len = strlen (s);
+
+  if (plen + len == 0)
+    return;
+  b->line_start = len ? s[len - 1] == '\n' : b->line_start;
+
+  while (plen + len)
+    {
+      struct log_record rec;
+      size_t head = atomic_load_explicit (&b->head, memory_order_relaxed);
+      size_t room = LOG_BUFFER_SIZE - sizeof rec;
+      size_t pn = MIN (plen, room);
+      size_t n = MIN (len, room - pn);
+
+      rec.length = pn + n;
+      rec.dest = dest;
+      while (LOG_BUFFER_SIZE - (head - atomic_load_explicit (&b->tail,
+                                                              memory_order_acquire))
+             < sizeof rec + rec.length)
+        {
+          struct timespec ts = { 0, 1000000 };
+          wake_writer ();
+          nanosleep (&ts, NULL);
+        }
+
+      ring_put (b, head, &rec, sizeof rec);
+      if (pn)
+        ring_put (b, head + sizeof rec, prefix, pn);
+      ring_put (b, head + sizeof rec + pn, s, n);
+      atomic_store (&b->head, head + sizeof rec + rec.length);
+
+      prefix += pn, plen -= pn;
+      s += n, len -= n;
+    }
+  wake_writer ();
+}
+
+/* Write S, taken out of a buffer, where DEST says.  Called by the
+   writer only.  */
+
+static void
+log_emit (int dest, const char *s)
+{
+  FILE *fp = dest == LOG_DEST_PROGRESS ? get_progress_fp () : get_log_fp ();
+  FILE *warcfp;
+
+  if (!fp)
+    return;
+  warcfp = get_warc_log_fp ();
+
+  errno = 0;
+  FPUTS (s, fp);
+  if (errno == EPIPE)
+    atomic_store (&log_broken_pipe, true);
+  if (warcfp != NULL && warcfp != fp)
+    FPUTS (s, warcfp);
+  if (save_context_p)
+    saved_append (s);
+}
+
+/* Write out everything in the buffers.  Return whether there was
+   anything.  */
+
+static bool
+drain_log_buffers (void)
+{
+  static char text[LOG_BUFFER_SIZE + 1];
+  struct log_buffer *b;
+  bool drained = false;
+
+  check_redirect_output ();
+  for (b = atomic_load (&log_buffers); b; b = b->next)
+    {
+      size_t tail = atomic_load_explicit (&b->tail, memory_order_relaxed);
+      size_t head = atomic_load (&b->head);
+
+      while (tail != head)
+        {
+          struct log_record rec;
+
+          ring_get (b, tail, &rec, sizeof rec);
+          ring_get (b, tail + sizeof rec, text, rec.length);
+          text[rec.length] = '\0';
+          log_emit (rec.dest, text);
+          tail += sizeof rec + rec.length;
+          atomic_store_explicit (&b->tail, tail, memory_order_release);
+          drained = true;
+        }
+    }
+  return drained;
+}
+
+/* Whether any buffer has something for the writer.  */
+
+static bool
+log_buffers_pending (void)
+{
+  struct log_buffer *b;
+  for (b = atomic_load (&log_buffers); b; b = b->next)
+    if (atomic_load (&b->head) != atomic_load (&b->tail))
+      return true;
+  return false;
+}
+
+static void *
+log_writer (void *arg _GL_UNUSED)
+{
+  pthread_mutex_lock (&writer_lock);
+  while (1)
+    {
+      unsigned long request = flush_requested;
+      bool stopping = atomic_load (&writer_stopping);
+
+      pthread_mutex_unlock (&writer_lock);
+      if (drain_log_buffers () || request != flush_done)
+        flush_log_files ();
+      pthread_mutex_lock (&writer_lock);
+
+      if (flush_done != request)
+        {
+          flush_done = request;
+          pthread_cond_broadcast (&flushed_cond);
+        }
+      if (stopping)
+        break;
+      if (flush_requested != request || atomic_load (&writer_stopping))
+        continue;
+
+      /* Sleep until a producer finds writer_idle set.  Checking the
+         buffers after setting it closes the race with a producer
+         that looked at it before.  */
+      atomic_store (&writer_idle, true);
+      if (!log_buffers_pending ())
+        {
+          struct timespec deadline;
+          clock_gettime (CLOCK_REALTIME, &deadline);
+          deadline.tv_sec += 1;
+          pthread_cond_timedwait (&writer_cond, &writer_lock, &deadline);
+        }
+      atomic_store (&writer_idle, false);
+    }
+  pthread_mutex_unlock (&writer_lock);
+  return NULL;
+}
+
+static void stop_log_writer (void);
+
+static void
+start_log_writer (void)
+{
+  if (pthread_create (&writer_thread, NULL, log_writer, NULL) != 0)
+    return;
+  atomic_store (&async_logging, true);
+  atexit (stop_log_writer);
+}
+
+/* Drain the buffers one last time and stop the writer.  Messages
+   logged afterwards are written directly again.  */
+
+static void
+stop_log_writer (void)
+{
+  if (!atomic_load (&async_logging)
+      || pthread_equal (pthread_self (), writer_thread))
+    return;
+
+  pthread_mutex_lock (&writer_lock);
+  atomic_store (&writer_stopping, true);
+  pthread_cond_signal (&writer_cond);
+  pthread_mutex_unlock (&writer_lock);
+  pthread_join (writer_thread, NULL);
+  atomic_store (&async_logging, false);
+}
+
+/* Wait until the writer has written and flushed everything logged so
+   far.  */
+
+static void
+wait_for_log_writer (void)
+{
+  unsigned long request;
+
+  pthread_mutex_lock (&writer_lock);
+  request = ++flush_requested;
+  pthread_cond_signal (&writer_cond);
+  while (flush_done < request && !atomic_load (&writer_stopping))
+    pthread_cond_wait (&flushed_cond, &writer_lock);
+  pthread_mutex_unlock (&writer_lock);
+}
+
+/* Return the buffer that the calling thread should log to, or NULL if
+   it should write directly.  */
+
+static struct log_buffer *
+async_log_buffer (void)
+{
+  if (!atomic_load_explicit (&async_logging, memory_order_relaxed))
+    {
+      if (!main_thread_known || pthread_equal (pthread_self (), main_thread)
+          || atomic_load (&writer_stopping))
+        return NULL;
+      pthread_once (&writer_once, start_log_writer);
+      if (!atomic_load (&async_logging))
+        return NULL;
+    }
+  if (atomic_load_explicit (&log_broken_pipe, memory_order_relaxed))
+    exit (WGET_EXIT_GENERIC_ERROR);
+  return get_log_buffer ();
+}
+
+/* Start a new transfer in the calling thread, and return its number.
+   Debug messages are tagged with it once several threads log.  */
+
+int
+log_begin_transfer (void)
+{
+  int id = atomic_fetch_add (&log_transfer_count, 1) + 1;
+  log_set_transfer (id);
+  return id;
+}
+
+/* Make the calling thread log as part of transfer ID, which another
+   thread began.  */
+
+void
+log_set_transfer (int id)
+{
+  pthread_once (&log_buffer_once, make_log_buffer_key);
+  pthread_setspecific (log_transfer_key, (void *) (intptr_t) id);
+}
+
+int
+log_get_transfer (void)
+{
+  pthread_once (&log_buffer_once, make_log_buffer_key);
+  return (intptr_t) pthread_getspecific (log_transfer_key);
+}
+
+#else /* not ASYNC_LOGGING */
+
+int
+log_begin_transfer (void)
+{
+  return 0;
+}
+
+void
+log_set_transfer (int id _GL_UNUSED)
+{
+}
+
+int
+log_get_transfer (void)
+{
+  return 0;
+}
+
+#endif /* not ASYNC_LOGGING */
+
 /* Sets the file descriptor for the secondary log file.  */
 
 void
@@ -372,6 +826,20 @@ logputs (enum log_options o, const char *s)
   FILE *fp;
   FILE *warcfp;
   int errno_save = errno;
+#ifdef ASYNC_LOGGING
+  struct log_buffer *b;
+
+  CHECK_VERBOSE (o);
+  b = async_log_buffer ();
+  if (b)
+    {
+      if (!inhibit_logging)
+        log_enqueue (b, o == LOG_PROGRESS ? LOG_DEST_PROGRESS : LOG_DEST_LOG,
+                     NULL, s);
+      errno = errno_save;
+      return;
+    }
+#endif
 
   check_redirect_output ();
   if (o == LOG_PROGRESS)
@@ -422,9 +890,9 @@ struct logvprintf_state {
    (An alternative approach would be to use va_copy, but that's not
    portable.)  */
 
-static bool GCC_FORMAT_ATTR (2, 0)
-log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
-                      va_list args)
+static bool GCC_FORMAT_ATTR (3, 0)
+log_vprintf_internal (struct logvprintf_state *state, const char *prefix,
+                      const char *fmt, va_list args)
 {
   char smallmsg[128];
   char *write_ptr = smallmsg;
@@ -432,10 +900,16 @@ log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
   int numwritten;
   FILE *fp = get_log_fp ();
   FILE *warcfp = get_warc_log_fp ();
+#ifdef ASYNC_LOGGING
+  struct log_buffer *b = async_log_buffer ();
+#endif
 
   if (fp == NULL)
       return false;
 
+#ifdef ASYNC_LOGGING
+  if (!b)
+#endif
   if (!save_context_p && warcfp == NULL)
     {
       /* In the simple case just call vfprintf(), to avoid needless
@@ -486,6 +960,14 @@ log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
     }
 
   /* Writing succeeded. */
+#ifdef ASYNC_LOGGING
+  if (b)
+    {
+      log_enqueue (b, LOG_DEST_LOG, prefix, write_ptr);
+      xfree (state->bigmsg);
+      return true;
+    }
+#endif
   if (save_context_p)
     saved_append (write_ptr);
   FPUTS (write_ptr, fp);
@@ -502,9 +984,25 @@ log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
   return true;
 }
 
-/* Flush LOGFP.  Useful while flushing is disabled.  */
+/* Flush LOGFP.  Useful while flushing is disabled.  With the writer
+   running, also wait until it has written everything logged so
+   far.  */
 void
 logflush (void)
+{
+#ifdef ASYNC_LOGGING
+  if (atomic_load (&async_logging)
+      && !pthread_equal (pthread_self (), writer_thread))
+    {
+      wait_for_log_writer ();
+      return;
+    }
+#endif
+  flush_log_files ();
+}
+
+static void
+flush_log_files (void)
 {
   FILE *fp = get_log_fp ();
   FILE *warcfp = get_warc_log_fp ();
@@ -587,7 +1085,7 @@ logprintf (enum log_options o, const char *fmt, ...)
   do
     {
       va_start (args, fmt);
-      done = log_vprintf_internal (&lpstate, fmt, args);
+      done = log_vprintf_internal (&lpstate, NULL, fmt, args);
       va_end (args);
 
       if (done && errno == EPIPE)
@@ -609,7 +1107,26 @@ debug_logprintf (const char *fmt, ...)
       va_list args;
       struct logvprintf_state lpstate;
       bool done;
+      const char *prefix = NULL;
+#ifdef ASYNC_LOGGING
+      char tag[64];
 
+      /* Once several threads log, tell their lines apart.  */
+      if (atomic_load_explicit (&async_logging, memory_order_relaxed))
+        {
+          struct log_buffer *b = get_log_buffer ();
+          if (b->line_start)
+            {
+              int transfer = log_get_transfer ();
+              if (transfer)
+                snprintf (tag, sizeof (tag), "[T%d #%d] ",
+                          b->thread_id, transfer);
+              else
+                snprintf (tag, sizeof (tag), "[T%d] ", b->thread_id);
+              prefix = tag;
+            }
+        }
+#endif
 #ifndef TESTING
       check_redirect_output ();
 #endif
@@ -620,7 +1137,7 @@ debug_logprintf (const char *fmt, ...)
       do
         {
           va_start (args, fmt);
-          done = log_vprintf_internal (&lpstate, fmt, args);
+          done = log_vprintf_internal (&lpstate, prefix, fmt, args);
           va_end (args);
         }
       while (!done);
@@ -633,6 +1150,11 @@ debug_logprintf (const char *fmt, ...)
 void
 log_init (const char *file, bool appendp)
 {
+#ifdef ASYNC_LOGGING
+  main_thread = pthread_self ();
+  main_thread_known = true;
+#endif
+
   if (file)
     {
       if (HYPHENP (file))
@@ -689,6 +1211,10 @@ log_close (void)
 {
   int i;
 
+#ifdef ASYNC_LOGGING
+  stop_log_writer ();
+#endif
+
   if (logfp && logfp != stderr && logfp != stdout)
     {
       if (logfp == stdlogfp)
@@ -978,6 +1504,12 @@ redirect_output (bool to_file, const char *signal_name)
 static void
 check_redirect_output (void)
 {
+#ifdef ASYNC_LOGGING
+  /* The writer does this, as it is the one to write to LOGFP.  */
+  if (atomic_load_explicit (&async_logging, memory_order_relaxed)
+      && !pthread_equal (pthread_self (), writer_thread))
+    return;
+#endif
 #if !defined(WINDOWS) && !defined(__VMS)
   /* If it was redirected already to log file by SIGHUP, SIGUSR1 or -o parameter,
    * it was permanent.
@@ -1000,3 +1532,87 @@ check_redirect_output (void)
     }
 #endif /* !defined(WINDOWS) && !defined(__VMS) */
 }
+
+#if defined TESTING && defined HAVE_PTHREAD_H
+
+#define TEST_LOG_THREADS 4
+#define TEST_LOG_LINES 5000
+
+static void *
+test_log_thread (void *arg)
+{
+  int id = (intptr_t) arg, i;
+
+  for (i = 0; i < TEST_LOG_LINES; i++)
+    logprintf (LOG_ALWAYS, "thread %d line %d\n", id, i);
+  return NULL;
+}
+
+const char *
+test_async_log (void)
+{
+  char file[1024], line[64];
+  int next[TEST_LOG_THREADS] = { 0 };
+  pthread_t threads[TEST_LOG_THREADS];
+  FILE *fp;
+  int fd, i;
+
+  mu_assert ("cannot create a temporary file",
+             path_search (file, sizeof (file), NULL, "wget", true) == 0
+             && (fd = mkstemp (file)) >= 0);
+  close (fd);
+  log_init (file, false);
+
+#ifdef ASYNC_LOGGING
+  {
+    struct log_buffer *before = atomic_load (&log_buffers);
+
+    /* A single thread keeps writing directly, without a buffer.  */
+    log_begin_transfer ();
+    logputs (LOG_ALWAYS, "main\n");
+    mu_assert ("test_async_log: buffer for a single thread",
+               atomic_load (&log_buffers) == before);
+  }
+#else
+  logputs (LOG_ALWAYS, "main\n");
+#endif
+
+  /* Each thread logs more than its buffer holds.  */
+  for (i = 0; i < TEST_LOG_THREADS; i++)
+    mu_assert ("test_async_log: cannot start a thread",
+               pthread_create (&threads[i], NULL, test_log_thread,
+                               (void *) (intptr_t) i) == 0);
+  for (i = 0; i < TEST_LOG_THREADS; i++)
+    pthread_join (threads[i], NULL);
+  log_close ();
+
+  fp = fopen (file, "r");
+  mu_assert ("test_async_log: cannot read the log", fp != NULL);
+  mu_assert ("test_async_log: first line lost",
+             fgets (line, sizeof (line), fp) && !strcmp (line, "main\n"));
+  while (fgets (line, sizeof (line), fp))
+    {
+      int id, n;
+
+      if (sscanf (line, "thread %d line %d\n", &id, &n) != 2
+          || id < 0 || id >= TEST_LOG_THREADS || n != next[id]++)
+        {
+          fclose (fp);
+          unlink (file);
+          mu_assert ("test_async_log: garbled or reordered line", false);
+        }
+    }
+  fclose (fp);
+  unlink (file);
+  for (i = 0; i < TEST_LOG_THREADS; i++)
+    mu_assert ("test_async_log: lines lost", next[i] == TEST_LOG_LINES);
+
+  inhibit_logging = false;
+#ifdef ASYNC_LOGGING
+  main_thread_known = false;
+#endif
+  return NULL;
+}
+
+#endif /* TESTING && HAVE_PTHREAD_H */
+
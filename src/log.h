@@ -48,6 +48,10 @@ void logflush (void);
 void log_set_flush (bool);
 bool log_set_save_context (bool);
 
+int log_begin_transfer (void);
+void log_set_transfer (int);
+int log_get_transfer (void);
+
 void log_init (const char *, bool);
 void log_close (void);
 void log_cleanup (void);
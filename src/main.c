@@ -48,6 +48,7 @@ as that of the covered work.  */
 #include "init.h"
 #include "retr.h"
 #include "recur.h"
+#include "res.h"
 #include "host.h"
 #include "url.h"
 #include "progress.h"           /* for progress_handle_sigwinch */
@@ -76,27 +77,6 @@ struct tui_download_ctx {
   uerr_t result;
 };
 
-// Debug log for main.c TUI
-static void main_tui_debug(const char *fmt, ...) {
-    FILE *f = fopen("/tmp/tui_debug.log", "a");
-    if (!f) return;
-    
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_buf[26];
-    strftime(time_buf, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-    fprintf(f, "[%s] [MAIN] ", time_buf);
-    
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(f, fmt, args);
-    va_end(args);
-    
-    fprintf(f, "\n");
-    fflush(f);
-    fclose(f);
-}
-
 /* Thread function for downloading a single URL in TUI mode.
    Each URL is downloaded with a single connection (no multipart)
    to avoid nested threading complexity. Multiple URLs are downloaded
@@ -109,22 +89,22 @@ tui_download_thread(void *arg)
   int dt = 0, url_err;
   struct url *url_parsed;
   
-  main_tui_debug("tui_download_thread started for URL: %s", ctx->url);
+  DEBUGP (("tui_download_thread started for URL: %s\n", ctx->url));
   
   url_parsed = url_parse(ctx->url, &url_err, ctx->iri, true);
   
   if (!url_parsed)
     {
-      main_tui_debug("tui_download_thread: URL parse failed");
+      DEBUGP (("tui_download_thread: URL parse failed\n"));
       ctx->result = URLERROR;
       return NULL;
     }
   
-  main_tui_debug("tui_download_thread: calling retrieve_url");
+  DEBUGP (("tui_download_thread: calling retrieve_url\n"));
   ctx->result = retrieve_url(url_parsed, ctx->url, &filename, &redirected_URL,
                              NULL, &dt, false, ctx->iri, true);
   
-  main_tui_debug("tui_download_thread: retrieve_url returned %d", ctx->result);
+  DEBUGP (("tui_download_thread: retrieve_url returned %d\n", ctx->result));
   
   xfree(redirected_URL);
   xfree(filename);
@@ -279,6 +259,17 @@ load_hsts (void)
     }
 }
 
+static pthread_once_t hsts_once = PTHREAD_ONCE_INIT;
+
+/* Return the HSTS store, reading the database the first time an HTTP
+   URL needs it, so that runs without any do not pay for it.  */
+hsts_store_t
+get_hsts_store (void)
+{
+  pthread_once (&hsts_once, load_hsts);
+  return hsts_store;
+}
+
 static void
 save_hsts (void)
 {
@@ -343,6 +334,7 @@ static struct cmdline_option option_data[] =
     { "backup-converted", 'K', OPT_BOOLEAN, "backupconverted", -1 },
     { "backups", 0, OPT_BOOLEAN, "backups", -1 },
     { "base", 'B', OPT_VALUE, "base", -1 },
+    { "batch", 0, OPT_VALUE, "batch", -1 },
     { "bind-address", 0, OPT_VALUE, "bindaddress", -1 },
 #ifdef HAVE_LIBCARES
     { "bind-dns-address", 0, OPT_VALUE, "binddnsaddress", -1 },
@@ -391,6 +383,8 @@ static struct cmdline_option option_data[] =
     { "follow-tags", 0, OPT_VALUE, "followtags", -1 },
     { "force-directories", 'x', OPT_BOOLEAN, "dirstruct", -1 },
     { "force-html", 'F', OPT_BOOLEAN, "forcehtml", -1 },
+    { "frontier-dir", 0, OPT_VALUE, "frontierdir", -1 },
+    { "frontier-order", 0, OPT_VALUE, "frontierorder", -1 },
     { "ftp-password", 0, OPT_VALUE, "ftppassword", -1 },
 #ifdef __VMS
     { "ftp-stmlf", 0, OPT_BOOLEAN, "ftpstmlf", -1 },
@@ -491,6 +485,7 @@ static struct cmdline_option option_data[] =
     { "retry-connrefused", 0, OPT_BOOLEAN, "retryconnrefused", -1 },
     { "retry-on-host-error", 0, OPT_BOOLEAN, "retryonhosterror", -1 },
     { "retry-on-http-error", 0, OPT_VALUE, "retryonhttperror", -1 },
+    { "robots-cache", 0, OPT_VALUE, "robotscache", -1 },
     { "save-cookies", 0, OPT_VALUE, "savecookies", -1 },
     { "save-headers", 0, OPT_BOOLEAN, "saveheaders", -1 },
     IF_SSL ( "secure-protocol", 0, OPT_VALUE, "secureprotocol", -1 )
@@ -498,6 +493,7 @@ static struct cmdline_option option_data[] =
     { "span-hosts", 'H', OPT_BOOLEAN, "spanhosts", -1 },
     { "spider", 0, OPT_BOOLEAN, "spider", -1 },
     { "start-pos", 0, OPT_VALUE, "startpos", -1 },
+    { "stats-file", 0, OPT_VALUE, "statsfile", -1 },
     { "strict-comments", 0, OPT_BOOLEAN, "strictcomments", -1 },
     { "timeout", 'T', OPT_VALUE, "timeout", -1 },
     { "timestamping", 'N', OPT_BOOLEAN, "timestamping", -1 },
@@ -517,8 +513,9 @@ static struct cmdline_option option_data[] =
     { "wait", 'w', OPT_VALUE, "wait", -1 },
     { "waitretry", 0, OPT_VALUE, "waitretry", -1 },
     { "warc-cdx", 0, OPT_BOOLEAN, "warccdx", -1 },
-#ifdef HAVE_LIBZ
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
     { "warc-compression", 0, OPT_BOOLEAN, "warccompression", -1 },
+    { "warc-compression-threads", 0, OPT_VALUE, "warccompressionthreads", -1 },
 #endif
     { "warc-dedup", 0, OPT_VALUE, "warccdxdedup", -1 },
     { "warc-digests", 0, OPT_BOOLEAN, "warcdigests", -1 },
@@ -527,6 +524,9 @@ static struct cmdline_option option_data[] =
     { "warc-keep-log", 0, OPT_BOOLEAN, "warckeeplog", -1 },
     { "warc-max-size", 0, OPT_VALUE, "warcmaxsize", -1 },
     { "warc-tempdir", 0, OPT_VALUE, "warctempdir", -1 },
+#ifdef HAVE_LIBZSTD
+    { "warc-zstd", 0, OPT_BOOLEAN, "warczstd", -1 },
+#endif
 #ifdef USE_WATT32
     { "wdebug", 0, OPT_BOOLEAN, "wdebug", -1 },
 #endif
@@ -698,6 +698,9 @@ Logging and input file:\n"),
        --report-speed=TYPE         output bandwidth as TYPE.  TYPE can be bits\n"),
     N_("\
   -i,  --input-file=FILE           download URLs found in local or external FILE\n"),
+    N_("\
+       --batch=SOURCE              run download jobs read from SOURCE, - for\n\
+                                     stdin or a Unix socket to listen on\n"),
 #ifdef HAVE_METALINK
     N_("\
        --input-metalink=FILE       download files covered in local Metalink FILE\n"),
@@ -713,6 +716,9 @@ Logging and input file:\n"),
        --no-config                 do not read any config file\n"),
     N_("\
        --rejected-log=FILE         log reasons for URL rejection to FILE\n"),
+    N_("\
+       --stats-file=FILE           append timing statistics of each transfer\n\
+                                     to FILE as lines of JSON\n"),
     "\n",
 
     N_("\
@@ -1020,9 +1026,16 @@ WARC options:\n"),
        --warc-cdx                  write CDX index files\n"),
     N_("\
        --warc-dedup=FILENAME       do not store records listed in this CDX file\n"),
-#ifdef HAVE_LIBZ
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
     N_("\
        --no-warc-compression       do not compress WARC files with GZIP\n"),
+    N_("\
+       --warc-compression-threads=NUM\n\
+                                   compress WARC records on NUM threads\n"),
+#endif
+#ifdef HAVE_LIBZSTD
+    N_("\
+       --warc-zstd                 compress WARC files with zstd instead of GZIP\n"),
 #endif
     N_("\
        --no-warc-digests           do not calculate SHA1 digests\n"),
@@ -1062,6 +1075,14 @@ Recursive download:\n"),
   -p,  --page-requisites           get all images, etc. needed to display HTML page\n"),
     N_("\
        --strict-comments           turn on strict (SGML) handling of HTML comments\n"),
+    N_("\
+       --frontier-dir=DIR          keep the crawl queue and seen URLs in DIR, and\n\
+                                     resume an interrupted crawl from there\n"),
+    N_("\
+       --frontier-order=ORDER      order in which to crawl queued URLs:\n\
+                                     fifo, links or hosts\n"),
+    N_("\
+       --robots-cache=FILE         keep fresh robots.txt rules in FILE across runs\n"),
     "\n",
 
     N_("\
@@ -1803,6 +1824,14 @@ WARNING: timestamping does nothing in combination with -O. See the manual\n\
 for details.\n\n"));
           opt.timestamping = false;
         }
+      if (opt.batch && HYPHENP (opt.batch) && HYPHENP (opt.output_document))
+        {
+          fprintf (stderr, _("\
+Cannot specify both -O - and --batch=-, which writes its records to\n\
+the standard output.\n"));
+          print_usage (1);
+          exit (WGET_EXIT_GENERIC_ERROR);
+        }
       if (opt.noclobber && file_exists_p(opt.output_document, NULL))
            {
               /* Check if output file exists; if it does, exit. */
@@ -1897,7 +1926,7 @@ for details.\n\n"));
       opt.always_rest = false;
     }
 
-  if (!nurls && !opt.input_filename
+  if (!nurls && !opt.input_filename && !opt.batch
 #ifdef HAVE_METALINK
       && !opt.input_metalink
 #endif
@@ -1949,6 +1978,7 @@ for details.\n\n"));
       if (!opt.rejectregex)
         exit (WGET_EXIT_GENERIC_ERROR);
     }
+  compile_acclists ();
   if (opt.post_data || opt.post_file_name)
     {
       if (opt.post_data && opt.post_file_name)
@@ -2223,29 +2253,19 @@ only if outputting to a regular file.\n"));
   signal (SIGWINCH, progress_handle_sigwinch);
 #endif
 
-#ifdef HAVE_HSTS
-  /* Load the HSTS database.
-     Maybe all the URLs are FTP(S), in which case HSTS would not be needed,
-     but this is the best place to do it, and it shouldn't be a critical
-     performance hit.
-   */
-  if (opt.hsts)
-    load_hsts ();
-#endif
-
   /* TUI mode: download all URLs in parallel */
   if (opt.tui && nurls > 0)
     {
-      main_tui_debug("TUI parallel download: nurls=%d, connections=%d", nurls, opt.connections);
-      main_tui_debug("opt.show_progress=%d, opt.quiet=%d, opt.verbose=%d", opt.show_progress, opt.quiet, opt.verbose);
-      main_tui_debug("opt.progress_type=%s", opt.progress_type ? opt.progress_type : "NULL");
+      DEBUGP (("TUI parallel download: nurls=%d, connections=%d\n", nurls, opt.connections));
+      DEBUGP (("opt.show_progress=%d, opt.quiet=%d, opt.verbose=%d\n", opt.show_progress, opt.quiet, opt.verbose));
+      DEBUGP (("opt.progress_type=%s\n", opt.progress_type ? opt.progress_type : "NULL"));
       
       int max_parallel = opt.connections > 0 ? opt.connections : 4;
       pthread_t *threads = xnew_array(pthread_t, max_parallel);
       struct tui_download_ctx *contexts = xnew_array(struct tui_download_ctx, nurls);
       int *thread_idx = xnew_array(int, max_parallel);  /* maps thread slot to url index */
       
-      main_tui_debug("max_parallel=%d", max_parallel);
+      DEBUGP (("max_parallel=%d\n", max_parallel));
       
       /* Initialize all download contexts */
       for (i = 0; i < nurls; i++)
@@ -2259,7 +2279,7 @@ only if outputting to a regular file.\n"));
           set_uri_encoding(contexts[i].iri, opt.locale, true);
           contexts[i].index = i;
           contexts[i].result = RETROK;
-          main_tui_debug("URL %d: %s", i, contexts[i].url);
+          DEBUGP (("URL %d: %s\n", i, contexts[i].url));
         }
       
       /* Initialize thread slots */
@@ -2453,6 +2473,10 @@ tui_skip_sequential:
                    opt.input_filename);
     }
 
+  /* And then the jobs of --batch.  */
+  if (opt.batch)
+    inform_exit_status (retrieve_from_batch (opt.batch));
+
 #ifdef HAVE_METALINK
   /* Finally, from metlink file, if any.  */
   if (opt.input_metalink)
@@ -2547,6 +2571,9 @@ tui_skip_sequential:
   if (opt.cookies_output)
     save_cookies ();
 
+  if (opt.robots_cache)
+    res_save_cache ();
+
 #ifdef HAVE_HSTS
   if (opt.hsts && hsts_store)
     save_hsts ();
@@ -44,9 +44,14 @@ as that of the covered work.  */
 #include "xmemdup0.h"
 #include "xstrndup.h"
 #include "c-strcase.h"
+#include "http.h"
+#include "ptimer.h"
 #include <errno.h>
 #include <unistd.h> /* For unlink.  */
 #include <metalink/metalink_parser.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #ifdef HAVE_GPGME
 #include <gpgme.h>
 #include <fcntl.h> /* For open and close.  */
@@ -56,6 +61,1293 @@ as that of the covered work.  */
 #include "../tests/unit-tests.h"
 #endif
 
+/* Segmented downloads from several mirrors.
+
+   When --connections is greater than one and a file has more than one
+   HTTP mirror, the file is split into segments that are fetched in
+   parallel, each into a part file of its own, and the part files are
+   joined into the output stream once all segments are in.
+
+   Segments follow the piece boundaries of the metalink's piece hashes
+   when there are any, so that each segment is verified as soon as it
+   lands.  A segment that fails is put back to be fetched again, and
+   its mirror is charged with an error.
+
+   Workers are spread over the mirrors in the order of the resources,
+   which are sorted by priority and preferred location.  Each worker
+   takes the next pending segment when it becomes free, so a fast
+   mirror ends up serving more segments than a slow one.  A mirror
+   that fails repeatedly, or whose throughput falls far behind that of
+   the best mirror, is retired and its workers stop taking segments.  */
+
+#ifdef HAVE_PTHREAD_H
+
+/* Lower bound for the size of a segment.  Each segment costs a
+   separate request.  */
+#define SEGMENT_MIN_SIZE (1024 * 1024)
+
+/* A mirror is retired after this many failed segments...  */
+#define MIRROR_MAX_ERRORS 2
+
+/* ...or when it is this many times slower than the fastest one.  */
+#define MIRROR_SLOW_FACTOR 4
+
+struct seg_mirror {
+  const char *url;              /* resource URL */
+  wgint bytes;                  /* bytes fetched successfully */
+  double secs;                  /* time taken to fetch them */
+  int errors;                   /* segments that failed */
+  bool retired;                 /* whether the mirror is out of use */
+};
+
+enum seg_state { SEG_PENDING, SEG_ACTIVE, SEG_DONE };
+
+struct segment {
+  wgint start, end;             /* byte range, END inclusive */
+  int piece;                    /* first piece in the segment */
+  enum seg_state state;
+  char *part_file;
+};
+
+struct seg_download {
+  struct segment *segs;
+  int seg_count;
+  int remaining;                /* segments not done yet */
+
+  struct seg_mirror *mirrors;
+  int mirror_count;
+  int active_mirrors;           /* mirrors not retired */
+
+  /* Piece hashes, indexed by piece number, or NULL. */
+  const char **piece_hashes;
+  int piece_count;
+  const char *piece_type;
+  wgint piece_length;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* signaled when a segment finishes */
+};
+
+struct seg_worker {
+  struct seg_download *dl;
+  struct seg_mirror *mirror;
+  pthread_t thread;
+};
+
+/* Check BUF, which holds LEN bytes of a piece, against the hex digest
+   HASH of type TYPE.  Unsupported types are taken as a match.  */
+
+static bool
+piece_hash_matches (const char *type, const char *buf, size_t len,
+                    const char *hash)
+{
+  char digest[SHA256_DIGEST_SIZE];
+  char digest_txt[2 * SHA256_DIGEST_SIZE + 1];
+  size_t size;
+
+  if (!c_strcasecmp (type, "sha1") || !c_strcasecmp (type, "sha-1"))
+    {
+      sha1_buffer (buf, len, digest);
+      size = SHA1_DIGEST_SIZE;
+    }
+  else if (!c_strcasecmp (type, "sha256") || !c_strcasecmp (type, "sha-256"))
+    {
+      sha256_buffer (buf, len, digest);
+      size = SHA256_DIGEST_SIZE;
+    }
+  else if (!c_strcasecmp (type, "md5"))
+    {
+      md5_buffer (buf, len, digest);
+      size = MD5_DIGEST_SIZE;
+    }
+  else
+    return true;
+
+  wg_hex_to_string (digest_txt, digest, size);
+  return !c_strcasecmp (digest_txt, hash);
+}
+
+/* Check that the part file of SEG is complete and, if piece hashes
+   are known, that every piece in it matches its hash.  */
+
+static bool
+segment_verify (struct seg_download *dl, struct segment *seg)
+{
+  wgint len = seg->end - seg->start + 1;
+  wgint off;
+  int piece;
+  char *buf;
+  FILE *fp;
+  bool ok = true;
+
+  if (file_size (seg->part_file) != len)
+    return false;
+  if (!dl->piece_hashes)
+    return true;
+
+  fp = fopen (seg->part_file, "rb");
+  if (!fp)
+    return false;
+  buf = xmalloc (dl->piece_length);
+  for (off = 0, piece = seg->piece; ok && off < len;
+       off += dl->piece_length, piece++)
+    {
+      size_t n = MIN (dl->piece_length, len - off);
+      if (fread (buf, 1, n, fp) != n)
+        ok = false;
+      else if (piece < dl->piece_count && dl->piece_hashes[piece])
+        ok = piece_hash_matches (dl->piece_type, buf, n,
+                                 dl->piece_hashes[piece]);
+    }
+  xfree (buf);
+  fclose (fp);
+
+  if (!ok)
+    logprintf (LOG_NOTQUIET, _("Piece %d of %s failed verification.\n"),
+               piece - 1, quote (seg->part_file));
+  return ok;
+}
+
+/* Whether MRES can be fetched straight with http_loop: an HTTP
+   resource reached without a proxy.  */
+
+static bool
+resource_fetchable (metalink_resource_t *mres)
+{
+  struct url *u;
+  bool usable;
+
+  if (mres->type && strcmp (mres->type, "http")
+      && strcmp (mres->type, "https"))
+    return false;
+  u = url_parse (mres->url, NULL, NULL, false);
+  if (!u)
+    return false;
+  usable = (u->scheme == SCHEME_HTTP
+#ifdef HAVE_SSL
+            || u->scheme == SCHEME_HTTPS
+#endif
+            ) && !url_uses_proxy (u);
+  url_free (u);
+  return usable;
+}
+
+/* Fetch bytes START to END of URL_STR into PART_FILE, following
+   redirections to other HTTP locations.  An END of -1 fetches up to
+   the end of the file.  */
+
+static uerr_t
+metalink_fetch (const char *url_str, wgint start, wgint end,
+                const char *part_file)
+{
+  struct iri *iri = iri_new ();
+  struct url *u;
+  char *url = xstrdup (url_str);
+  int redirections = 0, url_err;
+  uerr_t err;
+
+  set_uri_encoding (iri, opt.locale, true);
+  for (;;)
+    {
+      char *newloc = NULL, *local_file = NULL, *merged;
+      int dt = 0;
+
+      u = url_parse (url, &url_err, iri, false);
+      if (!u)
+        {
+          err = URLERROR;
+          break;
+        }
+
+      unlink (part_file);
+      err = http_loop (u, u, &newloc, &local_file, NULL, &dt, NULL, iri,
+                       NULL, start, end, part_file);
+      xfree (local_file);
+      url_free (u);
+
+      if ((err != NEWLOCATION && err != NEWLOCATION_KEEP_POST) || !newloc)
+        {
+          xfree (newloc);
+          break;
+        }
+      if (++redirections > opt.max_redirect)
+        {
+          logprintf (LOG_NOTQUIET, _("%d redirections exceeded.\n"),
+                     opt.max_redirect);
+          xfree (newloc);
+          err = WRONGCODE;
+          break;
+        }
+      merged = uri_merge (url, newloc);
+      xfree (newloc);
+      xfree (url);
+      url = merged;
+    }
+
+  xfree (url);
+  iri_free (iri);
+  return err;
+}
+
+/* Fetch SEG from MIRROR into its part file.  */
+
+static bool
+segment_fetch (struct seg_download *dl, struct seg_mirror *mirror,
+               struct segment *seg)
+{
+  return metalink_fetch (mirror->url, seg->start, seg->end,
+                         seg->part_file) == RETROK
+    && segment_verify (dl, seg);
+}
+
+/* Retire MIRROR if it is much slower than the fastest mirror, as long
+   as another mirror remains.  Called with DL->lock held.  */
+
+static void
+mirror_check_speed (struct seg_download *dl, struct seg_mirror *mirror)
+{
+  double rate, best = 0;
+  int i;
+
+  if (mirror->retired || dl->active_mirrors < 2 || mirror->secs <= 0)
+    return;
+
+  rate = mirror->bytes / mirror->secs;
+  for (i = 0; i < dl->mirror_count; i++)
+    {
+      struct seg_mirror *m = &dl->mirrors[i];
+      if (!m->retired && m->secs > 0)
+        best = MAX (best, m->bytes / m->secs);
+    }
+
+  if (rate * MIRROR_SLOW_FACTOR < best)
+    {
+      logprintf (LOG_VERBOSE, _("Mirror %s is too slow, dropping it.\n"),
+                 quote (mirror->url));
+      mirror->retired = true;
+      --dl->active_mirrors;
+    }
+}
+
+static void *
+segment_worker (void *arg)
+{
+  struct seg_worker *w = arg;
+  struct seg_download *dl = w->dl;
+  struct seg_mirror *mirror = w->mirror;
+
+  pthread_mutex_lock (&dl->lock);
+  while (dl->remaining > 0 && !mirror->retired)
+    {
+      struct segment *seg = NULL;
+      struct ptimer *timer;
+      double secs;
+      bool ok;
+      int i;
+
+      for (i = 0; i < dl->seg_count; i++)
+        if (dl->segs[i].state == SEG_PENDING)
+          {
+            seg = &dl->segs[i];
+            break;
+          }
+      if (!seg)
+        {
+          /* Wait in case a segment in progress fails and comes back. */
+          pthread_cond_wait (&dl->cond, &dl->lock);
+          continue;
+        }
+
+      seg->state = SEG_ACTIVE;
+      pthread_mutex_unlock (&dl->lock);
+
+      timer = ptimer_new ();
+      ok = segment_fetch (dl, mirror, seg);
+      secs = ptimer_measure (timer);
+      ptimer_destroy (timer);
+
+      pthread_mutex_lock (&dl->lock);
+      if (ok)
+        {
+          seg->state = SEG_DONE;
+          --dl->remaining;
+          mirror->bytes += seg->end - seg->start + 1;
+          mirror->secs += secs;
+          mirror_check_speed (dl, mirror);
+        }
+      else
+        {
+          seg->state = SEG_PENDING;
+          if (++mirror->errors >= MIRROR_MAX_ERRORS && !mirror->retired)
+            {
+              logprintf (LOG_NOTQUIET,
+                         _("Too many errors from mirror %s, dropping it.\n"),
+                         quote (mirror->url));
+              mirror->retired = true;
+              --dl->active_mirrors;
+            }
+        }
+      pthread_cond_broadcast (&dl->cond);
+    }
+
+  /* When the last mirror goes, nobody is left to fetch the pending
+     segments; wake up the other workers so that they can quit.  */
+  if (!dl->active_mirrors)
+    {
+      dl->remaining = 0;
+      pthread_cond_broadcast (&dl->cond);
+    }
+  pthread_mutex_unlock (&dl->lock);
+  return NULL;
+}
+
+/* Set up the piece hashes of MFILE in DL, if they are usable.  */
+
+static void
+segments_init_pieces (struct seg_download *dl, metalink_file_t *mfile)
+{
+  metalink_chunk_checksum_t *cc = mfile->chunk_checksum;
+  metalink_piece_hash_t **ph;
+
+  if (!cc || cc->length <= 0 || !cc->type || !cc->piece_hashes)
+    return;
+
+  dl->piece_length = cc->length;
+  dl->piece_count = (mfile->size + cc->length - 1) / cc->length;
+  dl->piece_type = cc->type;
+  dl->piece_hashes = xcalloc (dl->piece_count, sizeof (char *));
+  for (ph = cc->piece_hashes; *ph; ph++)
+    if ((*ph)->piece >= 0 && (*ph)->piece < dl->piece_count)
+      dl->piece_hashes[(*ph)->piece] = (*ph)->hash;
+}
+
+/* Download MFILE in segments from its HTTP mirrors, and write it to
+   output_stream.  Returns RETROK on success.  If the file cannot be
+   downloaded this way, nothing is written and an error is returned,
+   so that the caller can fall back to fetching it from one mirror at
+   a time.  */
+
+static uerr_t
+retrieve_metalink_segments (metalink_file_t *mfile, const char *destname)
+{
+  struct seg_download dl;
+  struct seg_worker *workers;
+  metalink_resource_t **mres_ptr;
+  int *mirror_conns;
+  int i, worker_count;
+  wgint seg_size, pos;
+  FILE *_output_stream = output_stream;
+  uerr_t ret = RETROK;
+
+  if (opt.connections < 2 || mfile->size <= 0 || !output_stream
+      || opt.always_rest)
+    return METALINK_RETR_ERROR;
+
+  xzero (dl);
+  for (mres_ptr = mfile->resources; *mres_ptr; mres_ptr++)
+    dl.mirror_count++;
+  dl.mirrors = xnew_array (struct seg_mirror, dl.mirror_count);
+  mirror_conns = xnew_array (int, dl.mirror_count);
+  dl.mirror_count = 0;
+
+  /* Only HTTP mirrors reached without a proxy take part, as segments
+     are fetched with ranged requests straight from http_loop.  */
+  for (mres_ptr = mfile->resources; *mres_ptr; mres_ptr++)
+    {
+      metalink_resource_t *mres = *mres_ptr;
+
+      if (!resource_fetchable (mres))
+        continue;
+
+      xzero (dl.mirrors[dl.mirror_count]);
+      dl.mirrors[dl.mirror_count].url = mres->url;
+      mirror_conns[dl.mirror_count] = mres->maxconnections > 0
+        ? mres->maxconnections : opt.connections;
+      dl.mirror_count++;
+    }
+
+  if (dl.mirror_count < 2)
+    {
+      xfree (dl.mirrors);
+      xfree (mirror_conns);
+      return METALINK_RETR_ERROR;
+    }
+
+  /* Cut the file into segments, on piece boundaries if possible. */
+  segments_init_pieces (&dl, mfile);
+  seg_size = MAX (SEGMENT_MIN_SIZE, mfile->size / (opt.connections * 4));
+  if (dl.piece_hashes)
+    seg_size = (seg_size + dl.piece_length - 1)
+      / dl.piece_length * dl.piece_length;
+
+  dl.seg_count = (mfile->size + seg_size - 1) / seg_size;
+  dl.segs = xnew0_array (struct segment, dl.seg_count);
+  for (i = 0, pos = 0; i < dl.seg_count; i++, pos += seg_size)
+    {
+      dl.segs[i].start = pos;
+      dl.segs[i].end = MIN (pos + seg_size, mfile->size) - 1;
+      dl.segs[i].piece = dl.piece_hashes ? pos / dl.piece_length : 0;
+      dl.segs[i].state = SEG_PENDING;
+      dl.segs[i].part_file = aprintf ("%s.seg%d", destname, i);
+    }
+  dl.remaining = dl.seg_count;
+  dl.active_mirrors = dl.mirror_count;
+  pthread_mutex_init (&dl.lock, NULL);
+  pthread_cond_init (&dl.cond, NULL);
+
+  logprintf (LOG_VERBOSE,
+             _("Downloading %s in %d segments from %d mirrors.\n"),
+             quote (destname), dl.seg_count, dl.mirror_count);
+
+  /* The workers write to their part files rather than to
+     output_stream, which is put back once they are joined.  Each
+     keeps its own persistent connection.  */
+  output_stream = NULL;
+
+  /* Hand out the connections to the mirrors in turn, best first. */
+  workers = xnew_array (struct seg_worker, opt.connections);
+  worker_count = 0;
+  while (worker_count < opt.connections)
+    {
+      bool assigned = false;
+      for (i = 0; i < dl.mirror_count && worker_count < opt.connections; i++)
+        if (mirror_conns[i] > 0)
+          {
+            --mirror_conns[i];
+            workers[worker_count].dl = &dl;
+            workers[worker_count].mirror = &dl.mirrors[i];
+            if (pthread_create (&workers[worker_count].thread, NULL,
+                                segment_worker, &workers[worker_count]) == 0)
+              worker_count++;
+            assigned = true;
+          }
+      if (!assigned)
+        break;
+    }
+
+  for (i = 0; i < worker_count; i++)
+    pthread_join (workers[i].thread, NULL);
+
+  output_stream = _output_stream;
+
+  for (i = 0; i < dl.seg_count; i++)
+    if (dl.segs[i].state != SEG_DONE)
+      ret = METALINK_RETR_ERROR;
+
+  /* Join the segments in order. */
+  for (i = 0; ret == RETROK && i < dl.seg_count; i++)
+    {
+      char buf[16 * 1024];
+      size_t n;
+      FILE *fp = fopen (dl.segs[i].part_file, "rb");
+
+      if (!fp)
+        {
+          ret = FOPENERR;
+          break;
+        }
+      while ((n = fread (buf, 1, sizeof (buf), fp)) > 0)
+        if (fwrite (buf, 1, n, output_stream) != n)
+          {
+            ret = FWRITEERR;
+            break;
+          }
+      fclose (fp);
+    }
+  if (ret == RETROK && fflush (output_stream) != 0)
+    ret = FWRITEERR;
+
+  if (ret != RETROK)
+    {
+      logprintf (LOG_NOTQUIET,
+                 _("Segmented download of %s failed.\n"), quote (destname));
+      /* Nothing partial must be left for the fallback. */
+      if (ftruncate (fileno (output_stream), 0) == 0)
+        rewind (output_stream);
+    }
+
+  for (i = 0; i < dl.seg_count; i++)
+    {
+      unlink (dl.segs[i].part_file);
+      xfree (dl.segs[i].part_file);
+    }
+  pthread_cond_destroy (&dl.cond);
+  pthread_mutex_destroy (&dl.lock);
+  xfree (workers);
+  xfree (dl.segs);
+  xfree (dl.piece_hashes);
+  xfree (dl.mirrors);
+  xfree (mirror_conns);
+  return ret;
+}
+
+#else /* not HAVE_PTHREAD_H */
+
+static uerr_t
+retrieve_metalink_segments (metalink_file_t *mfile _GL_UNUSED,
+                            const char *destname _GL_UNUSED)
+{
+  return METALINK_RETR_ERROR;
+}
+
+#endif /* not HAVE_PTHREAD_H */
+
+/* Check the file NAME, open for reading as FP, against the first
+   supported checksum of MFILE.  */
+
+static bool
+metalink_check_hash (metalink_file_t *mfile, FILE *fp, const char *name)
+{
+  metalink_checksum_t **mchksum_ptr, *mchksum;
+  bool hash_ok = false;
+
+  for (mchksum_ptr = mfile->checksums; *mchksum_ptr; mchksum_ptr++)
+    {
+      char md2[MD2_DIGEST_SIZE];
+      char md2_txt[2 * MD2_DIGEST_SIZE + 1];
+
+      char md4[MD4_DIGEST_SIZE];
+      char md4_txt[2 * MD4_DIGEST_SIZE + 1];
+
+      char md5[MD5_DIGEST_SIZE];
+      char md5_txt[2 * MD5_DIGEST_SIZE + 1];
+
+      char sha1[SHA1_DIGEST_SIZE];
+      char sha1_txt[2 * SHA1_DIGEST_SIZE + 1];
+
+      char sha224[SHA224_DIGEST_SIZE];
+      char sha224_txt[2 * SHA224_DIGEST_SIZE + 1];
+
+      char sha256[SHA256_DIGEST_SIZE];
+      char sha256_txt[2 * SHA256_DIGEST_SIZE + 1];
+
+      char sha384[SHA384_DIGEST_SIZE];
+      char sha384_txt[2 * SHA384_DIGEST_SIZE + 1];
+
+      char sha512[SHA512_DIGEST_SIZE];
+      char sha512_txt[2 * SHA512_DIGEST_SIZE + 1];
+
+      hash_ok = false;
+      mchksum = *mchksum_ptr;
+
+      /* I have seen both variants...  */
+      if (c_strcasecmp (mchksum->type, "md2")
+          && c_strcasecmp (mchksum->type, "md4")
+          && c_strcasecmp (mchksum->type, "md5")
+          && c_strcasecmp (mchksum->type, "sha1")
+          && c_strcasecmp (mchksum->type, "sha-1")
+          && c_strcasecmp (mchksum->type, "sha224")
+          && c_strcasecmp (mchksum->type, "sha-224")
+          && c_strcasecmp (mchksum->type, "sha256")
+          && c_strcasecmp (mchksum->type, "sha-256")
+          && c_strcasecmp (mchksum->type, "sha384")
+          && c_strcasecmp (mchksum->type, "sha-384")
+          && c_strcasecmp (mchksum->type, "sha512")
+          && c_strcasecmp (mchksum->type, "sha-512"))
+        {
+          DEBUGP (("Ignoring unsupported checksum type %s.\n",
+                   quote (mchksum->type)));
+          continue;
+        }
+
+      logprintf (LOG_VERBOSE, _("Computing checksum for %s\n"),
+                 quote (name));
+
+      DEBUGP (("Declared hash: %s\n", mchksum->hash));
+
+      if (c_strcasecmp (mchksum->type, "md2") == 0)
+        {
+          md2_stream (fp, md2);
+          wg_hex_to_string (md2_txt, md2, MD2_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", md2_txt));
+          if (!strcmp (md2_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "md4") == 0)
+        {
+          md4_stream (fp, md4);
+          wg_hex_to_string (md4_txt, md4, MD4_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", md4_txt));
+          if (!strcmp (md4_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "md5") == 0)
+        {
+          md5_stream (fp, md5);
+          wg_hex_to_string (md5_txt, md5, MD5_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", md5_txt));
+          if (!strcmp (md5_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "sha1") == 0
+               || c_strcasecmp (mchksum->type, "sha-1") == 0)
+        {
+          sha1_stream (fp, sha1);
+          wg_hex_to_string (sha1_txt, sha1, SHA1_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", sha1_txt));
+          if (!strcmp (sha1_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "sha224") == 0
+               || c_strcasecmp (mchksum->type, "sha-224") == 0)
+        {
+          sha224_stream (fp, sha224);
+          wg_hex_to_string (sha224_txt, sha224, SHA224_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", sha224_txt));
+          if (!strcmp (sha224_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "sha256") == 0
+               || c_strcasecmp (mchksum->type, "sha-256") == 0)
+        {
+          sha256_stream (fp, sha256);
+          wg_hex_to_string (sha256_txt, sha256, SHA256_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", sha256_txt));
+          if (!strcmp (sha256_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "sha384") == 0
+               || c_strcasecmp (mchksum->type, "sha-384") == 0)
+        {
+          sha384_stream (fp, sha384);
+          wg_hex_to_string (sha384_txt, sha384, SHA384_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", sha384_txt));
+          if (!strcmp (sha384_txt, mchksum->hash))
+            hash_ok = true;
+        }
+      else if (c_strcasecmp (mchksum->type, "sha512") == 0
+               || c_strcasecmp (mchksum->type, "sha-512") == 0)
+        {
+          sha512_stream (fp, sha512);
+          wg_hex_to_string (sha512_txt, sha512, SHA512_DIGEST_SIZE);
+          DEBUGP (("Computed hash: %s\n", sha512_txt));
+          if (!strcmp (sha512_txt, mchksum->hash))
+            hash_ok = true;
+        }
+
+      if (hash_ok)
+        {
+          logputs (LOG_VERBOSE,
+                   _("Checksum matches.\n"));
+        }
+      else
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("Checksum mismatch for file %s.\n"),
+                     quote (name));
+        }
+
+      /* Stop as soon as we checked the supported checksum.  */
+      break;
+    } /* Iterate over available checksums.  */
+  return hash_ok;
+}
+
+/* Verify the signature of MFILE over the file NAME.  Returns -1 if
+   the file must be rejected, 0 if it could not be verified and 1 if
+   it was verified successfully.  */
+
+static char
+metalink_check_signature (metalink_file_t *mfile _GL_UNUSED,
+                          const char *name _GL_UNUSED)
+{
+  char sig_status = 0; /* Not verified.  */
+
+#ifdef HAVE_GPGME
+  /* Check the crypto signature.
+
+     Note that the signatures from Metalink in XML will not be
+     parsed when using libmetalink version older than 0.1.3.
+     Metalink-over-HTTP is not affected by this problem.  */
+  if (mfile->signature)
+    {
+      metalink_signature_t *msig = mfile->signature;
+      gpgme_error_t gpgerr;
+      gpgme_ctx_t gpgctx;
+      gpgme_data_t gpgsigdata, gpgdata;
+      gpgme_verify_result_t gpgres;
+      gpgme_signature_t gpgsig;
+      int fd;
+
+      /* Initialize the library - as name suggests.  */
+      gpgme_check_version (NULL);
+
+      /* Open data file.  */
+      fd = open (name, O_RDONLY);
+      if (fd == -1)
+        {
+          logputs (LOG_NOTQUIET,
+                   _("Could not open downloaded file for signature "
+                     "verification.\n"));
+          goto gpg_skip_verification;
+        }
+
+      /* Assign file descriptor to GPG data structure.  */
+      gpgerr = gpgme_data_new_from_fd (&gpgdata, fd);
+      if (gpgerr != GPG_ERR_NO_ERROR)
+        {
+          logprintf (LOG_NOTQUIET,
+                     "GPGME data_new_from_fd: %s\n",
+                     gpgme_strerror (gpgerr));
+          goto gpg_skip_verification;
+        }
+
+      /* Prepare new GPGME context.  */
+      gpgerr = gpgme_new (&gpgctx);
+      if (gpgerr != GPG_ERR_NO_ERROR)
+        {
+          logprintf (LOG_NOTQUIET,
+                     "GPGME new: %s\n",
+                     gpgme_strerror (gpgerr));
+          gpgme_data_release (gpgdata);
+          goto gpg_skip_verification;
+        }
+
+      DEBUGP (("Verifying signature %s:\n%s\n",
+               quote (msig->mediatype),
+               msig->signature));
+
+      /* Check signature type.  */
+      if (strcmp (msig->mediatype, "application/pgp-signature"))
+        {
+          /* Unsupported signature type.  */
+          gpgme_release (gpgctx);
+          gpgme_data_release (gpgdata);
+          goto gpg_skip_verification;
+        }
+
+      gpgerr = gpgme_set_protocol (gpgctx, GPGME_PROTOCOL_OpenPGP);
+      if (gpgerr != GPG_ERR_NO_ERROR)
+        {
+          logprintf (LOG_NOTQUIET,
+                     "GPGME set_protocol: %s\n",
+                     gpgme_strerror (gpgerr));
+          gpgme_release (gpgctx);
+          gpgme_data_release (gpgdata);
+          goto gpg_skip_verification;
+        }
+
+      /* Load the signature.  */
+      gpgerr = gpgme_data_new_from_mem (&gpgsigdata,
+                                        msig->signature,
+                                        strlen (msig->signature),
+                                        0);
+      if (gpgerr != GPG_ERR_NO_ERROR)
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("GPGME data_new_from_mem: %s\n"),
+                     gpgme_strerror (gpgerr));
+          gpgme_release (gpgctx);
+          gpgme_data_release (gpgdata);
+          goto gpg_skip_verification;
+        }
+
+      /* Verify the signature.  */
+      gpgerr = gpgme_op_verify (gpgctx, gpgsigdata, gpgdata, NULL);
+      if (gpgerr != GPG_ERR_NO_ERROR)
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("GPGME op_verify: %s\n"),
+                     gpgme_strerror (gpgerr));
+          gpgme_data_release (gpgsigdata);
+          gpgme_release (gpgctx);
+          gpgme_data_release (gpgdata);
+          goto gpg_skip_verification;
+        }
+
+      /* Check the results.  */
+      gpgres = gpgme_op_verify_result (gpgctx);
+      if (!gpgres)
+        {
+          logputs (LOG_NOTQUIET,
+                   _("GPGME op_verify_result: NULL\n"));
+          gpgme_data_release (gpgsigdata);
+          gpgme_release (gpgctx);
+          gpgme_data_release (gpgdata);
+          goto gpg_skip_verification;
+        }
+
+      /* The list is null-terminated.  */
+      for (gpgsig = gpgres->signatures; gpgsig; gpgsig = gpgsig->next)
+        {
+          DEBUGP (("Checking signature %s\n", gpgsig->fpr));
+
+          if (gpgsig->summary
+              & (GPGME_SIGSUM_VALID | GPGME_SIGSUM_GREEN))
+            {
+              logputs (LOG_VERBOSE,
+                       _("Signature validation succeeded.\n"));
+              sig_status = 1;
+              break;
+            }
+
+          if (gpgsig->summary & GPGME_SIGSUM_RED)
+            {
+              logputs (LOG_NOTQUIET,
+                       _("Invalid signature. Rejecting resource.\n"));
+              sig_status = -1;
+              break;
+            }
+
+          if (gpgsig->summary == 0
+              && (gpgsig->status & 0xFFFF) == GPG_ERR_NO_ERROR)
+            {
+              logputs (LOG_VERBOSE,
+                       _("Data matches signature, but signature "
+                         "is not trusted.\n"));
+            }
+
+          if ((gpgsig->status & 0xFFFF) != GPG_ERR_NO_ERROR)
+            {
+              logprintf (LOG_NOTQUIET,
+                         "GPGME: %s\n",
+                         gpgme_strerror (gpgsig->status & 0xFFFF));
+            }
+        }
+      gpgme_data_release (gpgsigdata);
+      gpgme_release (gpgctx);
+      gpgme_data_release (gpgdata);
+gpg_skip_verification:
+      if (fd != -1)
+        close (fd);
+    } /* endif (mfile->signature) */
+#endif
+  return sig_status;
+}
+
+/* Parallel download of the files of a metalink.
+
+   When --connections is greater than one and a metalink lists several
+   files, up to that many files are downloaded at once, each from one
+   HTTP mirror at a time.  A finished download is handed over to a
+   verifier thread, which checks its size, checksum and signature
+   while the workers go on with the next files.  A file that fails
+   verification is fetched again from its next mirror.
+
+   Each file is downloaded into "<name>.part" and renamed once it is
+   verified.  Files that need a resource the workers cannot use (FTP,
+   or a proxy) are left to the one-at-a-time loop in
+   retrieve_from_metalink, which runs after the parallel pass.  */
+
+#ifdef HAVE_PTHREAD_H
+
+enum mfile_state {
+  MFILE_SKIPPED,                /* not taken into the pool */
+  MFILE_SERIAL,                 /* left to the serial loop */
+  MFILE_QUEUED,                 /* being fetched or verified */
+  MFILE_DONE                    /* finished, ERR tells how */
+};
+
+struct mfile_job {
+  metalink_file_t *mfile;
+  char *destname;               /* reserved local file */
+  char *part_file;              /* download in progress */
+  metalink_resource_t **mres_ptr; /* next resource to try */
+  bool serial_left;             /* resources only the serial loop can use */
+  enum mfile_state state;
+  uerr_t err;
+  struct mfile_job *next;       /* in the fetch or verify queue */
+};
+
+struct mfile_pool {
+  struct mfile_job *jobs;       /* indexed by metalink file counter - 1 */
+  int job_count;
+  int pending;                  /* queued jobs not done yet */
+
+  struct mfile_job *fetch_head, *fetch_tail;
+  struct mfile_job *verify_head, *verify_tail;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* signaled when a queue changes */
+};
+
+static void
+mfile_queue_push (struct mfile_job **head, struct mfile_job **tail,
+                  struct mfile_job *job)
+{
+  job->next = NULL;
+  if (*tail)
+    (*tail)->next = job;
+  else
+    *head = job;
+  *tail = job;
+}
+
+static struct mfile_job *
+mfile_queue_pop (struct mfile_job **head, struct mfile_job **tail)
+{
+  struct mfile_job *job = *head;
+  if (job)
+    {
+      *head = job->next;
+      if (!*head)
+        *tail = NULL;
+    }
+  return job;
+}
+
+/* Return the next resource of JOB the workers can fetch, or NULL when
+   there is none left.  */
+
+static metalink_resource_t *
+mfile_next_resource (struct mfile_job *job)
+{
+  for (; *job->mres_ptr; job->mres_ptr++)
+    {
+      metalink_resource_t *mres = *job->mres_ptr;
+
+      if (!RES_TYPE_SUPPORTED (mres->type))
+        continue;
+      if (resource_fetchable (mres))
+        {
+          job->mres_ptr++;
+          return mres;
+        }
+      job->serial_left = true;
+    }
+  return NULL;
+}
+
+/* Check the downloaded part file of JOB.  */
+
+static uerr_t
+mfile_verify (struct mfile_job *job)
+{
+  metalink_file_t *mfile = job->mfile;
+  FILE *fp;
+  bool hash_ok;
+
+  if (mfile->size
+      && file_size (job->part_file) != (wgint) mfile->size)
+    {
+      logprintf (LOG_NOTQUIET, _("Size mismatch for file %s.\n"),
+                 quote (job->destname));
+      return METALINK_SIZE_ERROR;
+    }
+
+  fp = fopen (job->part_file, "rb");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Could not open downloaded file.\n"));
+      return METALINK_RETR_ERROR;
+    }
+  hash_ok = metalink_check_hash (mfile, fp, job->destname);
+  fclose (fp);
+  if (!hash_ok)
+    return METALINK_CHKSUM_ERROR;
+
+  if (metalink_check_signature (mfile, job->part_file) < 0)
+    return METALINK_SIG_ERROR;
+  return RETROK;
+}
+
+/* Take JOB out of the pool.  Called with POOL->lock held.  */
+
+static void
+mfile_job_done (struct mfile_pool *pool, struct mfile_job *job, uerr_t err)
+{
+  job->err = err;
+  if (err == RETROK || !job->serial_left)
+    {
+      /* Keep a file that failed verification under its final name, for
+         badhash_or_remove to deal with.  */
+      if (err != METALINK_RETR_ERROR
+          && rename (job->part_file, job->destname) != 0)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot rename %s to %s: %s\n"),
+                     quote_n (0, job->part_file), quote_n (1, job->destname),
+                     strerror (errno));
+          job->err = err = FOPENERR;
+        }
+      job->state = MFILE_DONE;
+    }
+  else
+    {
+      /* Give the file back to the serial loop, which starts afresh. */
+      unlink (job->destname);
+      job->state = MFILE_SERIAL;
+    }
+  unlink (job->part_file);
+  --pool->pending;
+  pthread_cond_broadcast (&pool->cond);
+}
+
+static void *
+mfile_fetch_worker (void *arg)
+{
+  struct mfile_pool *pool = arg;
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->pending > 0)
+    {
+      struct mfile_job *job;
+      metalink_resource_t *mres;
+      bool fetched = false;
+
+      job = mfile_queue_pop (&pool->fetch_head, &pool->fetch_tail);
+      if (!job)
+        {
+          pthread_cond_wait (&pool->cond, &pool->lock);
+          continue;
+        }
+      pthread_mutex_unlock (&pool->lock);
+
+      while (!fetched && (mres = mfile_next_resource (job)))
+        {
+          DEBUGP (("Fetching %s from %s\n", quote_n (0, job->destname),
+                   quote_n (1, mres->url)));
+          fetched = metalink_fetch (mres->url, 0, -1,
+                                    job->part_file) == RETROK;
+          if (!fetched)
+            job->err = METALINK_RETR_ERROR;
+        }
+
+      pthread_mutex_lock (&pool->lock);
+      if (fetched)
+        {
+          mfile_queue_push (&pool->verify_head, &pool->verify_tail, job);
+          pthread_cond_broadcast (&pool->cond);
+        }
+      else
+        mfile_job_done (pool, job, job->err);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+static void *
+mfile_verifier (void *arg)
+{
+  struct mfile_pool *pool = arg;
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->pending > 0)
+    {
+      struct mfile_job *job;
+      uerr_t err;
+
+      job = mfile_queue_pop (&pool->verify_head, &pool->verify_tail);
+      if (!job)
+        {
+          pthread_cond_wait (&pool->cond, &pool->lock);
+          continue;
+        }
+      pthread_mutex_unlock (&pool->lock);
+
+      err = mfile_verify (job);
+
+      pthread_mutex_lock (&pool->lock);
+      if (err == RETROK)
+        mfile_job_done (pool, job, err);
+      else
+        {
+          /* Try the next mirror.  */
+          job->err = err;
+          mfile_queue_push (&pool->fetch_head, &pool->fetch_tail, job);
+          pthread_cond_broadcast (&pool->cond);
+        }
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* Set up a pool for the files of METALINK, or return NULL if they are
+   to be downloaded one at a time.  */
+
+static struct mfile_pool *
+mfile_pool_new (const metalink_t *metalink)
+{
+  struct mfile_pool *pool;
+  metalink_file_t **mfile_ptr;
+  int count = 0;
+
+  if (opt.connections < 2 || opt.metalink_index >= 0 || opt.always_rest)
+    return NULL;
+  for (mfile_ptr = metalink->files; *mfile_ptr; mfile_ptr++)
+    count++;
+  if (count < 2)
+    return NULL;
+
+  pool = xnew0 (struct mfile_pool);
+  pool->jobs = xnew0_array (struct mfile_job, count);
+  pool->job_count = count;
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->cond, NULL);
+  return pool;
+}
+
+/* Queue MFILE, the file number INDEX of the metalink, to be saved as
+   SAFENAME.  If the pool cannot take it, it is left to the serial
+   loop.  */
+
+static void
+mfile_pool_add (struct mfile_pool *pool, int index, metalink_file_t *mfile,
+                const char *safename)
+{
+  struct mfile_job *job = &pool->jobs[index];
+  FILE *fp;
+
+  job->mfile = mfile;
+  job->mres_ptr = mfile->resources;
+  job->state = MFILE_SERIAL;
+
+  /* Files without checksums are reported by the serial loop.  */
+  if (!mfile->checksums || !mfile->resources)
+    return;
+
+  /* Reserve the name now, so that files of the same name finishing in
+     any order get the same names as they would one at a time.  */
+  fp = unique_create (safename, true, &job->destname);
+  if (!fp)
+    {
+      xfree (job->destname);
+      return;
+    }
+  fclose (fp);
+
+  job->part_file = aprintf ("%s.part", job->destname);
+  job->err = METALINK_RETR_ERROR;
+  job->state = MFILE_QUEUED;
+  mfile_queue_push (&pool->fetch_head, &pool->fetch_tail, job);
+  pool->pending++;
+}
+
+/* Download the queued files of POOL.  */
+
+static void
+mfile_pool_run (struct mfile_pool *pool)
+{
+  pthread_t *workers, verifier;
+  char *_output_document = opt.output_document;
+  FILE *_output_stream = output_stream;
+  int i, worker_count = 0;
+
+  if (!pool->pending)
+    return;
+
+  logprintf (LOG_VERBOSE, _("Downloading %d metalink files in parallel.\n"),
+             pool->pending);
+
+  /* The workers write to their part files, not to the output
+     document, which is put back once they are joined.  */
+  opt.output_document = NULL;
+  output_stream = NULL;
+
+  workers = xnew_array (pthread_t, opt.connections);
+  if (pthread_create (&verifier, NULL, mfile_verifier, pool) == 0)
+    {
+      int wanted = MIN (opt.connections, pool->pending);
+
+      for (i = 0; i < wanted; i++)
+        if (pthread_create (&workers[worker_count], NULL,
+                            mfile_fetch_worker, pool) == 0)
+          worker_count++;
+      if (!worker_count)
+        {
+          /* Let the verifier go.  */
+          pthread_mutex_lock (&pool->lock);
+          pool->pending = 0;
+          pthread_cond_broadcast (&pool->cond);
+          pthread_mutex_unlock (&pool->lock);
+        }
+      for (i = 0; i < worker_count; i++)
+        pthread_join (workers[i], NULL);
+      pthread_join (verifier, NULL);
+    }
+
+  /* Whatever could not be started is left to the serial loop.  */
+  for (i = 0; i < pool->job_count; i++)
+    if (pool->jobs[i].state == MFILE_QUEUED)
+      {
+        unlink (pool->jobs[i].destname);
+        pool->jobs[i].state = MFILE_SERIAL;
+      }
+
+  opt.output_document = _output_document;
+  output_stream = _output_stream;
+  xfree (workers);
+}
+
+/* If the file number INDEX of the metalink was taken care of by POOL,
+   store its result in *ERR and return true.  */
+
+static bool
+mfile_pool_result (struct mfile_pool *pool, int index, uerr_t *err)
+{
+  struct mfile_job *job = &pool->jobs[index];
+
+  if (job->state == MFILE_SERIAL)
+    return false;
+
+  *err = RETROK;
+  if (job->state == MFILE_DONE)
+    {
+      *err = job->err;
+      if (*err != RETROK)
+        logprintf (LOG_VERBOSE,
+                   _("Failed to download %s. Skipping resource.\n"),
+                   quote (job->destname));
+      if ((*err != RETROK || opt.delete_after)
+          && file_exists_p (job->destname, NULL))
+        badhash_or_remove (job->destname);
+    }
+  return true;
+}
+
+static void
+mfile_pool_free (struct mfile_pool *pool)
+{
+  int i;
+
+  if (!pool)
+    return;
+  for (i = 0; i < pool->job_count; i++)
+    {
+      xfree (pool->jobs[i].destname);
+      xfree (pool->jobs[i].part_file);
+    }
+  pthread_cond_destroy (&pool->cond);
+  pthread_mutex_destroy (&pool->lock);
+  xfree (pool->jobs);
+  xfree (pool);
+}
+
+#else /* not HAVE_PTHREAD_H */
+
+struct mfile_pool;
+
+static struct mfile_pool *
+mfile_pool_new (const metalink_t *metalink _GL_UNUSED)
+{
+  return NULL;
+}
+
+static void
+mfile_pool_add (struct mfile_pool *pool _GL_UNUSED, int index _GL_UNUSED,
+                metalink_file_t *mfile _GL_UNUSED,
+                const char *safename _GL_UNUSED)
+{
+}
+
+static void
+mfile_pool_run (struct mfile_pool *pool _GL_UNUSED)
+{
+}
+
+static bool
+mfile_pool_result (struct mfile_pool *pool _GL_UNUSED, int index _GL_UNUSED,
+                   uerr_t *err _GL_UNUSED)
+{
+  return false;
+}
+
+static void
+mfile_pool_free (struct mfile_pool *pool _GL_UNUSED)
+{
+}
+
+#endif /* not HAVE_PTHREAD_H */
+
 /* Loop through all files in metalink structure and retrieve them.
    Returns RETROK if all files were downloaded.
    Returns last retrieval error (from retrieve_url) if some files
@@ -73,6 +1365,10 @@ retrieve_from_metalink (const metalink_t* metalink)
   /* metalink file counter */
   unsigned mfc = 0;
 
+  /* files downloaded in parallel, before the serial loop */
+  struct mfile_pool *pool;
+  bool pool_ran = false;
+
   /* metalink retrieval type */
   const char *metatpy = metalink->origin ? "Metalink/HTTP" : "Metalink/XML";
 
@@ -93,6 +1389,9 @@ retrieve_from_metalink (const metalink_t* metalink)
                _("-O not supported for metalink download. Ignoring.\n"));
     }
 
+  pool = mfile_pool_new (metalink);
+
+ files:
   for (mfile_ptr = metalink->files; *mfile_ptr; mfile_ptr++)
     {
       metalink_file_t *mfile = *mfile_ptr;
@@ -105,6 +1404,7 @@ retrieve_from_metalink (const metalink_t* metalink)
       char *destname = NULL;
       bool size_ok = false;
       bool hash_ok = false;
+      bool segments_tried = false;
 
       uerr_t retr_err = METALINK_MISSING_RESOURCE;
 
@@ -119,6 +1419,13 @@ retrieve_from_metalink (const metalink_t* metalink)
 
       mfc++;
 
+      /* Files already taken care of by the parallel pass.  */
+      if (pool_ran && mfile_pool_result (pool, mfc - 1, &retr_err))
+        {
+          last_retr_err = retr_err == RETROK ? last_retr_err : retr_err;
+          continue;
+        }
+
       /* The directory prefix for opt.metalink_over_http is handled by
          src/url.c (url_file_name), do not add it a second time.  */
       if (!metalink->origin && opt.dir_prefix && strlen (opt.dir_prefix))
@@ -367,12 +1674,21 @@ retrieve_from_metalink (const metalink_t* metalink)
           return x_retr_err;
         }
 
+      /* Queue the file for the parallel pass.  */
+      if (pool && !pool_ran)
+        {
+          mfile_pool_add (pool, mfc - 1, mfile, safename);
+          xfree (filename);
+          xfree (trsrname);
+          xfree (planname);
+          continue;
+        }
+
       /* Resources are sorted by priority.  */
       for (mres_ptr = mfile->resources;
            *mres_ptr && mfile->checksums && !skip_mfile; mres_ptr++)
         {
           metalink_resource_t *mres = *mres_ptr;
-          metalink_checksum_t **mchksum_ptr, *mchksum;
           struct iri *iri;
           struct url *url;
           file_stats_t flstats;
@@ -479,8 +1795,17 @@ retrieve_from_metalink (const metalink_t* metalink)
 
               opt.metalink_over_http = false;
               DEBUGP (("Storing to %s\n", destname));
-              retr_err = retrieve_url (url, mres->url, NULL, NULL,
-                                       NULL, NULL, opt.recursive, iri, false);
+
+              /* First try to get the file from all mirrors at once.  */
+              if (!segments_tried)
+                {
+                  segments_tried = true;
+                  retr_err = retrieve_metalink_segments (mfile, destname);
+                }
+              if (retr_err != RETROK)
+                retr_err = retrieve_url (url, mres->url, NULL, NULL,
+                                         NULL, NULL, opt.recursive, iri,
+                                         false);
               opt.metalink_over_http = _metalink_http;
 
               /*
@@ -546,312 +1871,14 @@ retrieve_from_metalink (const metalink_t* metalink)
                     }
                 }
 
-              for (mchksum_ptr = mfile->checksums; *mchksum_ptr; mchksum_ptr++)
-                {
-                  char md2[MD2_DIGEST_SIZE];
-                  char md2_txt[2 * MD2_DIGEST_SIZE + 1];
-
-                  char md4[MD4_DIGEST_SIZE];
-                  char md4_txt[2 * MD4_DIGEST_SIZE + 1];
-
-                  char md5[MD5_DIGEST_SIZE];
-                  char md5_txt[2 * MD5_DIGEST_SIZE + 1];
-
-                  char sha1[SHA1_DIGEST_SIZE];
-                  char sha1_txt[2 * SHA1_DIGEST_SIZE + 1];
-
-                  char sha224[SHA224_DIGEST_SIZE];
-                  char sha224_txt[2 * SHA224_DIGEST_SIZE + 1];
-
-                  char sha256[SHA256_DIGEST_SIZE];
-                  char sha256_txt[2 * SHA256_DIGEST_SIZE + 1];
-
-                  char sha384[SHA384_DIGEST_SIZE];
-                  char sha384_txt[2 * SHA384_DIGEST_SIZE + 1];
-
-                  char sha512[SHA512_DIGEST_SIZE];
-                  char sha512_txt[2 * SHA512_DIGEST_SIZE + 1];
-
-                  hash_ok = false;
-                  mchksum = *mchksum_ptr;
-
-                  /* I have seen both variants...  */
-                  if (c_strcasecmp (mchksum->type, "md2")
-                      && c_strcasecmp (mchksum->type, "md4")
-                      && c_strcasecmp (mchksum->type, "md5")
-                      && c_strcasecmp (mchksum->type, "sha1")
-                      && c_strcasecmp (mchksum->type, "sha-1")
-                      && c_strcasecmp (mchksum->type, "sha224")
-                      && c_strcasecmp (mchksum->type, "sha-224")
-                      && c_strcasecmp (mchksum->type, "sha256")
-                      && c_strcasecmp (mchksum->type, "sha-256")
-                      && c_strcasecmp (mchksum->type, "sha384")
-                      && c_strcasecmp (mchksum->type, "sha-384")
-                      && c_strcasecmp (mchksum->type, "sha512")
-                      && c_strcasecmp (mchksum->type, "sha-512"))
-                    {
-                      DEBUGP (("Ignoring unsupported checksum type %s.\n",
-                               quote (mchksum->type)));
-                      continue;
-                    }
-
-                  logprintf (LOG_VERBOSE, _("Computing checksum for %s\n"),
-                             quote (destname));
-
-                  DEBUGP (("Declared hash: %s\n", mchksum->hash));
-
-                  if (c_strcasecmp (mchksum->type, "md2") == 0)
-                    {
-                      md2_stream (local_file, md2);
-                      wg_hex_to_string (md2_txt, md2, MD2_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", md2_txt));
-                      if (!strcmp (md2_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "md4") == 0)
-                    {
-                      md4_stream (local_file, md4);
-                      wg_hex_to_string (md4_txt, md4, MD4_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", md4_txt));
-                      if (!strcmp (md4_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "md5") == 0)
-                    {
-                      md5_stream (local_file, md5);
-                      wg_hex_to_string (md5_txt, md5, MD5_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", md5_txt));
-                      if (!strcmp (md5_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "sha1") == 0
-                           || c_strcasecmp (mchksum->type, "sha-1") == 0)
-                    {
-                      sha1_stream (local_file, sha1);
-                      wg_hex_to_string (sha1_txt, sha1, SHA1_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", sha1_txt));
-                      if (!strcmp (sha1_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "sha224") == 0
-                           || c_strcasecmp (mchksum->type, "sha-224") == 0)
-                    {
-                      sha224_stream (local_file, sha224);
-                      wg_hex_to_string (sha224_txt, sha224, SHA224_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", sha224_txt));
-                      if (!strcmp (sha224_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "sha256") == 0
-                           || c_strcasecmp (mchksum->type, "sha-256") == 0)
-                    {
-                      sha256_stream (local_file, sha256);
-                      wg_hex_to_string (sha256_txt, sha256, SHA256_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", sha256_txt));
-                      if (!strcmp (sha256_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "sha384") == 0
-                           || c_strcasecmp (mchksum->type, "sha-384") == 0)
-                    {
-                      sha384_stream (local_file, sha384);
-                      wg_hex_to_string (sha384_txt, sha384, SHA384_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", sha384_txt));
-                      if (!strcmp (sha384_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-                  else if (c_strcasecmp (mchksum->type, "sha512") == 0
-                           || c_strcasecmp (mchksum->type, "sha-512") == 0)
-                    {
-                      sha512_stream (local_file, sha512);
-                      wg_hex_to_string (sha512_txt, sha512, SHA512_DIGEST_SIZE);
-                      DEBUGP (("Computed hash: %s\n", sha512_txt));
-                      if (!strcmp (sha512_txt, mchksum->hash))
-                        hash_ok = true;
-                    }
-
-                  if (hash_ok)
-                    {
-                      logputs (LOG_VERBOSE,
-                               _("Checksum matches.\n"));
-                    }
-                  else
-                    {
-                      logprintf (LOG_NOTQUIET,
-                                 _("Checksum mismatch for file %s.\n"),
-                                 quote (destname));
-                    }
-
-                  /* Stop as soon as we checked the supported checksum.  */
-                  break;
-                } /* Iterate over available checksums.  */
+              hash_ok = metalink_check_hash (mfile, local_file, destname);
               fclose (local_file);
               local_file = NULL;
 
               if (!hash_ok)
                 continue;
 
-              sig_status = 0; /* Not verified.  */
-
-#ifdef HAVE_GPGME
-              /* Check the crypto signature.
-
-                 Note that the signatures from Metalink in XML will not be
-                 parsed when using libmetalink version older than 0.1.3.
-                 Metalink-over-HTTP is not affected by this problem.  */
-              if (mfile->signature)
-                {
-                  metalink_signature_t *msig = mfile->signature;
-                  gpgme_error_t gpgerr;
-                  gpgme_ctx_t gpgctx;
-                  gpgme_data_t gpgsigdata, gpgdata;
-                  gpgme_verify_result_t gpgres;
-                  gpgme_signature_t gpgsig;
-                  int fd;
-
-                  /* Initialize the library - as name suggests.  */
-                  gpgme_check_version (NULL);
-
-                  /* Open data file.  */
-                  fd = open (destname, O_RDONLY);
-                  if (fd == -1)
-                    {
-                      logputs (LOG_NOTQUIET,
-                               _("Could not open downloaded file for signature "
-                                 "verification.\n"));
-                      goto gpg_skip_verification;
-                    }
-
-                  /* Assign file descriptor to GPG data structure.  */
-                  gpgerr = gpgme_data_new_from_fd (&gpgdata, fd);
-                  if (gpgerr != GPG_ERR_NO_ERROR)
-                    {
-                      logprintf (LOG_NOTQUIET,
-                                 "GPGME data_new_from_fd: %s\n",
-                                 gpgme_strerror (gpgerr));
-                      goto gpg_skip_verification;
-                    }
-
-                  /* Prepare new GPGME context.  */
-                  gpgerr = gpgme_new (&gpgctx);
-                  if (gpgerr != GPG_ERR_NO_ERROR)
-                    {
-                      logprintf (LOG_NOTQUIET,
-                                 "GPGME new: %s\n",
-                                 gpgme_strerror (gpgerr));
-                      gpgme_data_release (gpgdata);
-                      goto gpg_skip_verification;
-                    }
-
-                  DEBUGP (("Verifying signature %s:\n%s\n",
-                           quote (msig->mediatype),
-                           msig->signature));
-
-                  /* Check signature type.  */
-                  if (strcmp (msig->mediatype, "application/pgp-signature"))
-                    {
-                      /* Unsupported signature type.  */
-                      gpgme_release (gpgctx);
-                      gpgme_data_release (gpgdata);
-                      goto gpg_skip_verification;
-                    }
-
-                  gpgerr = gpgme_set_protocol (gpgctx, GPGME_PROTOCOL_OpenPGP);
-                  if (gpgerr != GPG_ERR_NO_ERROR)
-                    {
-                      logprintf (LOG_NOTQUIET,
-                                 "GPGME set_protocol: %s\n",
-                                 gpgme_strerror (gpgerr));
-                      gpgme_release (gpgctx);
-                      gpgme_data_release (gpgdata);
-                      goto gpg_skip_verification;
-                    }
-
-                  /* Load the signature.  */
-                  gpgerr = gpgme_data_new_from_mem (&gpgsigdata,
-                                                    msig->signature,
-                                                    strlen (msig->signature),
-                                                    0);
-                  if (gpgerr != GPG_ERR_NO_ERROR)
-                    {
-                      logprintf (LOG_NOTQUIET,
-                                 _("GPGME data_new_from_mem: %s\n"),
-                                 gpgme_strerror (gpgerr));
-                      gpgme_release (gpgctx);
-                      gpgme_data_release (gpgdata);
-                      goto gpg_skip_verification;
-                    }
-
-                  /* Verify the signature.  */
-                  gpgerr = gpgme_op_verify (gpgctx, gpgsigdata, gpgdata, NULL);
-                  if (gpgerr != GPG_ERR_NO_ERROR)
-                    {
-                      logprintf (LOG_NOTQUIET,
-                                 _("GPGME op_verify: %s\n"),
-                                 gpgme_strerror (gpgerr));
-                      gpgme_data_release (gpgsigdata);
-                      gpgme_release (gpgctx);
-                      gpgme_data_release (gpgdata);
-                      goto gpg_skip_verification;
-                    }
-
-                  /* Check the results.  */
-                  gpgres = gpgme_op_verify_result (gpgctx);
-                  if (!gpgres)
-                    {
-                      logputs (LOG_NOTQUIET,
-                               _("GPGME op_verify_result: NULL\n"));
-                      gpgme_data_release (gpgsigdata);
-                      gpgme_release (gpgctx);
-                      gpgme_data_release (gpgdata);
-                      goto gpg_skip_verification;
-                    }
-
-                  /* The list is null-terminated.  */
-                  for (gpgsig = gpgres->signatures; gpgsig; gpgsig = gpgsig->next)
-                    {
-                      DEBUGP (("Checking signature %s\n", gpgsig->fpr));
-
-                      if (gpgsig->summary
-                          & (GPGME_SIGSUM_VALID | GPGME_SIGSUM_GREEN))
-                        {
-                          logputs (LOG_VERBOSE,
-                                   _("Signature validation succeeded.\n"));
-                          sig_status = 1;
-                          break;
-                        }
-
-                      if (gpgsig->summary & GPGME_SIGSUM_RED)
-                        {
-                          logputs (LOG_NOTQUIET,
-                                   _("Invalid signature. Rejecting resource.\n"));
-                          sig_status = -1;
-                          break;
-                        }
-
-                      if (gpgsig->summary == 0
-                          && (gpgsig->status & 0xFFFF) == GPG_ERR_NO_ERROR)
-                        {
-                          logputs (LOG_VERBOSE,
-                                   _("Data matches signature, but signature "
-                                     "is not trusted.\n"));
-                        }
-
-                      if ((gpgsig->status & 0xFFFF) != GPG_ERR_NO_ERROR)
-                        {
-                          logprintf (LOG_NOTQUIET,
-                                     "GPGME: %s\n",
-                                     gpgme_strerror (gpgsig->status & 0xFFFF));
-                        }
-                    }
-                  gpgme_data_release (gpgsigdata);
-                  gpgme_release (gpgctx);
-                  gpgme_data_release (gpgdata);
-gpg_skip_verification:
-                  if (fd != -1)
-                    close (fd);
-                } /* endif (mfile->signature) */
-#endif
+              sig_status = metalink_check_signature (mfile, destname);
               /* Stop if file was downloaded with success.  */
               if (sig_status >= 0)
                 break;
@@ -914,6 +1941,17 @@ gpg_skip_verification:
       xfree (planname);
     } /* Iterate over files.  */
 
+  /* Download the queued files, then go over the files again for those
+     left to the serial loop.  */
+  if (pool && !pool_ran)
+    {
+      mfile_pool_run (pool);
+      pool_ran = true;
+      mfc = 0;
+      goto files;
+    }
+  mfile_pool_free (pool);
+
   /* Restore original values.  */
   opt.output_document = _output_document;
   output_stream_regular = _output_stream_regular;
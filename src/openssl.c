@@ -50,6 +50,9 @@ as that of the covered work.  */
 #endif
 
 #include <sys/ioctl.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include "utils.h"
 #include "connect.h"
@@ -175,8 +178,8 @@ static int ssl_true_initialized = 0;
 
    Returns true on success, false otherwise.  */
 
-bool
-ssl_init (void)
+static bool
+ssl_init_1 (void)
 {
   SSL_METHOD const *meth = NULL;
   long ssl_options = 0;
@@ -436,6 +439,28 @@ ssl_init (void)
   return false;
 }
 
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t ssl_init_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Several download threads may reach their first HTTPS connection at
+   once; only one of them creates the context.  */
+
+bool
+ssl_init (void)
+{
+  bool ok;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock (&ssl_init_lock);
+#endif
+  ok = ssl_init_1 ();
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock (&ssl_init_lock);
+#endif
+  return ok;
+}
+
 void
 ssl_cleanup (void)
 {
@@ -772,7 +797,9 @@ openssl_close (int fd, void *arg)
 
 static struct transport_implementation openssl_transport = {
   openssl_read, openssl_write, openssl_poll,
-  openssl_peek, openssl_errstr, openssl_close
+  openssl_peek, openssl_errstr, openssl_close,
+  /* SSL_read returns the data of one record at a time.  */
+  SSL3_RT_MAX_PLAIN_LENGTH
 };
 
 static const char *
@@ -70,6 +70,7 @@ struct options
   char *dir_prefix;             /* The top of directory tree */
   char *lfilename;              /* Log filename */
   char *input_filename;         /* Input filename */
+  char *batch;                  /* Read download jobs from here (--batch) */
 #ifdef HAVE_METALINK
   char *input_metalink;         /* Input metalink file */
   int metalink_index;           /* Metalink application/metalink4+xml metaurl ordinal number. */
@@ -128,6 +129,8 @@ struct options
   char *warc_cdx_dedup_filename;/* CDX file to be used for deduplication. */
   wgint warc_maxsize;           /* WARC max archive size */
   bool warc_compression_enabled;/* For GZIP compression. */
+  bool warc_zstd;               /* Compress with zstd instead of GZIP. */
+  int warc_compression_threads; /* Threads compressing WARC records. */
   bool warc_digests_enabled;    /* For SHA1 digests. */
   bool warc_cdx_enabled;        /* Create CDX files? */
   bool warc_keep_log;           /* Store the log file in a WARC record. */
@@ -174,6 +177,8 @@ struct options
   double wait;                  /* The wait period between retrievals. */
   double waitretry;             /* The wait period between retries. - HEH */
   bool use_robots;              /* Do we heed robots.txt? */
+  char *robots_cache;           /* File keeping robots.txt specs
+                                   across runs. */
 
   wgint limit_rate;             /* Limit the download rate to this
                                    many bps. */
@@ -345,6 +350,15 @@ struct options
 #endif
 
   char *rejected_log;           /* The file to log rejected URLS to. */
+  char *stats_file;             /* The file to write transfer stats to. */
+
+  char *frontier_dir;           /* Directory holding the recursive
+                                   crawl's queue and seen-set. */
+  enum frontier_order {
+    frontier_fifo,
+    frontier_links,
+    frontier_hosts
+  } frontier_order;             /* order of the recursive crawl */
 
 #ifdef HAVE_HSTS
   bool hsts;
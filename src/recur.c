@@ -36,6 +36,9 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include "url.h"
 #include "recur.h"
@@ -50,151 +53,409 @@ as that of the covered work.  */
 #include "css-url.h"
 #include "spider.h"
 #include "exits.h"
+#include "frontier.h"
+
+/* The blacklist is the seen-set of unescaped URLs (see frontier.c).
+   Unescaping is skipped for URLs without escapes, which are the vast
+   majority.  */
+
+static void blacklist_add (struct seen_set *blacklist, const char *url)
+{
+  if (!strchr (url, '%'))
+    seen_set_add (blacklist, url);
+  else
+    {
+      char *url_unescaped = xstrdup (url);
+
+      url_unescape (url_unescaped);
+      seen_set_add (blacklist, url_unescaped);
+      xfree (url_unescaped);
+    }
+}
+
+static bool blacklist_contains (struct seen_set *blacklist, const char *url)
+{
+  bool ret;
+
+  if (!strchr (url, '%'))
+    return seen_set_contains (blacklist, url);
+
+  {
+    char *url_unescaped = xstrdup (url);
+
+    url_unescape (url_unescaped);
+    ret = seen_set_contains (blacklist, url_unescaped);
+    xfree (url_unescaped);
+  }
+  return ret;
+}
+
+typedef enum
+{
+  WG_RR_SUCCESS, WG_RR_BLACKLIST, WG_RR_NOTHTTPS, WG_RR_NONHTTP, WG_RR_ABSOLUTE,
+  WG_RR_DOMAIN, WG_RR_PARENT, WG_RR_LIST, WG_RR_REGEX, WG_RR_RULES,
+  WG_RR_SPANNEDHOST, WG_RR_ROBOTS
+} reject_reason;
 
-/* Functions for maintaining the URL queue.  */
-
-struct queue_element {
-  const char *url;              /* the URL to download */
-  const char *referer;          /* the referring document */
-  int depth;                    /* the depth */
-  bool html_allowed;            /* whether the document is allowed to
-                                   be treated as HTML. */
-  struct iri *iri;                /* sXXXav */
-  bool css_allowed;             /* whether the document is allowed to
-                                   be treated as CSS. */
-  struct queue_element *next;   /* next element in queue */
+static reject_reason download_child (const struct urlpos *, struct url *, int,
+                              struct url *, struct seen_set *, struct iri *);
+static reject_reason descend_redirect (const char *, struct url *, int,
+                              struct url *, struct seen_set *, struct iri *);
+static void write_reject_log_header (FILE *);
+static void write_reject_log_reason (FILE *, reject_reason,
+                              const struct url *, const struct url *);
+
+/* Whether the links of a document at DEPTH are not to be followed, as
+   retrieve_tree decides once the document is retrieved.  In that case
+   --spider only checks that the document exists.  */
+
+static bool
+leaf_depth_p (int depth)
+{
+  return (opt.reclevel != INFINITE_RECURSION && depth >= opt.reclevel
+          && !(opt.page_requisites && depth <= opt.reclevel + 1));
+}
+
+#ifdef HAVE_PTHREAD_H
+/* Link checking over several connections.
+
+   With --spider and --connections=N, N checker threads run ahead of
+   retrieve_tree, each over a persistent connection of its own.  The
+   crawl still takes the URLs in queue order and does everything with
+   them it does otherwise; it only takes up to SPIDER_WINDOW URLs off
+   the queue in advance, and hands those that a checker can handle to
+   the checkers.  A checker sends HEAD, as --spider does, and GETs the
+   document only if it is HTML or CSS whose links will be followed.
+   Redirections, and URLs that need a proxy, are not for the checkers;
+   the crawl retrieves them itself when their turn comes.  So are URLs
+   that map to the local file of an earlier URL in the window, such as
+   /d/index.html after /d/, because the two retrievals would write over
+   each other's file.  */
+
+#define SPIDER_WINDOW (4 * opt.connections)
+
+struct spider_job {
+  struct iri *iri;
+  char *url;
+  char *referer;
+  int depth;
+  bool html_allowed;
+  bool css_allowed;
+
+  struct url *parsed;           /* URL, if it is for a checker */
+  bool done;                    /* whether the checker is done */
+  uerr_t status;                /* what spider_check_url returned */
+  int dt;
+  char *file;
+  char *local;                  /* local file name of the URL */
+
+  struct spider_job *next;      /* next job in the window */
+  struct spider_job *next_todo; /* next job waiting for a checker */
 };
 
-struct url_queue {
-  struct queue_element *head;
-  struct queue_element *tail;
-  int count, maxcount;
+struct spider_pool {
+  struct spider_job *head, *tail; /* the window, in queue order */
+  int count;                    /* jobs in the window */
+  struct spider_job *todo, *todo_tail; /* jobs waiting for a checker */
+  bool stop;
+
+  /* The local file names of the jobs in the window and of the job
+     the crawl is on, with the number of jobs that have each.  Only
+     the crawl uses it.  */
+  struct hash_table *locals;
+
+  pthread_mutex_t lock;
+  pthread_cond_t todo_cond;     /* signaled when a job is waiting */
+  pthread_cond_t done_cond;     /* signaled when a job is done */
+
+  pthread_t *threads;
+  int thread_count;
 };
 
-/* Create a URL queue. */
+static void
+spider_job_free (struct spider_job *job)
+{
+  if (job->file)
+    {
+      /* Retrieved for links that will not be followed after all.  */
+      unlink (job->file);
+      xfree (job->file);
+    }
+  if (job->parsed)
+    url_free (job->parsed);
+  xfree (job->local);
+  if (job->iri)
+    iri_free (job->iri);
+  xfree (job->url);
+  xfree (job->referer);
+  xfree (job);
+}
 
-static struct url_queue *
-url_queue_new (void)
+static void *
+spider_checker_run (void *arg)
 {
-  struct url_queue *queue = xnew0 (struct url_queue);
-  return queue;
+  struct spider_pool *pool = arg;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      struct spider_job *job = pool->todo;
+
+      if (!job)
+        {
+          if (pool->stop)
+            break;
+          pthread_cond_wait (&pool->todo_cond, &pool->lock);
+          continue;
+        }
+      pool->todo = job->next_todo;
+      if (!pool->todo)
+        pool->todo_tail = NULL;
+      pthread_mutex_unlock (&pool->lock);
+
+      job->dt = leaf_depth_p (job->depth) ? SPIDER_LEAF : 0;
+      job->status = spider_check_url (job->parsed, job->referer, &job->file,
+                                      &job->dt, job->iri);
+
+      pthread_mutex_lock (&pool->lock);
+      job->done = true;
+      pthread_cond_broadcast (&pool->done_cond);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
 }
 
-/* Delete a URL queue. */
+/* Start the checkers.  Return NULL if none can be started, or if
+   the options rule them out.  */
 
-static void
-url_queue_delete (struct url_queue *queue)
+static struct spider_pool *
+spider_pool_new (void)
 {
-  xfree (queue);
+  struct spider_pool *pool;
+  int i;
+
+  /* Authentication and WARC records are kept in state that only one
+     retrieval at a time may use.  */
+  if (opt.user || opt.http_user || opt.warc_filename)
+    return NULL;
+
+  pool = xnew0 (struct spider_pool);
+  pool->locals = make_string_hash_table (0);
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->todo_cond, NULL);
+  pthread_cond_init (&pool->done_cond, NULL);
+  pool->threads = xnew_array (pthread_t, opt.connections);
+  for (i = 0; i < opt.connections; i++)
+    {
+      if (pthread_create (&pool->threads[i], NULL, spider_checker_run,
+                          pool) != 0)
+        break;
+      pool->thread_count++;
+    }
+  if (!pool->thread_count)
+    {
+      pthread_cond_destroy (&pool->done_cond);
+      pthread_cond_destroy (&pool->todo_cond);
+      pthread_mutex_destroy (&pool->lock);
+      hash_table_destroy (pool->locals);
+      xfree (pool->threads);
+      xfree (pool);
+      return NULL;
+    }
+
+  logprintf (LOG_VERBOSE, _("Checking links over %d connections.\n"),
+             pool->thread_count);
+  return pool;
 }
 
-/* Enqueue a URL in the queue.  The queue is FIFO: the items will be
-   retrieved ("dequeued") from the queue in the order they were placed
-   into it.  */
+/* Stop the checkers.  Jobs left in the window go back to QUEUE, for
+   a crawl that was cut short to leave them for the next run.  */
 
 static void
-url_enqueue (struct url_queue *queue, struct iri *i,
-             const char *url, const char *referer, int depth,
-             bool html_allowed, bool css_allowed)
+spider_pool_free (struct spider_pool *pool, struct url_queue *queue)
 {
-  struct queue_element *qel = xnew (struct queue_element);
-  qel->iri = i;
-  qel->url = url;
-  qel->referer = referer;
-  qel->depth = depth;
-  qel->html_allowed = html_allowed;
-  qel->css_allowed = css_allowed;
-  qel->next = NULL;
-
-  ++queue->count;
-  if (queue->count > queue->maxcount)
-    queue->maxcount = queue->count;
-
-  DEBUGP (("Enqueuing %s at depth %d\n",
-           quotearg_n_style (0, escape_quoting_style, url), depth));
-  DEBUGP (("Queue count %d, maxcount %d.\n", queue->count, queue->maxcount));
-
-  if (i)
-    DEBUGP (("[IRI Enqueuing %s with %s\n", quote_n (0, url),
-             i->uri_encoding ? quote_n (1, i->uri_encoding) : "None"));
-
-  if (queue->tail)
-    queue->tail->next = qel;
-  queue->tail = qel;
-
-  if (!queue->head)
-    queue->head = queue->tail;
+  int i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->stop = true;
+  pool->todo = pool->todo_tail = NULL;
+  pthread_cond_broadcast (&pool->todo_cond);
+  pthread_mutex_unlock (&pool->lock);
+  for (i = 0; i < pool->thread_count; i++)
+    pthread_join (pool->threads[i], NULL);
+
+  while (pool->head)
+    {
+      struct spider_job *job = pool->head;
+
+      pool->head = job->next;
+      url_enqueue (queue, job->iri, job->url, job->referer, job->depth,
+                   job->html_allowed, job->css_allowed);
+      job->iri = NULL;
+      spider_job_free (job);
+    }
+
+  pthread_cond_destroy (&pool->done_cond);
+  pthread_cond_destroy (&pool->todo_cond);
+  pthread_mutex_destroy (&pool->lock);
+  string_set_free (pool->locals);
+  xfree (pool->threads);
+  xfree (pool);
 }
 
-/* Take a URL out of the queue.  Return true if this operation
-   succeeded, or false if the queue is empty.  */
+/* Count JOB among the jobs whose URL U maps to its local file.
+   Return whether another job already has that file.  */
 
 static bool
-url_dequeue (struct url_queue *queue, struct iri **i,
-             const char **url, const char **referer, int *depth,
-             bool *html_allowed, bool *css_allowed)
+spider_pool_claim (struct spider_pool *pool, struct spider_job *job,
+                   const struct url *u)
 {
-  struct queue_element *qel = queue->head;
-
-  if (!qel)
-    return false;
+  char *key;
+  void *value;
 
-  queue->head = queue->head->next;
-  if (!queue->head)
-    queue->tail = NULL;
-
-  *i = qel->iri;
-  *url = qel->url;
-  *referer = qel->referer;
-  *depth = qel->depth;
-  *html_allowed = qel->html_allowed;
-  *css_allowed = qel->css_allowed;
+  job->local = url_file_name (u, NULL);
+  if (hash_table_get_pair (pool->locals, job->local, &key, &value))
+    {
+      hash_table_put (pool->locals, key, (void *) ((intptr_t) value + 1));
+      return true;
+    }
+  hash_table_put (pool->locals, xstrdup (job->local), (void *) 1);
+  return false;
+}
 
-  --queue->count;
+/* Free JOB, which the crawl is done with.  */
 
-  DEBUGP (("Dequeuing %s at depth %d\n",
-           quotearg_n_style (0, escape_quoting_style, qel->url), qel->depth));
-  DEBUGP (("Queue count %d, maxcount %d.\n", queue->count, queue->maxcount));
+static void
+spider_pool_done (struct spider_pool *pool, struct spider_job *job)
+{
+  char *key;
+  void *value;
 
-  xfree (qel);
-  return true;
+  if (job->local
+      && hash_table_get_pair (pool->locals, job->local, &key, &value))
+    {
+      if ((intptr_t) value > 1)
+        hash_table_put (pool->locals, key, (void *) ((intptr_t) value - 1));
+      else
+        {
+          hash_table_remove (pool->locals, key);
+          xfree (key);
+        }
+    }
+  spider_job_free (job);
 }
 
-static void blacklist_add (struct hash_table *blacklist, const char *url)
+/* Hand JOB to a checker if one can check it alone.  */
+
+static void
+spider_pool_add (struct spider_pool *pool, struct spider_job *job)
 {
-  char *url_unescaped = xstrdup (url);
+  struct url *u;
+
+  if (dl_url_file_map && hash_table_contains (dl_url_file_map, job->url))
+    return;
+  u = url_parse (job->url, NULL, job->iri, true);
+  if (!u)
+    return;
+  if (spider_pool_claim (pool, job, u)
+      || !schemes_are_similar_p (u->scheme, SCHEME_HTTP)
+      || u->user || url_uses_proxy (u))
+    {
+      url_free (u);
+      return;
+    }
+  job->parsed = u;
 
-  url_unescape (url_unescaped);
-  string_set_add (blacklist, url_unescaped);
-  xfree (url_unescaped);
+  pthread_mutex_lock (&pool->lock);
+  if (pool->todo_tail)
+    pool->todo_tail->next_todo = job;
+  else
+    pool->todo = job;
+  pool->todo_tail = job;
+  pthread_cond_signal (&pool->todo_cond);
+  pthread_mutex_unlock (&pool->lock);
 }
 
-static int blacklist_contains (struct hash_table *blacklist, const char *url)
+/* Take the next URL of the crawl, as url_dequeue would, after filling
+   the window from QUEUE.  If the URL went to a checker, wait for the
+   checker to be done with it.  Return NULL when QUEUE is empty.  */
+
+static struct spider_job *
+spider_pool_next (struct spider_pool *pool, struct url_queue *queue)
 {
-  char *url_unescaped = xstrdup(url);
-  int ret;
+  struct spider_job *job;
 
-  url_unescape (url_unescaped);
-  ret = string_set_contains (blacklist, url_unescaped);
-  xfree (url_unescaped);
+  while (pool->count < SPIDER_WINDOW)
+    {
+      struct iri *i;
+      const char *url, *referer;
+      int depth;
+      bool html_allowed, css_allowed;
 
-  return ret;
+      if (!url_dequeue (queue, &i, &url, &referer, &depth,
+                        &html_allowed, &css_allowed))
+        break;
+      job = xnew0 (struct spider_job);
+      job->iri = i;
+      job->url = xstrdup (url);
+      job->referer = referer ? xstrdup (referer) : NULL;
+      job->depth = depth;
+      job->html_allowed = html_allowed;
+      job->css_allowed = css_allowed;
+
+      if (pool->tail)
+        pool->tail->next = job;
+      else
+        pool->head = job;
+      pool->tail = job;
+      pool->count++;
+      spider_pool_add (pool, job);
+    }
+
+  job = pool->head;
+  if (!job)
+    return NULL;
+  pool->head = job->next;
+  if (!pool->head)
+    pool->tail = NULL;
+  pool->count--;
+
+  if (job->parsed)
+    {
+      pthread_mutex_lock (&pool->lock);
+      while (!job->done)
+        pthread_cond_wait (&pool->done_cond, &pool->lock);
+      pthread_mutex_unlock (&pool->lock);
+    }
+  return job;
 }
 
-typedef enum
+/* Whether the checker's result for JOB stands, as opposed to the
+   crawl having to retrieve the URL itself.  If so, register what
+   retrieve_url would have.  */
+
+static bool
+spider_job_checked (struct spider_job *job)
 {
-  WG_RR_SUCCESS, WG_RR_BLACKLIST, WG_RR_NOTHTTPS, WG_RR_NONHTTP, WG_RR_ABSOLUTE,
-  WG_RR_DOMAIN, WG_RR_PARENT, WG_RR_LIST, WG_RR_REGEX, WG_RR_RULES,
-  WG_RR_SPANNEDHOST, WG_RR_ROBOTS
-} reject_reason;
+  if (!job->parsed || job->status == NEWLOCATION
+      || job->status == NEWLOCATION_KEEP_POST)
+    return false;
+  /* retrieve_url tries again without encoding the URL in UTF-8.  */
+  if (!(job->dt & RETROKF) && job->iri->utf8_encode)
+    return false;
 
-static reject_reason download_child (const struct urlpos *, struct url *, int,
-                              struct url *, struct hash_table *, struct iri *);
-static reject_reason descend_redirect (const char *, struct url *, int,
-                              struct url *, struct hash_table *, struct iri *);
-static void write_reject_log_header (FILE *);
-static void write_reject_log_reason (FILE *, reject_reason,
-                              const struct url *, const struct url *);
+  if (job->file && (job->dt & RETROKF))
+    {
+      register_download (job->parsed->url, job->file);
+      if (job->dt & TEXTHTML)
+        register_html (job->file);
+      if (job->dt & TEXTCSS)
+        register_css (job->file);
+    }
+  inform_exit_status (job->status);
+  return true;
+}
+#endif /* HAVE_PTHREAD_H */
 
 /* Retrieve a part of the web beginning with START_URL.  This used to
    be called "recursive retrieval", because the old function was
@@ -227,12 +488,21 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
   /* The URLs we do not wish to enqueue, because they are already in
      the queue, but haven't been downloaded yet.  */
-  struct hash_table *blacklist;
+  struct seen_set *blacklist;
+
+  /* Whether the queue was drained, as opposed to the crawl being cut
+     short.  */
+  bool finished = false;
 
   struct iri *i = iri_new ();
 
   FILE *rejectedlog = NULL; /* Don't write a rejected log. */
 
+#ifdef HAVE_PTHREAD_H
+  /* The link checkers of --spider.  */
+  struct spider_pool *pool = NULL;
+#endif
+
   /* Duplicate pi struct if not NULL */
   if (pi)
     {
@@ -248,13 +518,19 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 #endif
 
   queue = url_queue_new ();
-  blacklist = make_string_hash_table (0);
+  blacklist = seen_set_new ();
 
   /* Enqueue the starting URL.  Use start_url_parsed->url rather than
-     just URL so we enqueue the canonical form of the URL.  */
-  url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0, true,
-               false);
-  blacklist_add (blacklist, start_url_parsed->url);
+     just URL so we enqueue the canonical form of the URL.  If the
+     frontier was resumed from disk, the starting URL has been
+     processed already.  */
+  if (!blacklist_contains (blacklist, start_url_parsed->url))
+    {
+      url_enqueue (queue, i, start_url_parsed->url, NULL, 0, true, false);
+      blacklist_add (blacklist, start_url_parsed->url);
+    }
+  else
+    iri_free (i);
 
   if (opt.rejected_log)
     {
@@ -264,14 +540,23 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
         logprintf (LOG_NOTQUIET, "%s: %s\n", opt.rejected_log, strerror (errno));
     }
 
+#ifdef HAVE_PTHREAD_H
+  if (opt.spider && opt.connections > 1)
+    pool = spider_pool_new ();
+#endif
+
   while (1)
     {
       bool descend = false;
-      char *url, *referer, *file = NULL;
+      const char *url, *referer;
+      char *file = NULL, *url_copy = NULL;
       int depth;
       bool html_allowed, css_allowed;
       bool is_css = false;
       bool dash_p_leaf_HTML = false;
+#ifdef HAVE_PTHREAD_H
+      struct spider_job *job = NULL;
+#endif
 
       if (opt.quota && total_downloaded_bytes > opt.quota)
         break;
@@ -280,10 +565,30 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
       /* Get the next URL from the queue... */
 
-      if (!url_dequeue (queue, (struct iri **) &i,
-                        (const char **)&url, (const char **)&referer,
+#ifdef HAVE_PTHREAD_H
+      if (pool)
+        {
+          job = spider_pool_next (pool, queue);
+          if (!job)
+            {
+              finished = true;
+              break;
+            }
+          i = job->iri;
+          url = job->url;
+          referer = job->referer;
+          depth = job->depth;
+          html_allowed = job->html_allowed;
+          css_allowed = job->css_allowed;
+        }
+      else
+#endif
+      if (!url_dequeue (queue, (struct iri **) &i, &url, &referer,
                         &depth, &html_allowed, &css_allowed))
-        break;
+        {
+          finished = true;
+          break;
+        }
 
       /* ...and download it.  Note that this download is in most cases
          unconditional, as download_child already makes sure a file
@@ -319,6 +624,10 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
           char *redirected = NULL;
           struct url *url_parsed = url_parse (url, &url_err, i, true);
 
+          /* --spider only needs to check that a leaf exists.  */
+          if (opt.spider && leaf_depth_p (depth))
+            dt = SPIDER_LEAF;
+
           if (!url_parsed)
             {
               logprintf (LOG_NOTQUIET, "%s: %s.\n",url, url_error (url_err));
@@ -326,7 +635,16 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
             }
           else
             {
-
+#ifdef HAVE_PTHREAD_H
+              if (job && spider_job_checked (job))
+                {
+                  status = job->status;
+                  dt = job->dt;
+                  file = job->file;
+                  job->file = NULL;
+                }
+              else
+#endif
               status = retrieve_url (url_parsed, url, &file, &redirected, referer,
                                      &dt, false, i, true);
 
@@ -370,14 +688,10 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
                         }
                     }
 
-                  xfree (url);
-                  url = redirected;
+                  url = url_copy = redirected;
                 }
               else
-                {
-                  xfree (url);
-                  url = xstrdup (url_parsed->url);
-                }
+                url = url_copy = xstrdup (url_parsed->url);
               url_free (url_parsed);
             }
         }
@@ -435,7 +749,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
               struct urlpos *child = children;
               struct url *url_parsed = url_parse (url, NULL, i, true);
               struct iri *ci;
-              char *referer_url = url;
+              const char *referer_url = url;
               bool strip_auth;
 
               assert (url_parsed != NULL);
@@ -471,8 +785,8 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
                     {
                       ci = iri_new ();
                       set_uri_encoding (ci, i->content_encoding, false);
-                      url_enqueue (queue, ci, xstrdup (child->url->url),
-                                   xstrdup (referer_url), depth + 1,
+                      url_enqueue (queue, ci, child->url->url,
+                                   referer_url, depth + 1,
                                    child->link_expect_html,
                                    child->link_expect_css);
                       /* We blacklist the URL we have enqueued, because we
@@ -517,36 +831,34 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
           register_delete_file (file);
         }
 
-      xfree (url);
-      xfree (referer);
+      xfree (url_copy);
       xfree (file);
       iri_free (i);
+#ifdef HAVE_PTHREAD_H
+      if (job)
+        {
+          job->iri = NULL;
+          spider_pool_done (pool, job);
+        }
+#endif
     }
 
+#ifdef HAVE_PTHREAD_H
+  if (pool)
+    spider_pool_free (pool, queue);
+#endif
+
   if (rejectedlog)
     {
       fclose (rejectedlog);
       rejectedlog = NULL;
     }
 
-  /* If anything is left of the queue due to a premature exit, free it
-     now.  */
-  {
-    char *d1, *d2;
-    int d3;
-    bool d4, d5;
-    struct iri *d6;
-    while (url_dequeue (queue, (struct iri **)&d6,
-                        (const char **)&d1, (const char **)&d2, &d3, &d4, &d5))
-      {
-        iri_free (d6);
-        xfree (d1);
-        xfree (d2);
-      }
-  }
-  url_queue_delete (queue);
-
-  string_set_free (blacklist);
+  /* If anything is left of the queue due to a premature exit, it is
+     freed now, or kept on disk for a later run with the same
+     --frontier-dir.  */
+  url_queue_delete (queue, finished);
+  seen_set_free (blacklist, finished);
 
   if (opt.quota && total_downloaded_bytes > opt.quota)
     return QUOTEXC;
@@ -566,7 +878,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
 static reject_reason
 download_child (const struct urlpos *upos, struct url *parent, int depth,
-                  struct url *start_url_parsed, struct hash_table *blacklist,
+                  struct url *start_url_parsed, struct seen_set *blacklist,
                   struct iri *iri)
 {
   struct url *u = upos->url;
@@ -795,7 +1107,7 @@ download_child (const struct urlpos *upos, struct url *parent, int depth,
 
 static reject_reason
 descend_redirect (const char *redirected, struct url *orig_parsed, int depth,
-                    struct url *start_url_parsed, struct hash_table *blacklist,
+                    struct url *start_url_parsed, struct seen_set *blacklist,
                     struct iri *iri)
 {
   struct url *new_parsed;
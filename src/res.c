@@ -58,23 +58,24 @@ as that of the covered work.  */
 
    * We don't recognize sole CR as the line ending.
 
-   * We don't implement expiry mechanism for /robots.txt specs.  I
-     consider it non-necessary for a relatively short-lived
-     application such as Wget.  Besides, it is highly questionable
-     whether anyone deploys the recommended expiry scheme for
-     robots.txt.
+   * Specs only expire when they are kept in the --robots-cache file.
+     There they live as long as the HTTP response allowed, but never
+     longer than a day (RFC 9309, section 2.4).  Within a single run
+     they never expire.
 
    Entry points are functions res_parse, res_parse_from_file,
-   res_match_path, res_register_specs, res_get_specs, and
-   res_retrieve_file.  */
+   res_match_path, res_register_specs, res_get_specs,
+   res_retrieve_file, and res_save_cache.  */
 
 #include "wget.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 
 #include "utils.h"
 #include "hash.h"
@@ -83,8 +84,13 @@ as that of the covered work.  */
 #include "res.h"
 #include "c-strcase.h"
 
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #ifdef TESTING
 #include "../tests/unit-tests.h"
+#include <tmpdir.h>
 #endif
 
 struct path_info {
@@ -93,10 +99,28 @@ struct path_info {
   bool user_agent_exact_p;
 };
 
+/* A node of the prefix trie that res_match_path walks.  Children of a
+   node are chained through NEXT, and both links are indices into
+   robot_specs->nodes; 0 means "none", since the root is nobody's
+   child.  */
+
+struct path_node {
+  unsigned char c;              /* the (decoded) character of the node */
+  int rule;                     /* first path ending here, or -1 */
+  int child;                    /* first child */
+  int next;                     /* next sibling */
+};
+
 struct robot_specs {
   int count;
   int size;
   struct path_info *paths;
+
+  struct path_node *nodes;      /* the paths compiled by compile_specs */
+  int node_count;
+
+  time_t expires;               /* when the specs stop being fresh,
+                                   or 0 if they are not cached */
 };
 
 /* Parsing the robot spec. */
@@ -179,6 +203,85 @@ prune_non_exact (struct robot_specs *specs)
   specs->size  = cnt;
 }
 
+/* If C is '%' and (ptr[1], ptr[2]) form a hexadecimal number, and if
+   that number is not a numerical representation of '/', decode C and
+   advance the pointer.  */
+
+#define DECODE_MAYBE(c, ptr) do {                               \
+  if (c == '%' && c_isxdigit (ptr[1]) && c_isxdigit (ptr[2]))       \
+    {                                                           \
+      unsigned char decoded = X2DIGITS_TO_NUM (ptr[1], ptr[2]);          \
+      if (decoded != '/')                                       \
+        {                                                       \
+          c = decoded;                                          \
+          ptr += 2;                                             \
+        }                                                       \
+    }                                                           \
+} while (0)
+
+/* Return the child of NODE for character C, or 0 if there is none.  */
+
+static int
+find_child (const struct robot_specs *specs, int node, unsigned char c)
+{
+  int n;
+  for (n = specs->nodes[node].child; n; n = specs->nodes[n].next)
+    if (specs->nodes[n].c == c)
+      return n;
+  return 0;
+}
+
+/* Compile the paths of SPECS into a prefix trie of their decoded
+   characters.  Every node remembers the first path that ends in it,
+   so that res_match_path can find the first matching path with a
+   single walk down the trie.  */
+
+static void
+compile_specs (struct robot_specs *specs)
+{
+  int size = 1, i;
+
+  xfree (specs->nodes);
+  specs->nodes = xnew (struct path_node);
+  specs->nodes[0].c = 0;
+  specs->nodes[0].rule = -1;
+  specs->nodes[0].child = specs->nodes[0].next = 0;
+  specs->node_count = 1;
+
+  for (i = 0; i < specs->count; i++)
+    {
+      const char *p;
+      int node = 0;
+
+      for (p = specs->paths[i].path; *p; p++)
+        {
+          unsigned char c = *p;
+          int n;
+
+          DECODE_MAYBE (c, p);
+          n = find_child (specs, node, c);
+          if (!n)
+            {
+              if (specs->node_count == size)
+                {
+                  size <<= 1;
+                  specs->nodes = xrealloc (specs->nodes,
+                                           size * sizeof (struct path_node));
+                }
+              n = specs->node_count++;
+              specs->nodes[n].c = c;
+              specs->nodes[n].rule = -1;
+              specs->nodes[n].child = 0;
+              specs->nodes[n].next = specs->nodes[node].child;
+              specs->nodes[node].child = n;
+            }
+          node = n;
+        }
+      if (specs->nodes[node].rule == -1)
+        specs->nodes[node].rule = i;
+    }
+}
+
 #define EOL(p) ((p) >= lineend)
 
 #define SKIP_SPACE(p) do {              \
@@ -378,6 +481,7 @@ res_parse (const char *source, int length)
       specs->size = specs->count;
     }
 
+  compile_specs (specs);
   return specs;
 }
 
@@ -407,115 +511,163 @@ free_specs (struct robot_specs *specs)
   for (i = 0; i < specs->count; i++)
     xfree (specs->paths[i].path);
   xfree (specs->paths);
+  xfree (specs->nodes);
   xfree (specs);
 }
 
 /* Matching of a path according to the specs. */
 
-/* If C is '%' and (ptr[1], ptr[2]) form a hexadecimal number, and if
-   that number is not a numerical representation of '/', decode C and
-   advance the pointer.  */
-
-#define DECODE_MAYBE(c, ptr) do {                               \
-  if (c == '%' && c_isxdigit (ptr[1]) && c_isxdigit (ptr[2]))       \
-    {                                                           \
-      unsigned char decoded = X2DIGITS_TO_NUM (ptr[1], ptr[2]);          \
-      if (decoded != '/')                                       \
-        {                                                       \
-          c = decoded;                                          \
-          ptr += 2;                                             \
-        }                                                       \
-    }                                                           \
-} while (0)
-
-/* The inner matching engine: return true if RECORD_PATH matches
-   URL_PATH.  The rules for matching are described at
+/* Walk PATH down the trie of SPECS.  Of all the paths that are a
+   prefix of PATH, the first one in SPECS decides whether PATH is
+   allowed.  If none does, retrieval is by default allowed.  The rules
+   for matching are described at
    <http://www.robotstxt.org/norobots-rfc.txt>, section 3.2.2.  */
 
-static bool
-matches (const char *record_path, const char *url_path)
-{
-  const char *rp = record_path;
-  const char *up = url_path;
-
-  for (; ; ++rp, ++up)
-    {
-      char rc = *rp;
-      char uc = *up;
-      if (!rc)
-        return true;
-      if (!uc)
-        return false;
-      DECODE_MAYBE(rc, rp);
-      DECODE_MAYBE(uc, up);
-      if (rc != uc)
-        return false;
-    }
-}
-
-/* Iterate through all paths in SPECS.  For the first one that
-   matches, return its allow/reject status.  If none matches,
-   retrieval is by default allowed.  */
-
 bool
 res_match_path (const struct robot_specs *specs, const char *path)
 {
-  int i;
+  const char *p;
+  int node = 0, rule;
+  bool allowedp;
+
   if (!specs)
     return true;
-  for (i = 0; i < specs->count; i++)
-    if (matches (specs->paths[i].path, path))
-      {
-        bool allowedp = specs->paths[i].allowedp;
-        DEBUGP (("%s path %s because of rule %s.\n",
-                 allowedp ? "Allowing" : "Rejecting",
-                 path, quote (specs->paths[i].path)));
-        return allowedp;
-      }
-  return true;
+
+  rule = specs->nodes[0].rule;
+  for (p = path; *p; p++)
+    {
+      unsigned char c = *p;
+      DECODE_MAYBE (c, p);
+      node = find_child (specs, node, c);
+      if (!node)
+        break;
+      if (specs->nodes[node].rule != -1
+          && (rule == -1 || specs->nodes[node].rule < rule))
+        rule = specs->nodes[node].rule;
+    }
+  if (rule == -1)
+    return true;
+
+  allowedp = specs->paths[rule].allowedp;
+  DEBUGP (("%s path %s because of rule %s.\n",
+           allowedp ? "Allowing" : "Rejecting",
+           path, quote (specs->paths[rule].path)));
+  return allowedp;
 }
 
 /* Registering the specs. */
 
 static struct hash_table *registered_specs;
 
-/* Register RES specs that below to server on HOST:PORT.  They will
-   later be retrievable using res_get_specs.  */
+/* Whether --robots-cache has been read, and whether registered_specs
+   now has fresh specs that it lacks.  */
+static bool cache_loaded, cache_changed;
+
+static void load_cache (void);
+
+/* Specs are never kept for more than a day (RFC 9309, section 2.4).  */
+#define RES_CACHE_MAX_AGE (24 * 60 * 60)
+
+/* Whether res_retrieve_file is retrieving a robots.txt, and until
+   when the one it retrieved may be cached.  Download threads may
+   call res_set_expiry for robots.txt they fetch as ordinary links,
+   so these are locked, and only the thread that runs
+   res_retrieve_file may set the expiry.  */
+static bool retrieving;
+static time_t retrieved_expires;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_t retriever;
+static pthread_mutex_t expiry_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_EXPIRY() pthread_mutex_lock (&expiry_lock)
+# define UNLOCK_EXPIRY() pthread_mutex_unlock (&expiry_lock)
+# define SET_RETRIEVER() (retriever = pthread_self ())
+# define IS_RETRIEVER() pthread_equal (retriever, pthread_self ())
+#else
+# define LOCK_EXPIRY()
+# define UNLOCK_EXPIRY()
+# define SET_RETRIEVER()
+# define IS_RETRIEVER() true
+#endif
+
+/* Called by the HTTP code when a robots.txt response says until when
+   it is fresh: EXPIRES is that time, 0 if the response must not be
+   reused, or -1 if it doesn't say.  The specs parsed from it are
+   cached until then, or for RES_CACHE_MAX_AGE, whichever is less.  */
 
 void
-res_register_specs (const char *host, int port, struct robot_specs *specs)
+res_set_expiry (time_t expires)
 {
-  struct robot_specs *old;
-  char buf[256], *hp, *hp_old;
+  time_t limit = time (NULL) + RES_CACHE_MAX_AGE;
+
+  if (expires == -1 || expires > limit)
+    expires = limit;
+  LOCK_EXPIRY ();
+  if (retrieving && IS_RETRIEVER ())
+    retrieved_expires = expires;
+  UNLOCK_EXPIRY ();
+}
 
-  if (((unsigned) snprintf (buf, sizeof (buf), "%s:%d", host, port)) >= sizeof (buf))
-    hp = aprintf("%s:%d", host, port);
-  else
-    hp = buf;
+/* Put SPECS into registered_specs under HP, which is "host:port".  */
+
+static void
+register_specs (const char *hp, struct robot_specs *specs)
+{
+  struct robot_specs *old;
+  char *hp_old;
 
   if (!registered_specs)
     registered_specs = make_nocase_string_hash_table (0);
 
   if (hash_table_get_pair (registered_specs, hp, &hp_old, &old))
     {
-      if (hp != buf)
-        xfree (hp);
       if (old)
         free_specs (old);
       hash_table_put (registered_specs, hp_old, specs);
     }
   else
     {
-      hash_table_put (registered_specs, hp == buf ? xstrdup (hp) : hp, specs);
+      hash_table_put (registered_specs, xstrdup (hp), specs);
     }
 }
 
+/* Register RES specs that below to server on HOST:PORT.  They will
+   later be retrievable using res_get_specs.  If they were parsed from
+   the robots.txt that res_retrieve_file just retrieved, they are also
+   written to --robots-cache.  */
+
+void
+res_register_specs (const char *host, int port, struct robot_specs *specs)
+{
+  char buf[256], *hp;
+
+  if (((unsigned) snprintf (buf, sizeof (buf), "%s:%d", host, port)) >= sizeof (buf))
+    hp = aprintf("%s:%d", host, port);
+  else
+    hp = buf;
+
+  LOCK_EXPIRY ();
+  specs->expires = retrieved_expires > time (NULL) ? retrieved_expires : 0;
+  retrieved_expires = 0;
+  UNLOCK_EXPIRY ();
+  if (specs->expires)
+    cache_changed = true;
+
+  register_specs (hp, specs);
+  if (hp != buf)
+    xfree (hp);
+}
+
 /* Get the specs that belong to HOST:PORT. */
 
 struct robot_specs *
 res_get_specs (const char *host, int port)
 {
   char buf[256], *hp;
+  struct robot_specs *specs;
+
+  if (opt.robots_cache && !cache_loaded)
+    load_cache ();
 
   if (!registered_specs)
     return NULL;
@@ -525,7 +677,160 @@ res_get_specs (const char *host, int port)
   else
     hp = buf;
 
-  return hash_table_get (registered_specs, hp);
+  specs = hash_table_get (registered_specs, hp);
+  if (hp != buf)
+    xfree (hp);
+  return specs;
+}
+
+/* The robots cache.
+
+   The file named by --robots-cache keeps the specs of every server
+   for as long as they are fresh, so that the next runs need not
+   retrieve its robots.txt again.  After the comment lines at its top,
+   each server has a line of the form
+
+       <host>:<port>	<expires>	<count>
+
+   followed by <count> lines, one per path in the order of the specs,
+   of the form "A <path>" for allowed paths and "D <path>" for
+   disallowed ones.  <expires> is in seconds since the Epoch.  */
+
+static void
+load_cache (void)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t bufsize = 0;
+  time_t now = time (NULL);
+  int loaded = 0;
+
+  cache_loaded = true;
+  fp = fopen (opt.robots_cache, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open %s: %s\n"),
+                   opt.robots_cache, strerror (errno));
+      return;
+    }
+
+  while (getline (&line, &bufsize, fp) > 0)
+    {
+      struct robot_specs *specs;
+      char hp[256];
+      long long expires;
+      int count, i;
+
+      if (*line == '#' || *line == '\n')
+        continue;
+      if (sscanf (line, "%255s %lld %d", hp, &expires, &count) != 3
+          || count < 0)
+        goto corrupt;
+
+      specs = xnew0 (struct robot_specs);
+      for (i = 0; i < count; i++)
+        {
+          ssize_t len = getline (&line, &bufsize, fp);
+
+          if (len < 2 || (line[0] != 'A' && line[0] != 'D') || line[1] != ' ')
+            {
+              free_specs (specs);
+              goto corrupt;
+            }
+          if (line[len - 1] == '\n')
+            --len;
+          /* add_path strips a leading slash, which paths don't have
+             here anymore.  */
+          specs->count++;
+          if (specs->count > specs->size)
+            {
+              specs->size = specs->size ? specs->size << 1 : 1;
+              specs->paths = xrealloc (specs->paths,
+                                       specs->size * sizeof (struct path_info));
+            }
+          specs->paths[i].path = strdupdelim (line + 2, line + len);
+          specs->paths[i].allowedp = line[0] == 'A';
+          specs->paths[i].user_agent_exact_p = false;
+        }
+
+      if (expires <= now)
+        {
+          free_specs (specs);
+          continue;
+        }
+      specs->expires = (time_t) expires;
+      compile_specs (specs);
+      register_specs (hp, specs);
+      ++loaded;
+    }
+
+  DEBUGP (("Loaded robots.txt specs of %d servers from %s.\n",
+           loaded, quote (opt.robots_cache)));
+  xfree (line);
+  fclose (fp);
+  return;
+
+ corrupt:
+  logprintf (LOG_NOTQUIET, _("Ignoring the rest of corrupt robots cache %s.\n"),
+             quote (opt.robots_cache));
+  xfree (line);
+  fclose (fp);
+}
+
+/* Write the fresh specs to --robots-cache, if any were added since it
+   was read.  The file is replaced atomically, so that a crash never
+   leaves half of it behind.  */
+
+void
+res_save_cache (void)
+{
+  hash_table_iterator iter;
+  time_t now = time (NULL);
+  char *tmpname;
+  FILE *fp;
+
+  if (!opt.robots_cache || !cache_changed || !registered_specs)
+    return;
+
+  tmpname = aprintf ("%s.tmp", opt.robots_cache);
+  fp = fopen (tmpname, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open %s: %s\n"),
+                 tmpname, strerror (errno));
+      xfree (tmpname);
+      return;
+    }
+
+  fputs ("# Wget robots.txt cache\n"
+         "# Edit at your own risk.\n"
+         "# <host>:<port>\t<expires>\t<count>\n", fp);
+  for (hash_table_iterate (registered_specs, &iter);
+       hash_table_iter_next (&iter);
+       )
+    {
+      const struct robot_specs *specs = iter.value;
+      int i;
+
+      if (specs->expires <= now)
+        continue;
+      fprintf (fp, "%s\t%lld\t%d\n", (const char *) iter.key,
+               (long long) specs->expires, specs->count);
+      for (i = 0; i < specs->count; i++)
+        fprintf (fp, "%c %s\n", specs->paths[i].allowedp ? 'A' : 'D',
+                 specs->paths[i].path);
+    }
+
+  if (fclose (fp) == EOF || rename (tmpname, opt.robots_cache) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write %s: %s\n"),
+                 opt.robots_cache, strerror (errno));
+      unlink (tmpname);
+    }
+  else
+    cache_changed = false;
+  xfree (tmpname);
 }
 
 /* Loading the robots file.  */
@@ -557,6 +862,11 @@ res_retrieve_file (const char *url, char **file, struct iri *iri)
   *file = NULL;
   opt.timestamping = false;
   opt.spider       = false;
+  LOCK_EXPIRY ();
+  retrieving = true;
+  retrieved_expires = 0;
+  SET_RETRIEVER ();
+  UNLOCK_EXPIRY ();
 
   url_parsed = url_parse (robots_url, &url_err, i, true);
   if (!url_parsed)
@@ -573,15 +883,22 @@ res_retrieve_file (const char *url, char **file, struct iri *iri)
 
   opt.timestamping = saved_ts_val;
   opt.spider       = saved_sp_val;
+  LOCK_EXPIRY ();
+  retrieving = false;
+  /* Don't cache the dummy specs that replace robots.txt.  */
+  if (err != RETROK)
+    retrieved_expires = 0;
+  UNLOCK_EXPIRY ();
   xfree (robots_url);
   iri_free (i);
 
-  if (err != RETROK && *file != NULL)
+  if (err != RETROK)
     {
       /* If the file is not retrieved correctly, but retrieve_url
          allocated the file name, deallocate is here so that the
          caller doesn't have to worry about it.  */
-      xfree (*file);
+      if (*file != NULL)
+        xfree (*file);
     }
   return err == RETROK;
 }
@@ -641,6 +958,109 @@ test_is_robots_txt_url(void)
   return NULL;
 }
 
+const char *
+test_res_match_path(void)
+{
+  static const char robots[] =
+    "User-Agent: *\n"
+    "Disallow: /\n"
+    "\n"
+    "User-Agent: wget\n"
+    "Allow: /cgi-bin/ok\n"
+    "Disallow: /cgi-bin\n"
+    "Disallow: /%7Euser/\n"
+    "Disallow: /a%2Fb\n"
+    "Allow: /private/open\n"
+    "Disallow: /private\n";
+  unsigned i;
+  static const struct {
+    const char *path;
+    bool expected_result;
+  } test_array[] = {
+    { "", true },
+    { "index.html", true },
+    { "cgi-bin", false },
+    { "cgi-bin/ok.cgi", true },
+    { "cgi-bin/other.cgi", false },
+    { "cgi", true },
+    { "~user/x", false },
+    { "%7euser/x", false },
+    { "a/b", true },
+    { "a%2Fb", false },
+    { "private/open", true },
+    { "private/opening", true },
+    { "private/ope", false },
+  };
+  struct robot_specs *specs = res_parse (robots, sizeof (robots) - 1);
+
+  for (i = 0; i < countof(test_array); ++i)
+    {
+      mu_assert ("test_res_match_path: wrong result",
+                 res_match_path (specs, test_array[i].path) == test_array[i].expected_result);
+    }
+
+  free_specs (specs);
+  return NULL;
+}
+
+const char *
+test_res_cache(void)
+{
+  static const char robots[] =
+    "User-Agent: *\n"
+    "Allow: /private/open\n"
+    "Disallow: /private\n";
+  char file[1024];
+  char *saved_cache = opt.robots_cache;
+  struct robot_specs *specs;
+  time_t now = time (NULL);
+  FILE *fp;
+  int fd;
+
+  mu_assert ("cannot create a temporary file",
+             path_search (file, sizeof (file), NULL, "wget", true) == 0
+             && (fd = mkstemp (file)) >= 0);
+  close (fd);
+  opt.robots_cache = file;
+  res_cleanup ();
+  cache_loaded = true;
+  cache_changed = false;
+
+  /* Fresh specs are written, uncacheable ones are not.  */
+  retrieved_expires = now + 3600;
+  res_register_specs ("fresh.example", 80, res_parse (robots, sizeof (robots) - 1));
+  retrieved_expires = 0;
+  res_register_specs ("nocache.example", 80, res_parse (robots, sizeof (robots) - 1));
+  res_save_cache ();
+  mu_assert ("test_res_cache: cache not saved", !cache_changed);
+
+  /* Specs that expired since are dropped when loading.  */
+  fp = fopen (file, "a");
+  mu_assert ("test_res_cache: cannot append", fp != NULL);
+  fprintf (fp, "stale.example:80\t%lld\t1\nD private\n", (long long) now - 1);
+  fclose (fp);
+
+  res_cleanup ();
+  cache_loaded = false;
+  specs = res_get_specs ("fresh.example", 80);
+  mu_assert ("test_res_cache: fresh specs not reloaded", specs != NULL);
+  mu_assert ("test_res_cache: wrong expiry", specs->expires == now + 3600);
+  mu_assert ("test_res_cache: wrong rules",
+             res_match_path (specs, "index.html")
+             && res_match_path (specs, "private/open")
+             && !res_match_path (specs, "private/x"));
+  mu_assert ("test_res_cache: uncacheable specs reloaded",
+             res_get_specs ("nocache.example", 80) == NULL);
+  mu_assert ("test_res_cache: expired specs reloaded",
+             res_get_specs ("stale.example", 80) == NULL);
+
+  unlink (file);
+  res_cleanup ();
+  opt.robots_cache = saved_cache;
+  cache_loaded = cache_changed = false;
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
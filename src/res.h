@@ -40,6 +40,8 @@ bool res_match_path (const struct robot_specs *, const char *);
 
 void res_register_specs (const char *, int, struct robot_specs *);
 struct robot_specs *res_get_specs (const char *, int);
+void res_set_expiry (time_t);
+void res_save_cache (void);
 
 bool res_retrieve_file (const char *, char **, struct iri *);
 
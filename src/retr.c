@@ -63,34 +63,22 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "iri.h"
 #include "hsts.h"
+#include "warc.h"
 #include "tui.h"
+#include "stats.h"
 #include <sys/wait.h>
 #include <stdarg.h>
 #include <time.h>
 #ifdef HAVE_PTHREAD_H
 # include <pthread.h>
 #endif
-
-/* Debug logging for TUI mode */
-static void retr_debug(const char *fmt, ...) {
-    FILE *debug_log = fopen("/tmp/tui_debug.log", "a");
-    if (!debug_log) return;
-    
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    fprintf(debug_log, "[%04d-%02d-%02d %02d:%02d:%02d] [RETR] ",
-            tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
-            tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
-    
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(debug_log, fmt, args);
-    va_end(args);
-    
-    fprintf(debug_log, "\n");
-    fflush(debug_log);
-    fclose(debug_log);
-}
+#ifndef WINDOWS
+# include <signal.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+#include "sha256.h"
+#include "c-strcase.h"
 
 /* Total size of downloaded files.  Used to enforce quota.  */
 wgint total_downloaded_bytes;
@@ -106,6 +94,26 @@ FILE *output_stream;
    i.e. not `-' or a device file. */
 bool output_stream_regular;
 
+/* Add URLS downloaded files of BYTES in total, and DLTIME seconds of
+   download time, to the totals above.  Parallel downloads call this
+   from several threads.  */
+
+void
+add_download_totals (int urls, wgint bytes, double dltime)
+{
+#ifdef HAVE_PTHREAD_H
+  static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  pthread_mutex_lock (&totals_lock);
+#endif
+  numurls += urls;
+  total_downloaded_bytes += bytes;
+  total_download_time += dltime;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock (&totals_lock);
+#endif
+}
+
 static struct {
   wgint chunk_bytes;
   double chunk_start;
@@ -195,7 +203,7 @@ limit_bandwidth (wgint bytes, struct ptimer *timer)
    skipped.  */
 
 static int
-write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
+write_data (FILE *out, struct warc_body *out2, const char *buf, int bufsize,
             wgint *skip, wgint *written)
 {
   if (out == NULL && out2 == NULL)
@@ -220,8 +228,8 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
 
   if (out)
     fwrite (buf, 1, bufsize, out);
-  if (out2)
-    fwrite (buf, 1, bufsize, out2);
+  if (out2 && !warc_body_write (out2, buf, bufsize))
+    return -3;
 
   if (written)
     *written += bufsize;
@@ -242,22 +250,121 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
 #ifndef __VMS
   if (out)
     fflush (out);
-  if (out2)
-    fflush (out2);
 #endif /* ndef __VMS */
 
   if (out && ferror (out))
     return -2;
-  else if (out2 && ferror (out2))
-    return -3;
 
   return 0;
 }
 
+/* Read buffers of fd_read_body.
+
+   Reads start at DLBUF_INITIAL bytes, or at the size of a body known
+   to be smaller.  While reads keep filling the buffer, which means
+   that more data was already waiting in the socket, the read size
+   doubles up to DLBUF_MAX, so fast transfers take fewer system calls.
+   Reads never ask for more than the transport returns at once, so
+   over TLS, which returns one record of at most 16 KiB per read, they
+   keep that size and don't grow.  The buffers are kept from one body
+   to the next in each thread instead of being allocated for every
+   body, unless a body used less than a quarter of one that had grown
+   past its initial size.  */
+
+#define DLBUF_INITIAL MAX (BUFSIZ, 64 * 1024)
+#define DLBUF_MAX (1024 * 1024)
+
+/* Number of consecutive full reads after which the read size
+   doubles.  */
+#define DLBUF_FULL_READS 4
+
+/* Bytes read after which the socket receive buffer is first sized to
+   the transfer rate, and then again after each sixteenfold of it.  */
+#define RCVBUF_TUNE_BYTES (1024 * 1024)
+
+struct read_buffers {
+  char *dl;
+  int dlsize;
+  char *gz;
+  int gzsize;
+};
+
+#ifdef HAVE_PTHREAD_H
+static pthread_key_t read_buffers_key;
+static pthread_once_t read_buffers_once = PTHREAD_ONCE_INIT;
+
+static void
+free_read_buffers (void *arg)
+{
+  struct read_buffers *rb = arg;
+
+  xfree (rb->dl);
+  xfree (rb->gz);
+  xfree (rb);
+}
+
+static void
+make_read_buffers_key (void)
+{
+  pthread_key_create (&read_buffers_key, free_read_buffers);
+}
+#endif
+
+/* Return the read buffers of the calling thread.  */
+
+static struct read_buffers *
+read_buffers (void)
+{
+#ifdef HAVE_PTHREAD_H
+  struct read_buffers *rb;
+
+  pthread_once (&read_buffers_once, make_read_buffers_key);
+  rb = pthread_getspecific (read_buffers_key);
+  if (!rb)
+    {
+      rb = xnew0 (struct read_buffers);
+      pthread_setspecific (read_buffers_key, rb);
+    }
+  return rb;
+#else
+  static struct read_buffers rb;
+  return &rb;
+#endif
+}
+
+/* Return the buffer *BUF after making it at least SIZE bytes large.
+   The contents are not kept.  */
+
+static char *
+reserve_buffer (char **buf, int *bufsize, int size)
+{
+  if (*bufsize < size)
+    {
+      xfree (*buf);
+      *buf = xmalloc (size);
+      *bufsize = size;
+    }
+  return *buf;
+}
+
+/* Free the buffer *BUF if it is larger than KEEP bytes and only USED
+   bytes of it were needed, less than a quarter, so that a thread that
+   once read a fast body doesn't hold on to its buffer for good.  */
+
+static void
+trim_buffer (char **buf, int *bufsize, int used, int keep)
+{
+  if (*bufsize > keep && used < *bufsize / 4)
+    {
+      xfree (*buf);
+      *bufsize = 0;
+    }
+}
+
 /* Read the contents of file descriptor FD until it the connection
-   terminates or a read error occurs.  The data is read in portions of
-   up to 16K and written to OUT as it arrives.  If opt.verbose is set,
-   the progress is shown.
+   terminates or a read error occurs.  The data is read in portions
+   that grow with the rate it arrives at, and written to OUT as it
+   arrives.  If opt.verbose is set, the progress is shown.
 
    TOREAD is the amount of data expected to arrive, normally only used
    by the progress gauge.
@@ -269,10 +376,10 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
    the amount of data written to disk.  The time it took to download
    the data is stored to ELAPSED.
 
-   If OUT2 is non-NULL, the contents is also written to OUT2.
-   OUT2 will get an exact copy of the response: if this is a chunked
-   response, everything -- including the chunk headers -- is written
-   to OUT2.  (OUT will only get the unchunked response.)
+   If OUT2 is non-NULL, the contents is also written to the WARC
+   record block OUT2.  OUT2 will get an exact copy of the response:
+   if this is a chunked response, everything -- including the chunk
+   headers -- is written to OUT2.  (OUT will only get the unchunked response.)
 
    The function exits and returns the amount of data read.  In case of
    error while reading data, -1 is returned.  In case of error while
@@ -283,14 +390,24 @@ int
 fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread, wgint startpos,
 
               wgint *qtyread, wgint *qtywritten, double *elapsed, int flags,
-              FILE *out2)
+              struct warc_body *out2)
 {
-  retr_debug("fd_read_body called: file=%s, toread=%lld, startpos=%lld, show_progress=%d",
-             downloaded_filename ? downloaded_filename : "NULL", (long long)toread, (long long)startpos, opt.show_progress);
+  DEBUGP (("fd_read_body called: file=%s, toread=%lld, startpos=%lld, show_progress=%d\n",
+           downloaded_filename ? downloaded_filename : "NULL", (long long)toread, (long long)startpos, opt.show_progress));
   
   int ret = 0;
-  int dlbufsize = MAX (BUFSIZ, 64 * 1024);
-  char *dlbuf = xmalloc (dlbufsize);
+  struct read_buffers *rb = read_buffers ();
+  int dlbufsize = DLBUF_INITIAL;
+  char *dlbuf;
+
+  /* Most data one read of FD returns, or 0 if it is not limited.  */
+  int read_size = fd_read_size (fd);
+
+  /* Consecutive reads that filled DLBUF.  */
+  int full_reads = 0;
+
+  /* When to size the receive buffer of FD next.  */
+  wgint rcvbuf_tune_at = RCVBUF_TUNE_BYTES;
 
   struct ptimer *timer = NULL;
   double last_successful_read_tm = 0;
@@ -316,15 +433,34 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
   wgint remaining_chunk_size = 0;
 
 #ifdef HAVE_LIBZ
-  /* try to minimize the number of calls to inflate() and write_data() per
-     call to fd_read() */
-  unsigned int gzbufsize = dlbufsize * 4;
+  unsigned int gzbufsize = 0;
   char *gzbuf = NULL;
   z_stream gzstream;
+#endif
+
+  /* Use a smaller buffer for low requested bandwidths.  For example,
+     with --limit-rate=2k, it doesn't make sense to slurp in 16K of
+     data and then sleep for 8s.  With buffer size equal to the limit,
+     we never have to sleep for more than one second.  */
+  if (opt.limit_rate && opt.limit_rate < dlbufsize)
+    dlbufsize = opt.limit_rate;
 
+  if (read_size && read_size < dlbufsize)
+    dlbufsize = read_size;
+
+  /* Don't reserve more than a small body needs.  */
+  if (exact && toread < dlbufsize)
+    dlbufsize = MAX (toread, 1);
+  dlbuf = reserve_buffer (&rb->dl, &rb->dlsize, dlbufsize);
+
+#ifdef HAVE_LIBZ
+  /* try to minimize the number of calls to inflate() and write_data() per
+     call to fd_read() */
   if (flags & rb_compressed_gzip)
     {
-      gzbuf = xmalloc (gzbufsize);
+      gzbuf = reserve_buffer (&rb->gz, &rb->gzsize,
+                              MAX (dlbufsize, BUFSIZ) * 4);
+      gzbufsize = rb->gzsize;
       gzstream.zalloc = zalloc;
       gzstream.zfree = zfree;
       gzstream.opaque = Z_NULL;
@@ -336,7 +472,7 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
       ret = inflateInit2 (&gzstream, GZIP_DETECT | GZIP_WINDOW);
       if (ret != Z_OK)
         {
-          xfree (gzbuf);
+          gzbuf = NULL;
           errno = (ret == Z_MEM_ERROR) ? ENOMEM : EINVAL;
           ret = -1;
           goto out;
@@ -380,13 +516,6 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
       last_successful_read_tm = 0;
     }
 
-  /* Use a smaller buffer for low requested bandwidths.  For example,
-     with --limit-rate=2k, it doesn't make sense to slurp in 16K of
-     data and then sleep for 8s.  With buffer size equal to the limit,
-     we never have to sleep for more than one second.  */
-  if (opt.limit_rate && opt.limit_rate < dlbufsize)
-    dlbufsize = opt.limit_rate;
-
   /* Read from FD while there is data to read.  Normally toread==0
      means that it is unknown how much data is to arrive.  However, if
      EXACT is set, then toread==0 means what it says: that no data
@@ -426,7 +555,7 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                   break;
                 }
               else if (out2 != NULL)
-                fwrite (line, 1, strlen (line), out2);
+                warc_body_write (out2, line, strlen (line));
 
               remaining_chunk_size = strtol (line, &endl, 16);
               xfree (line);
@@ -446,7 +575,7 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                   else
                     {
                       if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
+                        warc_body_write (out2, line, strlen (line));
                       xfree (line);
                     }
                   break;
@@ -584,11 +713,42 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                   else
                     {
                       if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
+                        warc_body_write (out2, line, strlen (line));
                       xfree (line);
                     }
                 }
             }
+
+          /* The data of DLBUF is consumed now, so it can be replaced
+             by a larger buffer.  */
+          if (ret < dlbufsize || opt.limit_rate)
+            full_reads = 0;
+          else if (dlbufsize <= DLBUF_MAX / 2
+                   && (!read_size || dlbufsize * 2 <= read_size)
+                   && ++full_reads == DLBUF_FULL_READS)
+            {
+              full_reads = 0;
+              dlbufsize *= 2;
+              dlbuf = reserve_buffer (&rb->dl, &rb->dlsize, dlbufsize);
+#ifdef HAVE_LIBZ
+              if (gzbuf)
+                {
+                  gzbuf = reserve_buffer (&rb->gz, &rb->gzsize,
+                                          dlbufsize * 4);
+                  gzbufsize = rb->gzsize;
+                }
+#endif
+              DEBUGP (("Reading %d bytes at a time.\n", dlbufsize));
+            }
+
+          if (sum_read >= rcvbuf_tune_at && timer && !opt.limit_rate)
+            {
+              double secs = ptimer_read (timer);
+
+              if (secs > 0)
+                socket_tune_rcvbuf (fd, sum_read / secs);
+              rcvbuf_tune_at *= 16;
+            }
         }
 
       if (opt.limit_rate)
@@ -631,7 +791,6 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
               ret = -1;
             }
         }
-      xfree (gzbuf);
 
       if (gzstream.total_in != (uLong) sum_read)
         {
@@ -641,12 +800,17 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
     }
 #endif
 
+  trim_buffer (&rb->dl, &rb->dlsize, dlbufsize, DLBUF_INITIAL);
+#ifdef HAVE_LIBZ
+  trim_buffer (&rb->gz, &rb->gzsize, gzbuf ? gzbufsize : 0,
+               DLBUF_INITIAL * 4);
+#endif
+
   if (qtyread)
     *qtyread += sum_read;
   if (qtywritten)
     *qtywritten += sum_written;
-
-  xfree (dlbuf);
+  stats_body (sum_read, sum_written, elapsed ? *elapsed : 0);
 
   return ret;
 }
@@ -959,6 +1123,8 @@ struct http_thread_ctx
   wgint start;
   wgint end;
   char *part_filename;
+  int transfer;                 /* log_begin_transfer of the file */
+  struct transfer_stats *stats; /* the record of the range, or NULL */
   int status;
 };
 
@@ -969,10 +1135,14 @@ download_part_thread (void *arg)
   int dt = 0;
   char *newloc = NULL;
   char *local_file = NULL;
+  uerr_t res;
 
-  uerr_t res = http_loop (ctx->u, ctx->orig_parsed, &newloc, &local_file,
-                          ctx->refurl, &dt, ctx->proxy_url, ctx->iri, NULL,
-                          ctx->start, ctx->end, ctx->part_filename);
+  log_set_transfer (ctx->transfer);
+  stats_set_current (ctx->stats);
+  res = http_loop (ctx->u, ctx->orig_parsed, &newloc, &local_file,
+                   ctx->refurl, &dt, ctx->proxy_url, ctx->iri, NULL,
+                   ctx->start, ctx->end, ctx->part_filename);
+  stats_range_done (ctx->stats, res == RETROK);
 
   xfree (newloc);
   xfree (local_file);
@@ -1003,6 +1173,7 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
   char *local_file = NULL;
   int redirection_count = 0;
   wgint total_size = 0;
+  struct transfer_stats *stats;
 
   bool method_suspended = false;
   char *saved_body_data = NULL;
@@ -1024,6 +1195,9 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
   if (!refurl)
     refurl = opt.referer;
 
+  log_begin_transfer ();
+  stats = stats_begin ();
+
  redirected:
   /* (also for IRI fallbacking) */
 
@@ -1082,25 +1256,20 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
       /* we don't link against main.o when we're testing */
       hsts_store_t hsts_store = NULL;
 #else
-      extern hsts_store_t hsts_store;
+      hsts_store_t hsts_store = opt.hsts ? get_hsts_store () : NULL;
 #endif
 
-      if (opt.hsts && hsts_store)
+      if (hsts_store)
 	{
 	  if (hsts_match (hsts_store, u))
 	    logprintf (LOG_VERBOSE, "URL transformed to HTTPS due to an HSTS policy\n");
 	}
 #endif
-      /* Disable keep-alive for multithreaded downloads to avoid race conditions
-         on shared connection structures. */
-      if (opt.connections > 1)
-        opt.http_keep_alive = false;
-
       result = http_loop (u, orig_parsed, &mynewloc, &local_file, refurl, dt,
               proxy_url, iri, &total_size, -1, -1, NULL);
       
-      retr_debug("http_loop returned: result=%d, local_file=%s, total_size=%lld",
-                 result, local_file ? local_file : "NULL", (long long)total_size);
+      DEBUGP (("http_loop returned: result=%d, local_file=%s, total_size=%lld\n",
+               result, local_file ? local_file : "NULL", (long long)total_size));
 
       bool file_downloaded = false;
       if (local_file) {
@@ -1112,17 +1281,16 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
                   const char *fname = strrchr(local_file, '/');
                   fname = fname ? fname + 1 : local_file;
                   tui_register_completed_file(fname, local_file);
-                  retr_debug("Registered single-thread completed file: %s -> %s", fname, local_file);
+                  DEBUGP (("Registered single-thread completed file: %s -> %s\n", fname, local_file));
               }
           }
       }
 
-      if (opt.connections > 1 && total_size > 0 && result == RETROK && !file_downloaded)
+      if (opt.connections > 1 && !opt.spider
+          && total_size > 0 && result == RETROK && !file_downloaded)
         {
-          /* Disable DNS cache to avoid race conditions in multithreaded mode */
-          opt.dns_cache = false;
-          retr_debug("Starting multipart download: connections=%d, total_size=%lld, tui=%d", 
-                     opt.connections, (long long)total_size, opt.tui);
+          DEBUGP (("Starting multipart download: connections=%d, total_size=%lld, tui=%d\n", 
+                   opt.connections, (long long)total_size, opt.tui));
           
           /* Start TUI input handler for pause/cancel */
           if (opt.tui)
@@ -1134,6 +1302,7 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
           bool any_failed = false;
           pthread_t *threads = xnew_array (pthread_t, opt.connections);
           struct http_thread_ctx *jobs = xnew_array (struct http_thread_ctx, opt.connections);
+          struct transfer_stats *ranges = stats_begin_ranges (opt.connections);
 
           if (!local_file)
             {
@@ -1158,6 +1327,8 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
                   jobs[i].start = start;
                   jobs[i].end = end;
                   jobs[i].part_filename = aprintf ("%s.part%d", local_file, i);
+                  jobs[i].transfer = log_get_transfer ();
+                  jobs[i].stats = stats_range (ranges, i, start, end);
                   jobs[i].status = 1;
 
                   if (pthread_create (&threads[i], NULL, download_part_thread, &jobs[i]) == 0)
@@ -1256,7 +1427,7 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
                           const char *fname = strrchr(local_file, '/');
                           fname = fname ? fname + 1 : local_file;
                           tui_register_completed_file(fname, local_file);
-                          retr_debug("Registered completed file: %s -> %s", fname, local_file);
+                          DEBUGP (("Registered completed file: %s -> %s\n", fname, local_file));
                         }
                     }
                   else
@@ -1457,6 +1628,9 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
         register_css (local_file);
     }
 
+  stats_end (stats, origurl, url, redirection_count, result == RETROK);
+  stats = NULL;
+
   if (file)
     *file = local_file ? local_file : NULL;
   else
@@ -1482,12 +1656,47 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
   RESTORE_METHOD;
 
 bail:
+  stats_end (stats, origurl, NULL, redirection_count, false);
   if (register_status)
     inform_exit_status (result);
 
   return result;
 }
 
+#ifdef HAVE_PTHREAD_H
+/* Check U for the --spider link checkers of retrieve_tree, on a
+   thread of their own.  This is the part of retrieve_url that can run
+   next to other retrievals: U must be an HTTP(S) URL that needs no
+   proxy, and a redirection is not followed but returned as
+   NEWLOCATION, for the caller to retrieve U with retrieve_url.  The
+   caller registers *FILE and the exit status.  */
+
+uerr_t
+spider_check_url (struct url *u, const char *referer, char **file, int *dt,
+                  struct iri *iri)
+{
+  struct transfer_stats *stats = stats_begin ();
+  char *newloc = NULL;
+  uerr_t result;
+#ifdef HAVE_HSTS
+# ifdef TESTING
+  hsts_store_t hsts_store = NULL;
+# else
+  hsts_store_t hsts_store = opt.hsts ? get_hsts_store () : NULL;
+# endif
+
+  if (hsts_store && hsts_match (hsts_store, u))
+    logprintf (LOG_VERBOSE, "URL transformed to HTTPS due to an HSTS policy\n");
+#endif
+
+  result = http_loop (u, u, &newloc, file, referer, dt, NULL, iri, NULL,
+                      -1, -1, NULL);
+  xfree (newloc);
+  stats_end (stats, u->url, NULL, 0, result == RETROK);
+  return result;
+}
+#endif /* HAVE_PTHREAD_H */
+
 static uerr_t retrieve_from_url_list(struct urlpos *url_list, int *count, struct iri *iri)
 {
   struct urlpos *cur_url;
@@ -1647,6 +1856,329 @@ retrieve_from_file (const char *file, bool html, int *count)
   return status;
 }
 
+/* Return whether the SHA-256 digest of FILE is HEX, which may be
+   prefixed with "sha256:".  */
+
+static bool
+batch_checksum_ok (const char *file, const char *hex)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  char digest_hex[SHA256_DIGEST_SIZE * 2 + 1];
+  FILE *fp;
+  bool ok;
+
+  if (!c_strncasecmp (hex, "sha256:", 7))
+    hex += 7;
+  if (!file || !(fp = fopen (file, "rb")))
+    return false;
+  ok = sha256_stream (fp, digest) == 0;
+  fclose (fp);
+  if (!ok)
+    return false;
+  wg_hex_to_string (digest_hex, (char *) digest, SHA256_DIGEST_SIZE);
+  return !c_strcasecmp (digest_hex, hex);
+}
+
+/* The error text of a job that failed with STATUS, after the exit
+   statuses described in the manual.  */
+
+static const char *
+batch_error (uerr_t status)
+{
+  switch (get_status_for_err (status))
+    {
+    case WGET_EXIT_IO_FAIL:
+      return _("File I/O error");
+    case WGET_EXIT_NETWORK_FAIL:
+      return _("Network failure");
+    case WGET_EXIT_SSL_AUTH_FAIL:
+      return _("SSL verification failure");
+    case WGET_EXIT_SERVER_AUTH_FAIL:
+      return _("Username/password authentication failure");
+    case WGET_EXIT_PROTOCOL_ERROR:
+      return _("Protocol error");
+    case WGET_EXIT_SERVER_ERROR:
+      return _("Server issued an error response");
+    default:
+      return _("Generic error");
+    }
+}
+
+/* Run the job of one line of --batch input and write its completion
+   record to REPLY.  The line is a URL, optionally followed by a TAB
+   and the file to save it to, and by another TAB and the SHA-256
+   digest the file must have.  A job without a file is saved as any
+   download is, to the -O file if one was given; it cannot have a
+   digest then, since the -O file holds the other jobs too.  */
+
+static void
+batch_job (char *line, FILE *reply)
+{
+  char *url = line, *output, *checksum = NULL;
+  char *file = NULL, *t;
+  const char *error = NULL;
+  FILE *saved_output_stream = output_stream;
+  bool saved_output_stream_regular = output_stream_regular;
+  char *saved_output_document = opt.output_document;
+  struct iri *iri;
+  struct url *parsed;
+  struct ptimer *timer;
+  wgint bytes = total_downloaded_bytes;
+  uerr_t status = URLERROR;
+  int dt = 0, url_err, exit_status;
+  bool ok = false, checksum_ok = true;
+
+  output = strchr (line, '\t');
+  if (output)
+    {
+      *output++ = '\0';
+      checksum = strchr (output, '\t');
+      if (checksum)
+        *checksum++ = '\0';
+      if (!*output)
+        output = NULL;
+      if (checksum && !*checksum)
+        checksum = NULL;
+    }
+
+  timer = ptimer_new ();
+  t = maybe_prepend_scheme (url);
+  if (!t)
+    t = url;
+
+  iri = iri_new ();
+  set_uri_encoding (iri, opt.locale, true);
+  parsed = url_parse (t, &url_err, iri, true);
+  if (!parsed)
+    error = url_error (url_err);
+  else if (output && HYPHENP (output))
+    error = _("cannot write to standard output");
+  else if (checksum && !output && opt.output_document)
+    error = _("cannot check the digest of the -O file");
+  else
+    {
+      if (output)
+        {
+          /* Save to OUTPUT as -O would.  */
+          output_stream = fopen (output, opt.always_rest ? "ab" : "wb");
+          if (!output_stream)
+            {
+              error = strerror (errno);
+              status = FOPENERR;
+            }
+          else
+            {
+              struct stat st;
+              output_stream_regular = fstat (fileno (output_stream), &st) == 0
+                && S_ISREG (st.st_mode);
+              opt.output_document = output;
+            }
+        }
+      if (!error)
+        {
+          status = retrieve_url (parsed, t, &file, NULL, NULL, &dt, false,
+                                 iri, true);
+          ok = status == RETROK;
+        }
+      if (output)
+        {
+          if (output_stream)
+            fclose (output_stream);
+          output_stream = saved_output_stream;
+          output_stream_regular = saved_output_stream_regular;
+          opt.output_document = saved_output_document;
+        }
+      url_free (parsed);
+    }
+  iri_free (iri);
+
+  if (ok && checksum && !batch_checksum_ok (file ? file : output, checksum))
+    {
+      /* The checksum error Metalink downloads report too.  */
+      status = METALINK_CHKSUM_ERROR;
+      checksum_ok = ok = false;
+      error = _("Checksum mismatch");
+    }
+  if (!ok && !error)
+    error = batch_error (status);
+  inform_exit_status (status);
+  /* get_exit_status turns an unknown status into a generic error.  */
+  exit_status = get_status_for_err (status);
+  if (exit_status == WGET_EXIT_UNKNOWN)
+    exit_status = WGET_EXIT_GENERIC_ERROR;
+
+  fputs ("{\"url\":", reply);
+  json_put_string (reply, url);
+  if (file || output)
+    {
+      fputs (",\"file\":", reply);
+      json_put_string (reply, file ? file : output);
+    }
+  fprintf (reply, ",\"ok\":%s,\"exit\":%d,\"bytes\":%" PRId64
+           ",\"time\":%.6f",
+           ok ? "true" : "false", exit_status,
+           (int64_t) (total_downloaded_bytes - bytes), ptimer_measure (timer));
+  if (checksum)
+    fprintf (reply, ",\"checksum\":\"%s\"", checksum_ok ? "ok" : "mismatch");
+  if (error)
+    {
+      fputs (",\"error\":", reply);
+      json_put_string (reply, error);
+    }
+  fputs ("}\n", reply);
+  fflush (reply);
+
+  ptimer_destroy (timer);
+  xfree (file);
+  if (t != url)
+    xfree (t);
+}
+
+/* Run the jobs read from IN, one per line, writing their completion
+   records to REPLY.  Empty lines and lines starting with '#' are
+   skipped.  */
+
+static void
+batch_serve (FILE *in, FILE *reply)
+{
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+
+  while ((len = getline (&line, &size, in)) > 0)
+    {
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+      if (!len || *line == '#')
+        continue;
+      batch_job (line, reply);
+    }
+  free (line);
+}
+
+#ifndef WINDOWS
+/* The Unix socket of --batch, removed when Wget is killed.  */
+static const char *batch_socket;
+
+static void
+batch_remove_socket (int sig)
+{
+  unlink (batch_socket);
+  signal (sig, SIG_DFL);
+  raise (sig);
+}
+
+/* Remove the socket at SUN if a Wget that is gone left it behind, so
+   that it can be bound again.  One that still listens on it is left
+   alone, and binding then fails.  */
+
+static void
+batch_remove_stale_socket (const struct sockaddr_un *sun)
+{
+  struct stat st;
+  int sock;
+
+  if (lstat (sun->sun_path, &st) != 0 || !S_ISSOCK (st.st_mode))
+    return;
+  sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    return;
+  if (connect (sock, (const struct sockaddr *) sun, sizeof *sun) < 0
+      && errno == ECONNREFUSED)
+    {
+      DEBUGP (("Removing stale socket %s.\n", quote (sun->sun_path)));
+      unlink (sun->sun_path);
+    }
+  close (sock);
+}
+#endif
+
+/* Run download jobs until there are no more, for --batch.  SOURCE is
+   "-" to read the jobs from the standard input and write completion
+   records to the standard output.  Otherwise it is the name of a Unix
+   socket to create, and jobs are read from the clients that connect
+   to it, one client at a time, and answered on the same connection.
+
+   Unlike running Wget once per job, this keeps persistent
+   connections, the TLS context, the DNS cache and the HSTS store
+   between jobs.  */
+
+uerr_t
+retrieve_from_batch (const char *source)
+{
+#ifndef WINDOWS
+  struct sockaddr_un sun;
+  int lsock;
+#endif
+
+  if (HYPHENP (source))
+    {
+      batch_serve (stdin, stdout);
+      return RETROK;
+    }
+
+#ifndef WINDOWS
+  if (strlen (source) >= sizeof sun.sun_path)
+    {
+      logprintf (LOG_NOTQUIET, _("%s: Socket name too long.\n"), source);
+      return FOPENERR;
+    }
+  memset (&sun, 0, sizeof sun);
+  sun.sun_family = AF_UNIX;
+  strcpy (sun.sun_path, source);
+  batch_remove_stale_socket (&sun);
+
+  lsock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (lsock < 0
+      || bind (lsock, (struct sockaddr *) &sun, sizeof sun) < 0
+      || listen (lsock, 8) < 0)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", source, strerror (errno));
+      if (lsock >= 0)
+        close (lsock);
+      return FOPENERR;
+    }
+  batch_socket = source;
+  signal (SIGINT, batch_remove_socket);
+  signal (SIGTERM, batch_remove_socket);
+
+  for (;;)
+    {
+      FILE *in, *reply;
+      int sock = accept (lsock, NULL, NULL), sock2;
+
+      if (sock < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          logprintf (LOG_NOTQUIET, "%s: %s\n", source, strerror (errno));
+          break;
+        }
+      sock2 = dup (sock);
+      in = fdopen (sock, "r");
+      reply = sock2 >= 0 ? fdopen (sock2, "w") : NULL;
+      if (in && reply)
+        batch_serve (in, reply);
+      if (in)
+        fclose (in);
+      else
+        close (sock);
+      if (reply)
+        fclose (reply);
+      else if (sock2 >= 0)
+        close (sock2);
+    }
+
+  close (lsock);
+  unlink (source);
+  return FOPENERR;
+#else
+  logprintf (LOG_NOTQUIET, _("%s: Unix sockets are not supported.\n"),
+             source);
+  return FOPENERR;
+#endif
+}
+
 /* Print `giving up', or `retrying', depending on the impending
    action.  N1 and N2 are the attempt number and the attempt limit.  */
 void
@@ -1923,6 +2455,7 @@ input_file_url (const char *input_file)
 #ifdef TESTING
 
 #include <stdint.h>
+#include <tmpdir.h>
 #include "../tests/unit-tests.h"
 
 const char *
@@ -1948,4 +2481,210 @@ test_retr_rate(void)
   return NULL;
 }
 
+/* A transport that reads a file, returning at most
+   test_body_transport.read_size bytes per read, so that every read
+   that can fill the buffer does.  */
+
+static struct transport_implementation test_body_transport;
+
+static int
+test_body_read (int fd, char *buf, int bufsize, void *ctx _GL_UNUSED,
+                double timeout _GL_UNUSED)
+{
+  if (test_body_transport.read_size)
+    bufsize = MIN (bufsize, test_body_transport.read_size);
+  return read (fd, buf, bufsize);
+}
+
+static int
+test_body_peek (int fd, char *buf, int bufsize, void *ctx _GL_UNUSED,
+                double timeout _GL_UNUSED)
+{
+  return pread (fd, buf, bufsize, lseek (fd, 0, SEEK_CUR));
+}
+
+static void
+test_body_close (int fd, void *ctx _GL_UNUSED)
+{
+  close (fd);
+}
+
+static struct transport_implementation test_body_transport = {
+  test_body_read, NULL, NULL, test_body_peek, NULL, test_body_close, 0
+};
+
+/* Append LEN bytes of DATA to the body in *BUF, of *SIZE bytes,
+   chunked if CHUNKED.  */
+
+static void
+test_body_append (char **buf, size_t *size, const char *data, size_t len,
+                  bool chunked)
+{
+  *buf = xrealloc (*buf, *size + len + 32);
+  if (chunked)
+    *size += sprintf (*buf + *size, "%lx\r\n", (unsigned long) len);
+  memcpy (*buf + *size, data, len);
+  *size += len;
+  if (chunked)
+    *size += sprintf (*buf + *size, "\r\n");
+}
+
+/* Read the body of SIZE bytes in BUF with fd_read_body and FLAGS, and
+   return whether it comes out as the LEN bytes of EXPECTED.  */
+
+static bool
+test_body_read_back (const char *buf, size_t size, int flags,
+                     const char *expected, size_t len)
+{
+  char file[1024];
+  char *out_buf = xmalloc (len + 1);
+  bool same;
+  int show_progress = opt.show_progress;
+  FILE *out;
+  int fd;
+
+  if (path_search (file, sizeof (file), NULL, "wget", true) != 0
+      || (fd = mkstemp (file)) < 0)
+    return false;
+  unlink (file);
+  if (write (fd, buf, size) != (ssize_t) size)
+    {
+      close (fd);
+      return false;
+    }
+  lseek (fd, 0, SEEK_SET);
+  fd_register_transport (fd, &test_body_transport, NULL);
+
+  out = tmpfile ();
+  opt.show_progress = false;
+  same = out
+    && fd_read_body (NULL, fd, out, flags & rb_read_exactly ? size : 0, 0,
+                     NULL, NULL, NULL, flags, NULL) >= 0
+    && fseek (out, 0, SEEK_SET) == 0
+    && fread (out_buf, 1, len + 1, out) == len
+    && !memcmp (out_buf, expected, len);
+  opt.show_progress = show_progress;
+  fd_close (fd);
+  if (out)
+    fclose (out);
+  xfree (out_buf);
+  return same;
+}
+
+const char *
+test_fd_read_body (void)
+{
+  /* Chunks that end before, at and after the read sizes the reads
+     grow through.  */
+  static const size_t chunks[] = {
+    DLBUF_INITIAL * 6 + 1, DLBUF_INITIAL - 1, 1, DLBUF_MAX + 7,
+    DLBUF_INITIAL * 2, DLBUF_INITIAL * 2 + 1
+  };
+  size_t len = 3 * DLBUF_MAX + 12345;
+  char *body = xmalloc (len);
+  char *wire[4] = { NULL };
+  size_t wire_size[4] = { 0 };
+  const char *error = NULL;
+  unsigned int seed = 1;
+  int flags[4] = {
+    rb_chunked_transfer_encoding, rb_read_exactly,
+    rb_chunked_transfer_encoding | rb_compressed_gzip,
+    rb_read_exactly | rb_compressed_gzip
+  };
+  int bodies = 2;
+  size_t i, pos, n;
+  int j, k;
+
+  /* Data that doesn't compress, so that the gzip body is as long.  */
+  for (i = 0; i < len; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      body[i] = seed >> 24;
+    }
+  for (j = 0; j < 2; j++)
+    {
+      for (pos = 0, k = 0; pos < len; pos += n, k++)
+        {
+          n = MIN (chunks[k % countof (chunks)], len - pos);
+          test_body_append (&wire[j], &wire_size[j], body + pos, n, !j);
+        }
+      if (!j)
+        test_body_append (&wire[j], &wire_size[j], NULL, 0, true);
+    }
+
+#ifdef HAVE_LIBZ
+  {
+    z_stream zs;
+    uLong bound;
+    char *gz;
+
+    memset (&zs, 0, sizeof (zs));
+    deflateInit2 (&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                  Z_DEFAULT_STRATEGY);
+    bound = deflateBound (&zs, len);
+    gz = xmalloc (bound);
+    zs.next_in = (unsigned char *) body;
+    zs.avail_in = len;
+    zs.next_out = (unsigned char *) gz;
+    zs.avail_out = bound;
+    deflate (&zs, Z_FINISH);
+    for (j = 2; j < 4; j++)
+      {
+        for (pos = 0, k = 0; pos < zs.total_out; pos += n, k++)
+          {
+            n = MIN (chunks[k % countof (chunks)], zs.total_out - pos);
+            test_body_append (&wire[j], &wire_size[j], gz + pos, n, j == 2);
+          }
+        if (j == 2)
+          test_body_append (&wire[j], &wire_size[j], NULL, 0, true);
+      }
+    deflateEnd (&zs);
+    xfree (gz);
+    bodies = 4;
+  }
+#endif
+
+  /* Read the bodies as from a socket, whose reads grow, and as from
+     TLS, whose reads don't.  */
+  for (k = 0; k < 2 && !error; k++)
+    {
+      test_body_transport.read_size = k ? 16384 : 0;
+      for (j = 0; j < bodies && !error; j++)
+        {
+          struct read_buffers *rb = read_buffers ();
+
+          xfree (rb->dl);
+          rb->dlsize = 0;
+          if (!test_body_read_back (wire[j], wire_size[j], flags[j],
+                                    body, len))
+            error = aprintf ("%s: body %d, read size %d differs", __func__,
+                             j, test_body_transport.read_size);
+          else if (k ? rb->dlsize > 16384 : rb->dlsize <= DLBUF_INITIAL)
+            error = aprintf ("%s: body %d, read size %d grew to %d",
+                             __func__, j, test_body_transport.read_size,
+                             rb->dlsize);
+        }
+    }
+
+  /* A small body after a large one gives the grown buffer back.  */
+  if (!error)
+    {
+      struct read_buffers *rb = read_buffers ();
+
+      test_body_transport.read_size = 0;
+      if (!test_body_read_back (wire[1], wire_size[1], flags[1], body, len)
+          || rb->dlsize <= DLBUF_INITIAL)
+        error = aprintf ("%s: large body failed", __func__);
+      else if (!test_body_read_back (body, 1000, rb_read_exactly, body, 1000)
+               || rb->dlsize > DLBUF_INITIAL)
+        error = aprintf ("%s: small body kept %d bytes of buffer", __func__,
+                         rb->dlsize);
+    }
+
+  for (j = 0; j < 4; j++)
+    xfree (wire[j]);
+  xfree (body);
+  return error;
+}
+
 #endif /* TESTING */
@@ -42,6 +42,8 @@ extern double total_download_time;
 extern FILE *output_stream;
 extern bool output_stream_regular;
 
+void add_download_totals (int, wgint, double);
+
 /* Flags for fd_read_body. */
 enum {
   rb_read_exactly  = 1,
@@ -53,7 +55,9 @@ enum {
   rb_compressed_gzip = 8
 };
 
-int fd_read_body (const char *, int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *);
+struct warc_body;
+int fd_read_body (const char *, int, FILE *, wgint, wgint, wgint *, wgint *, double *, int,
+                  struct warc_body *);
 
 typedef const char *(*hunk_terminator_t) (const char *, const char *, int);
 
@@ -62,7 +66,10 @@ char *fd_read_line (int);
 
 uerr_t retrieve_url (struct url *, const char *, char **, char **,
                      const char *, int *, bool, struct iri *, bool);
+uerr_t spider_check_url (struct url *, const char *, char **, int *,
+                         struct iri *);
 uerr_t retrieve_from_file (const char *, bool, int *);
+uerr_t retrieve_from_batch (const char *);
 
 const char *retr_rate (wgint, double);
 double calc_rate (wgint, double, int *);
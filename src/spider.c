@@ -33,6 +33,9 @@ as that of the covered work.  */
 #include <stdio.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include "spider.h"
 #include "url.h"
@@ -54,16 +57,26 @@ spider_cleanup (void)
 }
 #endif
 
-/* Remembers broken links.  */
+/* Remembers broken links.  Links may be checked on several threads.  */
 void
 nonexisting_url (const char *url)
 {
+#ifdef HAVE_PTHREAD_H
+  static pthread_mutex_t nonexisting_urls_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
   /* Ignore robots.txt URLs */
   if (is_robots_txt_url (url))
     return;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock (&nonexisting_urls_lock);
+#endif
   if (!nonexisting_urls_set)
     nonexisting_urls_set = make_string_hash_table (0);
   string_set_add (nonexisting_urls_set, url);
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock (&nonexisting_urls_lock);
+#endif
 }
 
 void
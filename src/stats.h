@@ -0,0 +1,63 @@
+/* Declarations for stats.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef STATS_H
+#define STATS_H
+
+/* Phases of a transfer timed for --stats-file. */
+enum stats_phase {
+  STATS_DNS,
+  STATS_CONNECT,
+  STATS_TLS,
+  STATS_TTFB,
+  STATS_PHASES
+};
+
+struct transfer_stats;
+
+struct transfer_stats *stats_begin (void);
+struct transfer_stats *stats_begin_ranges (int);
+struct transfer_stats *stats_range (struct transfer_stats *, int,
+                                    wgint, wgint);
+void stats_range_done (struct transfer_stats *, bool);
+void stats_set_current (struct transfer_stats *);
+void stats_end (struct transfer_stats *, const char *, const char *, int,
+                bool);
+
+double stats_time (void);
+void stats_phase (enum stats_phase, double);
+void stats_connection (bool);
+void stats_try (void);
+void stats_status (int);
+void stats_body (wgint, wgint, double);
+
+void stats_cleanup (void);
+
+#endif /* STATS_H */
@@ -0,0 +1,284 @@
+/* String interning pool.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#include "wget.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "strpool.h"
+#include "hash.h"
+#include "utils.h"
+#ifdef TESTING
+# include "../tests/unit-tests.h"
+#endif
+
+/* A string pool stores exactly one copy of each string interned in
+   it, and hands out a pointer to that copy.  Since equal strings are
+   represented by the same pointer, interned strings can be shared by
+   any number of data structures without copying, and compared by
+   pointer value.
+
+   The string text is kept in large chunks that are carved out
+   sequentially, which avoids the per-string malloc overhead and
+   keeps strings that were interned together close in memory.
+   Individual strings are never freed; the whole pool is released at
+   once.  This matches the usage in recursive retrieval, where a URL
+   that has once been seen must be remembered until the end.  */
+
+/* Size of a regular chunk.  Strings longer than a quarter of this get
+   a chunk of their own so that the tail of the current chunk is not
+   wasted.  */
+#define POOL_CHUNK_SIZE (64 * 1024)
+
+struct pool_chunk {
+  struct pool_chunk *next;
+  size_t used, size;
+  char *data;
+};
+
+struct string_pool {
+  struct hash_table *index;     /* maps string contents to the copy
+                                   stored in a chunk. */
+  struct pool_chunk *chunks;    /* the first chunk is the one being
+                                   filled. */
+  size_t bytes;                 /* total bytes of text stored. */
+};
+
+/* Create an empty string pool. */
+
+struct string_pool *
+string_pool_new (void)
+{
+  struct string_pool *pool = xnew0 (struct string_pool);
+  pool->index = make_string_hash_table (0);
+  return pool;
+}
+
+static struct pool_chunk *
+pool_chunk_new (size_t size)
+{
+  struct pool_chunk *chunk = xmalloc (sizeof (struct pool_chunk) + size);
+  chunk->data = (char *) (chunk + 1);
+  chunk->used = 0;
+  chunk->size = size;
+  return chunk;
+}
+
+/* Copy the LEN bytes of S and the terminating NUL into POOL's
+   chunks, and return the copy.  */
+
+static char *
+pool_store (struct string_pool *pool, const char *s, size_t len)
+{
+  struct pool_chunk *chunk = pool->chunks;
+  char *copy;
+
+  if (len + 1 > POOL_CHUNK_SIZE / 4)
+    {
+      /* Link the dedicated chunk behind the current one, which
+         remains available for short strings.  */
+      struct pool_chunk *big = pool_chunk_new (len + 1);
+      if (chunk)
+        {
+          big->next = chunk->next;
+          chunk->next = big;
+        }
+      else
+        {
+          big->next = NULL;
+          pool->chunks = big;
+        }
+      chunk = big;
+    }
+  else if (!chunk || chunk->size - chunk->used < len + 1)
+    {
+      chunk = pool_chunk_new (POOL_CHUNK_SIZE);
+      chunk->next = pool->chunks;
+      pool->chunks = chunk;
+    }
+
+  copy = chunk->data + chunk->used;
+  memcpy (copy, s, len + 1);
+  chunk->used += len + 1;
+  pool->bytes += len + 1;
+  return copy;
+}
+
+/* Return the pooled copy of S, adding it to POOL if it is not there
+   yet.  The returned string remains valid until POOL is freed, and
+   must not be modified or freed by the caller.  */
+
+const char *
+string_pool_intern (struct string_pool *pool, const char *s)
+{
+  char *copy = hash_table_get (pool->index, s);
+  if (copy)
+    return copy;
+
+  copy = pool_store (pool, s, strlen (s));
+  hash_table_put (pool->index, copy, copy);
+  return copy;
+}
+
+/* Return the pooled copy of S if S has been interned in POOL, NULL
+   otherwise.  */
+
+const char *
+string_pool_find (const struct string_pool *pool, const char *s)
+{
+  return hash_table_get (pool->index, s);
+}
+
+/* Return the number of distinct strings in POOL. */
+
+int
+string_pool_count (const struct string_pool *pool)
+{
+  return hash_table_count (pool->index);
+}
+
+/* Free POOL and all the strings interned in it. */
+
+void
+string_pool_free (struct string_pool *pool)
+{
+  struct pool_chunk *chunk = pool->chunks;
+  while (chunk)
+    {
+      struct pool_chunk *next = chunk->next;
+      xfree (chunk);
+      chunk = next;
+    }
+  hash_table_destroy (pool->index);
+  xfree (pool);
+}
+
+/* The process-wide pool shared by the recursive retrieval queue and
+   blacklist, and the URL/file maps in convert.c.  Downloads can run
+   in several threads at once, so access to it is serialized.  */
+
+static struct string_pool *shared_pool;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t shared_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_SHARED_POOL() pthread_mutex_lock (&shared_pool_lock)
+# define UNLOCK_SHARED_POOL() pthread_mutex_unlock (&shared_pool_lock)
+#else
+# define LOCK_SHARED_POOL()
+# define UNLOCK_SHARED_POOL()
+#endif
+
+/* Intern S in the shared pool.  See string_pool_intern. */
+
+const char *
+intern_string (const char *s)
+{
+  const char *res;
+
+  LOCK_SHARED_POOL ();
+  if (!shared_pool)
+    shared_pool = string_pool_new ();
+  res = string_pool_intern (shared_pool, s);
+  UNLOCK_SHARED_POOL ();
+  return res;
+}
+
+/* Return the shared pool's copy of S, or NULL if S was never
+   interned.  */
+
+const char *
+find_interned_string (const char *s)
+{
+  const char *res = NULL;
+
+  LOCK_SHARED_POOL ();
+  if (shared_pool)
+    res = string_pool_find (shared_pool, s);
+  UNLOCK_SHARED_POOL ();
+  return res;
+}
+
+#if defined DEBUG_MALLOC || defined TESTING
+void
+interned_strings_cleanup (void)
+{
+  if (shared_pool)
+    {
+      DEBUGP (("String pool: %d strings, %lu bytes.\n",
+               string_pool_count (shared_pool),
+               (unsigned long) shared_pool->bytes));
+      string_pool_free (shared_pool);
+      shared_pool = NULL;
+    }
+}
+#endif
+
+#ifdef TESTING
+
+const char *
+test_string_pool (void)
+{
+  struct string_pool *pool = string_pool_new ();
+  char big[POOL_CHUNK_SIZE];
+  const char *a, *b, *c, *d;
+
+  a = string_pool_intern (pool, "http://example.com/");
+  b = string_pool_intern (pool, "http://example.com/a");
+  mu_assert ("test_string_pool: distinct strings share a copy", a != b);
+
+  c = string_pool_intern (pool, "http://example.com/");
+  mu_assert ("test_string_pool: equal strings not shared", a == c);
+  mu_assert ("test_string_pool: wrong contents",
+             !strcmp (b, "http://example.com/a"));
+  mu_assert ("test_string_pool: find failed",
+             string_pool_find (pool, "http://example.com/a") == b);
+  mu_assert ("test_string_pool: found missing string",
+             string_pool_find (pool, "http://example.com/b") == NULL);
+
+  /* A string that gets a chunk of its own must not disturb the chunk
+     being filled.  */
+  memset (big, 'x', sizeof (big) - 1);
+  big[sizeof (big) - 1] = '\0';
+  d = string_pool_intern (pool, big);
+  mu_assert ("test_string_pool: long string mangled",
+             strlen (d) == sizeof (big) - 1);
+  c = string_pool_intern (pool, "http://example.com/c");
+  mu_assert ("test_string_pool: short string after long one",
+             c == b + strlen (b) + 1);
+
+  mu_assert ("test_string_pool: wrong count", string_pool_count (pool) == 4);
+  string_pool_free (pool);
+  return NULL;
+}
+
+#endif /* TESTING */
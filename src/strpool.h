@@ -0,0 +1,46 @@
+/* Declarations for strpool.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+struct string_pool;
+
+struct string_pool *string_pool_new (void);
+const char *string_pool_intern (struct string_pool *, const char *);
+const char *string_pool_find (const struct string_pool *, const char *);
+int string_pool_count (const struct string_pool *);
+void string_pool_free (struct string_pool *);
+
+const char *intern_string (const char *);
+const char *find_interned_string (const char *);
+void interned_strings_cleanup (void);
+
+#endif /* STRPOOL_H */
@@ -19,7 +19,6 @@
 static bool tui_initialized = false;
 static WINDOW *main_win = NULL;
 static pthread_mutex_t tui_mutex = PTHREAD_MUTEX_INITIALIZER;
-static FILE *debug_log = NULL;
 
 // Pause and Cancel state
 static volatile bool tui_paused = false;
@@ -31,29 +30,6 @@ static volatile bool input_thread_running = false;
 static volatile int scroll_offset = 0;
 static int visible_bars = 0;  // Number of bars that can fit on screen
 
-// Debug logging function
-static void tui_debug(const char *fmt, ...) {
-    if (!debug_log) {
-        debug_log = fopen("/tmp/tui_debug.log", "a");
-        if (!debug_log) return;
-        fprintf(debug_log, "\n=== TUI Debug Session Started ===\n");
-    }
-    
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_buf[26];
-    strftime(time_buf, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-    fprintf(debug_log, "[%s] ", time_buf);
-    
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(debug_log, fmt, args);
-    va_end(args);
-    
-    fprintf(debug_log, "\n");
-    fflush(debug_log);
-}
-
 // Checksum types
 typedef enum {
     CHECKSUM_NONE = 0,
@@ -185,7 +161,7 @@ static void tui_cleanup_handler(void) {
 }
 
 static void init_ncurses_base() {
-    tui_debug("init_ncurses_base called, tui_initialized=%d", tui_initialized);
+    DEBUGP (("init_ncurses_base called, tui_initialized=%d\n", tui_initialized));
     if (tui_initialized) return;
     
     initscr();
@@ -203,7 +179,7 @@ static void init_ncurses_base() {
     }
     atexit(tui_cleanup_handler);
     tui_initialized = true;
-    tui_debug("init_ncurses_base completed");
+    DEBUGP (("init_ncurses_base completed\n"));
 }
 
 // Helper function to convert bytes to hex string
@@ -221,7 +197,7 @@ static bool calculate_md5(const char *filepath, char *result) {
 #ifdef HAVE_NETTLE
     FILE *file = fopen(filepath, "rb");
     if (!file) {
-        tui_debug("calculate_md5: failed to open file %s: %s", filepath, strerror(errno));
+        DEBUGP (("calculate_md5: failed to open file %s: %s\n", filepath, strerror(errno)));
         return false;
     }
     
@@ -241,10 +217,10 @@ static bool calculate_md5(const char *filepath, char *result) {
     md5_digest(&ctx, MD5_DIGEST_SIZE, digest);
     
     bytes_to_hex(digest, MD5_DIGEST_SIZE, result);
-    tui_debug("calculate_md5: %s -> %s", filepath, result);
+    DEBUGP (("calculate_md5: %s -> %s\n", filepath, result));
     return true;
 #else
-    tui_debug("calculate_md5: Nettle not available");
+    DEBUGP (("calculate_md5: Nettle not available\n"));
     strcpy(result, "N/A (Nettle not available)");
     return false;
 #endif
@@ -255,7 +231,7 @@ static bool calculate_sha256(const char *filepath, char *result) {
 #ifdef HAVE_NETTLE
     FILE *file = fopen(filepath, "rb");
     if (!file) {
-        tui_debug("calculate_sha256: failed to open file %s: %s", filepath, strerror(errno));
+        DEBUGP (("calculate_sha256: failed to open file %s: %s\n", filepath, strerror(errno)));
         return false;
     }
     
@@ -275,10 +251,10 @@ static bool calculate_sha256(const char *filepath, char *result) {
     sha256_digest(&ctx, SHA256_DIGEST_SIZE, digest);
     
     bytes_to_hex(digest, SHA256_DIGEST_SIZE, result);
-    tui_debug("calculate_sha256: %s -> %s", filepath, result);
+    DEBUGP (("calculate_sha256: %s -> %s\n", filepath, result));
     return true;
 #else
-    tui_debug("calculate_sha256: Nettle not available");
+    DEBUGP (("calculate_sha256: Nettle not available\n"));
     strcpy(result, "N/A (Nettle not available)");
     return false;
 #endif
@@ -311,7 +287,7 @@ void tui_register_completed_file(const char *filename, const char *filepath) {
     if (!filename || !filepath) return;
     
     pthread_mutex_lock(&tui_mutex);
-    tui_debug("tui_register_completed_file: %s -> %s", filename, filepath);
+    DEBUGP (("tui_register_completed_file: %s -> %s\n", filename, filepath));
     
     // Check if already registered
     for (int i = 0; i < completed_file_count; i++) {
@@ -340,7 +316,7 @@ int tui_get_completed_file_count(void) {
 }
 
 static void ensure_main_win() {
-    tui_debug("ensure_main_win called, main_win=%p", (void*)main_win);
+    DEBUGP (("ensure_main_win called, main_win=%p\n", (void*)main_win));
     if (main_win) return;
     
     int height, width;
@@ -353,11 +329,11 @@ static void ensure_main_win() {
     mvwprintw(main_win, 1, 2, " GNU Wget - Multi-threaded TUI Downloader ");
     if (has_colors()) wattroff(main_win, COLOR_PAIR(4) | A_BOLD);
     wrefresh(main_win);
-    tui_debug("ensure_main_win completed, main_win=%p, height=%d, width=%d", (void*)main_win, height, width);
+    DEBUGP (("ensure_main_win completed, main_win=%p, height=%d, width=%d\n", (void*)main_win, height, width));
 }
 
 TuiResult *tui_get_info(void) {
-    tui_debug("tui_get_info called");
+    DEBUGP (("tui_get_info called\n"));
     init_ncurses_base();
 
     int height, width;
@@ -439,14 +415,14 @@ TuiResult *tui_get_info(void) {
     // Clean up the input window
     delwin(win);
     
-    tui_debug("tui_get_info: pressed 's', count=%d", count);
+    DEBUGP (("tui_get_info: pressed 's', count=%d\n", count));
     
     // Create the main progress window immediately
     clear();
     refresh();
     ensure_main_win();
     
-    tui_debug("tui_get_info: main_win created, returning result");
+    DEBUGP (("tui_get_info: main_win created, returning result\n"));
     
     TuiResult *res = malloc(sizeof(TuiResult));
     res->urls = urls;
@@ -461,10 +437,10 @@ char *tui_get_url(void) {
 }
 
 void *tui_progress_create (const char *f_name, wgint initial, wgint total) {
-    tui_debug("tui_progress_create called: file=%s, initial=%lld, total=%lld", f_name, (long long)initial, (long long)total);
+    DEBUGP (("tui_progress_create called: file=%s, initial=%lld, total=%lld\n", f_name, (long long)initial, (long long)total));
     pthread_mutex_lock(&tui_mutex);
     
-    tui_debug("tui_progress_create: got mutex, tui_initialized=%d", tui_initialized);
+    DEBUGP (("tui_progress_create: got mutex, tui_initialized=%d\n", tui_initialized));
     if (!tui_initialized) init_ncurses_base();
     ensure_main_win();
 
@@ -519,8 +495,8 @@ void *tui_progress_create_with_checksum(const char *filename, const char *filepa
                                          wgint initial, wgint total,
                                          TuiChecksumType checksum_type, 
                                          const char *expected_checksum) {
-    tui_debug("tui_progress_create_with_checksum: file=%s, path=%s, checksum_type=%d", 
-              filename, filepath ? filepath : "NULL", checksum_type);
+    DEBUGP (("tui_progress_create_with_checksum: file=%s, path=%s, checksum_type=%d\n", 
+             filename, filepath ? filepath : "NULL", checksum_type));
     
     void *bar_ptr = tui_progress_create(filename, initial, total);
     TuiProgress *bar = (TuiProgress *)bar_ptr;
@@ -551,7 +527,7 @@ void tui_progress_set_filepath(void *bar_ptr, const char *filepath) {
         free(bar->filepath);
     }
     bar->filepath = strdup(filepath);
-    tui_debug("tui_progress_set_filepath: id=%d, path=%s", bar->id, filepath);
+    DEBUGP (("tui_progress_set_filepath: id=%d, path=%s\n", bar->id, filepath));
     pthread_mutex_unlock(&tui_mutex);
 }
 
@@ -741,7 +717,7 @@ void tui_progress_finish_with_checksum(void *bar_ptr, double time_taken) {
     
     // Calculate checksum if requested and filepath is available
     if (bar->checksum_type != CHECKSUM_NONE && bar->filepath) {
-        tui_debug("tui_progress_finish_with_checksum: calculating checksum for %s", bar->filepath);
+        DEBUGP (("tui_progress_finish_with_checksum: calculating checksum for %s\n", bar->filepath));
         
         bool success = calculate_checksum(bar->filepath, bar->checksum_type, bar->checksum);
         
@@ -750,7 +726,7 @@ void tui_progress_finish_with_checksum(void *bar_ptr, double time_taken) {
         
         if (success && bar->expected_checksum[0] != '\0') {
             bar->checksum_verified = verify_checksum(bar->checksum, bar->expected_checksum);
-            tui_debug("tui_progress_finish_with_checksum: verification result=%d", bar->checksum_verified);
+            DEBUGP (("tui_progress_finish_with_checksum: verification result=%d\n", bar->checksum_verified));
         }
         pthread_mutex_unlock(&tui_mutex);
         
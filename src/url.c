@@ -40,6 +40,7 @@ as that of the covered work.  */
 #include "utils.h"
 #include "url.h"
 #include "host.h"  /* for is_valid_ipv6_address */
+#include "hash.h"
 #include "c-strcase.h"
 #include "c-ctype.h"
 
@@ -52,6 +53,10 @@ as that of the covered work.  */
 #include "vms.h"
 #endif /* def __VMS */
 
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #ifdef TESTING
 #include "../tests/unit-tests.h"
 #endif
@@ -628,7 +633,7 @@ maybe_prepend_scheme (const char *url)
   return aprintf ("http://%s", url);
 }
 
-static void split_path (const char *, char **, char **);
+static char *split_path (const char *, char **, char **, char *);
 
 /* Like strpbrk, with the exception that it returns the pointer to the
    terminating zero (end-of-string aka "eos") if no matching character
@@ -921,14 +926,44 @@ url_parse (const char *url, int *error, struct iri *iri, bool percent_encode)
 
   u = xnew0 (struct url);
   u->scheme = scheme;
-  u->host   = strdupdelim (host_b, host_e);
   u->port   = port;
   u->user   = user;
   u->passwd = passwd;
 
-  u->path = strdupdelim (path_b, path_e);
-  path_modified = path_simplify (scheme, u->path);
-  split_path (u->path, &u->dir, &u->file);
+  /* Store the components in one block: the host, the path, room for
+     the dir and file split from the path, and the optional parts.  */
+  {
+    char *q;
+
+#define PART_SIZE(var) (var##_b ? var##_e - var##_b + 1 : 1)
+    u->components_size = PART_SIZE (host) + 2 * PART_SIZE (path) + 1
+      + PART_SIZE (params) + PART_SIZE (query) + PART_SIZE (fragment);
+#undef PART_SIZE
+    q = u->components = xmalloc (u->components_size);
+
+#define STORE_PART(field, var) do {             \
+  u->field = q;                                 \
+  if (var##_b)                                  \
+    {                                           \
+      memcpy (q, var##_b, var##_e - var##_b);   \
+      q += var##_e - var##_b;                   \
+    }                                           \
+  *q++ = '\0';                                  \
+} while (0)
+
+    STORE_PART (host, host);
+    STORE_PART (path, path);
+    path_modified = path_simplify (scheme, u->path);
+    q = split_path (u->path, &u->dir, &u->file, q);
+    if (params_b)
+      STORE_PART (params, params);
+    if (query_b)
+      STORE_PART (query, query);
+    if (fragment_b)
+      STORE_PART (fragment, fragment);
+
+#undef STORE_PART
+  }
 
   host_modified = lowercase_str (u->host);
 
@@ -958,20 +993,12 @@ url_parse (const char *url, int *error, struct iri *iri, bool percent_encode)
           char *new = idn_encode (iri, u->host);
           if (new)
             {
-              xfree (u->host);
               u->host = new;
               host_modified = true;
             }
         }
     }
 
-  if (params_b)
-    u->params = strdupdelim (params_b, params_e);
-  if (query_b)
-    u->query = strdupdelim (query_b, query_e);
-  if (fragment_b)
-    u->fragment = strdupdelim (fragment_b, fragment_e);
-
   if (opt.enable_iri || path_modified || u->fragment || host_modified || path_b == path_e)
     {
       /* If we suspect that a transformation has rendered what
@@ -1031,24 +1058,26 @@ url_error (int error_code)
    "foo"                ""            "foo"
    "foo/bar/baz%2fqux"  "foo/bar"     "baz/qux" (!)
 
-   DIR and FILE are freshly allocated.  */
+   DIR and FILE are stored to BUF, which must have room for the length
+   of PATH plus two characters.  Return the end of what was stored.  */
 
-static void
-split_path (const char *path, char **dir, char **file)
+static char *
+split_path (const char *path, char **dir, char **file, char *buf)
 {
-  char *last_slash = strrchr (path, '/');
-  if (!last_slash)
-    {
-      *dir = xstrdup ("");
-      *file = xstrdup (path);
-    }
-  else
-    {
-      *dir = strdupdelim (path, last_slash);
-      *file = xstrdup (last_slash + 1);
-    }
+  const char *last_slash = strrchr (path, '/');
+  size_t dir_len = last_slash ? (size_t) (last_slash - path) : 0;
+  const char *file_b = last_slash ? last_slash + 1 : path;
+  size_t file_len = strlen (file_b);
+
+  *dir = buf;
+  memcpy (buf, path, dir_len);
+  buf[dir_len] = '\0';
+  *file = buf + dir_len + 1;
+  memcpy (*file, file_b, file_len + 1);
+
   url_unescape (*dir);
   url_unescape (*file);
+  return *file + file_len + 1;
 }
 
 /* Note: URL's "full path" is the path with the query string and
@@ -1152,6 +1181,14 @@ url_escape_dir (const char *dir)
   return newdir;
 }
 
+/* Free the component P of U, unless it lives in the block of
+   url_parse, which url_free frees as a whole.  */
+#define free_component(u, p) do {                                       \
+  if (!(u)->components || (p) < (u)->components                         \
+      || (p) >= (u)->components + (u)->components_size)                 \
+    xfree (p);                                                          \
+} while (0)
+
 /* Sync u->path and u->url with u->dir and u->file.  Called after
    u->file or u->dir have been changed, typically by the FTP code.  */
 
@@ -1160,7 +1197,7 @@ sync_path (struct url *u)
 {
   char *newpath, *efile, *edir;
 
-  xfree (u->path);
+  free_component (u, u->path);
 
   /* u->dir and u->file are not escaped.  URL-escape them before
      reassembling them into u->path.  That way, if they contain
@@ -1206,7 +1243,7 @@ sync_path (struct url *u)
 void
 url_set_dir (struct url *url, const char *newdir)
 {
-  xfree (url->dir);
+  free_component (url, url->dir);
   url->dir = xstrdup (newdir);
   sync_path (url);
 }
@@ -1214,7 +1251,7 @@ url_set_dir (struct url *url, const char *newdir)
 void
 url_set_file (struct url *url, const char *newfile)
 {
-  xfree (url->file);
+  free_component (url, url->file);
   url->file = xstrdup (newfile);
   sync_path (url);
 }
@@ -1224,24 +1261,91 @@ url_free (struct url *url)
 {
   if (url)
     {
-      xfree (url->host);
+      free_component (url, url->host);
 
-      xfree (url->path);
+      free_component (url, url->path);
       xfree (url->url);
 
-      xfree (url->params);
-      xfree (url->query);
-      xfree (url->fragment);
+      free_component (url, url->params);
+      free_component (url, url->query);
+      free_component (url, url->fragment);
       xfree (url->user);
       xfree (url->passwd);
 
-      xfree (url->dir);
-      xfree (url->file);
+      free_component (url, url->dir);
+      free_component (url, url->file);
+      xfree (url->components);
 
       xfree (url);
     }
 }
 
+/* Directories mkalldirs knows to exist, so that saving many files to
+   the same directory costs one stat rather than one per file.  Range
+   workers save files concurrently, hence the lock.  */
+
+static struct hash_table *known_dirs;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t known_dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_KNOWN_DIRS() pthread_mutex_lock (&known_dirs_lock)
+# define UNLOCK_KNOWN_DIRS() pthread_mutex_unlock (&known_dirs_lock)
+#else
+# define LOCK_KNOWN_DIRS()
+# define UNLOCK_KNOWN_DIRS()
+#endif
+
+static bool
+known_dir_p (const char *dir)
+{
+  bool known;
+
+  LOCK_KNOWN_DIRS ();
+  known = known_dirs && hash_table_contains (known_dirs, dir);
+  UNLOCK_KNOWN_DIRS ();
+  return known;
+}
+
+/* Remember that DIR and the directories above it exist.  */
+
+static void
+add_known_dir (const char *dir)
+{
+  char *copy = xstrdup (dir);
+  char *p = copy + strlen (copy);
+
+  LOCK_KNOWN_DIRS ();
+  if (!known_dirs)
+    known_dirs = make_string_hash_table (0);
+  while (p > copy && !hash_table_contains (known_dirs, copy))
+    {
+      hash_table_put (known_dirs, xstrdup (copy), NULL);
+      while (p > copy && *p != '/')
+        --p;
+      *p = '\0';
+    }
+  UNLOCK_KNOWN_DIRS ();
+  xfree (copy);
+}
+
+/* Forget all the directories, after a file that was in the way of one
+   has been removed.  */
+
+static void
+forget_known_dirs (void)
+{
+  LOCK_KNOWN_DIRS ();
+  if (known_dirs)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (known_dirs, &iter);
+           hash_table_iter_next (&iter); )
+        xfree (iter.key);
+      hash_table_clear (known_dirs);
+    }
+  UNLOCK_KNOWN_DIRS ();
+}
+
 /* Create all the necessary directories for PATH (a file).  Calls
    make_directory internally.  */
 int
@@ -1260,11 +1364,18 @@ mkalldirs (const char *path)
     return 0;
   t = strdupdelim (path, p);
 
+  if (known_dir_p (t))
+    {
+      xfree (t);
+      return 0;
+    }
+
   /* Check whether the directory exists.  */
   if ((stat (t, &st) == 0))
     {
       if (S_ISDIR (st.st_mode))
         {
+          add_known_dir (t);
           xfree (t);
           return 0;
         }
@@ -1286,15 +1397,27 @@ mkalldirs (const char *path)
           if (unlink (t))
             logprintf (LOG_NOTQUIET, "Failed to unlink %s (%d): %s\n",
                        t, errno, strerror(errno));
+          forget_known_dirs ();
         }
     }
   res = make_directory (t);
   if (res != 0)
     logprintf (LOG_NOTQUIET, "%s: %s\n", t, strerror (errno));
+  else
+    add_known_dir (t);
   xfree (t);
   return res;
 }
 
+void
+mkalldirs_cleanup (void)
+{
+  forget_known_dirs ();
+  if (known_dirs)
+    hash_table_destroy (known_dirs);
+  known_dirs = NULL;
+}
+
 /* Functions for constructing the file name out of URL components.  */
 
 /* A growable string structure, used by url_file_name and friends.
@@ -1722,6 +1845,135 @@ append_dir_structure (const struct url *u, struct growable *dest)
     }
 }
 
+/* Local directory names url_file_name has built, keyed by the scheme,
+   host, port and directory of the URL.  Recursive downloads save many
+   files to each directory, and this spares quoting and converting the
+   same directory part for every one of them.  */
+
+static struct hash_table *dir_names;
+
+/* Start over rather than grow without bound.  */
+#define DIR_NAMES_MAX 4096
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t dir_names_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_DIR_NAMES() pthread_mutex_lock (&dir_names_lock)
+# define UNLOCK_DIR_NAMES() pthread_mutex_unlock (&dir_names_lock)
+#else
+# define LOCK_DIR_NAMES()
+# define UNLOCK_DIR_NAMES()
+#endif
+
+static void
+forget_dir_names (void)
+{
+  hash_table_iterator iter;
+
+  for (hash_table_iterate (dir_names, &iter); hash_table_iter_next (&iter); )
+    {
+      xfree (iter.key);
+      xfree (iter.value);
+    }
+  hash_table_clear (dir_names);
+}
+
+/* Append to DEST, after a slash if DEST is not empty, the local
+   directory that -x saves the files of U's directory to: the protocol
+   and host directories, if enabled, and the directory structure, in
+   the local encoding.  Nothing is appended if that directory is
+   empty.  */
+
+static void
+append_dir_name (const struct url *u, struct growable *dest)
+{
+  const char *last_slash = strrchr (u->path, '/');
+  char *key = aprintf ("%s%s:%d/%.*s",
+                       supported_schemes[u->scheme].leading_string,
+                       u->host, u->port,
+                       last_slash ? (int) (last_slash - u->path) : 0, u->path);
+  struct growable dir;
+  char *name;
+
+  LOCK_DIR_NAMES ();
+  name = dir_names ? hash_table_get (dir_names, key) : NULL;
+  if (name && *name)
+    {
+      if (dest->tail)
+        append_char ('/', dest);
+      append_string (name, dest);
+    }
+  UNLOCK_DIR_NAMES ();
+  if (name)
+    {
+      xfree (key);
+      return;
+    }
+
+  dir.base = NULL;
+  dir.size = 0;
+  dir.tail = 0;
+
+  if (opt.protocol_directories)
+    append_string (supported_schemes[u->scheme].name, &dir);
+  if (opt.add_hostdir)
+    {
+      if (dir.tail)
+        append_char ('/', &dir);
+      if (0 != strcmp (u->host, ".."))
+        append_string (u->host, &dir);
+      else
+        /* Host name can come from the network; malicious DNS may
+           allow ".." to be resolved, causing us to write to
+           "../<file>".  Defang such host names.  */
+        append_string ("%2E%2E", &dir);
+      if (u->port != scheme_default_port (u->scheme))
+        {
+          char portstr[24];
+          number_to_string (portstr, u->port);
+          append_char (FN_PORT_SEP, &dir);
+          append_string (portstr, &dir);
+        }
+    }
+  append_dir_structure (u, &dir);
+
+  /* Convert the remote chars to the local encoding.  */
+  name = dir.tail ? convert_fname (dir.base) : xstrdup ("");
+  if (!dir.tail)
+    xfree (dir.base);
+
+  if (*name)
+    {
+      if (dest->tail)
+        append_char ('/', dest);
+      append_string (name, dest);
+    }
+
+  LOCK_DIR_NAMES ();
+  if (!dir_names)
+    dir_names = make_string_hash_table (0);
+  if (hash_table_count (dir_names) >= DIR_NAMES_MAX)
+    forget_dir_names ();
+  if (!hash_table_contains (dir_names, key))
+    {
+      hash_table_put (dir_names, key, name);
+      key = name = NULL;
+    }
+  UNLOCK_DIR_NAMES ();
+  xfree (key);
+  xfree (name);
+}
+
+void
+url_file_name_cleanup (void)
+{
+  if (dir_names)
+    {
+      forget_dir_names ();
+      hash_table_destroy (dir_names);
+      dir_names = NULL;
+    }
+}
+
 /* Return a unique file name that matches the given URL as well as
    possible.  Does not create directories on the file system.  */
 
@@ -1755,8 +2007,7 @@ url_file_name (const struct url *u, char *replaced_filename)
   /* If "dirstruct" is turned on (typically the case with -r), add
      the host and port (unless those have been turned off) and
      directory structure.  */
-  /* All safe remote chars are unescaped and stored in temp_fnres,
-     then converted to local and appended to fnres.
+  /* All safe remote chars are unescaped and converted to local.
      Internationalized URL/IDN will produce punycode to lookup IP from DNS:
      https://en.wikipedia.org/wiki/URL
      https://en.wikipedia.org/wiki/Internationalized_domain_name
@@ -1764,35 +2015,7 @@ url_file_name (const struct url *u, char *replaced_filename)
      https://en.wikipedia.org/wiki/List_of_Unicode_characters
      https://en.wikipedia.org/wiki/List_of_writing_systems */
   if (opt.dirstruct)
-    {
-      if (opt.protocol_directories)
-        {
-          if (temp_fnres.tail)
-            append_char ('/', &temp_fnres);
-          append_string (supported_schemes[u->scheme].name, &temp_fnres);
-        }
-      if (opt.add_hostdir)
-        {
-          if (temp_fnres.tail)
-            append_char ('/', &temp_fnres);
-          if (0 != strcmp (u->host, ".."))
-            append_string (u->host, &temp_fnres);
-          else
-            /* Host name can come from the network; malicious DNS may
-               allow ".." to be resolved, causing us to write to
-               "../<file>".  Defang such host names.  */
-            append_string ("%2E%2E", &temp_fnres);
-          if (u->port != scheme_default_port (u->scheme))
-            {
-              char portstr[24];
-              number_to_string (portstr, u->port);
-              append_char (FN_PORT_SEP, &temp_fnres);
-              append_string (portstr, &temp_fnres);
-            }
-        }
-
-      append_dir_structure (u, &temp_fnres);
-    }
+    append_dir_name (u, &fnres);
 
   if (!replaced_filename)
     {
@@ -1812,9 +2035,6 @@ url_file_name (const struct url *u, char *replaced_filename)
       fname_len_check = strdupdelim (u_file, u_file + strlen (u_file));
     }
 
-  if (temp_fnres.tail)
-    append_char ('/', &temp_fnres);
-
   append_uri_pathel (fname_len_check,
     fname_len_check + strlen (fname_len_check), true, &temp_fnres);
 
@@ -1823,27 +2043,20 @@ url_file_name (const struct url *u, char *replaced_filename)
 
   /* convert all remote chars before length check and appending to local path */
   fname = convert_fname (temp_fnres.base);
-  temp_fnres.base = NULL;
-  temp_fnres.size = 0;
-  temp_fnres.tail = 0;
-  append_string (fname, &temp_fnres);
-
-  xfree (fname);
   xfree (fname_len_check);
 
   /* The filename has already been 'cleaned' by append_uri_pathel() above.  So,
    * just append it. */
   if (fnres.tail)
     append_char ('/', &fnres);
-  append_string (temp_fnres.base, &fnres);
+  append_string (fname, &fnres);
+  xfree (fname);
 
   fname = fnres.base;
 
   /* Make a final check that the path length is acceptable? */
   /* TODO: check fnres.base for path length problem */
 
-  xfree (temp_fnres.base);
-
   /* Check the cases in which the unique extensions are not used:
      1) Clobbering is turned off (-nc).
      2) Retrieval with regetting.
@@ -2558,6 +2771,67 @@ test_uri_merge(void)
   return NULL;
 }
 
+const char *
+test_known_dirs (void)
+{
+  add_known_dir ("a/b/c");
+  mu_assert ("test_known_dirs: a/b/c unknown", known_dir_p ("a/b/c"));
+  mu_assert ("test_known_dirs: a/b unknown", known_dir_p ("a/b"));
+  mu_assert ("test_known_dirs: a unknown", known_dir_p ("a"));
+  mu_assert ("test_known_dirs: a/bc known", !known_dir_p ("a/bc"));
+
+  add_known_dir ("/x/y");
+  mu_assert ("test_known_dirs: /x unknown", known_dir_p ("/x"));
+  mu_assert ("test_known_dirs: empty name known", !known_dir_p (""));
+
+  forget_known_dirs ();
+  mu_assert ("test_known_dirs: a/b/c not forgotten", !known_dir_p ("a/b/c"));
+
+  mkalldirs_cleanup ();
+  return NULL;
+}
+
+const char *
+test_url_file_name (void)
+{
+  static const struct {
+    const char *url;
+    const char *expected;
+  } test_array[] = {
+    { "http://www.example.com/a/b/page.html", "www.example.com/a/b/page.html" },
+    { "http://www.example.com/a/b/", "www.example.com/a/b/index.html" },
+    { "http://www.example.com:8080/a/b/x", "www.example.com:8080/a/b/x" },
+    { "http://www.example.com/a/b/page.html", "www.example.com/a/b/page.html" },
+    { "http://www.example.com/p?q=1", "www.example.com/p?q=1" },
+    { "http://www.example.com/a%20b/c%20d", "www.example.com/a b/c d" },
+  };
+  bool dirstruct = opt.dirstruct, add_hostdir = opt.add_hostdir;
+  char *msg = NULL;
+  unsigned i;
+
+  opt.dirstruct = opt.add_hostdir = true;
+  for (i = 0; i < countof (test_array); ++i)
+    {
+      struct url *u = url_parse (test_array[i].url, NULL, NULL, false);
+      char *name;
+
+      mu_assert ("test_url_file_name: parse failed", u);
+      name = url_file_name (u, NULL);
+      url_free (u);
+      if (strcmp (name, test_array[i].expected))
+        msg = aprintf ("test_url_file_name [%u]: expected '%s', got '%s'",
+                       i, test_array[i].expected, name);
+      xfree (name);
+      if (msg)
+        break;
+    }
+  opt.dirstruct = dirstruct;
+  opt.add_hostdir = add_hostdir;
+
+  url_file_name_cleanup ();
+  return msg;
+}
+
 #endif /* TESTING */
 
 /*
@@ -98,6 +98,11 @@ struct url
   /* Username and password (unquoted). */
   char *user;
   char *passwd;
+
+  /* The block url_parse stores host, path, params, query, fragment,
+     dir and file in, rather than allocate each of them.  */
+  char *components;
+  size_t components_size;
 };
 
 /* Function declarations */
@@ -123,10 +128,12 @@ const char *scheme_leading_string (enum url_scheme);
 
 char *url_string (const struct url *, enum url_auth_mode);
 char *url_file_name (const struct url *, char *);
+void url_file_name_cleanup (void);
 
 char *uri_merge (const char *, const char *);
 
 int mkalldirs (const char *);
+void mkalldirs_cleanup (void);
 
 char *maybe_prepend_scheme (const char *);
 bool schemes_are_similar_p (enum url_scheme a, enum url_scheme b);
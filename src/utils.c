@@ -62,6 +62,9 @@ as that of the covered work.  */
 #include <setjmp.h>
 
 #include <regex.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #ifdef HAVE_LIBPCRE2
 # define PCRE2_CODE_UNIT_WIDTH 8
 # include <pcre2.h>
@@ -100,6 +103,7 @@ as that of the covered work.  */
 #endif /* def __VMS */
 
 #ifdef TESTING
+#include <tmpdir.h>
 #include "../tests/unit-tests.h"
 #endif
 
@@ -643,9 +647,26 @@ file_size (const char *filename)
 
 #ifdef UNIQ_SEP
 
+/* The suffix unique_name_1 last returned for each prefix.  Without
+   it, saving the Nth file of the same name (index.html?page=N with
+   --restrict-file-names cutting the query, say) would stat N names.
+   The suffixes below the remembered one are taken as still used, so
+   a file deleted meanwhile does not get its name reused.  */
+
+static struct hash_table *unique_suffixes;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t unique_suffixes_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_UNIQUE_SUFFIXES() pthread_mutex_lock (&unique_suffixes_lock)
+# define UNLOCK_UNIQUE_SUFFIXES() pthread_mutex_unlock (&unique_suffixes_lock)
+#else
+# define LOCK_UNIQUE_SUFFIXES()
+# define UNLOCK_UNIQUE_SUFFIXES()
+#endif
+
 /* stat file names named PREFIX.1, PREFIX.2, etc., until one that
-   doesn't exist is found.  Return a freshly allocated copy of the
-   unused file name.  */
+   doesn't exist is found, starting with the one last returned for
+   PREFIX.  Return a freshly allocated copy of the unused file name.  */
 
 static char *
 unique_name_1 (const char *prefix)
@@ -654,6 +675,14 @@ unique_name_1 (const char *prefix)
   int plen = strlen (prefix);
   char *template = xmalloc (plen + 1 + 24);
   char *template_tail = template + plen;
+  char *key;
+  void *last;
+
+  LOCK_UNIQUE_SUFFIXES ();
+  if (unique_suffixes
+      && hash_table_get_pair (unique_suffixes, prefix, NULL, &last))
+    count = (intptr_t) last;
+  UNLOCK_UNIQUE_SUFFIXES ();
 
   memcpy (template, prefix, plen);
   *template_tail++ = UNIQ_SEP;
@@ -662,6 +691,19 @@ unique_name_1 (const char *prefix)
     number_to_string (template_tail, count++);
   while (file_exists_p (template, NULL) && count < 999999);
 
+  LOCK_UNIQUE_SUFFIXES ();
+  if (!unique_suffixes)
+    unique_suffixes = make_string_hash_table (0);
+  if (hash_table_get_pair (unique_suffixes, prefix, &key, &last))
+    {
+      if ((intptr_t) last < count - 1)
+        hash_table_put (unique_suffixes, key, (void *) (intptr_t) (count - 1));
+    }
+  else
+    hash_table_put (unique_suffixes, xstrdup (prefix),
+                    (void *) (intptr_t) (count - 1));
+  UNLOCK_UNIQUE_SUFFIXES ();
+
   return template;
 }
 
@@ -702,6 +744,20 @@ unique_name (const char *file)
   return file_exists_p (file, NULL) ? unique_name_1 (file) : xstrdup (file);
 }
 
+void
+unique_names_cleanup (void)
+{
+  if (unique_suffixes)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (unique_suffixes, &iter);
+           hash_table_iter_next (&iter); )
+        xfree (iter.key);
+      hash_table_destroy (unique_suffixes);
+      unique_suffixes = NULL;
+    }
+}
+
 #else /* def UNIQ_SEP */
 
 /* Dummy unique_name() for VMS.  Return the original name as easily as
@@ -721,6 +777,11 @@ unique_name (const char *file)
   return xstrdup (file);
 }
 
+void
+unique_names_cleanup (void)
+{
+}
+
 #endif /* def UNIQ_SEP [else] */
 
 /* Create a file based on NAME, except without overwriting an existing
@@ -1043,6 +1104,12 @@ fnmatch_nocase (const char *pattern, const char *string, int flags)
 
 static bool in_acclist (const char *const *, const char *, bool);
 
+/* The -A, -R, -I and -X lists compiled by compile_acclists.  */
+static struct acclist *accept_list, *reject_list, *include_list, *exclude_list;
+
+static bool acclist_match_file (const struct acclist *, const char *);
+static bool acclist_match_dir (const struct acclist *, const char *);
+
 /* Determine whether a file is acceptable to be followed, according to
    lists of patterns to accept/reject.  */
 bool
@@ -1056,6 +1123,13 @@ acceptable (const char *s)
   if ((p = strrchr (s, '/')))
     s = p + 1;
 
+  if (accept_list && !acclist_match_file (accept_list, s))
+    return false;
+  if (reject_list && acclist_match_file (reject_list, s))
+    return false;
+  if (accept_list || reject_list)
+    return true;
+
   if (opt.accepts)
     {
       if (opt.rejects)
@@ -1142,6 +1216,9 @@ accdir (const char *directory)
   /* Remove starting '/'.  */
   if (*directory == '/')
     ++directory;
+  if (include_list || exclude_list)
+    return ((!include_list || acclist_match_dir (include_list, directory))
+            && !(exclude_list && acclist_match_dir (exclude_list, directory)));
   if (opt.includes)
     {
       if (!dir_matches_p (opt.includes, directory))
@@ -1215,6 +1292,169 @@ in_acclist (const char *const *accepts, const char *s, bool backward)
   return false;
 }
 
+/* A list of patterns compiled for matching many names against it.
+
+   The patterns without wildcards, and the file patterns of the form
+   "*TAIL", go to a hash table: they match a file name whose tail or a
+   directory name whose leading components they equal.  Looking up
+   each tail length present in the list, or each leading part of the
+   directory, takes the place of comparing with every pattern.  Only
+   the remaining patterns are given to fnmatch, in the order of the
+   list.  */
+
+struct acclist {
+  bool match_all;               /* an empty directory matches all */
+  struct hash_table *literals;  /* file tails or directories */
+  int *lengths;                 /* the distinct lengths of the tails */
+  int length_count;
+  const char **globs;           /* the patterns left for fnmatch */
+  int glob_count;
+};
+
+/* Compile LIST, a list of file patterns if DIRS is false and of
+   directories otherwise.  */
+
+static struct acclist *
+acclist_compile (const char *const *list, bool dirs)
+{
+  struct acclist *al = xnew0 (struct acclist);
+  int count, i, j;
+
+  for (count = 0; list[count]; count++)
+    ;
+  al->literals = opt.ignore_case
+    ? make_nocase_string_hash_table (count)
+    : make_string_hash_table (count);
+  al->lengths = xnew_array (int, count);
+  al->globs = xnew_array (const char *, count);
+
+  for (i = 0; i < count; i++)
+    {
+      const char *p = list[i];
+      int len;
+
+      if (dirs && *p == '/')
+        ++p;
+      if (!has_wildcards_p (p))
+        ;
+      else if (!dirs && *p == '*' && !strpbrk (p + 1, "*?[]\\"))
+        ++p;
+      else
+        {
+          al->globs[al->glob_count++] = p;
+          continue;
+        }
+
+      if (dirs && !*p)
+        al->match_all = true;
+      if (hash_table_contains (al->literals, p))
+        continue;
+      hash_table_put (al->literals, xstrdup (p), NULL);
+      if (dirs)
+        continue;
+
+      /* Keep the lengths sorted, so that matching can stop at the
+         first one longer than the name.  */
+      len = strlen (p);
+      for (j = al->length_count; j > 0 && al->lengths[j - 1] >= len; j--)
+        ;
+      if (j < al->length_count && al->lengths[j] == len)
+        continue;
+      memmove (al->lengths + j + 1, al->lengths + j,
+               (al->length_count - j) * sizeof (int));
+      al->lengths[j] = len;
+      ++al->length_count;
+    }
+  return al;
+}
+
+static void
+acclist_free (struct acclist *al)
+{
+  hash_table_iterator iter;
+
+  if (!al)
+    return;
+  for (hash_table_iterate (al->literals, &iter); hash_table_iter_next (&iter); )
+    xfree (iter.key);
+  hash_table_destroy (al->literals);
+  xfree (al->lengths);
+  xfree (al->globs);
+  xfree (al);
+}
+
+/* Like in_acclist with BACKWARD set, for a compiled list.  */
+
+static bool
+acclist_match_file (const struct acclist *al, const char *s)
+{
+  int len = strlen (s);
+  int i;
+
+  for (i = 0; i < al->length_count && al->lengths[i] <= len; i++)
+    if (hash_table_contains (al->literals, s + len - al->lengths[i]))
+      return true;
+  for (i = 0; i < al->glob_count; i++)
+    if ((opt.ignore_case ? fnmatch_nocase : fnmatch) (al->globs[i], s, 0) == 0)
+      return true;
+  return false;
+}
+
+/* Like dir_matches_p, for a compiled list.  */
+
+static bool
+acclist_match_dir (const struct acclist *al, const char *dir)
+{
+  bool found = al->match_all;
+  int i;
+
+  if (!found && hash_table_count (al->literals))
+    {
+      /* Look up DIR and each part of it that ends before a slash.  */
+      char *copy = xstrdup (dir);
+      char *p;
+
+      found = hash_table_contains (al->literals, copy);
+      for (p = copy; !found && (p = strchr (p, '/')); *p++ = '/')
+        {
+          *p = '\0';
+          found = hash_table_contains (al->literals, copy);
+        }
+      xfree (copy);
+    }
+  for (i = 0; !found && i < al->glob_count; i++)
+    found = (opt.ignore_case ? fnmatch_nocase : fnmatch) (al->globs[i], dir,
+                                                          FNM_PATHNAME) == 0;
+  return found;
+}
+
+/* Compile the -A, -R, -I and -X lists, once the options are known, so
+   that acceptable and accdir need not walk them for each name.  */
+
+void
+compile_acclists (void)
+{
+  acclists_cleanup ();
+  if (opt.accepts)
+    accept_list = acclist_compile ((const char *const *) opt.accepts, false);
+  if (opt.rejects)
+    reject_list = acclist_compile ((const char *const *) opt.rejects, false);
+  if (opt.includes)
+    include_list = acclist_compile (opt.includes, true);
+  if (opt.excludes)
+    exclude_list = acclist_compile (opt.excludes, true);
+}
+
+void
+acclists_cleanup (void)
+{
+  acclist_free (accept_list);
+  acclist_free (reject_list);
+  acclist_free (include_list);
+  acclist_free (exclude_list);
+  accept_list = reject_list = include_list = exclude_list = NULL;
+}
+
 /* Return the location of STR's suffix (file extension).  Examples:
    suffix ("foo.bar")       -> "bar"
    suffix ("foo.bar.baz")   -> "baz"
@@ -2683,6 +2923,25 @@ print_decimal (double number)
   return buf;
 }
 
+/* Print S to FP as a JSON string.  */
+
+void
+json_put_string (FILE *fp, const char *s)
+{
+  putc ('"', fp);
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+        fprintf (fp, "\\%c", c);
+      else if (c < 0x20)
+        fprintf (fp, "\\u%04x", c);
+      else
+        putc (c, fp);
+    }
+  putc ('"', fp);
+}
+
 /* Get the maximum name length for the given path. */
 /* Return 0 if length is unknown. */
 long
@@ -3019,12 +3278,164 @@ test_dir_matches_p(void)
   for (i = 0; i < countof(test_array); ++i)
     {
       bool res = dir_matches_p (test_array[i].dirlist, test_array[i].dir);
+      struct acclist *al = acclist_compile (test_array[i].dirlist, true);
 
       mu_assert ("test_dir_matches_p: wrong result",
                  res == test_array[i].result);
+      res = acclist_match_dir (al, test_array[i].dir);
+      acclist_free (al);
+      mu_assert ("test_dir_matches_p: wrong result when compiled",
+                 res == test_array[i].result);
+    }
+
+  return NULL;
+}
+
+const char *
+test_acclist_match_file (void)
+{
+  static const char *const patterns[] = {
+    ".gif", "*.JPG", "index.html?*", "*[0-9].txt", "*", "tar.gz", NULL
+  };
+  static const char *const names[] = {
+    "a.gif", "a.jpg", "a.JPG", ".JPG", "index.html?x=1", "index.html",
+    "f1.txt", "f.txt", "x.tar.gz", "gz", "", "a.gi"
+  };
+  unsigned i, j;
+  int fold;
+
+  /* Each suffix of PATTERNS, and ignoring case or not, must match the
+     same names as in_acclist.  */
+  for (i = 0; patterns[i]; i++)
+    {
+      const char *list[countof (patterns)];
+
+      memcpy (list, patterns + i, sizeof list - i * sizeof *list);
+      for (fold = 0; fold < 2; fold++)
+        {
+          struct acclist *al;
+
+          opt.ignore_case = fold;
+          al = acclist_compile (list, false);
+          for (j = 0; j < countof (names); j++)
+            {
+              bool want = in_acclist (list, names[j], true);
+              if (acclist_match_file (al, names[j]) != want)
+                {
+                  acclist_free (al);
+                  opt.ignore_case = false;
+                  return aprintf ("test_acclist_match_file: %s %s \"%s\"",
+                                  want ? "missed" : "wrongly matched",
+                                  list[0], names[j]);
+                }
+            }
+          acclist_free (al);
+        }
+    }
+  opt.ignore_case = false;
+
+  return NULL;
+}
+
+#ifdef UNIQ_SEP
+/* Create the file NAME, or NAME.SUFFIX if SUFFIX is not 0.  */
+
+static bool
+test_unique_name_create (const char *name, int suffix)
+{
+  char *file = suffix ? aprintf ("%s%c%d", name, UNIQ_SEP, suffix)
+                      : xstrdup (name);
+  FILE *fp = fopen (file, "w");
+
+  xfree (file);
+  return fp && fclose (fp) == 0;
+}
+
+/* Return whether FILE is NAME.SUFFIX.  */
+
+static bool
+test_unique_name_is (const char *file, const char *name, int suffix)
+{
+  char *want = aprintf ("%s%c%d", name, UNIQ_SEP, suffix);
+  bool same = !strcmp (file, want);
+
+  xfree (want);
+  return same;
+}
+#endif
+
+const char *
+test_unique_name (void)
+{
+#ifdef UNIQ_SEP
+  char dir[1024];
+  char *name, *file;
+  const char *error = NULL;
+  int i;
+
+  mu_assert ("test_unique_name: no temporary directory",
+             path_search (dir, sizeof (dir), NULL, "wget", true) == 0
+             && mkdtemp (dir));
+  name = aprintf ("%s/file", dir);
+  unique_names_cleanup ();
+
+  for (i = 0; i < 3 && !error; i++)
+    if (!test_unique_name_create (name, i))
+      error = aprintf ("test_unique_name: cannot create %s.%d", name, i);
+
+  /* Each name returned is then taken, and the next call goes on from
+     it.  */
+  for (i = 3; i < 7 && !error; i++)
+    {
+      file = unique_name (name);
+      if (!test_unique_name_is (file, name, i))
+        error = aprintf ("test_unique_name: got %s, expected suffix %d",
+                         file, i);
+      else if (!test_unique_name_create (name, i))
+        error = aprintf ("test_unique_name: cannot create %s", file);
+      xfree (file);
     }
 
+  /* A name returned but then taken by someone else is skipped, and
+     one freed below it is not reused.  */
+  if (!error)
+    {
+      file = unique_name (name);
+      if (!test_unique_name_is (file, name, 7))
+        error = aprintf ("test_unique_name: got %s, expected suffix 7",
+                         file);
+      xfree (file);
+    }
+  if (!error)
+    {
+      file = aprintf ("%s%c1", name, UNIQ_SEP);
+      unlink (file);
+      xfree (file);
+      if (!test_unique_name_create (name, 7))
+        error = aprintf ("test_unique_name: cannot create %s.7", name);
+    }
+  if (!error)
+    {
+      file = unique_name (name);
+      if (!test_unique_name_is (file, name, 8))
+        error = aprintf ("test_unique_name: got %s after %s.7 was created,"
+                         " expected suffix 8", file, name);
+      xfree (file);
+    }
+
+  for (i = 0; i < 8; i++)
+    {
+      file = i ? aprintf ("%s%c%d", name, UNIQ_SEP, i) : xstrdup (name);
+      unlink (file);
+      xfree (file);
+    }
+  rmdir (dir);
+  xfree (name);
+  unique_names_cleanup ();
+  return error;
+#else
   return NULL;
+#endif
 }
 
 #endif /* TESTING */
@@ -90,6 +90,7 @@ wgint file_size (const char *);
 int make_directory (const char *);
 char *unique_name_passthrough (const char *);
 char *unique_name (const char *);
+void unique_names_cleanup (void);
 FILE *unique_create (const char *, bool, char **);
 FILE *fopen_excl (const char *, int);
 FILE *fopen_stat (const char *, const char *, file_stats_t *);
@@ -103,6 +104,8 @@ bool accdir (const char *s);
 char *suffix (const char *s);
 bool match_tail (const char *, const char *, bool);
 bool has_wildcards_p (const char *);
+void compile_acclists (void);
+void acclists_cleanup (void);
 
 bool has_html_suffix_p (const char *);
 
@@ -160,6 +163,7 @@ bool match_posix_regex (const void *, const char *);
 void stable_sort (void *, size_t, size_t, int (*) (const void *, const void *));
 
 const char *print_decimal (double);
+void json_put_string (FILE *, const char *);
 
 long get_max_length (const char *path, int length, int name);
 
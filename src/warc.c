@@ -34,6 +34,7 @@ as that of the covered work.  */
 #include "version.h"
 #include "dirname.h"
 #include "url.h"
+#include "cdx-index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +47,12 @@ as that of the covered work.  */
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #ifdef HAVE_LIBUUID
 #include <uuid/uuid.h>
@@ -69,6 +76,10 @@ as that of the covered work.  */
 #include "warc.h"
 #include "exits.h"
 
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
+
 
 /* The log file (a temporary file that contains a copy
    of the wget log). */
@@ -93,6 +104,25 @@ static off_t warc_current_gzfile_offset;
 static off_t warc_current_gzfile_uncompressed_size;
 # endif
 
+#ifdef HAVE_LIBZSTD
+/* The zstd stream for the current record (or NULL, if WARC or zstd
+   is disabled). */
+static ZSTD_CCtx *warc_current_zstd;
+
+/* zstd compression level for WARC records. */
+# define WARC_ZSTD_LEVEL 3
+#endif
+
+/* How the records of the WARC file are compressed. */
+static enum {
+  WARC_PLAIN,
+  WARC_GZIP,
+  WARC_ZSTD
+} warc_codec;
+
+/* The offset of the current record in the WARC file. */
+static off_t warc_current_record_offset;
+
 /* This is true until a warc_write_* method fails. */
 static bool warc_write_ok;
 
@@ -113,6 +143,9 @@ static int warc_current_file_number;
 /* The table of CDX records, if deduplication is enabled. */
 static struct hash_table * warc_cdx_dedup_table;
 
+/* The CDX index, if deduplication uses one instead of the table. */
+static struct cdx_index *warc_cdx_dedup_index;
+
 static bool warc_start_new_file (bool meta);
 
 
@@ -140,12 +173,419 @@ warc_cmp_sha1_digest (const void *digest1, const void *digest2)
 
 
 
+#define EXTRA_GZIP_HEADER_SIZE 14
+#define GZIP_STATIC_HEADER_SIZE  10
+#define FLG_FEXTRA          0x04
+#define OFF_FLG             3
+
+#ifdef HAVE_PTHREAD_H
+/* A record built in memory, to be compressed into a gzip member or a
+   zstd frame of its own.  */
+struct warc_record
+{
+  char *data;                   /* the record, compressed once done */
+  size_t size;
+  size_t alloc;
+  size_t raw_size;              /* size before compression */
+  char *cdx_line;               /* CDX line waiting for the offset */
+  char *cdx_uuid;
+  bool compressed;
+  bool failed;
+  struct warc_record *next;
+};
+
+/* Records larger than this are not buffered, but compressed straight
+   into the WARC file.  */
+#define WARC_RECORD_BUFFER_MAX (16 * 1024 * 1024)
+
+static void
+warc_record_append (struct warc_record *rec, const char *buf, size_t size)
+{
+  if (rec->size + size > rec->alloc)
+    {
+      rec->alloc = MAX (rec->alloc * 2, rec->size + size);
+      rec->alloc = MAX (rec->alloc, 4096);
+      rec->data = xrealloc (rec->data, rec->alloc);
+    }
+  memcpy (rec->data + rec->size, buf, size);
+  rec->size += size;
+}
+
+static void
+warc_record_free (struct warc_record *rec)
+{
+  xfree (rec->data);
+  xfree (rec->cdx_line);
+  xfree (rec->cdx_uuid);
+  xfree (rec);
+}
+
+#ifdef HAVE_LIBZ
+/* Compress REC into a single gzip member, with the skip length extra
+   field that warc_write_end_record adds to streamed records.  */
+static bool
+warc_gzip_record (struct warc_record *rec)
+{
+  z_stream zs;
+  gz_header head;
+  unsigned char extra[EXTRA_GZIP_HEADER_SIZE - 2];
+  unsigned char *out;
+  uLong bound, member_size;
+
+  xzero (zs);
+  xzero (head);
+  if (deflateInit2 (&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+
+  /* The field values are filled in below, once the sizes are known. */
+  memset (extra, 0, sizeof (extra));
+  extra[0] = 's';
+  extra[1] = 'l';
+  extra[2] = 8;
+  head.extra = extra;
+  head.extra_len = sizeof (extra);
+  head.os = 255;
+  deflateSetHeader (&zs, &head);
+
+  bound = deflateBound (&zs, rec->size) + EXTRA_GZIP_HEADER_SIZE;
+  out = xmalloc (bound);
+  zs.next_in = (unsigned char *) rec->data;
+  zs.avail_in = rec->size;
+  zs.next_out = out;
+  zs.avail_out = bound;
+  if (deflate (&zs, Z_FINISH) != Z_STREAM_END)
+    {
+      deflateEnd (&zs);
+      xfree (out);
+      return false;
+    }
+  member_size = zs.total_out;
+  deflateEnd (&zs);
+
+  /* Same layout as in warc_write_end_record: the size of the member,
+     then the size of the record.  */
+  out[16] = member_size & 255;
+  out[17] = (member_size >> 8) & 255;
+  out[18] = (member_size >> 16) & 255;
+  out[19] = (member_size >> 24) & 255;
+  out[20] = rec->size & 255;
+  out[21] = (rec->size >> 8) & 255;
+  out[22] = (rec->size >> 16) & 255;
+  out[23] = (rec->size >> 24) & 255;
+
+  xfree (rec->data);
+  rec->data = (char *) out;
+  rec->raw_size = rec->size;
+  rec->size = rec->alloc = member_size;
+  return true;
+}
+#endif /* HAVE_LIBZ */
+
+#ifdef HAVE_LIBZSTD
+/* Compress REC into a single zstd frame.  */
+static bool
+warc_zstd_record (struct warc_record *rec)
+{
+  size_t bound = ZSTD_compressBound (rec->size);
+  char *out = xmalloc (bound);
+  size_t n = ZSTD_compress (out, bound, rec->data, rec->size,
+                            WARC_ZSTD_LEVEL);
+
+  if (ZSTD_isError (n))
+    {
+      xfree (out);
+      return false;
+    }
+  xfree (rec->data);
+  rec->data = out;
+  rec->raw_size = rec->size;
+  rec->size = rec->alloc = n;
+  return true;
+}
+#endif /* HAVE_LIBZSTD */
+
+/* Compression of records on a pool of threads.
+
+   With --warc-compression-threads, records are built in memory
+   rather than streamed into the WARC file.  Finished records are
+   queued; compressor threads take them in order and turn each into
+   a gzip member or zstd frame of its own, and a single writer thread
+   appends the compressed records to the WARC file in the order they
+   were queued, printing their CDX lines once their offsets are
+   known.
+
+   While the pool is running, only the writer touches
+   warc_current_file and warc_current_cdx_file.  Anything else that
+   needs them, such as starting a new file, first waits for the queue
+   to drain.  */
+
+struct warc_pool
+{
+  pthread_t *compressors;
+  int compressor_count;
+  pthread_t writer;
+
+  /* All records not written yet, oldest first. */
+  struct warc_record *head, *tail;
+  /* The first record no compressor has taken yet. */
+  struct warc_record *next_compress;
+
+  int pending_count;            /* records in the queue */
+  size_t pending_size;          /* and their uncompressed size */
+  off_t written;                /* bytes in the current WARC file */
+  bool resync;                  /* WRITTEN is behind the file */
+
+  bool failed;                  /* a record could not be written */
+  bool quit;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Limit of the uncompressed size of the records in the queue. */
+#define WARC_POOL_MAX_PENDING (64 * 1024 * 1024)
+
+static struct warc_pool *warc_pool;
+
+/* The record being built, when the pool is in use. */
+static struct warc_record *warc_current_record;
+
+static void warc_print_cdx_line (const char *, off_t, const char *);
+
+static void *
+warc_compressor (void *arg)
+{
+  struct warc_pool *pool = arg;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      struct warc_record *rec = pool->next_compress;
+      bool ok = false;
+
+      if (!rec)
+        {
+          if (pool->quit)
+            break;
+          pthread_cond_wait (&pool->cond, &pool->lock);
+          continue;
+        }
+      pool->next_compress = rec->next;
+      pthread_mutex_unlock (&pool->lock);
+
+#ifdef HAVE_LIBZSTD
+      if (warc_codec == WARC_ZSTD)
+        ok = warc_zstd_record (rec);
+#endif
+#ifdef HAVE_LIBZ
+      if (warc_codec == WARC_GZIP)
+        ok = warc_gzip_record (rec);
+#endif
+
+      pthread_mutex_lock (&pool->lock);
+      rec->failed = !ok;
+      rec->compressed = true;
+      pthread_cond_broadcast (&pool->cond);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+static void *
+warc_writer (void *arg)
+{
+  struct warc_pool *pool = arg;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      struct warc_record *rec = pool->head;
+      off_t offset;
+      bool ok;
+
+      if (!rec || !rec->compressed)
+        {
+          if (!rec && pool->quit)
+            break;
+          pthread_cond_wait (&pool->cond, &pool->lock);
+          continue;
+        }
+      offset = pool->written;
+      ok = !rec->failed && !pool->failed;
+      pthread_mutex_unlock (&pool->lock);
+
+      ok = ok
+        && fwrite (rec->data, 1, rec->size, warc_current_file) == rec->size;
+      if (ok && rec->cdx_line)
+        warc_print_cdx_line (rec->cdx_line, offset, rec->cdx_uuid);
+
+      pthread_mutex_lock (&pool->lock);
+      if (!ok)
+        pool->failed = true;
+      pool->written += rec->size;
+      pool->head = rec->next;
+      if (!pool->head)
+        pool->tail = NULL;
+      --pool->pending_count;
+      pool->pending_size -= rec->raw_size;
+      pthread_cond_broadcast (&pool->cond);
+      warc_record_free (rec);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* Start a pool of COUNT compressor threads, or return NULL.  */
+static struct warc_pool *
+warc_pool_new (int count)
+{
+  struct warc_pool *pool = xnew0 (struct warc_pool);
+  int i;
+
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->cond, NULL);
+  pool->compressors = xnew_array (pthread_t, count);
+  for (i = 0; i < count; i++)
+    if (pthread_create (&pool->compressors[pool->compressor_count], NULL,
+                        warc_compressor, pool) == 0)
+      pool->compressor_count++;
+
+  if (!pool->compressor_count
+      || pthread_create (&pool->writer, NULL, warc_writer, pool) != 0)
+    {
+      pthread_mutex_lock (&pool->lock);
+      pool->quit = true;
+      pthread_cond_broadcast (&pool->cond);
+      pthread_mutex_unlock (&pool->lock);
+      for (i = 0; i < pool->compressor_count; i++)
+        pthread_join (pool->compressors[i], NULL);
+      pthread_cond_destroy (&pool->cond);
+      pthread_mutex_destroy (&pool->lock);
+      xfree (pool->compressors);
+      xfree (pool);
+      return NULL;
+    }
+  return pool;
+}
+
+/* Queue REC for compression and writing.  Returns false if an earlier
+   record failed.  */
+static bool
+warc_pool_submit (struct warc_pool *pool, struct warc_record *rec)
+{
+  bool ok;
+
+  rec->raw_size = rec->size;
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->pending_size > WARC_POOL_MAX_PENDING && !pool->failed)
+    pthread_cond_wait (&pool->cond, &pool->lock);
+  if (pool->tail)
+    pool->tail->next = rec;
+  else
+    pool->head = rec;
+  pool->tail = rec;
+  if (!pool->next_compress)
+    pool->next_compress = rec;
+  pool->pending_count++;
+  pool->pending_size += rec->raw_size;
+  ok = !pool->failed;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+  return ok;
+}
+
+/* Wait until every queued record is written.  Returns false if one of
+   them failed.  */
+static bool
+warc_pool_drain (struct warc_pool *pool)
+{
+  bool ok;
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->head)
+    pthread_cond_wait (&pool->cond, &pool->lock);
+  ok = !pool->failed;
+  pthread_mutex_unlock (&pool->lock);
+  return ok;
+}
+
+/* An upper bound of the size the WARC file will have once the queue
+   is written.  Compression may grow a record, but only slightly.  */
+static off_t
+warc_pool_size_bound (struct warc_pool *pool)
+{
+  off_t size;
+
+  pthread_mutex_lock (&pool->lock);
+  size = pool->written + pool->pending_size + pool->pending_size / 1024
+    + pool->pending_count * 64;
+  pthread_mutex_unlock (&pool->lock);
+  return size;
+}
+
+static void
+warc_pool_free (struct warc_pool *pool)
+{
+  int i;
+
+  warc_pool_drain (pool);
+  pthread_mutex_lock (&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+  for (i = 0; i < pool->compressor_count; i++)
+    pthread_join (pool->compressors[i], NULL);
+  pthread_join (pool->writer, NULL);
+  pthread_cond_destroy (&pool->cond);
+  pthread_mutex_destroy (&pool->lock);
+  xfree (pool->compressors);
+  xfree (pool);
+}
+#endif /* HAVE_PTHREAD_H */
+
+#ifdef HAVE_LIBZSTD
+/* Runs the zstd stream of the current record over SIZE bytes of
+   BUFFER with the directive MODE, and writes what comes out.  */
+static bool
+warc_zstd_write (const char *buffer, size_t size, ZSTD_EndDirective mode)
+{
+  char out[BUFSIZ];
+  ZSTD_inBuffer in = { buffer, size, 0 };
+  size_t remaining;
+
+  do
+    {
+      ZSTD_outBuffer ob = { out, sizeof (out), 0 };
+
+      remaining = ZSTD_compressStream2 (warc_current_zstd, &ob, &in, mode);
+      if (ZSTD_isError (remaining)
+          || fwrite (out, 1, ob.pos, warc_current_file) != ob.pos)
+        return false;
+    }
+  while (mode == ZSTD_e_end ? remaining > 0 : in.pos < in.size);
+  return true;
+}
+#endif /* HAVE_LIBZSTD */
+
 /* Writes SIZE bytes from BUFFER to the current WARC file,
    through gzwrite if compression is enabled.
    Returns the number of uncompressed bytes written.  */
 static size_t
 warc_write_buffer (const char *buffer, size_t size)
 {
+#ifdef HAVE_PTHREAD_H
+  if (warc_current_record)
+    {
+      warc_record_append (warc_current_record, buffer, size);
+      return size;
+    }
+#endif
+#ifdef HAVE_LIBZSTD
+  if (warc_current_zstd)
+    return warc_zstd_write (buffer, size, ZSTD_e_continue) ? size : 0;
+#endif
 #ifdef HAVE_LIBZ
   if (warc_current_gzfile)
     {
@@ -176,37 +616,40 @@ warc_write_string (const char *str)
 }
 
 
-#define EXTRA_GZIP_HEADER_SIZE 14
-#define GZIP_STATIC_HEADER_SIZE  10
-#define FLG_FEXTRA          0x04
-#define OFF_FLG             3
-
-/* Starts a new WARC record.  Writes the version header.
-   If opt.warc_maxsize is set and the current file is becoming
-   too large, this will open a new WARC file.
-
-   If compression is enabled, this will start a new
-   gzip stream in the current WARC file.
+/* Starts the compressed stream of a record at the end of the current
+   WARC file, if compression is enabled.
 
    Returns false and set warc_write_ok to false if there
    is an error.  */
 static bool
-warc_write_start_record (void)
+warc_start_stream (void)
 {
-  if (!warc_write_ok)
-    return false;
-
-  fflush (warc_current_file);
-  if (opt.warc_maxsize > 0 && ftello (warc_current_file) >= opt.warc_maxsize)
-    warc_start_new_file (false);
+#ifdef HAVE_LIBZSTD
+  if (warc_codec == WARC_ZSTD)
+    {
+      warc_current_zstd = ZSTD_createCCtx ();
+      if (warc_current_zstd == NULL
+          || ZSTD_isError (ZSTD_CCtx_setParameter (warc_current_zstd,
+                                                   ZSTD_c_compressionLevel,
+                                                   WARC_ZSTD_LEVEL)))
+        {
+          logprintf (LOG_NOTQUIET,
+_("Error opening ZSTD stream to WARC file.\n"));
+          ZSTD_freeCCtx (warc_current_zstd);
+          warc_current_zstd = NULL;
+          warc_write_ok = false;
+          return false;
+        }
+    }
+#endif
 
 #ifdef HAVE_LIBZ
   /* Start a GZIP stream, if required. */
-  if (opt.warc_compression_enabled)
+  if (warc_codec == WARC_GZIP)
     {
       int dup_fd;
       /* Record the starting offset of the new record. */
-      warc_current_gzfile_offset = ftello (warc_current_file);
+      warc_current_gzfile_offset = warc_current_record_offset;
 
       /* Reserve space for the extra GZIP header field.
          In warc_write_end_record we will fill this space
@@ -250,6 +693,64 @@ _("Error opening GZIP stream to WARC file.\n"));
     }
 #endif
 
+  return true;
+}
+
+/* Starts a new WARC record.  Writes the version header.
+   If opt.warc_maxsize is set and the current file is becoming
+   too large, this will open a new WARC file.
+
+   If compression is enabled, this will start a new
+   gzip stream in the current WARC file.  With a compression
+   pool, the record is built in memory instead.
+
+   Returns false and set warc_write_ok to false if there
+   is an error.  */
+static bool
+warc_write_start_record (void)
+{
+  if (!warc_write_ok)
+    return false;
+
+#ifdef HAVE_PTHREAD_H
+  if (warc_pool)
+    {
+      /* A record written past the pool moved the end of the file; the
+         pool is idle since.  */
+      if (warc_pool->resync)
+        {
+          fflush (warc_current_file);
+          warc_pool->written = ftello (warc_current_file);
+          warc_pool->resync = false;
+        }
+
+      /* Only look at the file itself when it may be full.  */
+      if (opt.warc_maxsize > 0
+          && warc_pool_size_bound (warc_pool) >= opt.warc_maxsize)
+        {
+          if (!warc_pool_drain (warc_pool))
+            {
+              warc_write_ok = false;
+              return false;
+            }
+          if (ftello (warc_current_file) >= opt.warc_maxsize)
+            warc_start_new_file (false);
+        }
+
+      warc_current_record = xnew0 (struct warc_record);
+      warc_write_string ("WARC/1.0\r\n");
+      return warc_write_ok;
+    }
+#endif
+
+  fflush (warc_current_file);
+  if (opt.warc_maxsize > 0 && ftello (warc_current_file) >= opt.warc_maxsize)
+    warc_start_new_file (false);
+
+  warc_current_record_offset = ftello (warc_current_file);
+  if (!warc_start_stream ())
+    return false;
+
   warc_write_string ("WARC/1.0\r\n");
   return warc_write_ok;
 }
@@ -286,6 +787,52 @@ warc_write_header_uri (const char *name, const char *value)
   return warc_write_ok;
 }
 
+#ifdef HAVE_PTHREAD_H
+/* Switches the current record from the compression pool to a stream
+   straight into the WARC file, once the records before it are
+   written.  */
+static void
+warc_record_unbuffer (void)
+{
+  struct warc_record *rec = warc_current_record;
+
+  warc_current_record = NULL;
+  if (!warc_pool_drain (warc_pool))
+    warc_write_ok = false;
+  else
+    {
+      fseeko (warc_current_file, 0L, SEEK_END);
+      warc_current_record_offset = ftello (warc_current_file);
+      warc_pool->resync = true;
+      if (warc_start_stream ()
+          && warc_write_buffer (rec->data, rec->size) != rec->size)
+        warc_write_ok = false;
+    }
+  warc_record_free (rec);
+}
+#endif
+
+/* Adds a Content-Length header of LENGTH to the WARC record and ends
+   the header section.  The block follows.  */
+static void
+warc_write_block_length (off_t length)
+{
+  char content_length[MAX_INT_TO_STRING_LEN(off_t)];
+
+  number_to_string (content_length, length);
+  warc_write_header ("Content-Length", content_length);
+
+#ifdef HAVE_PTHREAD_H
+  /* Do not hold large records in memory.  */
+  if (warc_current_record && warc_write_ok
+      && warc_current_record->size + length > WARC_RECORD_BUFFER_MAX)
+    warc_record_unbuffer ();
+#endif
+
+  /* End of the WARC header section. */
+  warc_write_string ("\r\n");
+}
+
 /* Copies the contents of DATA_IN to the WARC record.
    Adds a Content-Length header to the WARC record.
    Run this method after warc_write_header,
@@ -293,17 +840,11 @@ warc_write_header_uri (const char *name, const char *value)
 static bool
 warc_write_block_from_file (FILE *data_in)
 {
-  /* Add the Content-Length header. */
-  char content_length[MAX_INT_TO_STRING_LEN(off_t)];
   char buffer[BUFSIZ];
   size_t s;
 
   fseeko (data_in, 0L, SEEK_END);
-  number_to_string (content_length, ftello (data_in));
-  warc_write_header ("Content-Length", content_length);
-
-  /* End of the WARC header section. */
-  warc_write_string ("\r\n");
+  warc_write_block_length (ftello (data_in));
 
   if (fseeko (data_in, 0L, SEEK_SET) != 0)
     warc_write_ok = false;
@@ -328,7 +869,16 @@ static bool
 warc_write_end_record (void)
 {
   if (!warc_write_ok)
-    return warc_write_ok;
+    {
+#ifdef HAVE_PTHREAD_H
+      if (warc_current_record)
+        {
+          warc_record_free (warc_current_record);
+          warc_current_record = NULL;
+        }
+#endif
+      return warc_write_ok;
+    }
 
   if (warc_write_buffer ("\r\n\r\n", 4) != 4)
     {
@@ -336,6 +886,29 @@ warc_write_end_record (void)
       return false;
     }
 
+#ifdef HAVE_PTHREAD_H
+  /* Leave the compression and writing to the pool.  */
+  if (warc_current_record)
+    {
+      if (!warc_pool_submit (warc_pool, warc_current_record))
+        warc_write_ok = false;
+      warc_current_record = NULL;
+      return warc_write_ok;
+    }
+#endif
+
+#ifdef HAVE_LIBZSTD
+  /* Each record is a zstd frame of its own.  */
+  if (warc_current_zstd)
+    {
+      if (!warc_zstd_write (NULL, 0, ZSTD_e_end))
+        warc_write_ok = false;
+      ZSTD_freeCCtx (warc_current_zstd);
+      warc_current_zstd = NULL;
+      return warc_write_ok;
+    }
+#endif
+
 #ifdef HAVE_LIBZ
   /* We start a new gzip stream for each record.  */
   if (warc_write_ok && warc_current_gzfile)
@@ -603,12 +1176,191 @@ warc_base32_sha1_digest (const char *sha1_digest, char *sha1_base32, size_t sha1
 }
 
 
+/* The block of a record, captured while it is downloaded.  The
+   digests are computed as the data arrives, so the block is read only
+   once more, to copy it into the WARC file.  Small blocks stay in
+   memory; a block that outgrows WARC_BODY_MEMORY_MAX moves to a
+   temporary file.  */
+struct warc_body
+{
+  char *data;                   /* the block, while it is in memory */
+  size_t size;
+  size_t alloc;
+  FILE *spill;                  /* the block, once it outgrew memory */
+  off_t length;                 /* the length of the block */
+  off_t payload_offset;         /* start of the payload, or -1 */
+  bool hashed;                  /* the contexts below cover the block */
+  bool failed;                  /* writing to SPILL failed */
+  struct sha1_ctx block_ctx;
+  struct sha1_ctx head_ctx;     /* block_ctx at payload_offset */
+  struct sha1_ctx payload_ctx;
+};
+
+#define WARC_BODY_MEMORY_MAX (1024 * 1024)
+
+/* Returns a new, empty record block.  */
+struct warc_body *
+warc_body_new (void)
+{
+  struct warc_body *body = xnew0 (struct warc_body);
+
+  body->payload_offset = -1;
+  body->hashed = opt.warc_digests_enabled;
+  if (body->hashed)
+    sha1_init_ctx (&body->block_ctx);
+  return body;
+}
+
+/* Returns a record block that holds the contents of FP.  Its digests
+   are computed from the file when the record is written.  */
+static struct warc_body *
+warc_body_from_file (FILE *fp, off_t payload_offset)
+{
+  struct warc_body *body = xnew0 (struct warc_body);
+
+  body->spill = fp;
+  body->payload_offset = payload_offset;
+  return body;
+}
+
+/* Appends SIZE bytes at BUF to BODY.  Returns false if the block
+   could not be stored.  */
+bool
+warc_body_write (struct warc_body *body, const char *buf, size_t size)
+{
+  if (body->failed)
+    return false;
+
+  if (body->hashed)
+    {
+      sha1_process_bytes (buf, size, &body->block_ctx);
+      if (body->payload_offset >= 0)
+        sha1_process_bytes (buf, size, &body->payload_ctx);
+    }
+  body->length += size;
+
+  if (!body->spill && body->size + size > WARC_BODY_MEMORY_MAX)
+    {
+      body->spill = warc_tempfile ();
+      if (body->spill == NULL
+          || fwrite (body->data, 1, body->size, body->spill) != body->size)
+        body->failed = true;
+      xfree (body->data);
+      body->size = body->alloc = 0;
+      if (body->failed)
+        return false;
+    }
+
+  if (body->spill)
+    {
+      if (fwrite (buf, 1, size, body->spill) != size)
+        body->failed = true;
+      return !body->failed;
+    }
+
+  if (body->size + size > body->alloc)
+    {
+      body->alloc = MIN (MAX (body->alloc * 2, 16 * 1024),
+                         WARC_BODY_MEMORY_MAX);
+      body->alloc = MAX (body->alloc, body->size + size);
+      body->data = xrealloc (body->data, body->alloc);
+    }
+  memcpy (body->data + body->size, buf, size);
+  body->size += size;
+  return true;
+}
+
+/* Marks the end of the headers in BODY: the payload digest covers the
+   data written after this call.  */
+void
+warc_body_start_payload (struct warc_body *body)
+{
+  body->payload_offset = body->length;
+  if (body->hashed)
+    {
+      body->head_ctx = body->block_ctx;
+      sha1_init_ctx (&body->payload_ctx);
+    }
+}
+
+/* Releases BODY and its temporary file.  */
+void
+warc_body_free (struct warc_body *body)
+{
+  if (body->spill)
+    fclose (body->spill);
+  xfree (body->data);
+  xfree (body);
+}
+
+/* Stores the block digest of BODY in RES_BLOCK and, if it has a
+   payload, the payload digest in RES_PAYLOAD.  This can be done once
+   per block.  Returns false on error.  */
+static bool
+warc_body_digests (struct warc_body *body, void *res_block, void *res_payload)
+{
+  if (body->hashed)
+    {
+      sha1_finish_ctx (&body->block_ctx, res_block);
+      if (body->payload_offset >= 0)
+        sha1_finish_ctx (&body->payload_ctx, res_payload);
+      return true;
+    }
+  if (body->spill == NULL)
+    return false;
+
+  rewind (body->spill);
+  return warc_sha1_stream_with_payload (body->spill, res_block, res_payload,
+                                        body->payload_offset) == 0;
+}
+
+/* Cuts the payload off BODY, leaving only the headers, and stores the
+   digest of what is left in RES_BLOCK.  Returns false on error.  */
+static bool
+warc_body_drop_payload (struct warc_body *body, void *res_block)
+{
+  if (body->payload_offset < 0)
+    return false;
+
+  body->length = body->payload_offset;
+  if (body->spill)
+    {
+      if (fflush (body->spill) != 0
+          || ftruncate (fileno (body->spill), body->payload_offset) == -1)
+        return false;
+      rewind (body->spill);
+    }
+  else
+    body->size = body->payload_offset;
+
+  if (body->hashed)
+    {
+      sha1_finish_ctx (&body->head_ctx, res_block);
+      return true;
+    }
+  return body->spill && sha1_stream (body->spill, res_block) == 0;
+}
+
+/* Copies BODY to the WARC record, after a Content-Length header.  */
+static bool
+warc_write_block_from_body (struct warc_body *body)
+{
+  if (body->spill)
+    return warc_write_block_from_file (body->spill);
+
+  warc_write_block_length (body->size);
+  if (warc_write_ok
+      && warc_write_buffer (body->data, body->size) < body->size)
+    warc_write_ok = false;
+
+  return warc_write_ok;
+}
+
 /* Sets the digest headers of the record.
-   This method will calculate the block digest and, if payload_offset >= 0,
-   will also calculate the payload digest of the payload starting at the
-   provided offset.  */
+   This method will calculate the block digest and, if BODY has a
+   payload, the payload digest.  */
 static void
-warc_write_digest_headers (FILE *file, long payload_offset)
+warc_write_digest_headers (struct warc_body *body)
 {
   if (opt.warc_digests_enabled)
     {
@@ -616,16 +1368,14 @@ warc_write_digest_headers (FILE *file, long payload_offset)
       char sha1_res_block[SHA1_DIGEST_SIZE];
       char sha1_res_payload[SHA1_DIGEST_SIZE];
 
-      rewind (file);
-      if (warc_sha1_stream_with_payload (file, sha1_res_block,
-          sha1_res_payload, payload_offset) == 0)
+      if (warc_body_digests (body, sha1_res_block, sha1_res_payload))
         {
           char digest[BASE32_LENGTH(SHA1_DIGEST_SIZE) + 1 + 5];
 
           warc_write_header ("WARC-Block-Digest",
               warc_base32_sha1_digest (sha1_res_block, digest, sizeof(digest)));
 
-          if (payload_offset >= 0)
+          if (body->payload_offset >= 0)
               warc_write_header ("WARC-Payload-Digest",
                   warc_base32_sha1_digest (sha1_res_payload, digest, sizeof(digest)));
         }
@@ -782,6 +1532,7 @@ static bool
 warc_write_warcinfo_record (const char *filename)
 {
   FILE *warc_tmp;
+  struct warc_body *body;
   char timestamp[22];
   char *filename_basename;
 
@@ -825,14 +1576,15 @@ warc_write_warcinfo_record (const char *filename)
     }
   fprintf(warc_tmp, "\r\n");
 
-  warc_write_digest_headers (warc_tmp, -1);
-  warc_write_block_from_file (warc_tmp);
+  body = warc_body_from_file (warc_tmp, -1);
+  warc_write_digest_headers (body);
+  warc_write_block_from_body (body);
+  warc_body_free (body);
   warc_write_end_record ();
 
   if (! warc_write_ok)
     logprintf (LOG_NOTQUIET, _("Error writing warcinfo record to WARC file.\n"));
 
-  fclose (warc_tmp);
   return warc_write_ok;
 }
 
@@ -856,15 +1608,27 @@ warc_start_new_file (bool meta)
 # define WARC_GZ "warc.gz"
 #endif /* def __VMS [else] */
 
-#ifdef HAVE_LIBZ
-  const char *extension = (opt.warc_compression_enabled ? WARC_GZ : "warc");
-#else
   const char *extension = "warc";
-#endif
+
+  if (warc_codec == WARC_GZIP)
+    extension = WARC_GZ;
+  else if (warc_codec == WARC_ZSTD)
+    extension = "warc.zst";
 
   if (opt.warc_filename == NULL)
     return false;
 
+#ifdef HAVE_PTHREAD_H
+  /* The records queued so far belong to the current file.  */
+  if (warc_pool)
+    {
+      if (!warc_pool_drain (warc_pool))
+        warc_write_ok = false;
+      warc_pool->written = 0;
+      warc_pool->resync = false;
+    }
+#endif
+
   if (warc_current_file != NULL)
     fclose (warc_current_file);
 
@@ -932,125 +1696,30 @@ warc_start_cdx_file (void)
   return true;
 }
 
-#define CDX_FIELDSEP " \t\r\n"
-
-/* Parse the CDX header and find the field numbers of the original url,
-   checksum and record ID fields. */
-static bool
-warc_parse_cdx_header (char *lineptr, int *field_num_original_url,
-                       int *field_num_checksum, int *field_num_record_id)
-{
-  char *token;
-  char *save_ptr;
-
-  *field_num_original_url = -1;
-  *field_num_checksum = -1;
-  *field_num_record_id = -1;
-
-  token = strtok_r (lineptr, CDX_FIELDSEP, &save_ptr);
-
-  if (token != NULL && strcmp (token, "CDX") == 0)
-    {
-      int field_num = 0;
-      while (token != NULL)
-        {
-          token = strtok_r (NULL, CDX_FIELDSEP, &save_ptr);
-          if (token != NULL)
-            {
-              switch (token[0])
-                {
-                case 'a':
-                  *field_num_original_url = field_num;
-                  break;
-                case 'k':
-                  *field_num_checksum = field_num;
-                  break;
-                case 'u':
-                  *field_num_record_id = field_num;
-                  break;
-                }
-            }
-          field_num++;
-        }
-    }
-
-  return *field_num_original_url != -1
-         && *field_num_checksum != -1
-         && *field_num_record_id != -1;
-}
-
 /* Parse the CDX record and add it to the warc_cdx_dedup_table hash table. */
 static void
 warc_process_cdx_line (char *lineptr, int field_num_original_url,
                        int field_num_checksum, int field_num_record_id)
 {
-  char *original_url = NULL;
-  char *checksum = NULL;
-  char *record_id = NULL;
-  char *token;
-  char *save_ptr;
-  int field_num = 0;
-
-  /* Read this line to get the fields we need. */
-  token = strtok_r (lineptr, CDX_FIELDSEP, &save_ptr);
-  while (token != NULL)
-    {
-      char **val;
-      if (field_num == field_num_original_url)
-        val = &original_url;
-      else if (field_num == field_num_checksum)
-        val = &checksum;
-      else if (field_num == field_num_record_id)
-        val = &record_id;
-      else
-        val = NULL;
-
-      if (val != NULL)
-        *val = strdup (token);
-
-      token = strtok_r (NULL, CDX_FIELDSEP, &save_ptr);
-      field_num++;
-    }
+  const char *original_url, *record_id;
+  char digest[SHA1_DIGEST_SIZE];
 
-  if (original_url != NULL && checksum != NULL && record_id != NULL)
-    {
-      /* For some extra efficiency, we decode the base32 encoded
-         checksum value.  This should produce exactly SHA1_DIGEST_SIZE
-         bytes.  */
-      idx_t checksum_l;
-      char * checksum_v;
-      base32_decode_alloc (checksum, strlen (checksum), &checksum_v,
-                           &checksum_l);
-      xfree (checksum);
-
-      if (checksum_v != NULL && checksum_l == SHA1_DIGEST_SIZE)
-        {
-          /* This is a valid line with a valid checksum. */
-          struct warc_cdx_record *rec;
-          rec = xmalloc (sizeof (struct warc_cdx_record));
-          rec->url = original_url;
-          rec->uuid = record_id;
-          memcpy (rec->digest, checksum_v, SHA1_DIGEST_SIZE);
-          hash_table_put (warc_cdx_dedup_table, rec->digest, rec);
-          xfree (checksum_v);
-        }
-      else
-        {
-          xfree (original_url);
-          xfree (checksum_v);
-          xfree (record_id);
-        }
-    }
-  else
+  if (cdx_parse_line (lineptr, field_num_original_url, field_num_checksum,
+                      field_num_record_id, &original_url, digest, &record_id))
     {
-      xfree(checksum);
-      xfree(original_url);
-      xfree(record_id);
+      /* This is a valid line with a valid checksum. */
+      struct warc_cdx_record *rec;
+      rec = xmalloc (sizeof (struct warc_cdx_record));
+      rec->url = xstrdup (original_url);
+      rec->uuid = xstrdup (record_id);
+      memcpy (rec->digest, digest, SHA1_DIGEST_SIZE);
+      hash_table_put (warc_cdx_dedup_table, rec->digest, rec);
     }
 }
 
 /* Loads the CDX file from opt.warc_cdx_dedup_filename and fills
-   the warc_cdx_dedup_table. */
+   the warc_cdx_dedup_table.  If the file is a CDX index built with
+   util/cdx-index, it is opened in place instead.  */
 static bool
 warc_load_cdx_dedup_file (void)
 {
@@ -1058,6 +1727,7 @@ warc_load_cdx_dedup_file (void)
   char *lineptr = NULL;
   size_t n = 0;
   ssize_t line_length;
+  char magic[CDX_INDEX_MAGIC_SIZE];
   int field_num_original_url = -1;
   int field_num_checksum = -1;
   int field_num_record_id = -1;
@@ -1066,6 +1736,29 @@ warc_load_cdx_dedup_file (void)
   if (f == NULL)
     return false;
 
+  if (fread (magic, 1, sizeof (magic), f) == sizeof (magic)
+      && memcmp (magic, CDX_INDEX_MAGIC, sizeof (magic)) == 0)
+    {
+      unsigned long long nrecords;
+
+      fclose (f);
+      warc_cdx_dedup_index = cdx_index_open (opt.warc_cdx_dedup_filename);
+      if (warc_cdx_dedup_index == NULL)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n",
+                     quote (opt.warc_cdx_dedup_filename), strerror (errno));
+          return false;
+        }
+
+      nrecords = cdx_index_count (warc_cdx_dedup_index);
+      logprintf (LOG_VERBOSE, ngettext ("Opened CDX index of %llu record.\n\n",
+                                        "Opened CDX index of %llu records.\n\n",
+                                        nrecords),
+                 nrecords);
+      return true;
+    }
+  rewind (f);
+
   /* The first line should contain the CDX header.
      Format:  " CDX x x x x x"
      where x are field type indicators.  For our purposes, we only
@@ -1073,8 +1766,8 @@ warc_load_cdx_dedup_file (void)
      'u' (the WARC record id). */
   line_length = getline (&lineptr, &n, f);
   if (line_length != -1)
-    warc_parse_cdx_header (lineptr, &field_num_original_url,
-                           &field_num_checksum, &field_num_record_id);
+    cdx_parse_header (lineptr, &field_num_original_url,
+                      &field_num_checksum, &field_num_record_id);
 
   /* If the file contains all three fields, read the complete file. */
   if (field_num_original_url == -1
@@ -1124,23 +1817,26 @@ _("CDX file does not list record ids. (Missing column 'u'.)\n"));
 
   return true;
 }
-#undef CDX_FIELDSEP
 
-/* Returns the existing duplicate CDX record for the given url and payload
-   digest.  Returns NULL if the url is not found or if the payload digest
-   does not match, or if CDX deduplication is disabled. */
-static struct warc_cdx_record *
+/* Returns the record id of the existing duplicate CDX record for the
+   given url and payload digest.  Returns NULL if the url is not found
+   or if the payload digest does not match, or if CDX deduplication is
+   disabled. */
+static const char *
 warc_find_duplicate_cdx_record (const char *url, char *sha1_digest_payload)
 {
   struct warc_cdx_record *rec_existing;
 
+  if (warc_cdx_dedup_index != NULL)
+    return cdx_index_find (warc_cdx_dedup_index, url, sha1_digest_payload);
+
   if (warc_cdx_dedup_table == NULL)
     return NULL;
 
   rec_existing = hash_table_get (warc_cdx_dedup_table, sha1_digest_payload);
 
   if (rec_existing && strcmp (rec_existing->url, url) == 0)
-    return rec_existing;
+    return rec_existing->uuid;
   else
     return NULL;
 }
@@ -1154,6 +1850,27 @@ warc_init (void)
 
   if (opt.warc_filename != NULL)
     {
+      warc_codec = WARC_PLAIN;
+#ifdef HAVE_LIBZ
+      if (opt.warc_compression_enabled)
+        warc_codec = WARC_GZIP;
+#endif
+#ifdef HAVE_LIBZSTD
+      if (opt.warc_compression_enabled && opt.warc_zstd)
+        warc_codec = WARC_ZSTD;
+#endif
+
+#ifdef HAVE_PTHREAD_H
+      if (warc_codec != WARC_PLAIN && opt.warc_compression_threads > 0)
+        {
+          warc_pool = warc_pool_new (opt.warc_compression_threads);
+          if (warc_pool == NULL)
+            logprintf (LOG_NOTQUIET,
+                       _("Could not start WARC compression threads; "
+                         "compressing records one at a time.\n"));
+        }
+#endif
+
       if (opt.warc_cdx_dedup_filename != NULL)
         {
           if (! warc_load_cdx_dedup_file ())
@@ -1209,7 +1926,7 @@ static void
 warc_write_metadata (void)
 {
   char manifest_uuid[48];
-  FILE *warc_tmp_fp;
+  struct warc_body *arguments;
 
   /* If there are multiple WARC files, the metadata should be written to a separate file. */
   if (opt.warc_maxsize > 0)
@@ -1224,27 +1941,22 @@ warc_write_metadata (void)
                               warc_manifest_fp, -1);
   /* warc_write_resource_record has closed warc_manifest_fp. */
 
-  warc_tmp_fp = warc_tempfile ();
-  if (warc_tmp_fp == NULL)
-    {
-      logprintf (LOG_NOTQUIET, _("Could not open temporary WARC file.\n"));
-      exit (WGET_EXIT_GENERIC_ERROR);
-    }
-  fflush (warc_tmp_fp);
-  fprintf (warc_tmp_fp, "%s\n", program_argstring);
+  arguments = warc_body_new ();
+  warc_body_write (arguments, program_argstring, strlen (program_argstring));
+  warc_body_write (arguments, "\n", 1);
 
   warc_write_resource_record (NULL,
                    "metadata://gnu.org/software/wget/warc/wget_arguments.txt",
                               NULL, manifest_uuid, NULL, "text/plain",
-                              warc_tmp_fp, -1);
-  /* warc_write_resource_record has closed warc_tmp_fp. */
+                              arguments);
+  /* warc_write_resource_record has freed arguments. */
 
   if (warc_log_fp != NULL)
     {
       warc_write_resource_record (NULL,
                               "metadata://gnu.org/software/wget/warc/wget.log",
                                   NULL, manifest_uuid, NULL, "text/plain",
-                                  warc_log_fp, -1);
+                                  warc_body_from_file (warc_log_fp, -1));
       /* warc_write_resource_record has closed warc_log_fp. */
 
       warc_log_fp = NULL;
@@ -1260,6 +1972,13 @@ warc_close (void)
   if (warc_current_file != NULL)
     {
       warc_write_metadata ();
+#ifdef HAVE_PTHREAD_H
+      if (warc_pool)
+        {
+          warc_pool_free (warc_pool);
+          warc_pool = NULL;
+        }
+#endif
       *warc_current_warcinfo_uuid_str = 0;
       fclose (warc_current_file);
       warc_current_file = NULL;
@@ -1277,6 +1996,9 @@ warc_close (void)
       log_set_warc_log_fp (NULL);
     }
 
+  cdx_index_close (warc_cdx_dedup_index);
+  warc_cdx_dedup_index = NULL;
+
   xfree (warc_current_filename);
 }
 
@@ -1337,6 +2059,8 @@ warc_write_request_record (const char *url, const char *timestamp_str,
                            const char *record_uuid, const ip_address *ip,
                            FILE *body, off_t payload_offset)
 {
+  struct warc_body *wbody;
+
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "request");
   warc_write_header_uri ("WARC-Target-URI", url);
@@ -1345,39 +2069,34 @@ warc_write_request_record (const char *url, const char *timestamp_str,
   warc_write_header ("WARC-Record-ID", record_uuid);
   warc_write_ip_header (ip);
   warc_write_header ("WARC-Warcinfo-ID", warc_current_warcinfo_uuid_str);
-  warc_write_digest_headers (body, payload_offset);
-  warc_write_block_from_file (body);
+  wbody = warc_body_from_file (body, payload_offset);
+  warc_write_digest_headers (wbody);
+  warc_write_block_from_body (wbody);
+  warc_body_free (wbody);
   warc_write_end_record ();
 
-  fclose (body);
-
   return warc_write_ok;
 }
 
-/* Writes a response record to the CDX file.
+/* Formats the CDX line of a response record, up to the offset field.
    url  is the target uri of the request/response,
    timestamp_str  is the timestamp of the request that generated this response,
                   (generated with warc_timestamp),
    mime_type  is the mime type of the response body (will be printed to CDX),
    response_code  is the HTTP response code (will be printed to CDX),
    payload_digest  is the sha1 digest of the payload,
-   redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX),
-   offset  is the position of the WARC record in the WARC file,
-   warc_filename  is the filename of the WARC,
-   response_uuid  is the uuid of the response.
-   Returns true on success, false on error. */
-static bool
-warc_write_cdx_record (const char *url, const char *timestamp_str,
-                       const char *mime_type, int response_code,
-                       const char *payload_digest, const char *redirect_location,
-                       off_t offset, const char *warc_filename _GL_UNUSED,
-                       const char *response_uuid)
+   redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX).
+   Returns a freshly allocated string.  */
+static char *
+warc_cdx_line (const char *url, const char *timestamp_str,
+               const char *mime_type, int response_code,
+               const char *payload_digest, const char *redirect_location)
 {
   /* Transform the timestamp. */
   char timestamp_str_cdx[15];
-  char offset_string[MAX_INT_TO_STRING_LEN(off_t)];
   const char *checksum;
   char *tmp_location = NULL;
+  char *line;
 
   memcpy (timestamp_str_cdx     , timestamp_str     , 4); /* "YYYY" "-" */
   memcpy (timestamp_str_cdx +  4, timestamp_str +  5, 2); /* "mm"   "-" */
@@ -1400,17 +2119,26 @@ warc_write_cdx_record (const char *url, const char *timestamp_str,
   else
     tmp_location = url_escape(redirect_location);
 
+  line = aprintf ("%s %s %s %s %d %s %s - ", url, timestamp_str_cdx, url,
+                  mime_type, response_code, checksum, tmp_location);
+  free (tmp_location);
+
+  return line;
+}
+
+/* Prints a CDX line made with warc_cdx_line to the CDX file.
+   offset  is the position of the WARC record in the WARC file,
+   response_uuid  is the uuid of the response.  */
+static void
+warc_print_cdx_line (const char *line, off_t offset, const char *response_uuid)
+{
+  char offset_string[MAX_INT_TO_STRING_LEN(off_t)];
+
   number_to_string (offset_string, offset);
 
-  /* Print the CDX line. */
-  fprintf (warc_current_cdx_file, "%s %s %s %s %d %s %s - %s %s %s\n", url,
-           timestamp_str_cdx, url, mime_type, response_code, checksum,
-           tmp_location, offset_string, warc_current_filename,
-           response_uuid);
+  fprintf (warc_current_cdx_file, "%s%s %s %s\n", line, offset_string,
+           warc_current_filename, response_uuid);
   fflush (warc_current_cdx_file);
-  free (tmp_location);
-
-  return true;
 }
 
 /* Writes a revisit record to the WARC file.
@@ -1423,23 +2151,20 @@ warc_write_cdx_record (const char *url, const char *timestamp_str,
                  (generated with warc_uuid_str),
    payload_digest  is the sha1 digest of the payload,
    ip  is the ip address of the server (or NULL),
-   body  is a pointer to a file containing the response headers (without payload).
-   Calling this function will close body.
+   block_digest  is the digest of body,
+   body  is the response headers (without payload).
+   Calling this function will free body.
    Returns true on success, false on error. */
 static bool
 warc_write_revisit_record (const char *url, const char *timestamp_str,
                            const char *concurrent_to_uuid, const char *payload_digest,
-                           const char *refers_to, const ip_address *ip, FILE *body)
+                           const char *refers_to, const ip_address *ip,
+                           const char *block_digest, struct warc_body *body)
 {
   char revisit_uuid [48];
-  char block_digest[BASE32_LENGTH(SHA1_DIGEST_SIZE) + 1 + 5];
-  char sha1_res_block[SHA1_DIGEST_SIZE];
 
   warc_uuid_str (revisit_uuid, sizeof (revisit_uuid));
 
-  sha1_stream (body, sha1_res_block);
-  warc_base32_sha1_digest (sha1_res_block, block_digest, sizeof(block_digest));
-
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "revisit");
   warc_write_header ("WARC-Record-ID", revisit_uuid);
@@ -1454,11 +2179,10 @@ warc_write_revisit_record (const char *url, const char *timestamp_str,
   warc_write_header ("Content-Type", "application/http;msgtype=response");
   warc_write_header ("WARC-Block-Digest", block_digest);
   warc_write_header ("WARC-Payload-Digest", payload_digest);
-  warc_write_block_from_file (body);
+  warc_write_block_from_body (body);
+  warc_body_free (body);
   warc_write_end_record ();
 
-  fclose (body);
-
   return warc_write_ok;
 }
 
@@ -1469,16 +2193,17 @@ warc_write_revisit_record (const char *url, const char *timestamp_str,
    concurrent_to_uuid  is the uuid of the request for that generated this response
                  (generated with warc_uuid_str),
    ip  is the ip address of the server (or NULL),
-   body  is a pointer to a file containing the response headers and body.
+   body  is the response headers and body, with its payload started
+         after the headers.
    mime_type  is the mime type of the response body (will be printed to CDX),
    response_code  is the HTTP response code (will be printed to CDX),
    redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX),
-   Calling this function will close body.
+   Calling this function will free body.
    Returns true on success, false on error. */
 bool
 warc_write_response_record (const char *url, const char *timestamp_str,
                             const char *concurrent_to_uuid, const ip_address *ip,
-                            FILE *body, off_t payload_offset, const char *mime_type,
+                            struct warc_body *body, const char *mime_type,
                             int response_code, const char *redirect_location)
 {
   char block_digest[BASE32_LENGTH(SHA1_DIGEST_SIZE) + 1 + 5];
@@ -1486,20 +2211,18 @@ warc_write_response_record (const char *url, const char *timestamp_str,
   char sha1_res_block[SHA1_DIGEST_SIZE];
   char sha1_res_payload[SHA1_DIGEST_SIZE];
   char response_uuid [48];
-  off_t offset;
+  char *cdx_line = NULL;
 
   if (opt.warc_digests_enabled)
     {
-      /* Calculate the block and payload digests. */
-      rewind (body);
-      if (warc_sha1_stream_with_payload (body, sha1_res_block, sha1_res_payload,
-          payload_offset) == 0)
+      /* Collect the block and payload digests. */
+      if (warc_body_digests (body, sha1_res_block, sha1_res_payload))
         {
           /* Decide (based on url + payload digest) if we have seen this
              data before. */
-          struct warc_cdx_record *rec_existing;
-          rec_existing = warc_find_duplicate_cdx_record (url, sha1_res_payload);
-          if (rec_existing != NULL)
+          const char *refers_to;
+          refers_to = warc_find_duplicate_cdx_record (url, sha1_res_payload);
+          if (refers_to != NULL)
             {
               bool result;
 
@@ -1507,18 +2230,19 @@ warc_write_response_record (const char *url, const char *timestamp_str,
               logprintf (LOG_VERBOSE,
           _("Found exact match in CDX file. Saving revisit record to WARC.\n"));
 
-              /* Remove the payload from the file. */
-              if (payload_offset > 0)
+              /* Remove the payload from the record. */
+              if (!warc_body_drop_payload (body, sha1_res_block))
                 {
-                  if (ftruncate (fileno (body), payload_offset) == -1)
-                    return false;
+                  warc_body_free (body);
+                  return false;
                 }
 
               /* Send the original payload digest. */
+              warc_base32_sha1_digest (sha1_res_block, block_digest, sizeof(block_digest));
               warc_base32_sha1_digest (sha1_res_payload, payload_digest, sizeof(payload_digest));
               result = warc_write_revisit_record (url, timestamp_str,
-                         concurrent_to_uuid, payload_digest, rec_existing->uuid,
-                         ip, body);
+                         concurrent_to_uuid, payload_digest, refers_to,
+                         ip, block_digest, body);
 
               return result;
             }
@@ -1532,8 +2256,9 @@ warc_write_response_record (const char *url, const char *timestamp_str,
 
   warc_uuid_str (response_uuid, sizeof (response_uuid));
 
-  fseeko (warc_current_file, 0L, SEEK_END);
-  offset = ftello (warc_current_file);
+  if (opt.warc_cdx_enabled)
+    cdx_line = warc_cdx_line (url, timestamp_str, mime_type, response_code,
+                              payload_digest, redirect_location);
 
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "response");
@@ -1546,18 +2271,27 @@ warc_write_response_record (const char *url, const char *timestamp_str,
   warc_write_header ("WARC-Block-Digest", block_digest);
   warc_write_header ("WARC-Payload-Digest", payload_digest);
   warc_write_header ("Content-Type", "application/http;msgtype=response");
-  warc_write_block_from_file (body);
-  warc_write_end_record ();
+  warc_write_block_from_body (body);
+  warc_body_free (body);
 
-  fclose (body);
+#ifdef HAVE_PTHREAD_H
+  /* The writer adds the record to the CDX once it knows the offset. */
+  if (warc_current_record && cdx_line)
+    {
+      warc_current_record->cdx_line = cdx_line;
+      warc_current_record->cdx_uuid = xstrdup (response_uuid);
+      cdx_line = NULL;
+    }
+#endif
+  warc_write_end_record ();
 
-  if (warc_write_ok && opt.warc_cdx_enabled)
+  if (warc_write_ok && cdx_line)
     {
       /* Add this record to the CDX. */
-      warc_write_cdx_record (url, timestamp_str, mime_type, response_code,
-      payload_digest, redirect_location, offset, warc_current_filename,
-      response_uuid);
+      warc_print_cdx_line (cdx_line, warc_current_record_offset,
+                           response_uuid);
     }
+  xfree (cdx_line);
 
   return warc_write_ok;
 }
@@ -1571,15 +2305,15 @@ warc_write_response_record (const char *url, const char *timestamp_str,
    resource (generated with warc_uuid_str) or NULL,
    ip  is the ip address of the server (or NULL),
    content_type  is the mime type of the body (or NULL),
-   body  is a pointer to a file containing the resource data.
-   Calling this function will close body.
+   body  is the resource data.
+   Calling this function will free body.
    Returns true on success, false on error. */
 static bool
 warc_write_record (const char *record_type, const char *resource_uuid,
                  const char *url, const char *timestamp_str,
                  const char *concurrent_to_uuid,
-                 const ip_address *ip, const char *content_type, FILE *body,
-                 off_t payload_offset)
+                 const ip_address *ip, const char *content_type,
+                 struct warc_body *body)
 {
   char uuid_buf[48];
 
@@ -1600,13 +2334,12 @@ warc_write_record (const char *record_type, const char *resource_uuid,
   warc_write_header_uri ("WARC-Target-URI", url);
   warc_write_date_header (timestamp_str);
   warc_write_ip_header (ip);
-  warc_write_digest_headers (body, payload_offset);
+  warc_write_digest_headers (body);
   warc_write_header ("Content-Type", content_type);
-  warc_write_block_from_file (body);
+  warc_write_block_from_body (body);
+  warc_body_free (body);
   warc_write_end_record ();
 
-  fclose (body);
-
   return warc_write_ok;
 }
 
@@ -1618,18 +2351,18 @@ warc_write_record (const char *record_type, const char *resource_uuid,
    resource (generated with warc_uuid_str) or NULL,
    ip  is the ip address of the server (or NULL),
    content_type  is the mime type of the body (or NULL),
-   body  is a pointer to a file containing the resource data.
-   Calling this function will close body.
+   body  is the resource data.
+   Calling this function will free body.
    Returns true on success, false on error. */
 bool
 warc_write_resource_record (const char *resource_uuid, const char *url,
                  const char *timestamp_str, const char *concurrent_to_uuid,
-                 const ip_address *ip, const char *content_type, FILE *body,
-                 off_t payload_offset)
+                 const ip_address *ip, const char *content_type,
+                 struct warc_body *body)
 {
   return warc_write_record ("resource",
       resource_uuid, url, timestamp_str, concurrent_to_uuid,
-      ip, content_type, body, payload_offset);
+      ip, content_type, body);
 }
 
 /* Writes a metadata record to the WARC file.
@@ -1651,5 +2384,89 @@ warc_write_metadata_record (const char *record_uuid, const char *url,
 {
   return warc_write_record ("metadata",
       record_uuid, url, timestamp_str, concurrent_to_uuid,
-      ip, content_type, body, payload_offset);
+      ip, content_type, warc_body_from_file (body, payload_offset));
+}
+
+#if defined TESTING && defined HAVE_LIBZ && defined HAVE_PTHREAD_H
+const char *
+test_warc_gzip_record (void)
+{
+  static const char record[] = "WARC/1.0\r\nWARC-Type: resource\r\n"
+    "Content-Length: 5\r\n\r\nhello\r\n\r\n";
+  struct warc_record *rec = xnew0 (struct warc_record);
+  unsigned char *out;
+  char inflated[sizeof (record)];
+  z_stream zs;
+  size_t member_size;
+
+  warc_record_append (rec, record, sizeof (record) - 1);
+  mu_assert ("could not compress the record", warc_gzip_record (rec));
+  out = (unsigned char *) rec->data;
+
+  mu_assert ("no FEXTRA flag", out[OFF_FLG] & FLG_FEXTRA);
+  mu_assert ("no skip length field", out[12] == 's' && out[13] == 'l');
+  member_size = out[16] | (out[17] << 8) | (out[18] << 16) | (out[19] << 24);
+  mu_assert ("wrong member size", member_size == rec->size);
+  mu_assert ("wrong record size", out[20] == sizeof (record) - 1);
+
+  xzero (zs);
+  inflateInit2 (&zs, 15 + 16);
+  zs.next_in = out;
+  zs.avail_in = rec->size;
+  zs.next_out = (unsigned char *) inflated;
+  zs.avail_out = sizeof (inflated);
+  mu_assert ("member does not inflate", inflate (&zs, Z_FINISH) == Z_STREAM_END);
+  mu_assert ("wrong inflated size", zs.total_out == sizeof (record) - 1);
+  mu_assert ("wrong inflated data",
+             !memcmp (inflated, record, sizeof (record) - 1));
+  inflateEnd (&zs);
+
+  warc_record_free (rec);
+  return NULL;
+}
+#endif
+
+#ifdef TESTING
+const char *
+test_warc_body_digests (void)
+{
+  static const char head[] = "HTTP/1.1 200 OK\r\n\r\n";
+  char chunk[64 * 1024];
+  char res_block[SHA1_DIGEST_SIZE], res_payload[SHA1_DIGEST_SIZE];
+  char res_head[SHA1_DIGEST_SIZE], expected[SHA1_DIGEST_SIZE];
+  struct sha1_ctx ctx;
+  struct warc_body *body;
+  bool digests_enabled = opt.warc_digests_enabled;
+  int i;
+
+  opt.warc_digests_enabled = true;
+  body = warc_body_new ();
+  warc_body_write (body, head, sizeof (head) - 1);
+  warc_body_start_payload (body);
+  memset (chunk, 'x', sizeof (chunk));
+  /* Enough data to move the block out of memory.  */
+  for (i = 0; i < 20; i++)
+    mu_assert ("could not store the block",
+               warc_body_write (body, chunk, sizeof (chunk)));
+  mu_assert ("block was not spilled", body->spill != NULL);
+  mu_assert ("wrong block length",
+             body->length == (off_t) (sizeof (head) - 1 + 20 * sizeof (chunk)));
+
+  mu_assert ("no digests", warc_body_digests (body, res_block, res_payload));
+  rewind (body->spill);
+  warc_sha1_stream_with_payload (body->spill, expected, res_head,
+                                 body->payload_offset);
+  mu_assert ("wrong block digest", !memcmp (res_block, expected, sizeof (expected)));
+  mu_assert ("wrong payload digest", !memcmp (res_payload, res_head, sizeof (res_head)));
+
+  mu_assert ("could not drop the payload", warc_body_drop_payload (body, res_head));
+  sha1_init_ctx (&ctx);
+  sha1_process_bytes (head, sizeof (head) - 1, &ctx);
+  sha1_finish_ctx (&ctx, expected);
+  mu_assert ("wrong header digest", !memcmp (res_head, expected, sizeof (expected)));
+
+  warc_body_free (body);
+  opt.warc_digests_enabled = digests_enabled;
+  return NULL;
 }
+#endif
@@ -12,14 +12,20 @@ char * warc_timestamp (char *timestamp, size_t timestamp_size);
 
 FILE * warc_tempfile (void);
 
+struct warc_body;
+struct warc_body *warc_body_new (void);
+bool warc_body_write (struct warc_body *body, const char *buf, size_t size);
+void warc_body_start_payload (struct warc_body *body);
+void warc_body_free (struct warc_body *body);
+
 bool warc_write_request_record (const char *url, const char *timestamp_str,
   const char *concurrent_to_uuid, const ip_address *ip, FILE *body, off_t payload_offset);
 bool warc_write_response_record (const char *url, const char *timestamp_str,
-  const char *concurrent_to_uuid, const ip_address *ip, FILE *body, off_t payload_offset,
+  const char *concurrent_to_uuid, const ip_address *ip, struct warc_body *body,
   const char *mime_type, int response_code, const char *redirect_location);
 bool warc_write_resource_record (const char *resource_uuid, const char *url,
   const char *timestamp_str, const char *concurrent_to_uuid, const ip_address *ip,
-  const char *content_type, FILE *body, off_t payload_offset);
+  const char *content_type, struct warc_body *body);
 bool warc_write_metadata_record (const char *record_uuid, const char *url,
   const char *timestamp_str, const char *concurrent_to_uuid, ip_address *ip,
   const char *content_type, FILE *body, off_t payload_offset);
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+from sys import exit
+import hashlib
+import json
+import os
+import shlex
+from subprocess import run, PIPE
+from test.http_test import HTTPTest
+from exc.test_failed import TestFailed
+from misc.wget_file import WgetFile
+
+"""
+    This test runs download jobs read from the standard input with
+    --batch=- and checks their completion records.  Jobs without an output
+    file go to the -O file, which stays open across the jobs that have one.
+    Failed jobs carry an error text.  A job that would go to the -O file
+    cannot have a digest, and -O - cannot be combined with --batch=-.
+"""
+############# File Definitions ###############################################
+File1 = "Contents of File1.\n"
+File2 = "Contents of File2.\n"
+File3 = "Contents of File3.\n"
+File4 = "Contents of File4.\n"
+
+A_File = WgetFile ("File1", File1)
+B_File = WgetFile ("File2", File2)
+C_File = WgetFile ("File3", File3)
+D_File = WgetFile ("File4", File4)
+
+File2_sha256 = hashlib.sha256 (File2.encode ()).hexdigest ()
+Bad_sha256 = "0" * 64
+
+WGET_OPTIONS = "-O all.txt --batch=-"
+WGET_URLS = [[]]
+
+Files = [[A_File, B_File, C_File, D_File]]
+
+# Each job with the fields its completion record must have.
+Jobs = [
+    ("File1", {"ok": True, "exit": 0, "file": "all.txt"}),
+    ("File2\tFile2.out\t" + File2_sha256,
+     {"ok": True, "exit": 0, "file": "File2.out", "checksum": "ok"}),
+    ("File4\tFile4.out\tsha256:" + Bad_sha256,
+     {"ok": False, "exit": 1, "file": "File4.out", "checksum": "mismatch",
+      "error": "Checksum mismatch"}),
+    ("File3\t\t" + File2_sha256,
+     {"ok": False, "exit": 1,
+      "error": "cannot check the digest of the -O file"}),
+    ("missing", {"ok": False, "exit": 8,
+                 "error": "Server issued an error response"}),
+    ("File3", {"ok": True, "exit": 0, "file": "all.txt"}),
+]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [WgetFile ("all.txt", File1 + File3),
+                           WgetFile ("File2.out", File2),
+                           WgetFile ("File4.out", File4)]
+
+class BatchTest (HTTPTest):
+    def exec_wget (self):
+        params = shlex.split (self.gen_cmd_line ())
+        envs = {"HOME": os.getcwd ()}
+        envs.update (**self.envs)
+        stdout = run (params[:1] + ["-O", "-", "--batch=-"],
+                      input="", stdout=PIPE, stderr=PIPE, env=envs)
+        if stdout.returncode != 1 or stdout.stdout:
+            raise TestFailed ("-O - was accepted with --batch=-")
+        base = "http://localhost:%s/" % self.port
+        jobs = "".join (base + job + "\n" for job, _ in Jobs)
+        proc = run (params, input=jobs, stdout=PIPE, env=envs,
+                    universal_newlines=True)
+        records = [json.loads (line) for line in proc.stdout.splitlines ()]
+        if len (records) != len (Jobs):
+            raise TestFailed ("Expected %d records, got %d"
+                              % (len (Jobs), len (records)))
+        for (job, fields), record in zip (Jobs, records):
+            if record["url"] != base + job.split ("\t")[0]:
+                raise TestFailed ("Wrong URL in record %s" % record)
+            if record["ok"] and "error" in record:
+                raise TestFailed ("Error in successful record %s" % record)
+            for name, value in fields.items ():
+                if record.get (name) != value:
+                    raise TestFailed ("Expected %s %r in record %s"
+                                      % (name, value, record))
+        return proc.returncode
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = BatchTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+
+from sys import exit
+from misc.metalinkv3_xml import Metalinkv3_XML
+
+"""
+    This is to test Metalink/XML segmented downloads.
+
+    With --connections, a file with a known size is fetched in ranged
+    segments from all of its HTTP mirrors at once, and joined in order.
+"""
+
+############# File Definitions ###############################################
+# About 3 MiB, so that the file is cut into several segments.
+File1 = "".join ("Line %07d of the segmented file.\n" % i
+                 for i in range (90000))
+
+############# Metalink/XML ###################################################
+Meta = Metalinkv3_XML()
+
+XmlName = "test.metalink"
+
+Meta.xml (
+    # Metalink/XML file name
+    XmlName,
+    # file_name, save_name, content, size, hash_sha256
+    ["File1", XmlName + ".#1", File1, True, True,
+     # srv_file, srv_content, utype, location, preference
+     ["mirror1/File1", File1, "http", None, 30],
+     ["mirror2/File1", File1, "http", None, 30]],
+)
+
+err = Meta.http_test (
+    "--connections=4 --input-metalink " + XmlName, 0
+)
+
+exit (err)
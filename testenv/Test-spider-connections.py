@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+from sys import exit
+import os
+import re
+import shlex
+from subprocess import run, PIPE
+from test.http_test import HTTPTest
+from exc.test_failed import TestFailed
+from misc.wget_file import WgetFile
+
+"""
+    This test runs a recursive spider crawl once serially and once with
+    --connections=4 and checks that both report the same broken links.
+    Each /dirN/ is linked to along with /dirN/index.html, which is the
+    same local file.
+"""
+############# File Definitions ###############################################
+page = """
+<html>
+<head>
+  <title>Page {0}</title>
+</head>
+<body>
+  <p>
+    {1}
+    Also, a <a href="http://localhost:{{{{port}}}}/missing{0}">broken link</a>
+    and a <a href="http://localhost:{{{{port}}}}/nonexistent">shared one</a>.
+  </p>
+</body>
+</html>
+"""
+
+def link (path):
+    return ('A link to <a href="http://localhost:{{port}}/%s">%s</a>.'
+            % (path, path))
+
+Pages = 8
+Dirs = 30
+Files = [[WgetFile ("index.html",
+                    page.format ("", " ".join (
+                        [link ("page%d.html" % n) for n in range (Pages)]
+                        + [link ("dir%d/" % n) + link ("dir%d/index.html" % n)
+                           for n in range (Dirs)])))]
+         + [WgetFile ("page%d.html" % n,
+                      page.format (n, link ("page%d.html" % ((n + 1) % Pages))))
+            for n in range (Pages)]
+         + [WgetFile ("dir%d/index.html" % n, page.format ("-dir%d" % n, ""))
+            for n in range (Dirs)]]
+
+WGET_OPTIONS = "--spider -r"
+WGET_URLS = [[""]]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = []
+
+class SpiderConnectionsTest (HTTPTest):
+    def spider (self, params, envs):
+        proc = run (params, stderr=PIPE, env=envs, universal_newlines=True)
+        if re.search (r"^(utime|unlink)", proc.stderr, re.MULTILINE):
+            raise TestFailed ("Retrievals wrote over each other's files")
+        found = re.search (r"^Found (\d+) broken links?\.\n\n((?:.+\n)*)",
+                           proc.stderr, re.MULTILINE)
+        if not found:
+            raise TestFailed ("No broken link report")
+        links = found.group (2).splitlines ()
+        if int (found.group (1)) != len (links):
+            raise TestFailed ("Report counts %s links but lists %d"
+                              % (found.group (1), len (links)))
+        return proc.returncode, sorted (links)
+
+    def exec_wget (self):
+        params = shlex.split (self.gen_cmd_line ())
+        envs = {"HOME": os.getcwd ()}
+        envs.update (**self.envs)
+        serial = self.spider (params, envs)
+        parallel = self.spider (params[:1] + ["--connections=4"] + params[1:],
+                                envs)
+        base = "http://localhost:%s/" % self.port
+        expected = sorted ([base + "missing", base + "nonexistent"]
+                           + [base + "missing%d" % n for n in range (Pages)]
+                           + [base + "missing-dir%d" % n
+                              for n in range (Dirs)])
+        if serial[1] != expected:
+            raise TestFailed ("Unexpected broken links %s" % serial[1])
+        if parallel != serial:
+            raise TestFailed ("--connections=4 reported %s, serial %s"
+                              % (parallel, serial))
+        return serial[0]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = SpiderConnectionsTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
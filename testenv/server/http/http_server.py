@@ -1,6 +1,6 @@
 from http.server import HTTPServer, BaseHTTPRequestHandler
 from exc.server_error import ServerError, AuthError, NoBodyServerError
-from socketserver import BaseServer
+from socketserver import BaseServer, ThreadingMixIn
 from posixpath import basename, splitext
 from base64 import b64encode
 from random import random
@@ -10,13 +10,15 @@ import socket
 import os
 
 
-class StoppableHTTPServer(HTTPServer):
+class StoppableHTTPServer(ThreadingMixIn, HTTPServer):
     """ This class extends the HTTPServer class from default http.server library
     in Python 3. The StoppableHTTPServer class is capable of starting an HTTP
     server that serves a virtual set of files made by the WgetFile class and
     has most of its properties configurable through the server_conf()
-    method. """
+    method. Each connection is handled in its own thread, so that Wget can
+    keep several connections open at once. """
 
+    daemon_threads = True
     request_headers = list()
 
     """ Define methods for configuring the Server. """
@@ -88,7 +90,8 @@ class _Handler(BaseHTTPRequestHandler):
             if start is None:
                 self.wfile.write(content.encode('utf-8'))
             else:
-                self.wfile.write(content.encode('utf-8')[start:])
+                self.wfile.write(content.encode('utf-8')
+                                 [start:self.range_end + 1])
 
     def do_POST(self):
         """ According to RFC 7231 sec 4.3.3, if the resource requested in a POST
@@ -140,15 +143,18 @@ class _Handler(BaseHTTPRequestHandler):
 
     def parse_range_header(self, header_line, length):
         import re
+        self.range_end = length - 1
         if header_line is None:
             return None
         if not header_line.startswith("bytes="):
             raise ServerError("Cannot parse header Range: %s" %
                               (header_line))
-        regex = re.match(r"^bytes=(\d*)\-$", header_line)
+        regex = re.match(r"^bytes=(\d*)\-(\d*)$", header_line)
         range_start = int(regex.group(1))
         if range_start >= length:
             raise ServerError("Range Overflow")
+        if regex.group(2):
+            self.range_end = min(int(regex.group(2)), length - 1)
         return range_start
 
     def get_body_data(self):
@@ -383,10 +389,12 @@ class _Handler(BaseHTTPRequestHandler):
         the two requests, however, we use it here for a specific test.
         """
 
-        if self.path == "/":
-            path = "index.html"
-        else:
-            path = self.path[1:]
+        path = self.path[1:]
+        if path.endswith("/") or not path:
+            # Serve a directory's index.html, unless the directory has
+            # content of its own.
+            if path not in self.server.fileSys:
+                path += "index.html"
 
         self.__log_request(method)
 
@@ -444,9 +452,9 @@ class _Handler(BaseHTTPRequestHandler):
                 self.add_header("Accept-Ranges", "bytes")
                 self.add_header("Content-Range",
                                 "bytes %d-%d/%d" % (self.range_begin,
-                                                    content_length - 1,
+                                                    self.range_end,
                                                     content_length))
-                content_length -= self.range_begin
+                content_length = self.range_end + 1 - self.range_begin
             cont_type = self.guess_type(path)
             self.add_header("Content-Type", cont_type)
             self.add_header("Content-Length", content_length)
@@ -579,7 +579,7 @@ sub new
       IO::Socket::INET->new(
                             LocalHost => $self->{_localAddr},
                             LocalPort => $self->{_localPort},
-                            Listen    => 1,
+                            Listen    => 5,
                             Reuse     => $self->{_reuseAddr},
                             Proto     => 'tcp',
                             Type      => SOCK_STREAM
@@ -620,7 +620,9 @@ sub run
         $initialized = 1;
     }
 
-    $SIG{CHLD} = sub { wait };
+    # Reap the connection processes without interrupting accept.
+    $SIG{CHLD} = $self->{_server_behavior}{concurrent} ? 'IGNORE'
+                                                       : sub { wait };
     my $server_sock = $self->{_server_sock};
 
     # the accept loop
@@ -636,15 +638,20 @@ sub run
         # print who connected
         print STDERR "got a connection from: $client_ipnum\n" if $log;
 
-        # fork off a process to handle this connection.
-        # my $pid = fork();
-        # unless (defined $pid) {
-        #     warn "fork: $!";
-        #     sleep 5; # Back off in case system is overloaded.
-        #     next;
-        # }
+        # fork off a process to handle this connection, if the test
+        # needs several connections at once.
+        my $pid = 0;
+        if ($self->{_server_behavior}{concurrent})
+        {
+            $pid = fork();
+            unless (defined $pid) {
+                warn "fork: $!";
+                sleep 5; # Back off in case system is overloaded.
+                next;
+            }
+        }
 
-        if (1)
+        if (!$pid)
         {    # Child process.
 
             # install signals
@@ -751,6 +758,7 @@ sub run
                 # Run the command.
                 &{$command_table->{$cmd}}($conn, $cmd, $rest);
             }
+            exit 0 if $pid == 0 && $self->{_server_behavior}{concurrent};
         }
         else
         {    # Father
@@ -49,17 +49,28 @@ all_tests(void)
   mu_run_test (test_find_key_values);
   mu_run_test (test_has_key);
 #endif
+  mu_run_test (test_hash_table);
+  mu_run_test (test_string_pool);
+  mu_run_test (test_url_queue_order);
+  mu_run_test (test_url_queue_disk);
+  mu_run_test (test_cookie_header);
   mu_run_test (test_parse_content_disposition);
   mu_run_test (test_parse_range_header);
   mu_run_test (test_subdir_p);
   mu_run_test (test_dir_matches_p);
+  mu_run_test (test_acclist_match_file);
+  mu_run_test (test_unique_name);
   mu_run_test (test_commands_sorted);
   mu_run_test (test_cmd_spec_restrict_file_names);
   mu_run_test (test_path_simplify);
   mu_run_test (test_append_uri_pathel);
   mu_run_test (test_are_urls_equal);
   mu_run_test (test_uri_merge);
+  mu_run_test (test_known_dirs);
+  mu_run_test (test_url_file_name);
   mu_run_test (test_is_robots_txt_url);
+  mu_run_test (test_res_match_path);
+  mu_run_test (test_res_cache);
 #ifdef HAVE_HSTS
   mu_run_test (test_hsts_new_entry);
   mu_run_test (test_hsts_url_rewrite_superdomain);
@@ -69,6 +80,17 @@ all_tests(void)
   mu_run_test (test_parse_netrc);
   mu_run_test (test_retr_rate);
   mu_run_test (test_compute_chunk_range);
+  mu_run_test (test_fd_read_body);
+#if defined HAVE_LIBZ && defined HAVE_PTHREAD_H
+  mu_run_test (test_warc_gzip_record);
+#endif
+  mu_run_test (test_warc_body_digests);
+  mu_run_test (test_cdx_index);
+  mu_run_test (test_stats_file);
+#ifdef HAVE_PTHREAD_H
+  mu_run_test (test_async_log);
+#endif
+  mu_run_test (test_ftp_parse_mlsd);
 
   return NULL;
 }
@@ -47,17 +47,30 @@ do { \
 const char *test_has_key (void);
 const char *test_find_key_value (void);
 const char *test_find_key_values (void);
+const char *test_hash_table (void);
+const char *test_string_pool (void);
+const char *test_url_queue_order (void);
+const char *test_url_queue_disk (void);
+const char *test_cookie_header (void);
 const char *test_parse_content_disposition(void);
 const char *test_parse_range_header(void);
 const char *test_commands_sorted(void);
 const char *test_cmd_spec_restrict_file_names(void);
 const char *test_is_robots_txt_url(void);
+const char *test_res_match_path(void);
+const char *test_res_cache(void);
+const char *test_async_log(void);
+const char *test_stats_file(void);
 const char *test_path_simplify (void);
 const char *test_append_uri_pathel(void);
 const char *test_are_urls_equal(void);
 const char *test_uri_merge(void);
+const char *test_known_dirs(void);
+const char *test_url_file_name(void);
 const char *test_subdir_p(void);
 const char *test_dir_matches_p(void);
+const char *test_acclist_match_file(void);
+const char *test_unique_name(void);
 const char *test_hsts_new_entry(void);
 const char *test_hsts_url_rewrite_superdomain(void);
 const char *test_hsts_url_rewrite_congruent(void);
@@ -65,6 +78,11 @@ const char *test_hsts_read_database(void);
 const char *test_parse_netrc(void);
 const char *test_retr_rate(void);
 const char *test_compute_chunk_range(void);
+const char *test_fd_read_body(void);
+const char *test_warc_gzip_record(void);
+const char *test_warc_body_digests(void);
+const char *test_cdx_index(void);
+const char *test_ftp_parse_mlsd(void);
 
 #endif /* TEST_H */
 
@@ -0,0 +1,69 @@
+/* cdx-index.c: Build a CDX index for wget --warc-dedup.
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ * Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty provided the copyright
+ * notice and this notice are preserved.
+ *
+ * Usage: cdx-index CDX-FILE INDEX-FILE
+ *
+ * The index holds the URL, payload digest and record id of every
+ * record of CDX-FILE.  Giving it to --warc-dedup instead of the CDX
+ * file makes Wget open it in place rather than load the records into
+ * memory; see src/cdx-index.c for the format.  Use "-" as CDX-FILE to
+ * read the CDX from standard input.
+ *
+ * The program links against src/cdx-index.c built with -DSTANDALONE
+ * and against gnulib.  From a configured and built tree:
+ *
+ *   cc -O2 -DSTANDALONE -Isrc -Ilib util/cdx-index.c src/cdx-index.c \
+ *     lib/libgnu.a -o cdx-index
+ *
+ * (In a separate build directory, also add -I$(SRCDIR)/src and
+ * -I$(SRCDIR)/lib and take the sources from $(SRCDIR).)
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cdx-index.h"
+
+#define PROGRAM_NAME  "cdx-index"
+
+int
+main (int argc, char **argv)
+{
+  FILE *cdx;
+  const char *error;
+
+  if (argc != 3)
+    {
+      fputs ("usage: " PROGRAM_NAME " CDX-FILE INDEX-FILE\n", stderr);
+      return EXIT_FAILURE;
+    }
+
+  cdx = strcmp (argv[1], "-") ? fopen (argv[1], "r") : stdin;
+  if (!cdx)
+    {
+      fprintf (stderr, PROGRAM_NAME ": %s: %s\n", argv[1], strerror (errno));
+      return EXIT_FAILURE;
+    }
+
+  errno = 0;
+  error = cdx_index_build (cdx, argv[2]);
+  if (error)
+    {
+      if (errno)
+        fprintf (stderr, PROGRAM_NAME ": %s: %s\n", error, strerror (errno));
+      else
+        fprintf (stderr, PROGRAM_NAME ": %s\n", error);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
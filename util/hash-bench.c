@@ -0,0 +1,122 @@
+/* hash-bench.c: Time Wget's hash tables on URL-like string keys.
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ * Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty provided the copyright
+ * notice and this notice are preserved.
+ *
+ * The program links against src/hash.c built with -DSTANDALONE, so it
+ * can be used to compare two revisions of the table, e.g.:
+ *
+ *   git show HEAD~1:src/hash.c > /tmp/old-hash.c
+ *   cc -O2 $(FLAGS) util/hash-bench.c /tmp/old-hash.c -o old
+ *   cc -O2 $(FLAGS) util/hash-bench.c src/hash.c -o new
+ *   ./old 1000000; ./new 1000000
+ *
+ * where FLAGS is "-DSTANDALONE -Dxmalloc=malloc -I. -Isrc", and -I.
+ * points to a configured build directory containing config.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+
+#define PROGRAM_NAME  "hash-bench"
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *what, double start, long ops)
+{
+  double secs = now () - start;
+  printf ("%-18s %8.1f ns/op\n", what, secs * 1e9 / ops);
+}
+
+int
+main (int argc, char **argv)
+{
+  long n = argc > 1 ? atol (argv[1]) : 1000000;
+  char **urls, **misses;
+  struct hash_table *ht;
+  double start;
+  long i, found = 0;
+
+  if (n <= 0)
+    {
+      fputs ("usage: " PROGRAM_NAME " [count]\n", stderr);
+      return EXIT_FAILURE;
+    }
+
+  /* Keys resemble what recursive retrieval stores in the blacklist
+     and in dl_url_file_map: long strings with shared prefixes.  */
+  urls = malloc (n * sizeof *urls);
+  misses = malloc (n * sizeof *misses);
+  if (!urls || !misses)
+    {
+      fputs (PROGRAM_NAME ": out of memory\n", stderr);
+      return EXIT_FAILURE;
+    }
+  for (i = 0; i < n; i++)
+    {
+      char buf[128];
+      snprintf (buf, sizeof buf, "https://host%ld.example.com/dir/%ld/page.html?id=%ld",
+                i % 97, i % 1009, i);
+      urls[i] = strdup (buf);
+      snprintf (buf, sizeof buf, "https://host%ld.example.com/dir/%ld/other.html?id=%ld",
+                i % 97, i % 1009, i);
+      misses[i] = strdup (buf);
+    }
+
+  printf ("%ld keys\n", n);
+  ht = make_string_hash_table (0);
+
+  start = now ();
+  for (i = 0; i < n; i++)
+    hash_table_put (ht, urls[i], urls[i]);
+  report ("insert (growing)", start, n);
+
+  start = now ();
+  for (i = 0; i < n; i++)
+    found += hash_table_get (ht, urls[(i * 7919) % n]) != NULL;
+  report ("lookup hit", start, n);
+
+  start = now ();
+  for (i = 0; i < n; i++)
+    found += hash_table_contains (ht, misses[i]);
+  report ("lookup miss", start, n);
+
+  start = now ();
+  for (i = 0; i < n; i += 2)
+    hash_table_remove (ht, urls[i]);
+  report ("remove", start, (n + 1) / 2);
+
+  start = now ();
+  for (i = 0; i < n; i++)
+    found += hash_table_contains (ht, urls[i]);
+  report ("mixed after remove", start, n);
+
+  /* Every lookup hit, then the n / 2 keys left after removing the
+     even-numbered ones.  */
+  if (found != n + n / 2)
+    printf ("unexpected hit count %ld\n", found);
+
+  hash_table_destroy (ht);
+  for (i = 0; i < n; i++)
+    {
+      free (urls[i]);
+      free (misses[i]);
+    }
+  free (urls);
+  free (misses);
+  return 0;
+}
@@ -0,0 +1,144 @@
+/* startup-bench.c: Time how long Wget takes to send its first request.
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ * Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty provided the copyright
+ * notice and this notice are preserved.
+ *
+ * Usage: startup-bench RUNS WGET [OPTION]...
+ *
+ * Run WGET RUNS times against a server on the loopback interface and
+ * report how long it took from starting the process to the server
+ * receiving the request, and to the process exiting.  The server
+ * answers every request with an empty 204 response.  The OPTIONs are
+ * passed to WGET before the URL, e.g. "--no-config" or "-e hsts=off"
+ * to see what reading the configuration and databases costs.
+ *
+ * The program does not depend on the Wget sources:
+ *
+ *   cc -O2 util/startup-bench.c -o startup-bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PROGRAM_NAME  "startup-bench"
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+report (const char *what, double *times, int runs)
+{
+  qsort (times, runs, sizeof *times, cmp_double);
+  printf ("%-18s min %7.2f ms  median %7.2f ms  p90 %7.2f ms\n", what,
+          times[0] * 1e3, times[runs / 2] * 1e3, times[runs * 9 / 10] * 1e3);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char response[] =
+    "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  struct sockaddr_in sin;
+  socklen_t len = sizeof sin;
+  int runs, run, lsock, one = 1, nopts;
+  double *first, *total;
+  char url[64];
+  char **args;
+
+  if (argc < 3 || (runs = atoi (argv[1])) <= 0)
+    {
+      fputs ("usage: " PROGRAM_NAME " RUNS WGET [OPTION]...\n", stderr);
+      return EXIT_FAILURE;
+    }
+
+  lsock = socket (AF_INET, SOCK_STREAM, 0);
+  setsockopt (lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  memset (&sin, 0, sizeof sin);
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (lsock, (struct sockaddr *) &sin, sizeof sin) < 0
+      || listen (lsock, 1) < 0
+      || getsockname (lsock, (struct sockaddr *) &sin, &len) < 0)
+    {
+      perror (PROGRAM_NAME);
+      return EXIT_FAILURE;
+    }
+  snprintf (url, sizeof url, "http://127.0.0.1:%d/", ntohs (sin.sin_port));
+
+  /* WGET -q -O /dev/null OPTION... URL */
+  nopts = argc - 3;
+  args = calloc (nopts + 6, sizeof *args);
+  args[0] = argv[2];
+  args[1] = "-q";
+  args[2] = "-O";
+  args[3] = "/dev/null";
+  memcpy (args + 4, argv + 3, nopts * sizeof *args);
+  args[4 + nopts] = url;
+
+  first = calloc (runs, sizeof *first);
+  total = calloc (runs, sizeof *total);
+  for (run = 0; run < runs; run++)
+    {
+      double start = now ();
+      char buf[4096];
+      int status, sock;
+      pid_t pid = fork ();
+
+      if (pid < 0)
+        {
+          perror ("fork");
+          return EXIT_FAILURE;
+        }
+      if (pid == 0)
+        {
+          execv (args[0], args);
+          perror (args[0]);
+          _exit (127);
+        }
+
+      sock = accept (lsock, NULL, NULL);
+      if (sock < 0 || read (sock, buf, sizeof buf) <= 0)
+        {
+          fprintf (stderr, PROGRAM_NAME ": no request from %s\n", args[0]);
+          return EXIT_FAILURE;
+        }
+      first[run] = now () - start;
+      if (write (sock, response, sizeof response - 1) < 0)
+        perror ("write");
+      close (sock);
+
+      waitpid (pid, &status, 0);
+      total[run] = now () - start;
+      if (!WIFEXITED (status) || WEXITSTATUS (status))
+        fprintf (stderr, PROGRAM_NAME ": %s exited with status %d\n",
+                 args[0], status);
+    }
+
+  printf ("%d runs of %s\n", runs, args[0]);
+  report ("first request", first, runs);
+  report ("exit", total, runs);
+  return 0;
+}
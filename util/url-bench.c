@@ -0,0 +1,178 @@
+/* url-bench.c: Time Wget's URL parser.
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ * Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty provided the copyright
+ * notice and this notice are preserved.
+ *
+ * Usage: url-bench [FILE] [ROUNDS]
+ *
+ * Parse and free every URL of FILE, one per line, ROUNDS times (10 by
+ * default), then resolve the path of each URL against the URL before
+ * it with uri_merge.  Without FILE, or with "-" as FILE, a synthetic corpus
+ * of 100000 links as a recursive crawl finds them is used.
+ *
+ * url.c depends on much of Wget, so the program links against the
+ * library the unit tests are built from.  After "make check" in a
+ * configured build directory:
+ *
+ *   cc -O2 -I. -Isrc -Ilib util/url-bench.c src/libunittest.a \
+ *     lib/libgnu.a $(LIBS) -o url-bench
+ *
+ * where $(LIBS) are the libraries from src/Makefile.  Build it for
+ * two revisions to compare them on the same corpus.
+ */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "url.h"
+
+#define PROGRAM_NAME  "url-bench"
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *what, double start, long ops)
+{
+  double secs = now () - start;
+  printf ("%-18s %8.1f ns/op\n", what, secs * 1e9 / ops);
+}
+
+static char **
+synthetic_corpus (long *count)
+{
+  long n = 100000, i;
+  char **urls = xnew_array (char *, n);
+
+  for (i = 0; i < n; i++)
+    {
+      switch (i % 4)
+        {
+        case 0:
+          urls[i] = aprintf ("http://www%ld.example.com/dir/%ld/page.html",
+                             i % 97, i % 1009);
+          break;
+        case 1:
+          urls[i] = aprintf ("https://www%ld.example.com/a/b/../c/./%ld/"
+                             "index.php?id=%ld&sort=asc#top",
+                             i % 97, i % 1009, i);
+          break;
+        case 2:
+          urls[i] = aprintf ("https://cdn.example.org:8443/static/img%%20%ld.png",
+                             i);
+          break;
+        default:
+          urls[i] = aprintf ("ftp://user:pw@ftp.example.net/pub/%ld/file-%ld.tar.gz",
+                             i % 1009, i);
+          break;
+        }
+    }
+  *count = n;
+  return urls;
+}
+
+static char **
+read_corpus (const char *file, long *count)
+{
+  FILE *fp = fopen (file, "r");
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  long n = 0, alloc = 1024;
+  char **urls;
+
+  if (!fp)
+    {
+      perror (file);
+      exit (EXIT_FAILURE);
+    }
+  urls = xnew_array (char *, alloc);
+  while ((len = getline (&line, &size, fp)) > 0)
+    {
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+      if (!len)
+        continue;
+      if (n == alloc)
+        urls = xrealloc (urls, (alloc *= 2) * sizeof *urls);
+      urls[n++] = xstrdup (line);
+    }
+  free (line);
+  fclose (fp);
+  *count = n;
+  return urls;
+}
+
+int
+main (int argc, char **argv)
+{
+  long n, i, round, rounds = argc > 2 ? atol (argv[2]) : 10;
+  long parsed = 0;
+  char **urls;
+  double start;
+
+  if (argc > 3 || rounds <= 0)
+    {
+      fputs ("usage: " PROGRAM_NAME " [FILE] [ROUNDS]\n", stderr);
+      return EXIT_FAILURE;
+    }
+
+  if (argc > 1 && strcmp (argv[1], "-"))
+    urls = read_corpus (argv[1], &n);
+  else
+    urls = synthetic_corpus (&n);
+  if (!n)
+    {
+      fputs (PROGRAM_NAME ": no URLs\n", stderr);
+      return EXIT_FAILURE;
+    }
+  printf ("%ld URLs, %ld rounds\n", n, rounds);
+
+  start = now ();
+  for (round = 0; round < rounds; round++)
+    for (i = 0; i < n; i++)
+      {
+        struct url *u = url_parse (urls[i], NULL, NULL, true);
+        if (u)
+          {
+            ++parsed;
+            url_free (u);
+          }
+      }
+  report ("url_parse+free", start, n * rounds);
+
+  start = now ();
+  for (round = 0; round < rounds; round++)
+    for (i = 1; i < n; i++)
+      {
+        const char *link = strchr (urls[i], ':');
+        char *merged;
+
+        if (link && link[1] == '/' && link[2] == '/')
+          link = strchr (link + 3, '/');
+        merged = uri_merge (urls[i - 1], link ? link : urls[i]);
+        xfree (merged);
+      }
+  report ("uri_merge", start, (n - 1) * rounds);
+
+  if (parsed != n * rounds)
+    printf ("%ld URLs failed to parse\n", n - parsed / rounds);
+
+  for (i = 0; i < n; i++)
+    xfree (urls[i]);
+  xfree (urls);
+  return 0;
+}